@@ -0,0 +1,79 @@
+#include <etvdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* etvdbd - serves etvdb lookups to other processes on the host,
+ * see etvdb_daemon_run() */
+
+static void _usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s socket] [-l language] [-t ttl] [-k api key]\n", name);
+}
+
+static void _stop_cb(int sig)
+{
+	(void)sig;
+	etvdb_daemon_stop();
+}
+
+int main(int argc, char **argv)
+{
+	char *path = NULL, *lang = NULL, *key = NULL;
+	int opt;
+	double ttl = -1.0;
+	Eina_Bool ok;
+	Eina_Hash *langs;
+	struct sigaction sa;
+
+	while ((opt = getopt(argc, argv, "s:l:t:k:h")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'l':
+			lang = optarg;
+			break;
+		case 't':
+			ttl = atof(optarg);
+			break;
+		case 'k':
+			key = optarg;
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!etvdb_init(key)) {
+		fprintf(stderr, "etvdb couldn't be initialized.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (lang) {
+		langs = etvdb_languages_get(NULL);
+		if (!langs || !etvdb_language_set(langs, lang)) {
+			fprintf(stderr, "Unsupported language %s.\n", lang);
+			if (langs)
+				eina_hash_free(langs);
+			etvdb_shutdown();
+			return EXIT_FAILURE;
+		}
+		eina_hash_free(langs);
+	}
+
+	if (ttl >= 0)
+		etvdb_daemon_cache_ttl_set(ttl);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _stop_cb;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ok = etvdb_daemon_run(path);
+	etvdb_shutdown();
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
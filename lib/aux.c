@@ -18,3 +18,69 @@ size_t _dl_to_mem_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
 
 	return size_total;
 }
+
+/* this packs an ISO 8601 date string (e.g. 2013-03-28) into an integer,
+ * packed dates can be compared like the strings. returns 0 on invalid input */
+uint32_t _etvdb_date_pack(const char *date)
+{
+	unsigned int y, m, d;
+
+	if (!date || sscanf(date, "%4u-%2u-%2u", &y, &m, &d) != 3)
+		return 0;
+
+	if (m < 1 || m > 12 || d < 1 || d > 31)
+		return 0;
+
+	return DATE_PACK(y, m, d);
+}
+
+/* today's date in the packed format */
+uint32_t _etvdb_date_today(void)
+{
+	struct tm ltime;
+	time_t t;
+
+	time(&t);
+	localtime_r(&t, &ltime);
+
+	return DATE_PACK(ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+}
+
+/* set up an empty string table, it has to be freed even if this fails */
+Eina_Bool _etvdb_string_table_init(String_Table *t)
+{
+	t->buf = eina_binbuf_new();
+	t->offsets = eina_hash_string_superfast_new(NULL);
+	if (!t->buf || !t->offsets)
+		return EINA_FALSE;
+
+	/* offset 0 is reserved for NULL */
+	return eina_binbuf_append_length(t->buf, (const unsigned char *)"", 1);
+}
+
+/* add a string to a table and return its offset, 0 for NULL */
+uint32_t _etvdb_string_table_add(String_Table *t, const char *str)
+{
+	uintptr_t offset;
+
+	if (!str)
+		return 0;
+
+	offset = (uintptr_t)eina_hash_find(t->offsets, str);
+	if (offset)
+		return offset - 1;
+
+	offset = eina_binbuf_length_get(t->buf);
+	eina_binbuf_append_length(t->buf, (const unsigned char *)str, strlen(str) + 1);
+	eina_hash_add(t->offsets, str, (void *)(offset + 1));
+
+	return offset;
+}
+
+void _etvdb_string_table_free(String_Table *t)
+{
+	if (t->buf)
+		eina_binbuf_free(t->buf);
+	if (t->offsets)
+		eina_hash_free(t->offsets);
+}
@@ -0,0 +1,599 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* downloads at the same time by default */
+#define ARTWORK_CONNECTIONS_DEFAULT 4
+
+/* longest ETag, which is kept */
+#define ETAG_MAX 256
+
+/* state while Banner records are parsed */
+typedef struct _banners_parse {
+	Eina_List *list; /**< parsed Banners */
+	Etvdb_Banner *b; /**< Banner of the current record */
+	uint32_t series_id; /**< TVDB ID of the Series */
+	int depth; /**< XML nesting depth */
+	Xml_Tag sibling; /**< XML_TAG of the current field */
+} Banners_Parse;
+
+/* one image of an artwork download */
+typedef struct _artwork_item {
+	const Etvdb_Banner *banner; /**< Banner of the image */
+	const char *src; /**< path of the image on the banner server */
+	char *path; /**< file the image is written to */
+	FILE *fp; /**< temporary file, while the image is received */
+	struct curl_slist *headers; /**< request headers */
+	long status; /**< HTTP status of the response */
+	long long length; /**< Content-Length of the response, -1 if unknown */
+	long long size; /**< size of the existing file, -1 if there is none */
+	char etag[ETAG_MAX]; /**< ETag of the response */
+	size_t now; /**< bytes received, as reported last */
+	Eina_Bool validated; /**< the ETag of the existing file was sent, the status tells if it changed */
+	Eina_Bool skipped; /**< the existing file is up to date */
+} Artwork_Item;
+
+/* state of an artwork download */
+typedef struct _artwork {
+	Artwork_Item *items; /**< the images */
+	Etvdb_Artwork_Cb cb; /**< user callback */
+	void *data; /**< user data */
+	Eina_Bool ok; /**< all images were downloaded or up to date */
+} Artwork;
+
+/* internal functions */
+static Eina_Bool _banner_record_cb(Download_Stream *st, const char *rec, size_t len);
+static Eina_Bool _parse_banner_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static char *_path_get(const char *dir, const char *src);
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri);
+static void _setup_cb(Download_Batch *batch, unsigned int i, CURL *easy);
+static size_t _write_cb(Download_Batch *batch, unsigned int i, const char *ptr, size_t len);
+static void _progress_cb(Download_Batch *batch, unsigned int i, size_t now, size_t total);
+static Eina_Bool _skipped_cb(Download_Batch *batch, unsigned int i);
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl);
+static size_t _header_cb(char *buf, size_t size, size_t nitems, void *userdata);
+static Eina_Bool _etag_read(const char *path, char *etag);
+static void _etag_write(const char *path, const char *etag);
+
+/**
+ * @brief Banners and Artwork
+ * @defgroup Banners
+ *
+ * @{
+ *
+ * These functions get the Banners of a Series, the posters, fanart,
+ * series and season banners, and download their images to files.
+ *
+ * The images are written to disk while they arrive, so no image
+ * is held in memory, however many are downloaded.
+ * Files, which are up to date already, are not downloaded again.
+ */
+
+/**
+ * @brief Get the Banners of a Series
+ *
+ * This function parses the Banner records while they are downloaded.
+ *
+ * @param s initialized TVDB Series structure
+ *
+ * @return a list of Etvdb_Banner structures, which have to be freed with etvdb_banner_free()
+ * @return NULL on failure or if the Series has no Banners
+ *
+ * @ingroup Banners
+ */
+EAPI Eina_List *etvdb_banners_get(Series *s)
+{
+	char uri[URI_MAX];
+	CURLcode res;
+	Download_Stream st;
+	Banners_Parse bp;
+	Etvdb_Banner *b;
+
+	if (!s->id) {
+		ERR("Passed series data is not valid.");
+		return NULL;
+	}
+
+	memset(&bp, 0, sizeof(Banners_Parse));
+	bp.series_id = s->id;
+
+	st.tag = "Banner";
+	st.record_cb = _banner_record_cb;
+	st.data = &bp;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/banners.xml",
+			etvdb_api_key, s->id);
+
+	res = _etvdb_dl_stream(&st, uri);
+	free(st.buf.data);
+
+	if (res) {
+		ERR("Couldn't get Banners of Series %"PRIu32" from server.", s->id);
+		EINA_LIST_FREE(bp.list, b)
+			etvdb_banner_free(b);
+		return NULL;
+	}
+
+	DBG("Found %u Banners of Series %"PRIu32, eina_list_count(bp.list), s->id);
+
+	return bp.list;
+}
+
+/**
+ * @brief Free a Banner structure
+ *
+ * @param b pointer to Etvdb_Banner structure
+ *
+ * @ingroup Banners
+ */
+EAPI void etvdb_banner_free(Etvdb_Banner *b)
+{
+	if (!b)
+		return;
+
+	free(b->path);
+	free(b->thumbnail);
+	free(b->type);
+	free(b->type2);
+	free(b);
+}
+
+/**
+ * @brief Download the images of Banners to files
+ *
+ * This function downloads the images of many Banners, e.g. the posters
+ * of a whole catalogue, over several connections at the same time.
+ * Every image is streamed to a temporary file in dir, which replaces
+ * the file of the image once it is complete.
+ * The file is named after the path of the image, with its slashes
+ * replaced by underscores, e.g. posters_73739-1.jpg.
+ *
+ * An existing file is kept, if the server reports the same ETag as
+ * the last time it was downloaded. Files without a kept ETag are
+ * kept, if they have the same size as the image.
+ * The ETag is kept in a file next to the image, with .etag appended.
+ *
+ * cb is called from the calling thread, it can be NULL.
+ * The deadline and cancellation token of the calling thread
+ * apply to the whole call.
+ *
+ * @param banners list of Etvdb_Banner structures, Banners without an image are left out
+ * @param dir existing directory the files are written to
+ * @param opts settings, or NULL for the defaults
+ * @param cb callback called with the progress of every image
+ * @param data data passed to cb
+ *
+ * @return EINA_TRUE if all images were downloaded or up to date
+ * @return EINA_FALSE if any image failed
+ *
+ * @ingroup Banners
+ */
+EAPI Eina_Bool etvdb_banners_download(Eina_List *banners, const char *dir,
+		const Etvdb_Artwork *opts, Etvdb_Artwork_Cb cb, const void *data)
+{
+	unsigned int i, n = 0;
+	struct stat st;
+	Eina_List *l;
+	Artwork aw;
+	Artwork_Item *item;
+	Download_Batch batch;
+	Etvdb_Artwork o;
+	Etvdb_Banner *b;
+
+	if (!dir) {
+		ERR("No directory to download to.");
+		return EINA_FALSE;
+	}
+
+	memset(&o, 0, sizeof(Etvdb_Artwork));
+	if (opts)
+		o = *opts;
+	if (!o.connections)
+		o.connections = ARTWORK_CONNECTIONS_DEFAULT;
+
+	memset(&aw, 0, sizeof(Artwork));
+	aw.cb = cb;
+	aw.data = (void *)data;
+	aw.ok = EINA_TRUE;
+	aw.items = calloc(eina_list_count(banners) + 1, sizeof(Artwork_Item));
+	if (!aw.items) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	EINA_LIST_FOREACH(banners, l, b) {
+		item = &aw.items[n];
+		item->src = o.thumbnails ? b->thumbnail : b->path;
+		if (!item->src || !*item->src)
+			continue;
+
+		item->path = _path_get(dir, item->src);
+		if (!item->path) {
+			aw.ok = EINA_FALSE;
+			continue;
+		}
+
+		item->banner = b;
+		item->size = stat(item->path, &st) ? -1 : (long long)st.st_size;
+		n++;
+	}
+
+	memset(&batch, 0, sizeof(Download_Batch));
+	batch.count = n;
+	batch.connections = o.connections;
+	batch.uri_cb = _uri_cb;
+	batch.setup_cb = _setup_cb;
+	batch.write_cb = _write_cb;
+	batch.progress_cb = _progress_cb;
+	batch.skipped_cb = _skipped_cb;
+	batch.done_cb = _done_cb;
+	batch.data = &aw;
+
+	DBG("Downloading %u images to %s.", n, dir);
+
+	if (!_etvdb_dl_batch(&batch))
+		aw.ok = EINA_FALSE;
+
+	/* images, which were still downloading when the batch was aborted */
+	for (i = 0; i < n; i++) {
+		item = &aw.items[i];
+		if (item->fp) {
+			char part[strlen(item->path) + sizeof(".part")];
+
+			snprintf(part, sizeof(part), "%s.part", item->path);
+			fclose(item->fp);
+			unlink(part);
+		}
+		curl_slist_free_all(item->headers);
+		free(item->path);
+	}
+	free(aw.items);
+
+	return aw.ok;
+}
+/**
+ * @}
+ */
+
+/* parse one complete Banner record */
+static Eina_Bool _banner_record_cb(Download_Stream *st, const char *rec, size_t len)
+{
+	Banners_Parse *bp = st->data;
+
+	if (_etvdb_request_expired()) {
+		st->aborted = EINA_TRUE;
+		return EINA_FALSE;
+	}
+
+	bp->b = calloc(1, sizeof(Etvdb_Banner));
+	if (!bp->b) {
+		ERR("Couldn't allocate enough memory.");
+		st->aborted = EINA_TRUE;
+		return EINA_FALSE;
+	}
+
+	bp->b->series_id = bp->series_id;
+	bp->depth = 0;
+
+	if (!_etvdb_xml_parse(rec, len, _parse_banner_cb, bp))
+		WARN("Parsing a Banner failed, skipping it.");
+
+	if (bp->b->path)
+		bp->list = eina_list_append(bp->list, bp->b);
+	else
+		etvdb_banner_free(bp->b);
+	bp->b = NULL;
+
+	return EINA_TRUE;
+}
+
+/* parses a single Banner record */
+static Eina_Bool _parse_banner_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
+{
+	char buf[length + 1];
+	char **str = NULL;
+	Banners_Parse *bp = data;
+	Etvdb_Banner *b = bp->b;
+
+	switch (type) {
+	case EINA_SIMPLE_XML_OPEN:
+		if (bp->depth == 0 && tag == XML_TAG_BANNER)
+			bp->depth++;
+		else if (bp->depth == 1)
+			bp->sibling = tag;
+		break;
+	case EINA_SIMPLE_XML_CLOSE:
+		if (tag == XML_TAG_BANNER)
+			bp->depth--;
+		break;
+	case EINA_SIMPLE_XML_DATA:
+		if (bp->depth != 1)
+			break;
+
+		MEM2STR(buf, content, length);
+
+		switch (bp->sibling) {
+		case XML_TAG_ID:
+			sscanf(buf, "%"SCNu32, &b->id);
+			break;
+		case XML_TAG_BANNER_PATH:
+			str = &b->path;
+			break;
+		case XML_TAG_THUMBNAIL_PATH:
+			str = &b->thumbnail;
+			break;
+		case XML_TAG_BANNER_TYPE:
+			str = &b->type;
+			break;
+		case XML_TAG_BANNER_TYPE2:
+			str = &b->type2;
+			break;
+		case XML_TAG_LANGUAGE:
+			strncpy(b->lang, buf, sizeof(b->lang) - 1);
+			break;
+		case XML_TAG_SEASON:
+			sscanf(buf, "%"SCNu16, &b->season);
+			break;
+		case XML_TAG_RATING:
+			sscanf(buf, "%lf", &b->rating);
+			break;
+		case XML_TAG_RATING_COUNT:
+			sscanf(buf, "%"SCNu32, &b->rating_count);
+			break;
+		default:
+			break;
+		}
+
+		if (str) {
+			free(*str);
+			*str = strdup(buf);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return EINA_TRUE;
+}
+
+/* the file of an image in dir, named after its path without slashes */
+static char *_path_get(const char *dir, const char *src)
+{
+	char *path, *p;
+	size_t len;
+
+	len = strlen(dir);
+	path = malloc(len + strlen(src) + 2);
+	if (!path) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	memcpy(path, dir, len);
+	path[len] = '/';
+	strcpy(path + len + 1, src);
+
+	for (p = path + len + 1; *p; p++) {
+		if (*p == '/')
+			*p = '_';
+	}
+
+	return path;
+}
+
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri)
+{
+	Artwork *aw = batch->data;
+
+	snprintf(uri, URI_MAX, TVDB_BANNER_URI"/%s", aw->items[i].src);
+}
+
+/* ask for the image only if its ETag changed, and watch the response headers */
+static void _setup_cb(Download_Batch *batch, unsigned int i, CURL *easy)
+{
+	char header[ETAG_MAX + sizeof("If-None-Match: ")], etag[ETAG_MAX];
+	Artwork *aw = batch->data;
+	Artwork_Item *item = &aw->items[i];
+
+	item->status = 0;
+	item->length = -1;
+	item->etag[0] = '\0';
+	item->validated = EINA_FALSE;
+
+	if (item->size >= 0 && _etag_read(item->path, etag)) {
+		snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+		item->headers = curl_slist_append(NULL, header);
+		item->validated = EINA_TRUE;
+	}
+
+	curl_easy_setopt(easy, CURLOPT_HTTPHEADER, item->headers);
+	curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, _header_cb);
+	curl_easy_setopt(easy, CURLOPT_HEADERDATA, item);
+}
+
+/* write the image to its temporary file, while it arrives */
+static size_t _write_cb(Download_Batch *batch, unsigned int i, const char *ptr, size_t len)
+{
+	Artwork *aw = batch->data;
+	Artwork_Item *item = &aw->items[i];
+	char part[strlen(item->path) + sizeof(".part")];
+
+	/* bodies of error responses are dropped */
+	if (item->status != 200)
+		return len;
+
+	if (!item->fp) {
+		snprintf(part, sizeof(part), "%s.part", item->path);
+		item->fp = fopen(part, "wb");
+		if (!item->fp) {
+			ERR("Couldn't open %s for writing.", part);
+			return 0;
+		}
+	}
+
+	return fwrite(ptr, 1, len, item->fp);
+}
+
+static void _progress_cb(Download_Batch *batch, unsigned int i, size_t now, size_t total)
+{
+	Artwork *aw = batch->data;
+	Artwork_Item *item = &aw->items[i];
+
+	if (!aw->cb || now == item->now)
+		return;
+
+	item->now = now;
+	aw->cb(aw->data, item->banner, item->path, ETVDB_ARTWORK_RUNNING, now, total);
+}
+
+/* the header callback stopped the download, because the file is up to date */
+static Eina_Bool _skipped_cb(Download_Batch *batch, unsigned int i)
+{
+	Artwork *aw = batch->data;
+
+	return aw->items[i].skipped;
+}
+
+/* move a complete image in place, or throw its temporary file away */
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl)
+{
+	Artwork *aw = batch->data;
+	Artwork_Item *item = &aw->items[i];
+	char part[strlen(item->path) + sizeof(".part")];
+	Etvdb_Artwork_State state;
+
+	free(dl->data);
+	curl_slist_free_all(item->headers);
+	item->headers = NULL;
+
+	snprintf(part, sizeof(part), "%s.part", item->path);
+
+	if (item->skipped || (!res && item->status == 304)) {
+		DBG("%s is up to date.", item->path);
+		state = ETVDB_ARTWORK_SKIPPED;
+	} else if (!res && item->status == 200) {
+		/* an empty image doesn't open its file while it arrives */
+		if (!item->fp)
+			item->fp = fopen(part, "wb");
+
+		if (item->fp && !fclose(item->fp) && !rename(part, item->path)) {
+			_etag_write(item->path, item->etag);
+			state = ETVDB_ARTWORK_DONE;
+		} else {
+			ERR("Couldn't write %s.", item->path);
+			state = ETVDB_ARTWORK_FAILED;
+		}
+		item->fp = NULL;
+	} else {
+		if (res)
+			ERR("Couldn't download %s: %s", item->src, curl_easy_strerror(res));
+		else
+			ERR("Couldn't download %s: HTTP %ld", item->src, item->status);
+		state = ETVDB_ARTWORK_FAILED;
+	}
+
+	if (item->fp) {
+		fclose(item->fp);
+		item->fp = NULL;
+	}
+	if (state != ETVDB_ARTWORK_DONE)
+		unlink(part);
+
+	if (state == ETVDB_ARTWORK_FAILED)
+		aw->ok = EINA_FALSE;
+
+	if (aw->cb)
+		aw->cb(aw->data, item->banner, item->path, state, dl->len, dl->len);
+}
+
+/* this cURL header callback keeps the status, length and ETag of a response.
+ * it stops the transfer at the end of the headers, if the existing file has the size of the image.
+ * if the ETag was sent, a 200 means the image changed, so the size isn't trusted then */
+static size_t _header_cb(char *buf, size_t size, size_t nitems, void *userdata)
+{
+	size_t len = size * nitems, n;
+	Artwork_Item *item = userdata;
+
+	if (len > 5 && !strncmp(buf, "HTTP/", 5)) {
+		/* a new response, e.g. after an informational one */
+		sscanf(buf, "%*s %ld", &item->status);
+		item->length = -1;
+		item->etag[0] = '\0';
+	} else if (len > 15 && !strncasecmp(buf, "Content-Length:", 15))
+		sscanf(buf + 15, "%lld", &item->length);
+	else if (len > 5 && !strncasecmp(buf, "ETag:", 5)) {
+		buf += 5;
+		len -= 5;
+		while (len && (*buf == ' ' || *buf == '\t')) {
+			buf++;
+			len--;
+		}
+		for (n = len; n && (buf[n - 1] == '\r' || buf[n - 1] == '\n' || buf[n - 1] == ' '); n--);
+
+		if (n < ETAG_MAX) {
+			memcpy(item->etag, buf, n);
+			item->etag[n] = '\0';
+		}
+
+		return size * nitems;
+	} else if (len <= 2 && item->status == 200 && !item->validated
+			&& item->size >= 0 && item->length == item->size) {
+		DBG("%s has the size of the image, not downloading it.", item->path);
+		item->skipped = EINA_TRUE;
+		return 0;
+	}
+
+	return len;
+}
+
+/* read the ETag of the last download of a file */
+static Eina_Bool _etag_read(const char *path, char *etag)
+{
+	char name[strlen(path) + sizeof(".etag")];
+	size_t len;
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s.etag", path);
+
+	fp = fopen(name, "r");
+	if (!fp)
+		return EINA_FALSE;
+
+	if (!fgets(etag, ETAG_MAX, fp))
+		etag[0] = '\0';
+	fclose(fp);
+
+	len = strlen(etag);
+	while (len && (etag[len - 1] == '\n' || etag[len - 1] == '\r'))
+		etag[--len] = '\0';
+
+	return len > 0;
+}
+
+/* keep the ETag of a downloaded file, a file without ETag drops an old one */
+static void _etag_write(const char *path, const char *etag)
+{
+	char name[strlen(path) + sizeof(".etag")];
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s.etag", path);
+
+	if (!*etag) {
+		unlink(name);
+		return;
+	}
+
+	fp = fopen(name, "w");
+	if (!fp) {
+		WARN("Couldn't write %s.", name);
+		return;
+	}
+
+	fprintf(fp, "%s\n", etag);
+	fclose(fp);
+}
@@ -0,0 +1,353 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* downloads at the same time, if not set */
+#define BULK_CONNECTIONS_DEFAULT 8
+
+/* documents waiting or being parsed per thread, if not set */
+#define BULK_INFLIGHT_PER_THREAD 2
+
+/* a Series waiting to be passed to the callback */
+typedef struct _bulk_result {
+	unsigned int index; /**< index of the ID */
+	Series *s; /**< the Series, NULL on failure */
+} Bulk_Result;
+
+/* state of a bulk download */
+typedef struct _bulk {
+	Etvdb_Bulk opts; /**< settings, with the defaults filled in */
+	Etvdb_Bulk_Cb cb; /**< callback for every Series */
+	void *data; /**< data of the callback */
+	uint32_t *ids; /**< IDs to download */
+	unsigned char *delivered; /**< the callback was called for an ID */
+	Bulk_Result *results; /**< Series waiting for the callback */
+	unsigned int queued; /**< number of results */
+	Eina_Bool delivering; /**< a thread passes the results to the callback */
+	Pool *pool; /**< shared workers parsing the documents */
+	Pool_Group group; /**< documents queued or being parsed */
+	Eina_List *waiting; /**< documents waiting for a parser */
+	unsigned int parsing; /**< documents handed to the workers, at most opts.threads */
+	Download_Batch batch; /**< the downloads */
+	int inflight; /**< documents downloading, waiting or being parsed */
+	double deadline; /**< deadline of the calling thread */
+	Etvdb_Cancel *cancel; /**< cancellation token of the calling thread */
+	Eina_Bool ok; /**< all Series were delivered */
+	Eina_Lock lock; /**< protects the results and the parsers */
+} Bulk;
+
+/* a downloaded document, parsed by a worker */
+typedef struct _bulk_doc {
+	Bulk *bulk; /**< the bulk download */
+	unsigned int index; /**< index of the ID */
+	Download dl; /**< the document */
+} Bulk_Doc;
+
+/* internal functions */
+static void _deliver(Bulk *b, unsigned int index, Series *s);
+static void _doc_parse(void *data);
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri);
+static Eina_Bool _admit_cb(Download_Batch *batch);
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl);
+
+/**
+ * @brief Bulk Downloads
+ * @defgroup Bulk
+ *
+ * @{
+ *
+ * These functions download and populate many Series at once.
+ *
+ * The documents are downloaded over several connections at the same time,
+ * and every finished document is parsed by the worker threads
+ * the library shares between all calls,
+ * which take work from each other when they run out of it.
+ * Only a limited number of documents is downloaded ahead of the parsers,
+ * so memory use stays bounded however many Series are requested.
+ */
+
+/**
+ * @brief Download and populate many Series
+ *
+ * This function gets the Base Series Record and all Episodes
+ * of every ID, like etvdb_series_by_id_get() and etvdb_series_populate() do,
+ * and passes every Series to cb as soon as it is ready.
+ * The Series are passed in no particular order.
+ *
+ * cb is called once for every ID, but never by two threads at the same time.
+ * Series found in the local store are passed from the calling thread,
+ * before anything is downloaded, the downloaded ones from the worker threads
+ * or the calling thread. No lock is held while cb runs.
+ * IDs left over by an expired deadline or a cancellation are passed
+ * from the calling thread at the end.
+ * The Series belongs to the callback and has to be freed with etvdb_series_free(),
+ * it is NULL if the ID couldn't be downloaded.
+ *
+ * The deadline and cancellation token of the calling thread
+ * apply to the whole call.
+ *
+ * @param ids array of TVDB Series IDs
+ * @param count number of IDs
+ * @param opts settings, or NULL for the defaults
+ * @param cb callback called for every ID
+ * @param data data passed to cb
+ *
+ * @return EINA_TRUE if all Series were downloaded
+ * @return EINA_FALSE if any Series failed
+ *
+ * @ingroup Bulk
+ */
+EAPI Eina_Bool etvdb_series_bulk_get(const uint32_t *ids, unsigned int count,
+		const Etvdb_Bulk *opts, Etvdb_Bulk_Cb cb, const void *data)
+{
+	unsigned int i, n = 0;
+	Bulk b;
+	Eina_List *all;
+	Series *s;
+
+	memset(&b, 0, sizeof(Bulk));
+	if (opts)
+		b.opts = *opts;
+
+	if (!b.opts.threads)
+		b.opts.threads = eina_cpu_count();
+	if (!b.opts.threads)
+		b.opts.threads = 1;
+	if (!b.opts.connections)
+		b.opts.connections = BULK_CONNECTIONS_DEFAULT;
+	if (!b.opts.inflight)
+		b.opts.inflight = b.opts.threads * BULK_INFLIGHT_PER_THREAD;
+	if (!b.opts.fields)
+		b.opts.fields = ETVDB_FIELD_ALL;
+
+	b.cb = cb;
+	b.data = (void *)data;
+	b.deadline = etvdb_deadline_get();
+	b.cancel = _etvdb_request_cancel_get();
+	b.ok = EINA_TRUE;
+
+	b.ids = malloc((count + 1) * sizeof(uint32_t));
+	b.delivered = calloc(count + 1, 1);
+	b.results = malloc((count + 1) * sizeof(Bulk_Result));
+	if (!b.ids || !b.delivered || !b.results) {
+		ERR("Couldn't allocate enough memory.");
+		free(b.ids);
+		free(b.delivered);
+		free(b.results);
+		return EINA_FALSE;
+	}
+
+	/* Series in the store don't need to be downloaded */
+	for (i = 0; i < count; i++) {
+		s = _etvdb_store_series_find(ids[i]);
+		if (s && _etvdb_store_episodes_find(s, &all) && _etvdb_series_episodes_bucket(s, all)) {
+			cb((void *)data, ids[i], s);
+			continue;
+		}
+
+		if (s)
+			etvdb_series_free(s);
+		b.ids[n++] = ids[i];
+	}
+
+	if (!n)
+		goto end;
+
+	b.pool = _etvdb_pool_shared_get();
+	if (!b.pool) {
+		b.ok = EINA_FALSE;
+		goto end;
+	}
+
+	eina_lock_new(&b.lock);
+	_etvdb_pool_group_init(&b.group);
+
+	b.batch.count = n;
+	b.batch.connections = b.opts.connections;
+	b.batch.uri_cb = _uri_cb;
+	b.batch.admit_cb = _admit_cb;
+	b.batch.done_cb = _done_cb;
+	b.batch.data = &b;
+
+	DBG("Downloading %u Series over %u connections, parsing on %u threads.",
+			n, b.opts.connections, b.opts.threads);
+
+	if (!_etvdb_dl_batch(&b.batch))
+		b.ok = EINA_FALSE;
+
+	/* this waits for the queued documents */
+	_etvdb_pool_group_wait(b.pool, &b.group);
+	_etvdb_pool_group_free(&b.group);
+	eina_lock_free(&b.lock);
+
+	/* IDs, which weren't downloaded, because the call was aborted */
+	for (i = 0; i < n; i++) {
+		if (!b.delivered[i]) {
+			cb((void *)data, b.ids[i], NULL);
+			b.ok = EINA_FALSE;
+		}
+	}
+
+end:
+	free(b.ids);
+	free(b.delivered);
+	free(b.results);
+
+	return b.ok;
+}
+/**
+ * @}
+ */
+
+/* pass a Series to the callback, s is NULL on failure.
+ * the Series is queued, the first thread finding nobody else delivering
+ * passes all queued ones to the callback, without holding the lock */
+static void _deliver(Bulk *b, unsigned int index, Series *s)
+{
+	Bulk_Result r;
+
+	if (s && b->opts.fields == ETVDB_FIELD_ALL)
+		_etvdb_store_series_add(s);
+
+	eina_lock_take(&b->lock);
+
+	if (!s)
+		b->ok = EINA_FALSE;
+
+	b->delivered[index] = 1;
+	b->results[b->queued].index = index;
+	b->results[b->queued].s = s;
+	b->queued++;
+
+	if (b->delivering) {
+		eina_lock_release(&b->lock);
+		return;
+	}
+
+	b->delivering = EINA_TRUE;
+	while (b->queued) {
+		r = b->results[--b->queued];
+		eina_lock_release(&b->lock);
+
+		b->cb(b->data, b->ids[r.index], r.s);
+
+		eina_lock_take(&b->lock);
+	}
+	b->delivering = EINA_FALSE;
+
+	eina_lock_release(&b->lock);
+}
+
+/* parse a document in a worker */
+static void _doc_parse(void *data)
+{
+	Bulk_Doc *doc = data, *next;
+	Bulk *b = doc->bulk;
+	Eina_List *all;
+	Series *s;
+	double deadline = etvdb_deadline_get();
+	Etvdb_Cancel *cancel = _etvdb_request_cancel_get();
+
+	etvdb_deadline_set(b->deadline);
+	etvdb_cancel_set(b->cancel);
+
+	/* the document holds the Series record followed by the Episodes */
+	s = _etvdb_series_parse(doc->dl.data, doc->dl.len, b->opts.fields);
+	if (!s) {
+		ERR("Couldn't parse Series %"PRIu32, b->ids[doc->index]);
+		free(doc->dl.data);
+	} else {
+		all = _etvdb_episodes_parse(s, doc->dl.data, doc->dl.len, b->opts.fields, EINA_FALSE);
+
+		if (all && b->opts.fields == ETVDB_FIELD_ALL)
+			_etvdb_store_episodes_add(s, all);
+
+		if (!all || !_etvdb_series_episodes_bucket(s, all)) {
+			ERR("Couldn't get Episodes for Series %"PRIu32, s->id);
+			etvdb_series_free(s);
+			s = NULL;
+		}
+	}
+
+	_deliver(b, doc->index, s);
+	free(doc);
+
+	/* a download can take the place of the document */
+	__atomic_sub_fetch(&b->inflight, 1, __ATOMIC_ACQ_REL);
+	_etvdb_dl_batch_wakeup(&b->batch);
+
+	/* a document waiting for a parser takes the place of this one */
+	eina_lock_take(&b->lock);
+	next = eina_list_data_get(b->waiting);
+	if (next)
+		b->waiting = eina_list_remove_list(b->waiting, b->waiting);
+	else
+		b->parsing--;
+	eina_lock_release(&b->lock);
+
+	if (next)
+		_etvdb_pool_group_push(b->pool, &b->group, _doc_parse, next);
+
+	/* the worker may be waiting for a call of its own */
+	etvdb_deadline_set(deadline);
+	etvdb_cancel_set(cancel);
+}
+
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri)
+{
+	Bulk *b = batch->data;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/all/%s.xml",
+			etvdb_api_key, b->ids[i], etvdb_language);
+}
+
+/* a download is only started, if the parsers keep up */
+static Eina_Bool _admit_cb(Download_Batch *batch)
+{
+	Bulk *b = batch->data;
+
+	if (__atomic_load_n(&b->inflight, __ATOMIC_ACQUIRE) >= (int)b->opts.inflight)
+		return EINA_FALSE;
+
+	__atomic_add_fetch(&b->inflight, 1, __ATOMIC_ACQ_REL);
+
+	return EINA_TRUE;
+}
+
+/* hand a finished download to the workers, at most opts.threads are parsed at once */
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl)
+{
+	Bulk *b = batch->data;
+	Bulk_Doc *doc;
+
+	if (res) {
+		ERR("Couldn't get Series %"PRIu32" from server.", b->ids[i]);
+		free(dl->data);
+		_deliver(b, i, NULL);
+		__atomic_sub_fetch(&b->inflight, 1, __ATOMIC_ACQ_REL);
+		return;
+	}
+
+	doc = malloc(sizeof(Bulk_Doc));
+	if (!doc) {
+		ERR("Couldn't allocate enough memory.");
+		free(dl->data);
+		_deliver(b, i, NULL);
+		__atomic_sub_fetch(&b->inflight, 1, __ATOMIC_ACQ_REL);
+		return;
+	}
+
+	doc->bulk = b;
+	doc->index = i;
+	doc->dl = *dl;
+
+	eina_lock_take(&b->lock);
+	if (b->parsing >= b->opts.threads) {
+		b->waiting = eina_list_append(b->waiting, doc);
+		eina_lock_release(&b->lock);
+		return;
+	}
+	b->parsing++;
+	eina_lock_release(&b->lock);
+
+	_etvdb_pool_group_push(b->pool, &b->group, _doc_parse, doc);
+}
@@ -0,0 +1,586 @@
+#define _GNU_SOURCE /* struct ucred */
+#include "etvdb_private.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* time the daemon has to answer the hello, so etvdb_init() never hangs on it */
+#define CLIENT_HELLO_TIMEOUT 1.0
+
+/* maximum time to block in poll() before checking the cancellation token again */
+#define CLIENT_POLL_MS 250
+
+/* daemon socket, NULL if there is no daemon */
+static char *_path = NULL;
+/* the daemon is checked on every new connection */
+static Eina_Bool _check = EINA_FALSE;
+/* connections to the daemon, which aren't in use, as file descriptors */
+static Eina_List *_idle = NULL;
+/* process, which opened the connections, a forked child opens its own */
+static pid_t _pid = 0;
+/* changes on every disconnect, so connections of an old daemon aren't kept */
+static unsigned int _generation = 0;
+static int _connected = 0;
+static Eina_Lock _client_lock;
+
+/* internal functions */
+static Eina_Bool _request(Daemon_Op op, const void *payload, uint32_t len,
+		char **reply, uint32_t *reply_len);
+static int _open(const char *path, Eina_Bool check, double until);
+static Eina_Bool _exchange(int fd, Daemon_Op op, const void *payload, uint32_t len,
+		double until, Daemon_Frame *f, char **reply);
+static void _release(int fd, unsigned int generation);
+static Series *_series_from_image(char *image, size_t len);
+static Eina_Bool _peer_trusted(int fd UNUSED, const char *path UNUSED);
+static void _disconnect(void);
+
+/**
+ * @brief Daemon Client
+ * @defgroup Client
+ *
+ * @{
+ *
+ * Processes on a host can share the caches and connections
+ * of a running etvdbd daemon, see etvdb_daemon_run().
+ *
+ * etvdb_init() connects to the daemon, if it is running.
+ * While connected, etvdb_series_by_id_get(), etvdb_series_populate()
+ * and etvdb_series_find() are answered by the daemon, everything else
+ * and every request the daemon can't answer is handled locally.
+ * If the daemon goes away, etvdb falls back to fetching data itself.
+ * Calls, which wait for the daemon, keep to the deadline and
+ * cancellation token of their thread and fetch data themselves,
+ * if the daemon doesn't answer in time.
+ *
+ * Every thread, which talks to the daemon at the same time, uses a
+ * connection of its own, so a slow answer doesn't hold up other threads.
+ * A forked child opens new connections.
+ *
+ * The daemon socket is taken from the ETVDB_SOCKET environment variable,
+ * $XDG_RUNTIME_DIR/etvdbd.sock or /tmp/etvdbd-UID.sock, in this order.
+ * Set ETVDB_SOCKET to an empty string to never use the daemon.
+ * A daemon at a default path is only used, if it runs as the same user,
+ * so other users can't answer in its place, e.g. by creating the socket
+ * in /tmp first.
+ */
+
+/**
+ * @brief Connect to a daemon
+ *
+ * An existing connection is closed first.
+ *
+ * @param path path of the daemon socket, or NULL for the default,
+ * which is only used if the daemon runs as the same user
+ *
+ * @return EINA_TRUE if the daemon answered, EINA_FALSE otherwise
+ *
+ * @ingroup Client
+ */
+EAPI Eina_Bool etvdb_client_connect(const char *path)
+{
+	char def[URI_MAX];
+	int fd;
+	double until;
+	struct sockaddr_un addr;
+	Eina_Bool check = EINA_FALSE;
+
+	etvdb_client_disconnect();
+
+	/* paths set by the user are trusted, default ones are checked */
+	if (!path) {
+		path = _etvdb_daemon_path_get(def);
+		check = path == def;
+	}
+	if (!path || !*path || strlen(path) >= sizeof(addr.sun_path))
+		return EINA_FALSE;
+
+	until = etvdb_time_get() + _etvdb_request_remaining();
+	if (until > etvdb_time_get() + CLIENT_HELLO_TIMEOUT)
+		until = etvdb_time_get() + CLIENT_HELLO_TIMEOUT;
+
+	fd = _open(path, check, until);
+	if (fd < 0)
+		return EINA_FALSE;
+
+	eina_lock_take(&_client_lock);
+	_path = strdup(path);
+	if (!_path) {
+		eina_lock_release(&_client_lock);
+		ERR("Couldn't allocate enough memory.");
+		close(fd);
+		return EINA_FALSE;
+	}
+	_check = check;
+	_pid = getpid();
+	_idle = eina_list_append(_idle, (void *)(intptr_t)fd);
+	__atomic_store_n(&_connected, 1, __ATOMIC_RELEASE);
+	eina_lock_release(&_client_lock);
+
+	INFO("Connected to daemon at %s.", path);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Disconnect from the daemon
+ *
+ * Following calls fetch data themselves.
+ *
+ * @ingroup Client
+ */
+EAPI void etvdb_client_disconnect(void)
+{
+	eina_lock_take(&_client_lock);
+	_disconnect();
+	eina_lock_release(&_client_lock);
+}
+
+/**
+ * @brief Check if etvdb is connected to a daemon
+ *
+ * @return EINA_TRUE if calls are sent to a daemon
+ *
+ * @ingroup Client
+ */
+EAPI Eina_Bool etvdb_client_connected_get(void)
+{
+	return __atomic_load_n(&_connected, __ATOMIC_ACQUIRE);
+}
+/**
+ * @}
+ */
+
+/* set up the client and connect to a running daemon, called by etvdb_init() */
+Eina_Bool _etvdb_client_init(void)
+{
+	if (!eina_lock_new(&_client_lock))
+		return EINA_FALSE;
+
+	etvdb_client_connect(NULL);
+
+	return EINA_TRUE;
+}
+
+/* close the connection, called by etvdb_shutdown() */
+void _etvdb_client_shutdown(void)
+{
+	etvdb_client_disconnect();
+	eina_lock_free(&_client_lock);
+}
+
+/* get the default path of the daemon socket, buf has URI_MAX bytes */
+const char *_etvdb_daemon_path_get(char *buf)
+{
+	const char *env;
+
+	env = getenv("ETVDB_SOCKET");
+	if (env)
+		return env;
+
+	env = getenv("XDG_RUNTIME_DIR");
+	if (env && *env)
+		snprintf(buf, URI_MAX, "%s/etvdbd.sock", env);
+	else
+		snprintf(buf, URI_MAX, "/tmp/etvdbd-%u.sock", (unsigned int)getuid());
+
+	return buf;
+}
+
+/* get a Series from the daemon, populated or not.
+ * returns NULL if the daemon couldn't answer, the caller fetches it then */
+Series *_etvdb_client_series_get(uint32_t id, Eina_Bool populated)
+{
+	char *reply;
+	uint32_t len;
+	Daemon_Series_Req req;
+
+	if (!etvdb_client_connected_get())
+		return NULL;
+
+	memset(req.lang, 0, sizeof(req.lang));
+	strncpy(req.lang, etvdb_language, sizeof(req.lang) - 1);
+	req.id = id;
+
+	if (!_request(populated ? DAEMON_OP_SERIES_POPULATE : DAEMON_OP_SERIES_GET,
+				&req, sizeof(req), &reply, &len))
+		return NULL;
+
+	return _series_from_image(reply, len);
+}
+
+/* populate a Series with the Episodes the daemon has.
+ * returns EINA_FALSE if the daemon couldn't answer, the caller fetches them then */
+Eina_Bool _etvdb_client_series_populate(Series *s)
+{
+	Eina_List *all = NULL, *l, *ll, *sl;
+	Episode *e, *dup;
+	Series *tmp;
+
+	tmp = _etvdb_client_series_get(s->id, EINA_TRUE);
+	if (!tmp)
+		return EINA_FALSE;
+
+	/* the Episodes of tmp belong to its image, they are copied */
+	EINA_LIST_FOREACH(tmp->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e) {
+			dup = etvdb_episode_dup(e);
+			dup->series = s;
+			all = eina_list_append(all, dup);
+		}
+	}
+
+	EINA_LIST_FOREACH(tmp->specials, l, e) {
+		dup = etvdb_episode_dup(e);
+		dup->series = s;
+		all = eina_list_append(all, dup);
+	}
+
+	etvdb_series_free(tmp);
+
+	return _etvdb_series_episodes_bucket(s, all);
+}
+
+/* find Series through the daemon.
+ * returns EINA_FALSE if the daemon couldn't answer, the caller searches then */
+Eina_Bool _etvdb_client_series_find(const char *name, Eina_List **list)
+{
+	char *reply, *p, *image;
+	uint32_t len, count, i, ilen;
+	size_t nlen = strlen(name);
+	Daemon_Find_Req *req;
+	Series *s;
+
+	*list = NULL;
+
+	if (!etvdb_client_connected_get())
+		return EINA_FALSE;
+
+	req = malloc(sizeof(Daemon_Find_Req) + nlen);
+	if (!req) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	memset(req->lang, 0, sizeof(req->lang));
+	strncpy(req->lang, etvdb_language, sizeof(req->lang) - 1);
+	memcpy(req->name, name, nlen);
+
+	if (!_request(DAEMON_OP_SERIES_FIND, req, sizeof(Daemon_Find_Req) + nlen, &reply, &len)) {
+		free(req);
+		return EINA_FALSE;
+	}
+	free(req);
+
+	/* count | (length | snapshot image) * count */
+	if (len < sizeof(uint32_t))
+		goto bad;
+
+	memcpy(&count, reply, sizeof(uint32_t));
+	p = reply + sizeof(uint32_t);
+
+	for (i = 0; i < count; i++) {
+		if ((size_t)(reply + len - p) < sizeof(uint32_t))
+			goto bad;
+		memcpy(&ilen, p, sizeof(uint32_t));
+		p += sizeof(uint32_t);
+		if ((size_t)(reply + len - p) < ilen)
+			goto bad;
+
+		/* every Series owns a copy of its image */
+		image = malloc(ilen + 1);
+		if (!image)
+			goto bad;
+		memcpy(image, p, ilen);
+		p += ilen;
+
+		s = _series_from_image(image, ilen);
+		if (!s)
+			goto bad;
+		*list = eina_list_append(*list, s);
+	}
+
+	free(reply);
+
+	return EINA_TRUE;
+
+bad:
+	ERR("Invalid answer from the daemon.");
+	EINA_LIST_FREE(*list, s)
+		etvdb_series_free(s);
+	free(reply);
+
+	return EINA_FALSE;
+}
+
+/* build a Series, which owns image.
+ * Series without Episodes are copied, so they can be populated later */
+static Series *_series_from_image(char *image, size_t len)
+{
+	Series *s, *dup;
+
+	s = _etvdb_snapshot_series_get(image, len);
+	if (!s) {
+		ERR("Invalid Series from the daemon.");
+		free(image);
+		return NULL;
+	}
+
+	_etvdb_series_priv_get(s)->image = image;
+
+	if (s->seasons || s->specials)
+		return s;
+
+	dup = etvdb_series_dup(s);
+	etvdb_series_free(s);
+
+	return dup;
+}
+
+/* send a request and wait for the reply, *reply has to be free()d.
+ * the request gets a connection of its own, so the lock isn't held while it waits.
+ * a connection, which broke or timed out, is closed, the daemon is dropped
+ * if it went away, so following calls don't wait for it */
+static Eina_Bool _request(Daemon_Op op, const void *payload, uint32_t len,
+		char **reply, uint32_t *reply_len)
+{
+	char path[sizeof(((struct sockaddr_un *)NULL)->sun_path)], *buf;
+	int fd = -1;
+	unsigned int generation;
+	double until;
+	Daemon_Frame f;
+	Eina_Bool check;
+
+	eina_lock_take(&_client_lock);
+
+	if (!_path) {
+		eina_lock_release(&_client_lock);
+		return EINA_FALSE;
+	}
+
+	/* the connections of the parent are shared with it, they aren't used */
+	if (_pid != getpid()) {
+		while (_idle) {
+			close((intptr_t)eina_list_data_get(_idle));
+			_idle = eina_list_remove_list(_idle, _idle);
+		}
+		_pid = getpid();
+	}
+
+	if (_idle) {
+		fd = (intptr_t)eina_list_data_get(_idle);
+		_idle = eina_list_remove_list(_idle, _idle);
+	}
+
+	generation = _generation;
+	check = _check;
+	strcpy(path, _path);
+
+	eina_lock_release(&_client_lock);
+
+	until = etvdb_time_get() + _etvdb_request_remaining();
+
+	if (fd < 0)
+		fd = _open(path, check, until);
+
+	if (fd < 0 || !_exchange(fd, op, payload, len, until, &f, &buf)) {
+		if (fd >= 0)
+			close(fd);
+
+		if (_etvdb_request_expired() || etvdb_time_get() >= until) {
+			DBG("Daemon didn't answer request %u in time, fetching data locally.", op);
+			return EINA_FALSE;
+		}
+
+		WARN("Lost connection to the daemon, fetching data locally.");
+		eina_lock_take(&_client_lock);
+		if (generation == _generation)
+			_disconnect();
+		eina_lock_release(&_client_lock);
+
+		return EINA_FALSE;
+	}
+
+	_release(fd, generation);
+
+	/* the daemon couldn't answer, e.g. it serves another language */
+	if (f.status != DAEMON_OK) {
+		DBG("Daemon couldn't answer request %u: status %u", op, f.status);
+		free(buf);
+		return EINA_FALSE;
+	}
+
+	if (reply) {
+		*reply = buf;
+		*reply_len = f.len;
+	} else
+		free(buf);
+
+	return EINA_TRUE;
+}
+
+/* open a connection to the daemon and say hello.
+ * returns the connection, or -1 if there is no usable daemon */
+static int _open(const char *path, Eina_Bool check, double until)
+{
+	char *buf = NULL;
+	int fd;
+	uint32_t version = DAEMON_PROTO_VERSION;
+	struct sockaddr_un addr;
+	Daemon_Frame f;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		DBG("No daemon at %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (check && !_peer_trusted(fd, path)) {
+		WARN("Daemon at %s doesn't run as this user, fetching data locally.", path);
+		close(fd);
+		return -1;
+	}
+
+	if (!_exchange(fd, DAEMON_OP_HELLO, &version, sizeof(version), until, &f, &buf)
+			|| f.status != DAEMON_OK) {
+		WARN("Daemon at %s didn't answer or speaks a different protocol.", path);
+		free(buf);
+		close(fd);
+		return -1;
+	}
+
+	free(buf);
+
+	return fd;
+}
+
+/* send a request on a connection and read the answer, *reply has to be free()d.
+ * returns EINA_FALSE if the connection broke or timed out, it can't be used any more */
+static Eina_Bool _exchange(int fd, Daemon_Op op, const void *payload, uint32_t len,
+		double until, Daemon_Frame *f, char **reply)
+{
+	char *buf;
+
+	f->len = len;
+	f->op = op;
+	f->status = DAEMON_OK;
+
+	if (!_etvdb_daemon_io(fd, f, sizeof(*f), EINA_TRUE, until)
+			|| !_etvdb_daemon_io(fd, (void *)payload, len, EINA_TRUE, until)
+			|| !_etvdb_daemon_io(fd, f, sizeof(*f), EINA_FALSE, until) || f->len > DAEMON_FRAME_MAX)
+		return EINA_FALSE;
+
+	buf = malloc(f->len + 1);
+	if (!buf || !_etvdb_daemon_io(fd, buf, f->len, EINA_FALSE, until)) {
+		free(buf);
+		return EINA_FALSE;
+	}
+
+	*reply = buf;
+
+	return EINA_TRUE;
+}
+
+/* give a connection back for the following requests */
+static void _release(int fd, unsigned int generation)
+{
+	eina_lock_take(&_client_lock);
+
+	if (_path && generation == _generation && _pid == getpid()) {
+		_idle = eina_list_prepend(_idle, (void *)(intptr_t)fd);
+		fd = -1;
+	}
+
+	eina_lock_release(&_client_lock);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+/* check that the daemon runs as this user, or at least owns the socket */
+static Eina_Bool _peer_trusted(int fd UNUSED, const char *path UNUSED)
+{
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return EINA_FALSE;
+
+	return cred.uid == getuid();
+#else
+	struct stat st;
+
+	if (lstat(path, &st) || !S_ISSOCK(st.st_mode))
+		return EINA_FALSE;
+
+	return st.st_uid == getuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+#endif
+}
+
+/* drop the daemon, the lock is held. connections in use are closed, when they are given back */
+static void _disconnect(void)
+{
+	while (_idle) {
+		close((intptr_t)eina_list_data_get(_idle));
+		_idle = eina_list_remove_list(_idle, _idle);
+	}
+
+	free(_path);
+	_path = NULL;
+	_generation++;
+
+	__atomic_store_n(&_connected, 0, __ATOMIC_RELEASE);
+}
+
+/* transfer len bytes over a daemon connection, restarting after signals and short transfers.
+ * with until set, it gives up at that time or when the call is cancelled */
+Eina_Bool _etvdb_daemon_io(int fd, void *buf, size_t len, Eina_Bool out, double until)
+{
+	ssize_t n;
+	char *p = buf;
+	int flags = until > 0 ? MSG_DONTWAIT : 0, ms;
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = out ? POLLOUT : POLLIN;
+
+	while (len) {
+		if (until > 0) {
+			if (_etvdb_request_expired() || etvdb_time_get() >= until)
+				return EINA_FALSE;
+
+			ms = (int)((until - etvdb_time_get()) * 1000) + 1;
+			if (ms > CLIENT_POLL_MS)
+				ms = CLIENT_POLL_MS;
+			if (poll(&pfd, 1, ms) == 0)
+				continue;
+		}
+
+		if (out)
+			n = send(fd, p, len, MSG_NOSIGNAL | flags);
+		else
+			n = recv(fd, p, len, flags);
+
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+			continue;
+		if (n <= 0)
+			return EINA_FALSE;
+
+		p += n;
+		len -= n;
+	}
+
+	return EINA_TRUE;
+}
@@ -0,0 +1,283 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* position of a record in the date index */
+typedef struct _compact_date {
+	uint32_t aired; /**< packed air date of the record */
+	uint32_t index; /**< index of the record */
+} Compact_Date;
+
+/* compact Episodes of a Series, records, date index and strings share one allocation */
+struct _etvdb_compact {
+	uint32_t series_id; /**< TVDB ID of the Series */
+	unsigned int count; /**< number of Episodes */
+	Etvdb_Episode_Compact *episodes; /**< Episode records */
+	Compact_Date *by_date; /**< record indexes ordered by air date, then by index */
+	const char *strings; /**< string blob, offset 0 is an empty string */
+	size_t strings_len; /**< length of the string blob */
+};
+
+/* internal functions */
+static void _episode_set(String_Table *cs, Etvdb_Episode_Compact *c, Episode *e);
+static unsigned int _aired_lower(const Etvdb_Compact *c, uint32_t date);
+static int _date_cmp(const void *a, const void *b);
+
+/**
+ * @brief Compact Episode Records
+ * @defgroup Compact
+ *
+ * @{
+ *
+ * A compact copy of the Episodes of a Series, for large catalogues
+ * which are scanned a lot.
+ *
+ * Every Episode is a fixed size Etvdb_Episode_Compact record with
+ * a packed date and offsets into a string blob of the Series instead of pointers.
+ * The records are about half the size of an Episode with its pointers,
+ * and dates are compared as integers.
+ * The records are indexed by air date, so lookups by date are binary searches.
+ */
+
+/**
+ * @brief Create a compact copy of the Episodes of a Series
+ *
+ * The records are in the order of the Series: seasons first, then specials.
+ * The Series is not changed and can be freed afterwards.
+ *
+ * @param s a populated Series
+ *
+ * @return a new Etvdb_Compact, which has to be freed with etvdb_compact_free()
+ * @return NULL on failure
+ *
+ * @ingroup Compact
+ */
+EAPI Etvdb_Compact *etvdb_compact_new(Series *s)
+{
+	unsigned int i, count = 0, n = 0;
+	size_t len;
+	String_Table cs;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+	Etvdb_Compact *c = NULL;
+	Etvdb_Episode_Compact *recs;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		count += eina_list_count(sl);
+	count += eina_list_count(s->specials);
+
+	recs = calloc(count + 1, sizeof(Etvdb_Episode_Compact));
+	if (!_etvdb_string_table_init(&cs) || !recs) {
+		ERR("Couldn't allocate enough memory.");
+		goto end;
+	}
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_set(&cs, &recs[n++], e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_set(&cs, &recs[n++], e);
+
+	/* the records are followed by the date index and the strings in the same block */
+	len = eina_binbuf_length_get(cs.buf);
+	c = malloc(sizeof(Etvdb_Compact) + count * (sizeof(Etvdb_Episode_Compact) + sizeof(Compact_Date)) + len);
+	if (!c) {
+		ERR("Couldn't allocate enough memory.");
+		goto end;
+	}
+
+	c->series_id = s->id;
+	c->count = count;
+	c->episodes = (Etvdb_Episode_Compact *)(c + 1);
+	c->by_date = (Compact_Date *)(c->episodes + count);
+	c->strings = (const char *)(c->by_date + count);
+	c->strings_len = len;
+	memcpy(c->episodes, recs, count * sizeof(Etvdb_Episode_Compact));
+	memcpy((char *)c->strings, eina_binbuf_string_get(cs.buf), len);
+
+	for (i = 0; i < count; i++) {
+		c->by_date[i].aired = recs[i].aired;
+		c->by_date[i].index = i;
+	}
+	qsort(c->by_date, count, sizeof(Compact_Date), _date_cmp);
+
+	DBG("Compacted %u Episodes of Series %"PRIu32", %zu bytes of strings.", count, s->id, len);
+
+end:
+	free(recs);
+	_etvdb_string_table_free(&cs);
+
+	return c;
+}
+
+/**
+ * @brief Free compact Episodes
+ *
+ * @param c compact Episodes
+ *
+ * @ingroup Compact
+ */
+EAPI void etvdb_compact_free(Etvdb_Compact *c)
+{
+	free(c);
+}
+
+/**
+ * @brief Get the compact Episode records
+ *
+ * @param c compact Episodes
+ * @param count set to the number of records
+ *
+ * @return the records, which belong to c
+ *
+ * @ingroup Compact
+ */
+EAPI const Etvdb_Episode_Compact *etvdb_compact_episodes_get(const Etvdb_Compact *c, unsigned int *count)
+{
+	*count = c->count;
+
+	return c->episodes;
+}
+
+/**
+ * @brief Get a string of a compact Episode record
+ *
+ * @param c compact Episodes
+ * @param offset a string offset of a record, e.g. its name
+ *
+ * @return the string, which belongs to c, or NULL if the record has none
+ *
+ * @ingroup Compact
+ */
+EAPI const char *etvdb_compact_string_get(const Etvdb_Compact *c, uint32_t offset)
+{
+	if (!offset || offset >= c->strings_len)
+		return NULL;
+
+	return c->strings + offset;
+}
+
+/**
+ * @brief Get the compact Episode, which aired first at a date
+ *
+ * @param c compact Episodes
+ * @param date a packed date, see etvdb_date_pack()
+ *
+ * @return the record, or NULL if no Episode aired at this date.
+ * If several did, the first one in the order of the Series.
+ *
+ * @ingroup Compact
+ */
+EAPI const Etvdb_Episode_Compact *etvdb_compact_by_date_get(const Etvdb_Compact *c, uint32_t date)
+{
+	unsigned int i;
+
+	if (!date)
+		return NULL;
+
+	i = _aired_lower(c, date);
+	if (i == c->count || c->by_date[i].aired != date)
+		return NULL;
+
+	return &c->episodes[c->by_date[i].index];
+}
+
+/**
+ * @brief Get the compact Episode, which airs next
+ *
+ * @param c compact Episodes
+ * @param date a packed date, see etvdb_date_pack()
+ *
+ * @return the first record airing at or after date, or NULL if there is none
+ *
+ * @ingroup Compact
+ */
+EAPI const Etvdb_Episode_Compact *etvdb_compact_airs_next_get(const Etvdb_Compact *c, uint32_t date)
+{
+	unsigned int i;
+
+	i = _aired_lower(c, date);
+	if (i == c->count)
+		return NULL;
+
+	return &c->episodes[c->by_date[i].index];
+}
+
+/**
+ * @brief Pack a date
+ *
+ * Packed dates compare like the date strings do.
+ *
+ * @param date a ISO 8601 date string, e.g. "2014-05-25"
+ *
+ * @return the packed date, 0 if date is invalid
+ *
+ * @ingroup Compact
+ */
+EAPI uint32_t etvdb_date_pack(const char *date)
+{
+	return _etvdb_date_pack(date);
+}
+
+/**
+ * @brief Unpack a date
+ *
+ * @param date a packed date
+ * @param buf buffer for the ISO 8601 date string, at least 11 bytes
+ *
+ * @return buf, or NULL if date is 0
+ *
+ * @ingroup Compact
+ */
+EAPI char *etvdb_date_unpack(uint32_t date, char *buf)
+{
+	if (!date)
+		return NULL;
+
+	snprintf(buf, 11, "%04"PRIu32"-%02"PRIu32"-%02"PRIu32,
+			(date >> 9) % 10000, (date >> 5) & 0xF, date & 0x1F);
+
+	return buf;
+}
+/**
+ * @}
+ */
+
+/* fill a compact record */
+static void _episode_set(String_Table *cs, Etvdb_Episode_Compact *c, Episode *e)
+{
+	c->id = e->id;
+	c->aired = _etvdb_date_pack(e->firstaired);
+	c->season = e->season;
+	c->number = e->number;
+	c->imdb_id = _etvdb_string_table_add(cs, e->imdb_id);
+	c->name = _etvdb_string_table_add(cs, etvdb_episode_name_get(e));
+	c->overview = _etvdb_string_table_add(cs, etvdb_episode_overview_get(e));
+}
+
+/* position of the first record in the date index, which aired at or after date */
+static unsigned int _aired_lower(const Etvdb_Compact *c, uint32_t date)
+{
+	unsigned int lo = 0, hi = c->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (c->by_date[mid].aired < date)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int _date_cmp(const void *a, const void *b)
+{
+	const Compact_Date *da = a, *db = b;
+
+	if (da->aired != db->aired)
+		return da->aired < db->aired ? -1 : 1;
+
+	return (da->index > db->index) - (da->index < db->index);
+}
@@ -0,0 +1,589 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+/* raw size of a block of overviews, smaller blocks decompress faster,
+ * larger ones compress better */
+#define BLOCK_SIZE (16 * 1024)
+
+/* number of decompressed blocks cached per thread */
+#define CACHE_BLOCKS 4
+
+/* zstd level used when no other one was set */
+#define LEVEL_DEFAULT 3
+
+/* one compressed block of overviews */
+typedef struct _overview_block {
+	void *data; /**< compressed data */
+	size_t size; /**< compressed size */
+	size_t raw_size; /**< decompressed size */
+} Overview_Block;
+
+/* position of one overview */
+typedef struct _overview_ref {
+	uint32_t block; /**< block index */
+	uint32_t offset; /**< offset in the decompressed block */
+} Overview_Ref;
+
+/* position of the overview of an Episode */
+typedef struct _overview_entry {
+	uint32_t id; /**< TVDB ID of the Episode */
+	Overview_Ref ref; /**< position of the overview */
+} Overview_Entry;
+
+/* a dictionary and level, kept as long as overviews are compressed with it */
+typedef struct _overview_dict {
+	ZSTD_CDict *cdict; /**< compression dictionary, NULL to compress without one */
+	ZSTD_DDict *ddict; /**< decompression dictionary, NULL without one */
+	int level; /**< compression level */
+	int refs; /**< the current setting and every Overviews using it */
+} Overview_Dict;
+
+/* the compressed overviews of a Series */
+struct _etvdb_overviews {
+	uint64_t serial; /**< unique number, identifies the blocks in the caches */
+	Overview_Dict *dict; /**< dictionary the blocks were compressed with, NULL for none */
+	Overview_Block *blocks; /**< compressed blocks */
+	unsigned int count; /**< number of blocks */
+	Overview_Entry *entries; /**< Episode overviews, sorted by ID */
+	unsigned int entries_count; /**< number of entries */
+	Overview_Ref series; /**< overview of the Series */
+	Eina_Bool has_series; /**< the Series has an overview */
+};
+
+/* a decompressed block */
+typedef struct _cache_entry {
+	uint64_t serial; /**< serial of the owning overviews, 0 if unused */
+	uint32_t block; /**< block index */
+	unsigned int used; /**< last use, for LRU replacement */
+	char *data; /**< decompressed data */
+	size_t size; /**< allocated size of data */
+} Cache_Entry;
+
+/* block under construction */
+typedef struct _block_builder {
+	Overviews *ov; /**< overviews the block is added to */
+	Eina_Binbuf *raw; /**< raw text of the current block */
+	ZSTD_CCtx *cctx; /**< compression context of the thread */
+	unsigned int entries_size; /**< allocated size of ov->entries */
+	Eina_Bool failed; /**< compression failed */
+} Block_Builder;
+
+/* internal functions */
+static void _episode_add(Block_Builder *b, Episode *e);
+static Eina_Bool _block_add(Block_Builder *b, const char *str, Overview_Ref *ref);
+static Eina_Bool _block_flush(Block_Builder *b);
+static const char *_ref_get(const Overviews *ov, const Overview_Ref *ref);
+static int _entry_cmp(const void *a, const void *b);
+static Overview_Dict *_dict_ref(void);
+static void _dict_unref(Overview_Dict *d);
+static void _overviews_free(Overviews *ov);
+
+/* dictionary used for new compressions, NULL for none and the default level.
+ * the lock is only held to swap or reference it */
+static Overview_Dict *_dict = NULL;
+static Eina_Lock _dict_lock;
+static uint64_t _serial = 0;
+
+/* decompressed blocks and zstd contexts, every thread has its own */
+static __thread Cache_Entry _cache[CACHE_BLOCKS];
+static __thread unsigned int _cache_clock = 0;
+static __thread ZSTD_DCtx *_dctx = NULL;
+static __thread ZSTD_CCtx *_cctx = NULL;
+
+/**
+ * @brief Compressed Overviews
+ * @defgroup Compression
+ *
+ * @{
+ *
+ * Overviews make up most of the memory of a catalogue, but are rarely read.
+ * etvdb_series_overviews_compress() moves the overviews of a Series
+ * into zstd compressed blocks.
+ * etvdb_series_overview_get() and etvdb_episode_overview_get()
+ * decompress a block on access, and keep the last few blocks
+ * of each thread decompressed.
+ *
+ * A dictionary trained on overviews (e.g. with zstd --train) improves
+ * the compression of the small blocks a lot, see etvdb_overviews_dictionary_set().
+ *
+ * Threads compress and decompress at the same time, each with
+ * zstd contexts of its own.
+ *
+ * These functions require etvdb to be built with zstd.
+ */
+
+/**
+ * @brief Set the dictionary and level used for compression
+ *
+ * The setting applies to Series compressed afterwards,
+ * Series compressed before keep the dictionary they were compressed with.
+ *
+ * @param dict dictionary, NULL to compress without one
+ * @param len length of dict
+ * @param level zstd compression level, 0 for the default
+ *
+ * @return EINA_TRUE on success
+ * @return EINA_FALSE on failure
+ *
+ * @ingroup Compression
+ */
+EAPI Eina_Bool etvdb_overviews_dictionary_set(const void *dict, size_t len, int level)
+{
+	Overview_Dict *d, *old;
+
+	d = calloc(1, sizeof(Overview_Dict));
+	if (!d) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	d->level = level ? level : LEVEL_DEFAULT;
+	d->refs = 1;
+
+	if (dict && len) {
+		d->cdict = ZSTD_createCDict(dict, len, d->level);
+		d->ddict = ZSTD_createDDict(dict, len);
+		if (!d->cdict || !d->ddict) {
+			ERR("Couldn't load the compression dictionary.");
+			_dict_unref(d);
+			return EINA_FALSE;
+		}
+	}
+
+	eina_lock_take(&_dict_lock);
+	old = _dict;
+	_dict = d;
+	eina_lock_release(&_dict_lock);
+
+	_dict_unref(old);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Compress the overviews of a Series
+ *
+ * This function moves the overviews of a Series and its Episodes into
+ * compressed blocks, the overview members are NULL afterwards.
+ * Use etvdb_series_overview_get() and etvdb_episode_overview_get()
+ * to read them.
+ *
+ * Compressing a Series again adds overviews, which were filled in later.
+ * Populating the Series again drops the compressed overviews.
+ * Series loaded with etvdb_series_load() can't be compressed.
+ *
+ * @param s a Series
+ *
+ * @return EINA_TRUE on success
+ * @return EINA_FALSE on failure
+ *
+ * @ingroup Compression
+ */
+EAPI Eina_Bool etvdb_series_overviews_compress(Series *s)
+{
+	const char *str;
+	Block_Builder b;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+	Series_Priv *priv;
+
+	if (s->priv && s->priv->map) {
+		ERR("Series %"PRIu32" was loaded from a snapshot and can't be changed.", s->id);
+		return EINA_FALSE;
+	}
+
+	priv = _etvdb_series_priv_get(s);
+	if (!priv)
+		return EINA_FALSE;
+
+	if (!_cctx)
+		_cctx = ZSTD_createCCtx();
+
+	b.ov = calloc(1, sizeof(Overviews));
+	b.raw = eina_binbuf_new();
+	b.cctx = _cctx;
+	b.entries_size = 0;
+	b.failed = EINA_FALSE;
+	if (!b.ov || !b.raw || !b.cctx) {
+		ERR("Couldn't allocate enough memory.");
+		free(b.ov);
+		if (b.raw)
+			eina_binbuf_free(b.raw);
+		return EINA_FALSE;
+	}
+
+	b.ov->serial = __atomic_add_fetch(&_serial, 1, __ATOMIC_RELAXED);
+	b.ov->dict = _dict_ref();
+
+	/* overviews, which are compressed already, are read from the old blocks */
+	str = s->overview ? s->overview : _etvdb_overviews_series_get(s);
+	if (str && _block_add(&b, str, &b.ov->series))
+		b.ov->has_series = EINA_TRUE;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_add(&b, e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_add(&b, e);
+
+	_block_flush(&b);
+
+	eina_binbuf_free(b.raw);
+
+	/* later overviews of the same Episode replace earlier ones */
+	qsort(b.ov->entries, b.ov->entries_count, sizeof(Overview_Entry), _entry_cmp);
+
+	if (b.failed) {
+		ERR("Compressing the overviews of Series %"PRIu32" failed.", s->id);
+		_overviews_free(b.ov);
+		return EINA_FALSE;
+	}
+
+	/* the overviews are only kept compressed now */
+	free(s->overview);
+	s->overview = NULL;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e) {
+			free(e->overview);
+			e->overview = NULL;
+		}
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e) {
+		free(e->overview);
+		e->overview = NULL;
+	}
+
+	_overviews_free(priv->overviews);
+	priv->overviews = b.ov;
+
+	DBG("Compressed the overviews of Series %"PRIu32" into %u blocks.", s->id, b.ov->count);
+
+	return EINA_TRUE;
+}
+/**
+ * @}
+ */
+
+/* set up compression, called by etvdb_init() */
+Eina_Bool _etvdb_compress_init(void)
+{
+	return eina_lock_new(&_dict_lock);
+}
+
+/* free the dictionary setting and the cache of the calling thread, called by etvdb_shutdown().
+ * compressed Series keep their dictionary */
+void _etvdb_compress_shutdown(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < CACHE_BLOCKS; i++) {
+		free(_cache[i].data);
+		memset(&_cache[i], 0, sizeof(Cache_Entry));
+	}
+
+	ZSTD_freeDCtx(_dctx);
+	_dctx = NULL;
+	ZSTD_freeCCtx(_cctx);
+	_cctx = NULL;
+
+	_dict_unref(_dict);
+	_dict = NULL;
+	eina_lock_free(&_dict_lock);
+}
+
+/* free the compressed overviews of a Series */
+void _etvdb_overviews_free(Series *s)
+{
+	if (!s->priv)
+		return;
+
+	_overviews_free(s->priv->overviews);
+	s->priv->overviews = NULL;
+}
+
+/* get a compressed Series overview, NULL if there is none */
+const char *_etvdb_overviews_series_get(const Series *s)
+{
+	if (!s->priv || !s->priv->overviews || !s->priv->overviews->has_series)
+		return NULL;
+
+	return _ref_get(s->priv->overviews, &s->priv->overviews->series);
+}
+
+/* get a compressed Episode overview, NULL if there is none */
+const char *_etvdb_overviews_episode_get(const Episode *e)
+{
+	unsigned int lo = 0, hi, mid;
+	Overviews *ov;
+
+	if (!e->series || !e->series->priv || !(ov = e->series->priv->overviews))
+		return NULL;
+
+	/* the last entry of an ID wins, like the last overview added */
+	hi = ov->entries_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ov->entries[mid].id <= e->id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo || ov->entries[lo - 1].id != e->id)
+		return NULL;
+
+	return _ref_get(ov, &ov->entries[lo - 1].ref);
+}
+
+static void _overviews_free(Overviews *ov)
+{
+	unsigned int i;
+
+	if (!ov)
+		return;
+
+	for (i = 0; i < ov->count; i++)
+		free(ov->blocks[i].data);
+
+	free(ov->blocks);
+	free(ov->entries);
+	_dict_unref(ov->dict);
+	free(ov);
+}
+
+/* add the overview of an Episode */
+static void _episode_add(Block_Builder *b, Episode *e)
+{
+	const char *str;
+	Overview_Entry *entries;
+	Overviews *ov = b->ov;
+
+	str = etvdb_episode_overview_get(e);
+	if (!str || b->failed)
+		return;
+
+	if (ov->entries_count == b->entries_size) {
+		b->entries_size = b->entries_size ? b->entries_size * 2 : 64;
+		entries = realloc(ov->entries, b->entries_size * sizeof(Overview_Entry));
+		if (!entries) {
+			ERR("Couldn't allocate enough memory.");
+			b->failed = EINA_TRUE;
+			return;
+		}
+		ov->entries = entries;
+	}
+
+	if (!_block_add(b, str, &ov->entries[ov->entries_count].ref))
+		return;
+
+	ov->entries[ov->entries_count++].id = e->id;
+}
+
+/* append an overview to the current block, compress it when it is full */
+static Eina_Bool _block_add(Block_Builder *b, const char *str, Overview_Ref *ref)
+{
+	ref->block = b->ov->count;
+	ref->offset = eina_binbuf_length_get(b->raw);
+	eina_binbuf_append_length(b->raw, (const unsigned char *)str, strlen(str) + 1);
+
+	if (eina_binbuf_length_get(b->raw) >= BLOCK_SIZE)
+		return _block_flush(b);
+
+	return EINA_TRUE;
+}
+
+/* compress the current block */
+static Eina_Bool _block_flush(Block_Builder *b)
+{
+	size_t raw_size, bound, size;
+	void *data;
+	Overview_Block *blocks;
+
+	raw_size = eina_binbuf_length_get(b->raw);
+	if (!raw_size)
+		return EINA_TRUE;
+
+	bound = ZSTD_compressBound(raw_size);
+	data = malloc(bound);
+	blocks = realloc(b->ov->blocks, (b->ov->count + 1) * sizeof(Overview_Block));
+	if (!data || !blocks) {
+		ERR("Couldn't allocate enough memory.");
+		free(data);
+		b->failed = EINA_TRUE;
+		return EINA_FALSE;
+	}
+	b->ov->blocks = blocks;
+
+	if (b->ov->dict && b->ov->dict->cdict)
+		size = ZSTD_compress_usingCDict(b->cctx, data, bound,
+				eina_binbuf_string_get(b->raw), raw_size, b->ov->dict->cdict);
+	else
+		size = ZSTD_compressCCtx(b->cctx, data, bound,
+				eina_binbuf_string_get(b->raw), raw_size,
+				b->ov->dict ? b->ov->dict->level : LEVEL_DEFAULT);
+
+	if (ZSTD_isError(size)) {
+		ERR("zstd: %s", ZSTD_getErrorName(size));
+		free(data);
+		b->failed = EINA_TRUE;
+		return EINA_FALSE;
+	}
+
+	/* don't keep the slack of the bound */
+	blocks[b->ov->count].data = realloc(data, size);
+	if (!blocks[b->ov->count].data)
+		blocks[b->ov->count].data = data;
+	blocks[b->ov->count].size = size;
+	blocks[b->ov->count].raw_size = raw_size;
+	b->ov->count++;
+
+	eina_binbuf_reset(b->raw);
+
+	return EINA_TRUE;
+}
+
+/* get an overview from the cache of the calling thread, decompress its block if needed */
+static const char *_ref_get(const Overviews *ov, const Overview_Ref *ref)
+{
+	unsigned int i, victim = 0;
+	size_t size;
+	char *data;
+	Cache_Entry *c;
+	const Overview_Block *block;
+
+	_cache_clock++;
+
+	for (i = 0; i < CACHE_BLOCKS; i++) {
+		c = &_cache[i];
+		if (c->serial == ov->serial && c->block == ref->block) {
+			c->used = _cache_clock;
+			return c->data + ref->offset;
+		}
+
+		if (c->used < _cache[victim].used)
+			victim = i;
+	}
+
+	block = &ov->blocks[ref->block];
+	c = &_cache[victim];
+	c->serial = 0;
+
+	if (c->size < block->raw_size) {
+		data = realloc(c->data, block->raw_size);
+		if (!data) {
+			ERR("Couldn't allocate enough memory.");
+			return NULL;
+		}
+		c->data = data;
+		c->size = block->raw_size;
+	}
+
+	if (!_dctx && !(_dctx = ZSTD_createDCtx())) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	/* the overviews keep their dictionary, so no lock is needed */
+	if (ov->dict && ov->dict->ddict)
+		size = ZSTD_decompress_usingDDict(_dctx, c->data, c->size, block->data, block->size, ov->dict->ddict);
+	else
+		size = ZSTD_decompressDCtx(_dctx, c->data, c->size, block->data, block->size);
+
+	if (ZSTD_isError(size) || size != block->raw_size) {
+		ERR("Decompressing overviews failed: %s",
+				ZSTD_isError(size) ? ZSTD_getErrorName(size) : "size mismatch");
+		return NULL;
+	}
+
+	c->serial = ov->serial;
+	c->block = ref->block;
+	c->used = _cache_clock;
+
+	return c->data + ref->offset;
+}
+
+/* order Episode overviews by ID, and by the order they were added */
+static int _entry_cmp(const void *a, const void *b)
+{
+	const Overview_Entry *ea = a, *eb = b;
+
+	if (ea->id != eb->id)
+		return ea->id < eb->id ? -1 : 1;
+
+	/* refs of one Series grow while they are added */
+	if (ea->ref.block != eb->ref.block)
+		return ea->ref.block < eb->ref.block ? -1 : 1;
+
+	return (ea->ref.offset > eb->ref.offset) - (ea->ref.offset < eb->ref.offset);
+}
+
+/* reference the current dictionary, the lock is only held for that */
+static Overview_Dict *_dict_ref(void)
+{
+	Overview_Dict *d;
+
+	eina_lock_take(&_dict_lock);
+	d = _dict;
+	if (d)
+		__atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
+	eina_lock_release(&_dict_lock);
+
+	return d;
+}
+
+/* give back a dictionary, it is freed with the last reference */
+static void _dict_unref(Overview_Dict *d)
+{
+	if (!d || __atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	ZSTD_freeCDict(d->cdict);
+	ZSTD_freeDDict(d->ddict);
+	free(d);
+}
+
+#else /* HAVE_ZSTD */
+
+EAPI Eina_Bool etvdb_overviews_dictionary_set(const void *dict UNUSED, size_t len UNUSED, int level UNUSED)
+{
+	ERR("etvdb was built without compression support.");
+	return EINA_FALSE;
+}
+
+EAPI Eina_Bool etvdb_series_overviews_compress(Series *s UNUSED)
+{
+	ERR("etvdb was built without compression support.");
+	return EINA_FALSE;
+}
+
+Eina_Bool _etvdb_compress_init(void)
+{
+	return EINA_TRUE;
+}
+
+void _etvdb_compress_shutdown(void)
+{
+}
+
+void _etvdb_overviews_free(Series *s UNUSED)
+{
+}
+
+const char *_etvdb_overviews_series_get(const Series *s UNUSED)
+{
+	return NULL;
+}
+
+const char *_etvdb_overviews_episode_get(const Episode *e UNUSED)
+{
+	return NULL;
+}
+
+#endif /* HAVE_ZSTD */
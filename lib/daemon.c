@@ -0,0 +1,587 @@
+#define _GNU_SOURCE /* accept4() and pipe2() */
+#include "etvdb_private.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* pending connections on the daemon socket */
+#define DAEMON_BACKLOG 64
+
+/* open connections, more wait in the backlog */
+#define DAEMON_CONNS_MAX 256
+
+/* worker threads serving requests, they keep their TVDB connections */
+#define DAEMON_WORKERS 8
+
+/* time a client has to send a request or take its answer, in seconds */
+#define DAEMON_IO_TIMEOUT 10.0
+
+/* cached answers, the least recently used are dropped beyond it */
+#define DAEMON_CACHE_MAX 1024
+
+/* longest name searched for, so every key fits into URI_MAX */
+#define DAEMON_NAME_MAX 1024
+
+/* an answer of the daemon, cached or being fetched */
+typedef struct _daemon_entry {
+	Eina_Binbuf *image; /**< the answer, NULL while it is fetched */
+	double time; /**< time the answer was fetched */
+	double used; /**< time the answer was served last */
+	Eina_Bool busy; /**< a connection is fetching the answer */
+} Daemon_Entry;
+
+/* a client connection, its requests are served by the workers one at a time */
+typedef struct _daemon_conn {
+	int fd; /**< the connection */
+	int busy; /**< a worker serves a request, the connection isn't polled */
+	int dead; /**< the connection broke or was closed, it is freed when it isn't busy */
+} Daemon_Conn;
+
+/* a cached answer, which may be dropped */
+typedef struct _daemon_victim {
+	const char *key; /**< key of the answer */
+	double used; /**< time the answer was served last */
+} Daemon_Victim;
+
+/* answers collected by _cache_trim() */
+typedef struct _daemon_trim {
+	Daemon_Victim *victims; /**< answers, which aren't being fetched */
+	unsigned int count; /**< used size of victims */
+	double now; /**< time of the trim */
+} Daemon_Trim;
+
+/* internal functions */
+static void _conn_serve(void *data);
+static Daemon_Status _answer(Daemon_Op op, const char *payload, uint32_t len, Eina_Binbuf **out);
+static Eina_Binbuf *_fetch(Daemon_Op op, uint32_t id, const char *name);
+static Eina_Binbuf *_find_fetch(const char *name);
+static void _cache_trim(void);
+static Eina_Bool _victim_collect(const Eina_Hash *hash UNUSED, const void *key, void *data, void *fdata);
+static int _victim_cmp(const void *a, const void *b);
+static void _conns_reap(Eina_Bool all);
+static void _entry_free(void *data);
+
+/* answers by "op:ID" or "op:name", shared by all connections */
+static Eina_Hash *_cache = NULL;
+static Eina_Lock _cache_lock;
+static Eina_Condition _cache_cond;
+static double _ttl = 3600.0;
+
+static Eina_List *_conns = NULL;
+static unsigned int _conns_count = 0;
+static Pool *_workers = NULL;
+
+/* woken up by etvdb_daemon_stop() with 'x' and by served requests with 'r' */
+static int _wake[2] = { -1, -1 };
+
+/**
+ * @brief Caching Daemon
+ * @defgroup Daemon
+ *
+ * @{
+ *
+ * etvdbd serves etvdb lookups to other processes on a Unix domain socket,
+ * so short-lived tools get answers from a warm cache,
+ * see @ref Client for the other side.
+ *
+ * Answers are cached for a while, and concurrent requests for the same
+ * data are merged into one fetch. The answers are Series in the
+ * @ref Snapshots format, so clients use them without parsing.
+ *
+ * The daemon answers in the language set with etvdb_language_set(),
+ * clients using other languages fetch data themselves.
+ * Requests of up to 256 connections are served by a fixed number of
+ * worker threads, which keep their TVDB connections, so many clients
+ * share a few connections to TVDB. Further clients wait until
+ * a connection is closed.
+ * The cache keeps at most 1024 answers and drops expired and
+ * least recently used ones, when it is full.
+ * Requests are served by several threads, which share the local store,
+ * if the daemon process opened one with etvdb_store_open().
+ */
+
+/**
+ * @brief Set how long the daemon caches answers
+ *
+ * @param seconds time in seconds, 0 disables the cache,
+ * concurrent requests are still merged
+ *
+ * @ingroup Daemon
+ */
+EAPI void etvdb_daemon_cache_ttl_set(double seconds)
+{
+	_ttl = seconds;
+}
+
+/**
+ * @brief Run the daemon
+ *
+ * This function serves requests on a Unix domain socket
+ * until etvdb_daemon_stop() is called.
+ *
+ * @param path path of the socket, or NULL for the default, see @ref Client
+ *
+ * @return EINA_TRUE after a clean stop, EINA_FALSE if the socket couldn't be set up
+ *
+ * @ingroup Daemon
+ */
+EAPI Eina_Bool etvdb_daemon_run(const char *path)
+{
+	char def[URI_MAX], c;
+	int fd, lfd;
+	unsigned int i, n;
+	Eina_Bool stop;
+	struct sockaddr_un addr;
+	struct pollfd pfd[DAEMON_CONNS_MAX + 2];
+	Daemon_Conn *conn, *polled[DAEMON_CONNS_MAX];
+	Eina_List *l;
+
+	/* the daemon never asks another daemon */
+	etvdb_client_disconnect();
+
+	if (!path)
+		path = _etvdb_daemon_path_get(def);
+	if (!path || !*path || strlen(path) >= sizeof(addr.sun_path)) {
+		ERR("Invalid daemon socket path.");
+		return EINA_FALSE;
+	}
+
+	if (etvdb_client_connect(path)) {
+		etvdb_client_disconnect();
+		ERR("A daemon is running at %s already.", path);
+		return EINA_FALSE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* a stale socket of a crashed daemon is replaced */
+	unlink(path);
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(lfd, DAEMON_BACKLOG)) {
+		ERR("Couldn't listen on %s: %s", path, strerror(errno));
+		if (lfd >= 0)
+			close(lfd);
+		return EINA_FALSE;
+	}
+
+	if (pipe2(_wake, O_CLOEXEC | O_NONBLOCK)) {
+		ERR("Couldn't create the wake up pipe: %s", strerror(errno));
+		close(lfd);
+		unlink(path);
+		return EINA_FALSE;
+	}
+
+	_workers = _etvdb_pool_new(DAEMON_WORKERS);
+	if (!_workers) {
+		close(_wake[0]);
+		close(_wake[1]);
+		_wake[0] = _wake[1] = -1;
+		close(lfd);
+		unlink(path);
+		return EINA_FALSE;
+	}
+
+	eina_lock_new(&_cache_lock);
+	eina_condition_new(&_cache_cond, &_cache_lock);
+	_cache = eina_hash_string_superfast_new(_entry_free);
+
+	INFO("Daemon listening on %s.", path);
+
+	pfd[0].fd = lfd;
+	pfd[1].fd = _wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		/* at the limit, new connections wait in the backlog */
+		pfd[0].events = _conns_count < DAEMON_CONNS_MAX ? POLLIN : 0;
+
+		/* connections being served are polled again, when their answer is sent */
+		n = 0;
+		EINA_LIST_FOREACH(_conns, l, conn) {
+			if (__atomic_load_n(&conn->busy, __ATOMIC_ACQUIRE))
+				continue;
+			polled[n] = conn;
+			pfd[n + 2].fd = conn->fd;
+			pfd[n + 2].events = POLLIN;
+			n++;
+		}
+
+		if (poll(pfd, n + 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ERR("Daemon poll failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfd[1].revents) {
+			stop = EINA_FALSE;
+			while (read(_wake[0], &c, 1) > 0)
+				stop |= c == 'x';
+			if (stop)
+				break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!pfd[i + 2].revents)
+				continue;
+
+			conn = polled[i];
+			__atomic_store_n(&conn->busy, 1, __ATOMIC_RELEASE);
+			if (!_etvdb_pool_push(_workers, _conn_serve, conn)) {
+				conn->dead = 1;
+				__atomic_store_n(&conn->busy, 0, __ATOMIC_RELEASE);
+			}
+		}
+
+		_conns_reap(EINA_FALSE);
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		conn = calloc(1, sizeof(Daemon_Conn));
+		if (!conn) {
+			ERR("Couldn't allocate enough memory.");
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		_conns = eina_list_append(_conns, conn);
+		_conns_count++;
+	}
+
+	close(lfd);
+	unlink(path);
+
+	/* requests, which are queued or being read, fail right away */
+	EINA_LIST_FOREACH(_conns, l, conn)
+		shutdown(conn->fd, SHUT_RDWR);
+	_etvdb_pool_free(_workers);
+	_workers = NULL;
+	_conns_reap(EINA_TRUE);
+
+	while (read(_wake[0], &c, 1) > 0);
+	close(_wake[0]);
+	close(_wake[1]);
+	_wake[0] = _wake[1] = -1;
+
+	eina_hash_free(_cache);
+	_cache = NULL;
+	eina_condition_free(&_cache_cond);
+	eina_lock_free(&_cache_lock);
+
+	INFO("Daemon stopped.");
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Stop the daemon
+ *
+ * This function can be called from any thread and from signal handlers.
+ *
+ * @ingroup Daemon
+ */
+EAPI void etvdb_daemon_stop(void)
+{
+	int fd = _wake[1];
+
+	if (fd >= 0 && write(fd, "x", 1) < 0)
+		return;
+}
+/**
+ * @}
+ */
+
+/* serve one request of a connection, which has data to read, in a worker */
+static void _conn_serve(void *data)
+{
+	char *payload;
+	Daemon_Conn *conn = data;
+	Daemon_Frame f;
+	Daemon_Status status;
+	Eina_Binbuf *out = NULL;
+
+	if (!_etvdb_daemon_io(conn->fd, &f, sizeof(f), EINA_FALSE, etvdb_time_get() + DAEMON_IO_TIMEOUT)
+			|| f.len > DAEMON_FRAME_MAX)
+		goto dead;
+
+	payload = malloc(f.len + 1);
+	if (!payload || !_etvdb_daemon_io(conn->fd, payload, f.len, EINA_FALSE, etvdb_time_get() + DAEMON_IO_TIMEOUT)) {
+		free(payload);
+		goto dead;
+	}
+	payload[f.len] = '\0';
+
+	status = _answer(f.op, payload, f.len, &out);
+	free(payload);
+
+	f.status = status;
+	f.len = out ? eina_binbuf_length_get(out) : 0;
+
+	if (!_etvdb_daemon_io(conn->fd, &f, sizeof(f), EINA_TRUE, etvdb_time_get() + DAEMON_IO_TIMEOUT)
+			|| (out && !_etvdb_daemon_io(conn->fd, (void *)eina_binbuf_string_get(out), f.len,
+					EINA_TRUE, etvdb_time_get() + DAEMON_IO_TIMEOUT)))
+		goto dead;
+
+	goto end;
+
+dead:
+	conn->dead = 1;
+end:
+	if (out)
+		eina_binbuf_free(out);
+
+	__atomic_store_n(&conn->busy, 0, __ATOMIC_RELEASE);
+
+	/* a full pipe wakes the daemon up anyway */
+	if (write(_wake[1], "r", 1) < 0)
+		DBG("Daemon is woken up already.");
+}
+
+/* answer a request from the cache, or fetch the answer.
+ * requests for an answer, which is being fetched, wait for it */
+static Daemon_Status _answer(Daemon_Op op, const char *payload, uint32_t len, Eina_Binbuf **out)
+{
+	char key[URI_MAX];
+	const char *name = NULL;
+	uint32_t id = 0, name_len;
+	const Daemon_Series_Req *sreq;
+	const Daemon_Find_Req *freq;
+	Daemon_Entry *entry;
+	Eina_Binbuf *image;
+	double now;
+
+	switch (op) {
+	case DAEMON_OP_HELLO:
+		if (len != sizeof(uint32_t) || *(const uint32_t *)payload != DAEMON_PROTO_VERSION)
+			return DAEMON_UNSUPPORTED;
+		return DAEMON_OK;
+	case DAEMON_OP_SERIES_GET:
+	case DAEMON_OP_SERIES_POPULATE:
+		if (len != sizeof(Daemon_Series_Req))
+			return DAEMON_INVALID;
+		sreq = (const Daemon_Series_Req *)payload;
+		if (strncmp(sreq->lang, etvdb_language, sizeof(sreq->lang)))
+			return DAEMON_UNSUPPORTED;
+		id = sreq->id;
+		snprintf(key, URI_MAX, "%u:%"PRIu32, op, id);
+		break;
+	case DAEMON_OP_SERIES_FIND:
+		if (len < sizeof(Daemon_Find_Req))
+			return DAEMON_INVALID;
+		freq = (const Daemon_Find_Req *)payload;
+		if (strncmp(freq->lang, etvdb_language, sizeof(freq->lang)))
+			return DAEMON_UNSUPPORTED;
+		/* the whole name is the key, so it has to fit without a nul in it */
+		name_len = len - sizeof(Daemon_Find_Req);
+		if (name_len > DAEMON_NAME_MAX || memchr(freq->name, '\0', name_len))
+			return DAEMON_INVALID;
+		name = freq->name;
+		snprintf(key, URI_MAX, "%u:%s", op, name);
+		break;
+	default:
+		return DAEMON_INVALID;
+	}
+
+	eina_lock_take(&_cache_lock);
+
+	while ((entry = eina_hash_find(_cache, key)) && entry->busy)
+		eina_condition_wait(&_cache_cond);
+
+	now = etvdb_time_get();
+	if (entry && now - entry->time < _ttl) {
+		entry->used = now;
+		*out = eina_binbuf_new();
+		eina_binbuf_append_length(*out, eina_binbuf_string_get(entry->image),
+				eina_binbuf_length_get(entry->image));
+		eina_lock_release(&_cache_lock);
+		return DAEMON_OK;
+	}
+
+	if (entry)
+		eina_hash_del_by_key(_cache, key);
+	else if (eina_hash_population(_cache) >= DAEMON_CACHE_MAX)
+		_cache_trim();
+
+	entry = calloc(1, sizeof(Daemon_Entry));
+	if (!entry) {
+		ERR("Couldn't allocate enough memory.");
+		eina_lock_release(&_cache_lock);
+		return DAEMON_INVALID;
+	}
+	entry->busy = EINA_TRUE;
+	eina_hash_add(_cache, key, entry);
+	eina_lock_release(&_cache_lock);
+
+	image = _fetch(op, id, name);
+
+	eina_lock_take(&_cache_lock);
+	if (image) {
+		entry->image = image;
+		entry->time = entry->used = etvdb_time_get();
+		entry->busy = EINA_FALSE;
+
+		*out = eina_binbuf_new();
+		eina_binbuf_append_length(*out, eina_binbuf_string_get(image), eina_binbuf_length_get(image));
+	} else
+		eina_hash_del_by_key(_cache, key);
+
+	eina_condition_broadcast(&_cache_cond);
+	eina_lock_release(&_cache_lock);
+
+	return image ? DAEMON_OK : DAEMON_NOT_FOUND;
+}
+
+/* fetch an answer, name is only used to find Series */
+static Eina_Binbuf *_fetch(Daemon_Op op, uint32_t id, const char *name)
+{
+	Eina_Binbuf *image;
+	Series *s;
+
+	if (op == DAEMON_OP_SERIES_FIND)
+		return _find_fetch(name);
+
+	s = etvdb_series_by_id_get(id);
+	if (!s)
+		return NULL;
+
+	if (op == DAEMON_OP_SERIES_POPULATE && !etvdb_series_populate(s)) {
+		etvdb_series_free(s);
+		return NULL;
+	}
+
+	image = _etvdb_snapshot_build(s);
+	etvdb_series_free(s);
+
+	return image;
+}
+
+/* search Series, the answer is: count | (length | snapshot image) * count */
+static Eina_Binbuf *_find_fetch(const char *name)
+{
+	uint32_t count, len;
+	Eina_Binbuf *out, *image;
+	Eina_List *list;
+	Series *s;
+
+	list = etvdb_series_find(name);
+
+	out = eina_binbuf_new();
+	if (!out) {
+		ERR("Couldn't allocate enough memory.");
+		EINA_LIST_FREE(list, s)
+			etvdb_series_free(s);
+		return NULL;
+	}
+
+	count = eina_list_count(list);
+	eina_binbuf_append_length(out, (const unsigned char *)&count, sizeof(count));
+
+	EINA_LIST_FREE(list, s) {
+		image = _etvdb_snapshot_build(s);
+		etvdb_series_free(s);
+		if (!image) {
+			eina_binbuf_free(out);
+			out = NULL;
+			break;
+		}
+
+		len = eina_binbuf_length_get(image);
+		eina_binbuf_append_length(out, (const unsigned char *)&len, sizeof(len));
+		eina_binbuf_append_length(out, eina_binbuf_string_get(image), len);
+		eina_binbuf_free(image);
+	}
+
+	EINA_LIST_FREE(list, s)
+		etvdb_series_free(s);
+
+	return out;
+}
+
+/* drop expired answers from the full cache, and the least recently used ones,
+ * until a quarter of it is free, so it isn't trimmed on every insert.
+ * the cache lock is held */
+static void _cache_trim(void)
+{
+	unsigned int i, drop;
+	Daemon_Trim trim;
+
+	trim.victims = malloc(eina_hash_population(_cache) * sizeof(Daemon_Victim));
+	if (!trim.victims) {
+		ERR("Couldn't allocate enough memory.");
+		return;
+	}
+	trim.count = 0;
+	trim.now = etvdb_time_get();
+
+	eina_hash_foreach(_cache, _victim_collect, &trim);
+	qsort(trim.victims, trim.count, sizeof(Daemon_Victim), _victim_cmp);
+
+	/* expired answers sort first, they were marked as never used */
+	drop = eina_hash_population(_cache) - DAEMON_CACHE_MAX * 3 / 4;
+	for (i = 0; i < trim.count && (i < drop || trim.victims[i].used < 0); i++)
+		eina_hash_del_by_key(_cache, trim.victims[i].key);
+
+	DBG("Dropped %u cached answers.", i);
+	free(trim.victims);
+}
+
+/* collect the answers, which aren't being fetched */
+static Eina_Bool _victim_collect(const Eina_Hash *hash UNUSED, const void *key, void *data, void *fdata)
+{
+	Daemon_Entry *entry = data;
+	Daemon_Trim *trim = fdata;
+
+	if (entry->busy)
+		return EINA_TRUE;
+
+	trim->victims[trim->count].key = key;
+	trim->victims[trim->count].used = trim->now - entry->time < _ttl ? entry->used : -1.0;
+	trim->count++;
+
+	return EINA_TRUE;
+}
+
+static int _victim_cmp(const void *a, const void *b)
+{
+	const Daemon_Victim *va = a, *vb = b;
+
+	return (va->used > vb->used) - (va->used < vb->used);
+}
+
+/* free closed connections, or all of them on shutdown, when the workers are stopped */
+static void _conns_reap(Eina_Bool all)
+{
+	Eina_List *l, *lnex;
+	Daemon_Conn *conn;
+
+	EINA_LIST_FOREACH_SAFE(_conns, l, lnex, conn) {
+		if (!all && (__atomic_load_n(&conn->busy, __ATOMIC_ACQUIRE) || !conn->dead))
+			continue;
+
+		close(conn->fd);
+		free(conn);
+		_conns = eina_list_remove_list(_conns, l);
+		_conns_count--;
+	}
+}
+
+static void _entry_free(void *data)
+{
+	Daemon_Entry *entry = data;
+
+	if (entry->image)
+		eina_binbuf_free(entry->image);
+	free(entry);
+}
@@ -1,8 +1,10 @@
 #include "etvdb_private.h"
 
 /* internal functions */
-static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length);
+static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static char *_episode_text_cb(void *data, void *record, Xml_Tag tag,
+		const char *content, unsigned length, Eina_Bool decode);
 
 /**
  * @brief Overall Episode Functions
@@ -27,34 +29,60 @@ static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const
  *
  * @return a list containing all episodes of a series.
  *
+ * @see etvdb_episodes_fields_get()
+ *
  * @ingroup Episodes
  */
 EAPI Eina_List *etvdb_episodes_get(Series *s)
+{
+	return etvdb_episodes_fields_get(s, ETVDB_FIELD_ALL);
+}
+
+/**
+ * @brief Get all Episodes of a Series with selected fields
+ *
+ * This function works like etvdb_episodes_get(), but only parses
+ * the fields in the mask, the others are left NULL.
+ * Skipped fields are neither copied nor decoded, so leaving out the
+ * overview makes this a lot cheaper.
+ * They can be filled in later with etvdb_series_fields_fill().
+ *
+ * @param s initialized TVDB Series structure
+ * @param fields mask of Etvdb_Field values
+ *
+ * @return a list containing all episodes of a series.
+ *
+ * @ingroup Episodes
+ */
+EAPI Eina_List *etvdb_episodes_fields_get(Series *s, unsigned int fields)
 {
 	char uri[URI_MAX];
 	Download xml;
-	Parser_Data pdata;
-
-	pdata.s = s;
-	pdata.data = NULL;
+	Eina_List *all;
 
 	if (!s->id) {
 		ERR("Passed series data is not valid.");
 		return NULL;
 	}
 
+	if (_etvdb_store_episodes_find(s, &all))
+		return all;
+
 	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/all/%s.xml", etvdb_api_key, s->id, etvdb_language);
 
-	CURL_XML_DL_MEM(xml, uri)
+	CURL_XML_DL_MEM(xml, uri) {
 		ERR("Couldn't get series data from server.");
+		free(xml.data);
+		return NULL;
+	}
 
-	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_episodes_cb, &pdata))
-		CRIT("Parsing Episode data failed. If it happens again, please report a bug.");
+	all = _etvdb_episodes_parse(s, xml.data, xml.len, fields, EINA_TRUE);
 
-	free(xml.data);
+	/* only complete records are stored, a Series without Episodes, too */
+	if (fields == ETVDB_FIELD_ALL && (all || !_etvdb_request_expired()))
+		_etvdb_store_episodes_add(s, all);
 
-	return pdata.data;
+	return all;
 }
 
 /**
@@ -197,6 +225,8 @@ EAPI Episode *etvdb_episode_by_date_get(Series *s, const char *date)
  *
  * Please note, that while the series initialization includes associating it to the episode,
  * the reverse is not true, so the returned episode data cannot be found in the series.
+ * If the registry is enabled and the Episode belongs to a loaded Series,
+ * that Episode is returned instead, it is part of its Series, see @ref Registry.
  *
  * @param id TVDB ID of a episode
  *
@@ -211,20 +241,47 @@ EAPI Episode *etvdb_episode_by_id_get(uint32_t id, Series **s)
 {
 	char uri[URI_MAX];
 	Download xml;
+	uint32_t series_id;
 	Parser_Data pdata;
 	Episode *e = NULL;
 
 	pdata.s = *s;
 	pdata.data = NULL;
+	pdata.fields = ETVDB_FIELD_ALL;
+	pdata.lazy = NULL;
+
+	e = _etvdb_registry_episode_find(id, s);
+	if (e)
+		return e;
+
+	e = _etvdb_store_episode_find(id, &series_id);
+	if (e) {
+		if (!*s || !(*s)->id)
+			*s = etvdb_series_by_id_get(series_id);
+		e->series = *s;
+		return e;
+	}
 
 	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/episodes/%"PRIu32"/%s.xml", etvdb_api_key, id, etvdb_language);
 
-	CURL_XML_DL_MEM(xml, uri)
+	CURL_XML_DL_MEM(xml, uri) {
 		ERR("Couldn't get episode data from server.");
+		free(xml.data);
+		return NULL;
+	}
 
 	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_episodes_cb, &pdata))
+	if (!_etvdb_xml_parse(xml.data, xml.len, _parse_episodes_cb, &pdata)) {
+		if (_etvdb_request_expired()) {
+			ERR("Parsing Episode data aborted, the deadline expired or the call was cancelled.");
+			free(xml.data);
+			EINA_LIST_FREE(pdata.data, e)
+				etvdb_episode_free(e);
+			*s = pdata.s;
+			return NULL;
+		}
 		CRIT("Parsing Episode data failed. If it happens again, please report a bug.");
+	}
 
 	free(xml.data);
 
@@ -235,6 +292,9 @@ EAPI Episode *etvdb_episode_by_id_get(uint32_t id, Series **s)
 
 	*s = pdata.s;
 
+	if (e && e->series)
+		_etvdb_store_episode_add(e->series->id, e);
+
 	return e;
 }
 
@@ -251,41 +311,28 @@ EAPI Episode *etvdb_episode_by_id_get(uint32_t id, Series **s)
  * @return a Episode structure on success,
  * @return NULL on failure.
  *
+ * @see etvdb_episode_by_order_get()
+ *
  * @ingroup Episodes
  */
 EAPI Episode *etvdb_episode_by_number_get(Series *s, int season, int episode)
 {
 	char uri[URI_MAX];
-	Download xml;
 	Episode *e = NULL;
-	Parser_Data pdata;
-
-	pdata.s = s;
-	pdata.data = NULL;
 
 	if (!s->id) {
 		ERR("Passed series data is not valid.");
 		return NULL;
 	}
 
+	e = _etvdb_store_episode_number_find(s, season, episode);
+	if (e)
+		return e;
+
 	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/default/%d/%d/%s.xml",
 			etvdb_api_key, s->id, season, episode, etvdb_language);
 
-	CURL_XML_DL_MEM(xml, uri)
-		ERR("Couldn't get episode data from server.");
-
-	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_episodes_cb, &pdata))
-		CRIT("Parsing Episode data failed. If it happens again, please report a bug.");
-
-	free(xml.data);
-
-	/* we assume that only a single episode is in the list
-	 * should it be more (which would be a TVDB bug), its a memleak */
-	e = eina_list_data_get(pdata.data);
-	pdata.data = eina_list_remove_list(pdata.data, pdata.data);
-
-	return e;
+	return _etvdb_episode_download(s, uri);
 }
 
 /**
@@ -293,6 +340,8 @@ EAPI Episode *etvdb_episode_by_number_get(Series *s, int season, int episode)
  *
  * This function frees a Episode structure and its data.
  * Note that a referenced parent series won't be freed.
+ * Episodes of a Series loaded by etvdb_series_load() and
+ * Episodes registered in the registry are freed together with their Series.
  *
  * @param e pointer to Episode structure
  *
@@ -300,10 +349,17 @@ EAPI Episode *etvdb_episode_by_number_get(Series *s, int season, int episode)
  */
 EAPI void etvdb_episode_free(Episode *e)
 {
+	/* Episodes loaded from a snapshot or registered are freed with their Series */
+	if (e->owner)
+		return;
+
+	/* only Episodes with pending lazy fields take the lazy lock */
+	if (__atomic_load_n(&e->lazy, __ATOMIC_ACQUIRE))
+		_etvdb_lazy_forget(e);
 	free(e->imdb_id);
-	free(e->name);
+	eina_stringshare_del(e->name);
 	free(e->overview);
-	free(e->firstaired);
+	eina_stringshare_del(e->firstaired);
 	free(e);
 }
 
@@ -387,6 +443,44 @@ END:
 	return e;
 }
 
+/**
+ * @brief Copy an Episode structure
+ *
+ * This function copies an Episode, the copy belongs to the same Series.
+ * It is useful to keep an Episode passed to a callback by etvdb_episodes_foreach().
+ *
+ * @param e pointer to Episode structure
+ *
+ * @return a new Episode structure, which has to be freed with etvdb_episode_free()
+ *
+ * @ingroup Episodes
+ */
+EAPI Episode *etvdb_episode_dup(const Episode *e)
+{
+	const char *name, *overview;
+	Episode *dup;
+
+	/* lazy fields are decoded in the original, so both keep them */
+	name = etvdb_episode_name_get((Episode *)e);
+	overview = etvdb_episode_overview_get((Episode *)e);
+
+	dup = etvdb_episode_new();
+	dup->id = e->id;
+	dup->imdb_id = e->imdb_id ? strdup(e->imdb_id) : NULL;
+	dup->name = (char *)eina_stringshare_add(name);
+	dup->overview = overview ? strdup(overview) : NULL;
+	dup->firstaired = (char *)eina_stringshare_add(e->firstaired);
+	dup->number = e->number;
+	dup->season = e->season;
+	dup->dvd_season = e->dvd_season;
+	dup->dvd_number = e->dvd_number;
+	dup->absolute_number = e->absolute_number;
+	dup->series = e->series;
+	dup->skipped = e->skipped;
+
+	return dup;
+}
+
 /**
  * @brief Initialize new Episode structure
  *
@@ -411,6 +505,12 @@ EAPI Episode *etvdb_episode_new()
 	e->series = NULL;
 	e->number = 0;
 	e->season = 0;
+	e->dvd_season = 0;
+	e->dvd_number = 0;
+	e->absolute_number = 0;
+	e->owner = 0;
+	e->skipped = 0;
+	e->lazy = 0;
 
 	return e;
 }
@@ -418,12 +518,163 @@ EAPI Episode *etvdb_episode_new()
  * @}
  */
 
+/* this parses the Episodes of a downloaded document, data is consumed.
+ * large documents are parsed on several threads, if parallel is set */
+Eina_List *_etvdb_episodes_parse(Series *s, char *data, size_t len, unsigned int fields, Eina_Bool parallel)
+{
+	Eina_List *all;
+	Episode *e;
+	Parser_Data pdata;
+	Eina_Bool parsed;
+
+	pdata.s = s;
+	pdata.data = NULL;
+	pdata.fields = fields;
+	pdata.lazy = NULL;
+
+	/* the response is kept for lazy fields, it is freed with the last one */
+	if (fields & ETVDB_FIELD_LAZY) {
+		pdata.lazy = _etvdb_lazy_buffer_new(data, len);
+		if (!pdata.lazy) {
+			free(data);
+			return NULL;
+		}
+	}
+
+	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
+	if (parallel && _etvdb_parse_threads_for(len) > 1) {
+		parsed = _etvdb_parse_parallel(data, len, "Episode", _parse_episodes_cb,
+				&pdata, &all);
+		pdata.data = all;
+	} else
+		parsed = _etvdb_xml_parse(data, len, _parse_episodes_cb, &pdata);
+
+	if (!parsed) {
+		if (_etvdb_request_expired()) {
+			ERR("Parsing Episode data aborted, the deadline expired or the call was cancelled.");
+			EINA_LIST_FREE(pdata.data, e)
+				etvdb_episode_free(e);
+			if (pdata.lazy)
+				_etvdb_lazy_buffer_unref(pdata.lazy);
+			else
+				free(data);
+			return NULL;
+		}
+		CRIT("Parsing Episode data failed. If it happens again, please report a bug.");
+	}
+
+	if (pdata.lazy)
+		_etvdb_lazy_buffer_unref(pdata.lazy);
+	else
+		free(data);
+
+	return pdata.data;
+}
+
+/* download the document of a single Episode of a Series and parse it */
+Episode *_etvdb_episode_download(Series *s, const char *uri)
+{
+	Download xml;
+	Episode *e = NULL;
+	Parser_Data pdata;
+
+	pdata.s = s;
+	pdata.data = NULL;
+	pdata.fields = ETVDB_FIELD_ALL;
+	pdata.lazy = NULL;
+
+	CURL_XML_DL_MEM(xml, uri) {
+		ERR("Couldn't get episode data from server.");
+		free(xml.data);
+		return NULL;
+	}
+
+	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
+	if (!_etvdb_xml_parse(xml.data, xml.len, _parse_episodes_cb, &pdata)) {
+		if (_etvdb_request_expired()) {
+			ERR("Parsing Episode data aborted, the deadline expired or the call was cancelled.");
+			free(xml.data);
+			EINA_LIST_FREE(pdata.data, e)
+				etvdb_episode_free(e);
+			return NULL;
+		}
+		CRIT("Parsing Episode data failed. If it happens again, please report a bug.");
+	}
+
+	free(xml.data);
+
+	/* we assume that only a single episode is in the list
+	 * should it be more (which would be a TVDB bug), its a memleak */
+	e = eina_list_data_get(pdata.data);
+	pdata.data = eina_list_remove_list(pdata.data, pdata.data);
+
+	if (e)
+		_etvdb_store_episode_add(s->id, e);
+
+	return e;
+}
+
+/* set the field of an Episode, which tag stands for, from its content.
+ * the strings are stored by text_cb, this is shared by all Episode parsers */
+void _etvdb_episode_field_set(Episode *e, Xml_Tag tag, const char *content, unsigned length,
+		Field_Text_Cb text_cb, void *data)
+{
+	char buf[length + 1];
+
+	switch (tag) {
+	case XML_TAG_ID:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu32, &e->id);
+		DBG("Found ID: %"PRIu32, e->id);
+		break;
+	case XML_TAG_EPISODE_NAME:
+		e->name = text_cb(data, e, tag, content, length, EINA_TRUE);
+		break;
+	case XML_TAG_IMDB_ID:
+		e->imdb_id = text_cb(data, e, tag, content, length, EINA_FALSE);
+		break;
+	case XML_TAG_OVERVIEW:
+		e->overview = text_cb(data, e, tag, content, length, EINA_TRUE);
+		break;
+	case XML_TAG_FIRSTAIRED:
+		e->firstaired = text_cb(data, e, tag, content, length, EINA_FALSE);
+		break;
+	case XML_TAG_EPISODE_NUMBER:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &e->number);
+		DBG("Found Episode Number: %d", e->number);
+		break;
+	case XML_TAG_SEASON_NUMBER:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &e->season);
+		DBG("Found Season Number: %d", e->season);
+		break;
+	case XML_TAG_DVD_EPISODE_NUMBER:
+		/* parts of a split episode are numbered like 1.1, they keep the 1 */
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &e->dvd_number);
+		DBG("Found DVD Episode Number: %d", e->dvd_number);
+		break;
+	case XML_TAG_DVD_SEASON:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &e->dvd_season);
+		DBG("Found DVD Season Number: %d", e->dvd_season);
+		break;
+	case XML_TAG_ABSOLUTE_NUMBER:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &e->absolute_number);
+		DBG("Found Absolute Number: %d", e->absolute_number);
+		break;
+	default:
+		break;
+	}
+}
+
 /* this callback parses the episodes of tvdb's all document and populates a Series structure */
-static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length)
+static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
 {
 	char buf[length + 1];
-	enum nname { UNKNOWN, ID, NAME, IMDB, OVERVIEW, FIRSTAIRED, NUMBER, SEASON, SERIES };
 	Episode *episode;
 	Parser_Data *pdata = data;
 	uint32_t id = 0;
@@ -432,40 +683,32 @@ static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const
 	case EINA_SIMPLE_XML_OPEN:
 		switch (pdata->xml_depth) {
 		case 0:
-			if (!TAGCMP("Data", content))
+			if (tag == XML_TAG_DATA)
 				pdata->xml_depth++;
 			break;
 		case 1:
-			if (!TAGCMP("Episode", content)) {
+			if (tag == XML_TAG_EPISODE) {
+				if (_etvdb_request_expired())
+					return EINA_FALSE;
+
 				pdata->xml_depth++;
 				episode = etvdb_episode_new();
+				episode->skipped = ~pdata->fields & ETVDB_FIELD_ALL;
 				pdata->data = eina_list_append(pdata->data, episode);
 			}
 			break;
 		case 2:
-			if (!TAGCMP("id", content))
-				pdata->xml_sibling = ID;
-			else if (!TAGCMP("EpisodeName", content))
-				pdata->xml_sibling = NAME;
-			else if (!TAGCMP("IMDB_ID", content))
-				pdata->xml_sibling = IMDB;
-			else if (!TAGCMP("Overview", content))
-				pdata->xml_sibling = OVERVIEW;
-			else if (!TAGCMP("FirstAired", content))
-				pdata->xml_sibling = FIRSTAIRED;
-			else if (!TAGCMP("EpisodeNumber", content))
-				pdata->xml_sibling = NUMBER;
-			else if (!TAGCMP("SeasonNumber", content))
-				pdata->xml_sibling = SEASON;
-			else if (!TAGCMP("seriesid", content))
-				pdata->xml_sibling = SERIES;
-			else
-				pdata->xml_sibling = UNKNOWN;
+			pdata->xml_sibling = tag;
+			if ((tag == XML_TAG_EPISODE_NAME && !(pdata->fields & ETVDB_FIELD_NAME))
+					|| (tag == XML_TAG_IMDB_ID && !(pdata->fields & ETVDB_FIELD_IMDB_ID))
+					|| (tag == XML_TAG_OVERVIEW && !(pdata->fields & ETVDB_FIELD_OVERVIEW))
+					|| (tag == XML_TAG_FIRSTAIRED && !(pdata->fields & ETVDB_FIELD_FIRSTAIRED)))
+				pdata->xml_sibling = XML_TAG_UNKNOWN;
 			break;
 		}
 		break;
 	case EINA_SIMPLE_XML_CLOSE:
-		if (!TAGCMP("Episode", content)) {
+		if (tag == XML_TAG_EPISODE) {
 			pdata->xml_count++;
 			pdata->xml_depth--;
 		}
@@ -474,55 +717,17 @@ static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const
 		if (pdata->xml_depth == 2) {
 			episode = eina_list_nth(pdata->data, pdata->xml_count);
 
-			switch (pdata->xml_sibling) {
-			case ID:
-				MEM2STR(buf, content, length);
-				sscanf(buf, "%"SCNu32, &episode->id);
-				DBG("Found ID: %"PRIu32, episode->id);
-				break;
-			case NAME:
-				episode->name = malloc(length + 1);
-				MEM2STR(buf, content, length);
-				HTML2UTF(episode->name, buf);
-				DBG("Found Name: %s", episode->name);
-				break;
-			case IMDB:
-				episode->imdb_id = malloc(length + 1);
-				MEM2STR(episode->imdb_id, content, length);
-				DBG("Found IMDB_ID: %s", episode->imdb_id);
-				break;
-			case OVERVIEW:
-				episode->overview = malloc(length + 1);
-				MEM2STR(buf, content, length);
-				HTML2UTF(episode->overview, buf);
-				DBG("Found Overview: %zu chars", strlen(episode->overview));
-				break;
-			case FIRSTAIRED:
-				episode->firstaired = malloc(length + 1);
-				MEM2STR(episode->firstaired, content, length);
-				DBG("Found First Aired Date: %s", episode->firstaired);
-				break;
-			case NUMBER:
-				MEM2STR(buf, content, length);
-				sscanf(buf, "%"SCNu16, &episode->number);
-				DBG("Found Episode Number: %d", episode->number);
-				break;
-			case SEASON:
+			if (pdata->xml_sibling != XML_TAG_SERIES_ID) {
+				_etvdb_episode_field_set(episode, pdata->xml_sibling, content, length,
+						_episode_text_cb, pdata);
+			} else if (pdata->s && pdata->s->id) {
+				DBG("Found Series ID, but using existing one.");
+				episode->series = pdata->s;
+			} else {
 				MEM2STR(buf, content, length);
-				sscanf(buf, "%"SCNu16, &episode->season);
-				DBG("Found Season Number: %d", episode->season);
-				break;
-			case SERIES:
-				if (pdata->s && pdata->s->id) {
-					DBG("Found Series ID, but using existing one.");
-					episode->series = pdata->s;
-				} else {
-					MEM2STR(buf, content, length);
-					sscanf(buf, "%"SCNu32, &id);
-					pdata->s = episode->series = etvdb_series_by_id_get(id);
-					DBG("Found Series ID: %"PRIu32, episode->series->id);
-				}
-				break;
+				sscanf(buf, "%"SCNu32, &id);
+				pdata->s = episode->series = etvdb_series_by_id_get(id);
+				DBG("Found Series ID: %"PRIu32, episode->series->id);
 			}
 		}
 		break;
@@ -532,3 +737,49 @@ static Eina_Bool _parse_episodes_cb(void *data, Eina_Simple_XML_Type type, const
 
 	return EINA_TRUE;
 }
+
+/* stores the strings of a parsed Episode, names and overviews are left to lazy decoding if enabled */
+static char *_episode_text_cb(void *data, void *record, Xml_Tag tag,
+		const char *content, unsigned length, Eina_Bool decode UNUSED)
+{
+	char buf[length + 1];
+	char *str = NULL;
+	Parser_Data *pdata = data;
+	Episode *e = record;
+
+	switch (tag) {
+	case XML_TAG_EPISODE_NAME:
+		if (pdata->lazy) {
+			_etvdb_lazy_add(pdata->lazy, e, ETVDB_FIELD_NAME, content, length);
+			break;
+		}
+		MEM2STR(buf, content, length);
+		HTML2UTF(buf, NULL);
+		str = (char *)eina_stringshare_add(buf);
+		DBG("Found Name: %s", str);
+		break;
+	case XML_TAG_IMDB_ID:
+		str = malloc(length + 1);
+		MEM2STR(str, content, length);
+		DBG("Found IMDB_ID: %s", str);
+		break;
+	case XML_TAG_OVERVIEW:
+		if (pdata->lazy) {
+			_etvdb_lazy_add(pdata->lazy, e, ETVDB_FIELD_OVERVIEW, content, length);
+			break;
+		}
+		str = malloc(length + 1);
+		MEM2STR(buf, content, length);
+		HTML2UTF(str, buf);
+		DBG("Found Overview: %zu chars", strlen(str));
+		break;
+	case XML_TAG_FIRSTAIRED:
+		str = (char *)eina_stringshare_add_length(content, length);
+		DBG("Found First Aired Date: %s", str);
+		break;
+	default:
+		break;
+	}
+
+	return str;
+}
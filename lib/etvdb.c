@@ -74,6 +74,46 @@ EAPI Eina_Bool etvdb_init(char *api_key)
 		return EINA_FALSE;
 	}
 
+	if (!_etvdb_request_init()) {
+		CRIT("Request infrastructure couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_pool_init()) {
+		CRIT("Worker pool couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_compress_init()) {
+		CRIT("Compression couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_lazy_init()) {
+		CRIT("Lazy fields couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_store_init()) {
+		CRIT("Store couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_search_init()) {
+		CRIT("Search index couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_registry_init()) {
+		CRIT("Registry couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
+	if (!_etvdb_client_init()) {
+		CRIT("Daemon client couldn't be initialized.");
+		return EINA_FALSE;
+	}
+
 #ifdef DEBUG
 	curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, 1);
 	eina_log_domain_level_set("etvdb", EINA_LOG_LEVEL_DBG);
@@ -98,6 +138,15 @@ EAPI Eina_Bool etvdb_init(char *api_key)
  */
 EAPI Eina_Bool etvdb_shutdown(void)
 {
+	_etvdb_client_shutdown();
+	_etvdb_store_shutdown();
+	_etvdb_registry_shutdown();
+	_etvdb_search_shutdown();
+	_etvdb_lazy_shutdown();
+	_etvdb_compress_shutdown();
+	/* the workers free their transfer contexts, when they exit */
+	_etvdb_pool_shutdown();
+	_etvdb_request_shutdown();
 	curl_easy_cleanup(curl_handle);
 	curl_global_cleanup();
 	eina_log_domain_unregister(_etvdb_log_dom);
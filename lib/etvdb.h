@@ -39,8 +39,29 @@
  *  To get started, check out the following sections:
  *  @li @ref Setup
  *  @li @ref Infrastructure
+ *  @li @ref Requests
  *  @li @ref Episodes
  *  @li @ref Series
+ *  @li @ref Watchlist
+ *  @li @ref Snapshots
+ *  @li @ref Store
+ *  @li @ref Search
+ *  @li @ref Streaming
+ *  @li @ref Lazy
+ *  @li @ref Compact
+ *  @li @ref Compression
+ *  @li @ref Parsing
+ *  @li @ref Bulk
+ *  @li @ref Shared
+ *  @li @ref Client
+ *  @li @ref Daemon
+ *  @li @ref Translations
+ *  @li @ref Refresh
+ *  @li @ref Versions
+ *  @li @ref Registry
+ *  @li @ref Orders
+ *  @li @ref Banners
+ *  @li @ref Export
  */
 
 #include <stdlib.h>
@@ -96,24 +117,250 @@ typedef struct _etvdb_series {
 	uint16_t runtime; /**< Typical Episode Runtime */
 	Eina_List *seasons; /**< List containing 1 list per season */
 	Eina_List *specials; /**< List containing special episodes */
+	struct _etvdb_series_priv *priv; /**< Library internal data, never touch it */
 } Series;
 
 /**
  * this structure represents a TVDB Episode
  *
  * it is roughly comparable to TVDB's Base Series Record.
+ * name and firstaired are eina_stringshares, etvdb_episode_free() releases them
+ * with eina_stringshare_del(), so they have to be set with eina_stringshare_add().
  */
 typedef struct _etvdb_episode {
 	uint32_t id; /**< TVDB ID */
 	char *imdb_id; /**< IMDB Episode ID */
-	char *name; /**< Episode Name */
+	char *name; /**< Episode Name, an eina_stringshare */
 	char *overview; /**< Episode Description */
-	char *firstaired; /**< Episode aired first at this date */
+	char *firstaired; /**< Episode aired first at this date, an eina_stringshare */
 	uint16_t number; /**< Episode Number in Season */
 	uint16_t season; /**< Season Number in Series */
+	uint16_t dvd_season; /**< Season Number on DVD */
+	uint16_t dvd_number; /**< Episode Number in DVD Season, 0 if unknown */
+	uint16_t absolute_number; /**< Episode Number counted over all Seasons, 0 if unknown */
 	Series *series; /**< parent Series structure */
+	uint8_t owner; /**< Library internal, set if the Episode is freed with its Series, never touch it */
+	uint8_t skipped; /**< Etvdb_Field mask of the fields, which were left out while parsing */
+	uint8_t lazy; /**< Library internal, set while fields wait to be decoded, never touch it */
 } Episode;
 
+/**
+ * this structure represents an Episode in a compact form
+ *
+ * strings are offsets into the string blob of their Etvdb_Compact,
+ * 0 means there is no such string.
+ * @see etvdb_compact_string_get()
+ */
+typedef struct _etvdb_episode_compact {
+	uint32_t id; /**< TVDB ID */
+	uint32_t aired; /**< Packed first aired date, 0 if unknown */
+	uint16_t season; /**< Season Number in Series */
+	uint16_t number; /**< Episode Number in Season */
+	uint32_t imdb_id; /**< Offset of the IMDB Episode ID */
+	uint32_t name; /**< Offset of the Episode Name */
+	uint32_t overview; /**< Offset of the Episode Description */
+} Etvdb_Episode_Compact;
+
+/**
+ * this structure holds the compact Episodes of one Series
+ *
+ * it is opaque.
+ * @see etvdb_compact_new()
+ */
+typedef struct _etvdb_compact Etvdb_Compact;
+
+/**
+ * this structure represents a catalogue of Series in shared memory
+ *
+ * it is opaque.
+ * @see etvdb_catalogue_create()
+ * @see etvdb_catalogue_open()
+ */
+typedef struct _etvdb_catalogue Etvdb_Catalogue;
+
+/**
+ * fields of Series and Episode records, which can be requested
+ *
+ * IDs, numbers and the runtime are always parsed.
+ * @see etvdb_episodes_fields_get()
+ */
+typedef enum _etvdb_field {
+	ETVDB_FIELD_NAME = 1 << 0, /**< name of a Series or Episode */
+	ETVDB_FIELD_OVERVIEW = 1 << 1, /**< overview of a Series or Episode */
+	ETVDB_FIELD_IMDB_ID = 1 << 2, /**< IMDB ID of a Series or Episode */
+	ETVDB_FIELD_FIRSTAIRED = 1 << 3, /**< first aired date of an Episode */
+	ETVDB_FIELD_ALL = 0xF, /**< all fields */
+	ETVDB_FIELD_LAZY = 1 << 4 /**< decode the name and overview of Episodes on first access */
+} Etvdb_Field;
+
+/**
+ * orderings of the Episodes of a Series
+ *
+ * @see etvdb_episode_from_series_order_get()
+ */
+typedef enum _etvdb_order {
+	ETVDB_ORDER_DEFAULT, /**< aired order, by season and episode number */
+	ETVDB_ORDER_DVD, /**< DVD order, by DVD season and episode number */
+	ETVDB_ORDER_ABSOLUTE /**< absolute order, by episode number over all seasons */
+} Etvdb_Order;
+
+/**
+ * callback called for every Episode by etvdb_episodes_foreach()
+ *
+ * return EINA_FALSE to stop the stream.
+ */
+typedef Eina_Bool (*Etvdb_Episode_Cb)(void *data, const Episode *e);
+
+/**
+ * callback called for every Series by etvdb_series_find_foreach()
+ *
+ * return EINA_FALSE to stop the stream.
+ */
+typedef Eina_Bool (*Etvdb_Series_Cb)(void *data, const Series *s);
+
+/**
+ * this structure holds the settings of a bulk download
+ *
+ * members, which are 0, use their default.
+ * @see etvdb_series_bulk_get()
+ */
+typedef struct _etvdb_bulk {
+	unsigned int threads; /**< Documents parsed at the same time on the shared workers, one per CPU by default */
+	unsigned int connections; /**< Downloads at the same time, 8 by default */
+	unsigned int inflight; /**< Documents downloading or waiting to be parsed, 2 per thread by default */
+	unsigned int fields; /**< Etvdb_Field mask, ETVDB_FIELD_ALL by default */
+} Etvdb_Bulk;
+
+/**
+ * callback called for every Series by etvdb_series_bulk_get()
+ *
+ * s belongs to the callback, it is NULL if the Series couldn't be downloaded.
+ */
+typedef void (*Etvdb_Bulk_Cb)(void *data, uint32_t id, Series *s);
+
+/**
+ * this structure represents a cancellation token
+ *
+ * it is opaque and can be triggered from any thread
+ * to abort the calls it is attached to.
+ * @see etvdb_cancel_new()
+ */
+typedef struct _etvdb_cancel Etvdb_Cancel;
+
+/**
+ * this structure holds the settings of the resilience layer
+ *
+ * @see etvdb_resilience_set()
+ */
+typedef struct _etvdb_resilience {
+	unsigned int retries; /**< Retries after a failed request */
+	double backoff_base; /**< Delay before the first retry in seconds */
+	double backoff_max; /**< Maximum delay between retries in seconds */
+	double hedge_percentile; /**< Latency percentile (0-100) after which a hedged request is sent, 0 disables hedging */
+	double hedge_delay_min; /**< Minimum delay before a hedged request is sent in seconds */
+	unsigned int breaker_threshold; /**< Failed calls in a row which open the circuit breaker, 0 disables it */
+	double breaker_cooldown; /**< Time the circuit breaker stays open in seconds */
+} Etvdb_Resilience;
+
+/**
+ * this structure represents a watchlist
+ *
+ * it is opaque and holds a merged timeline of many Series.
+ * @see etvdb_watchlist_new()
+ */
+typedef struct _etvdb_watchlist Etvdb_Watchlist;
+
+/**
+ * this structure represents a refresh scheduler
+ *
+ * it is opaque and refreshes Series in the background.
+ * @see etvdb_refresh_new()
+ */
+typedef struct _etvdb_refresh Etvdb_Refresh;
+
+/**
+ * callback called for every Series refreshed by a refresh scheduler
+ *
+ * fresh replaces old, the callback swaps it in and frees old.
+ * @see etvdb_refresh_new()
+ */
+typedef void (*Etvdb_Refresh_Cb)(void *data, Series *old, Series *fresh);
+
+/**
+ * this structure represents a Series, which is replaced by new versions
+ *
+ * it is opaque and can be read by many threads while it is refreshed.
+ * @see etvdb_versioned_new()
+ */
+typedef struct _etvdb_versioned Etvdb_Versioned;
+
+/**
+ * this structure represents a TVDB Banner, an image of a Series
+ *
+ * it is roughly comparable to a record of TVDB's banners.xml.
+ */
+typedef struct _etvdb_banner {
+	uint32_t id; /**< TVDB ID */
+	uint32_t series_id; /**< TVDB ID of the Series */
+	char *path; /**< Path of the image on the banner server */
+	char *thumbnail; /**< Path of a smaller image, NULL if there is none */
+	char *type; /**< Banner Type, e.g. "poster", "fanart", "series" or "season" */
+	char *type2; /**< Resolution or style, e.g. "680x1000" or "graphical" */
+	char lang[3]; /**< Language code, empty if unknown */
+	uint16_t season; /**< Season Number of season banners */
+	double rating; /**< Average rating, 0 if unrated */
+	uint32_t rating_count; /**< Number of ratings */
+} Etvdb_Banner;
+
+/**
+ * this structure holds the settings of an artwork download
+ *
+ * members, which are 0, use their default.
+ * @see etvdb_banners_download()
+ */
+typedef struct _etvdb_artwork {
+	unsigned int connections; /**< Downloads at the same time, 4 by default */
+	Eina_Bool thumbnails; /**< download the thumbnails instead of the images */
+} Etvdb_Artwork;
+
+/**
+ * states of an image passed to an Etvdb_Artwork_Cb
+ */
+typedef enum _etvdb_artwork_state {
+	ETVDB_ARTWORK_RUNNING, /**< the image is being downloaded */
+	ETVDB_ARTWORK_DONE, /**< the image was written to its file */
+	ETVDB_ARTWORK_SKIPPED, /**< the file is up to date already */
+	ETVDB_ARTWORK_FAILED /**< the image couldn't be downloaded or written */
+} Etvdb_Artwork_State;
+
+/**
+ * callback called for the images of etvdb_banners_download()
+ *
+ * it is called repeatedly with ETVDB_ARTWORK_RUNNING while an image
+ * is received, and once with the final state.
+ * now and total are in bytes, total is 0 if the size isn't known yet.
+ */
+typedef void (*Etvdb_Artwork_Cb)(void *data, const Etvdb_Banner *b, const char *path,
+		Etvdb_Artwork_State state, size_t now, size_t total);
+
+/**
+ * formats of an exporter
+ *
+ * @see etvdb_export_new()
+ */
+typedef enum _etvdb_export_format {
+	ETVDB_EXPORT_NDJSON, /**< one JSON object per line */
+	ETVDB_EXPORT_CSV /**< comma separated values with a header row, RFC 4180 */
+} Etvdb_Export_Format;
+
+/**
+ * this structure represents an exporter
+ *
+ * it is opaque and writes Episode records to a file.
+ * @see etvdb_export_new()
+ */
+typedef struct _etvdb_export Etvdb_Export;
+
 /**
  * @file
  * @brief This is the public etvdb API.
@@ -125,23 +372,145 @@ EAPI Eina_Hash     *etvdb_languages_get(const char *lang_file_path);
 EAPI Eina_Bool      etvdb_language_set(Eina_Hash *hash, char *lang);
 EAPI time_t         etvdb_server_time_get(void);
 
+EAPI double         etvdb_time_get(void);
+EAPI void           etvdb_deadline_set(double deadline);
+EAPI double         etvdb_deadline_get(void);
+EAPI Etvdb_Cancel  *etvdb_cancel_new(void);
+EAPI void           etvdb_cancel_free(Etvdb_Cancel *c);
+EAPI void           etvdb_cancel_set(Etvdb_Cancel *c);
+EAPI void           etvdb_cancel_trigger(Etvdb_Cancel *c);
+EAPI void           etvdb_cancel_reset(Etvdb_Cancel *c);
+EAPI Eina_Bool      etvdb_cancel_triggered_get(Etvdb_Cancel *c);
+EAPI void           etvdb_resilience_set(const Etvdb_Resilience *r);
+EAPI Eina_Bool      etvdb_resilience_get(Etvdb_Resilience *r);
+
+EAPI void           etvdb_parse_threads_set(unsigned int threads);
+EAPI unsigned int   etvdb_parse_threads_get(void);
+EAPI Eina_Bool      etvdb_series_bulk_get(const uint32_t *ids, unsigned int count,
+		const Etvdb_Bulk *opts, Etvdb_Bulk_Cb cb, const void *data);
+
 EAPI Series        *etvdb_series_by_id_get(uint32_t id);
+EAPI Series        *etvdb_series_by_id_fields_get(uint32_t id, unsigned int fields);
+EAPI Series        *etvdb_series_dup(const Series *s);
 EAPI int            etvdb_series_episodes_count(Series *s, int season);
 EAPI Eina_List     *etvdb_series_find(const char *name);
+EAPI Eina_Bool      etvdb_series_find_foreach(const char *name, Etvdb_Series_Cb cb, const void *data);
 EAPI void           etvdb_series_free(Series *s);
 EAPI Series        *etvdb_series_from_list_get(Eina_List *list, int number);
+EAPI Eina_Bool      etvdb_series_list_upgrade(Eina_List *list, unsigned int count);
 EAPI Series        *etvdb_series_new();
+EAPI const char    *etvdb_series_overview_get(const Series *s);
+EAPI Eina_Bool      etvdb_series_overviews_compress(Series *s);
+EAPI Eina_Bool      etvdb_overviews_dictionary_set(const void *dict, size_t len, int level);
 EAPI Eina_Bool      etvdb_series_populate(Series *s);
+EAPI Eina_Bool      etvdb_series_populate_fields(Series *s, unsigned int fields);
+EAPI Eina_Bool      etvdb_series_fields_fill(Series *s, unsigned int fields);
+EAPI Eina_Bool      etvdb_series_save(Series *s, const char *path);
+EAPI Series        *etvdb_series_load(const char *path);
+EAPI Series        *etvdb_series_translations_get(uint32_t id, const char **langs, unsigned int count);
+EAPI const char    *etvdb_series_name_translation_get(const Series *s, const char *lang);
+EAPI const char    *etvdb_series_overview_translation_get(const Series *s, const char *lang);
+EAPI const char    *etvdb_episode_name_translation_get(const Episode *e, const char *lang);
+EAPI const char    *etvdb_episode_overview_translation_get(const Episode *e, const char *lang);
+
+EAPI Eina_Bool      etvdb_store_open(const char *path);
+EAPI void           etvdb_store_close(void);
+EAPI void           etvdb_store_max_age_set(time_t seconds);
+EAPI Eina_Bool      etvdb_store_series_put(Series *s);
+EAPI Series        *etvdb_store_series_get(uint32_t id);
+EAPI Series        *etvdb_store_series_by_imdb_get(const char *imdb_id);
+EAPI Eina_List     *etvdb_store_episodes_aired_get(Series *s, const char *from, const char *to);
+
+EAPI void           etvdb_search_index_add(Series *s);
+EAPI void           etvdb_search_index_clear(void);
+EAPI Eina_List     *etvdb_search_local(const char *query, unsigned int max);
+EAPI Eina_List     *etvdb_series_search(const char *query, unsigned int max);
 
 EAPI Eina_List     *etvdb_episodes_get(Series *s);
+EAPI Eina_List     *etvdb_episodes_fields_get(Series *s, unsigned int fields);
+EAPI Eina_Bool      etvdb_episodes_foreach(uint32_t series_id, Etvdb_Episode_Cb cb, const void *data);
 EAPI Episode       *etvdb_episode_airs_next_get(Series *s, char *timestr);
 EAPI Episode       *etvdb_episode_by_date_get(Series *s, const char *date);
 EAPI Episode       *etvdb_episode_by_id_get(uint32_t id, Series **s);
 EAPI Episode       *etvdb_episode_by_number_get(Series *s, int season, int episode);
+EAPI Episode       *etvdb_episode_dup(const Episode *e);
+EAPI const char    *etvdb_episode_name_get(Episode *e);
+EAPI const char    *etvdb_episode_overview_get(Episode *e);
 EAPI void           etvdb_episode_free(Episode *e);
 EAPI Episode       *etvdb_episode_from_series_get(Series *s, int season, int episode);
 EAPI Episode       *etvdb_episode_latest_aired_get(Series *s, char *timestr);
 EAPI Episode       *etvdb_episode_new();
+
+EAPI Etvdb_Compact  *etvdb_compact_new(Series *s);
+EAPI void           etvdb_compact_free(Etvdb_Compact *c);
+EAPI const Etvdb_Episode_Compact *etvdb_compact_episodes_get(const Etvdb_Compact *c, unsigned int *count);
+EAPI const char    *etvdb_compact_string_get(const Etvdb_Compact *c, uint32_t offset);
+EAPI const Etvdb_Episode_Compact *etvdb_compact_by_date_get(const Etvdb_Compact *c, uint32_t date);
+EAPI const Etvdb_Episode_Compact *etvdb_compact_airs_next_get(const Etvdb_Compact *c, uint32_t date);
+EAPI uint32_t       etvdb_date_pack(const char *date);
+EAPI char          *etvdb_date_unpack(uint32_t date, char *buf);
+
+EAPI Eina_Bool      etvdb_client_connect(const char *path);
+EAPI void           etvdb_client_disconnect(void);
+EAPI Eina_Bool      etvdb_client_connected_get(void);
+EAPI void           etvdb_daemon_cache_ttl_set(double seconds);
+EAPI Eina_Bool      etvdb_daemon_run(const char *path);
+EAPI void           etvdb_daemon_stop(void);
+
+EAPI Etvdb_Catalogue *etvdb_catalogue_create(const char *name);
+EAPI Etvdb_Catalogue *etvdb_catalogue_open(const char *name);
+EAPI void           etvdb_catalogue_close(Etvdb_Catalogue *c);
+EAPI Eina_Bool      etvdb_catalogue_unlink(const char *name);
+EAPI Eina_Bool      etvdb_catalogue_series_add(Etvdb_Catalogue *c, Series *s);
+EAPI Eina_Bool      etvdb_catalogue_publish(Etvdb_Catalogue *c);
+EAPI Series        *etvdb_catalogue_series_get(Etvdb_Catalogue *c, uint32_t id);
+EAPI uint64_t       etvdb_catalogue_generation_get(const Etvdb_Catalogue *c);
+
+EAPI Etvdb_Watchlist *etvdb_watchlist_new(void);
+EAPI void           etvdb_watchlist_free(Etvdb_Watchlist *w);
+EAPI Eina_Bool      etvdb_watchlist_series_add(Etvdb_Watchlist *w, Series *s);
+EAPI Eina_Bool      etvdb_watchlist_series_del(Etvdb_Watchlist *w, Series *s);
+EAPI Eina_Bool      etvdb_watchlist_series_update(Etvdb_Watchlist *w, Series *s);
+EAPI Eina_List     *etvdb_watchlist_airs_next_get(Etvdb_Watchlist *w, const char *date, unsigned int n);
+EAPI Eina_List     *etvdb_watchlist_aired_between_get(Etvdb_Watchlist *w, const char *from, const char *to);
+EAPI Episode       *etvdb_watchlist_series_next_get(Etvdb_Watchlist *w, Series *s, const char *date);
+EAPI Episode       *etvdb_watchlist_series_latest_get(Etvdb_Watchlist *w, Series *s, const char *date);
+EAPI Eina_List     *etvdb_watchlist_next_per_series_get(Etvdb_Watchlist *w, const char *date);
+
+EAPI Etvdb_Refresh *etvdb_refresh_new(double rate, Etvdb_Refresh_Cb cb, const void *data);
+EAPI void           etvdb_refresh_free(Etvdb_Refresh *r);
+EAPI void           etvdb_refresh_intervals_set(Etvdb_Refresh *r, double airing, double ended);
+EAPI Eina_Bool      etvdb_refresh_series_add(Etvdb_Refresh *r, Series *s);
+EAPI Eina_Bool      etvdb_refresh_series_del(Etvdb_Refresh *r, Series *s);
+
+EAPI Etvdb_Versioned *etvdb_versioned_new(Series *s);
+EAPI void           etvdb_versioned_free(Etvdb_Versioned *v);
+EAPI Series        *etvdb_versioned_acquire(Etvdb_Versioned *v);
+EAPI void           etvdb_versioned_release(Series *s);
+EAPI Eina_Bool      etvdb_versioned_publish(Etvdb_Versioned *v, Series *s);
+EAPI Eina_Bool      etvdb_versioned_refresh(Etvdb_Versioned *v);
+EAPI uint64_t       etvdb_versioned_version_get(const Etvdb_Versioned *v);
+
+EAPI void           etvdb_registry_set(Eina_Bool enable);
+EAPI Series        *etvdb_registry_series_get(uint32_t id);
+EAPI Series        *etvdb_registry_series_by_imdb_get(const char *imdb_id);
+EAPI Episode       *etvdb_registry_episode_get(uint32_t id);
+EAPI Episode       *etvdb_registry_episode_by_imdb_get(const char *imdb_id);
+
+EAPI Episode       *etvdb_episode_from_series_order_get(Series *s, Etvdb_Order order, int season, int episode);
+EAPI Episode       *etvdb_episode_by_order_get(Series *s, Etvdb_Order order, int season, int episode);
+
+EAPI Eina_List     *etvdb_banners_get(Series *s);
+EAPI void           etvdb_banner_free(Etvdb_Banner *b);
+EAPI Eina_Bool      etvdb_banners_download(Eina_List *banners, const char *dir,
+		const Etvdb_Artwork *opts, Etvdb_Artwork_Cb cb, const void *data);
+
+EAPI Etvdb_Export  *etvdb_export_new(int fd, Etvdb_Export_Format format);
+EAPI Eina_Bool      etvdb_export_free(Etvdb_Export *x);
+EAPI Eina_Bool      etvdb_export_flush(Etvdb_Export *x);
+EAPI Eina_Bool      etvdb_export_series(Etvdb_Export *x, const Series *s);
+EAPI Eina_Bool      etvdb_export_series_list(Etvdb_Export *x, const Eina_List *list);
+EAPI void           etvdb_export_bulk_cb(void *data, uint32_t id, Series *s);
 /**
  * @}
  */
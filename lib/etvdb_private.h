@@ -17,7 +17,7 @@
 #define WARN(...) EINA_LOG_DOM_WARN(_etvdb_log_dom, __VA_ARGS__)
 #define DBG(...)  EINA_LOG_DOM_DBG(_etvdb_log_dom, __VA_ARGS__)
 
-#define HTML2UTF(x, y) decode_html_entities_utf8(x, y)
+#define HTML2UTF(x, y) _etvdb_xml_decode(x, y)
 
 /* this copies a non-nul-terminated buffer and terminates It
  * len is the size of src, dst has to be len+1 */
@@ -25,26 +25,28 @@
 	memcpy(dst, src, slen); \
 	dst[slen] = '\0';
 
-/* convenience macro to compare a tag to unterminated input.
- * it is meant to be used with eina simple_xml only. */
-#define TAGCMP(s1, s2) \
-	memcmp(s1">", s2, strlen(s1">"))
-
 /* convenience macro to download a xml to memory
  * use very carefully! dl.data has to bee free()d!
- * the block following will be executed when the download fails. */
+ * the block following will be executed when the download fails,
+ * hits the deadline or is cancelled. */
 #define CURL_XML_DL_MEM(dl, uri) \
-	dl.data = malloc(1); \
-	dl.len = 0; \
-	curl_easy_setopt(curl_handle, CURLOPT_URL, uri); \
-	curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 60); \
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, _dl_to_mem_cb); \
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&dl); \
-	if (curl_easy_perform(curl_handle))
+	if (_etvdb_dl_mem(&dl, uri))
+
+
+/* packs a date into 32 bit: 23 bit year, 4 bit month, 5 bit day */
+#define DATE_PACK(y, m, d) \
+	(((uint32_t)(y) << 9) | ((uint32_t)(m) << 5) | (uint32_t)(d))
 
+/* bits of Episode::owner */
+#define EPISODE_OWNER_SNAPSHOT (1 << 0) /* part of the Episode block of a snapshot Series */
+#define EPISODE_OWNER_REGISTRY (1 << 1) /* registered, it belongs to its Series */
+
+/* number of Etvdb_Order values */
+#define ETVDB_ORDER_COUNT (ETVDB_ORDER_ABSOLUTE + 1)
 
 #define ETVDB_API_KEY "A34C5A0CAF0F3EFD"
 #define TVDB_API_URI "http://thetvdb.com/api"
+#define TVDB_BANNER_URI "http://thetvdb.com/banners"
 
 #ifndef DATA_LANG_FILE_XML
   #define DATA_LANG_FILE_XML "../data/languages.xml"
@@ -65,15 +67,285 @@ typedef struct _download {
 	char *data; /**< Download Data */
 } Download;
 
+/** Structure representing a download, which is parsed record by record */
+typedef struct _download_stream Download_Stream;
+struct _download_stream {
+	Download buf; /**< Received data, which is not passed on yet */
+	const char *tag; /**< Tag of the records, e.g. "Episode" */
+	Eina_Bool (*record_cb)(Download_Stream *st, const char *rec, size_t len); /**< Called for every complete record, returns EINA_FALSE to stop */
+	void *data; /**< Data of the record callback */
+	unsigned int records; /**< Number of records passed on */
+	Eina_Bool stopped; /**< The record callback stopped the stream */
+	Eina_Bool aborted; /**< The record callback failed, set it before returning EINA_FALSE */
+};
+
+/** Structure representing many downloads, which run at the same time */
+typedef struct _download_batch Download_Batch;
+struct _download_batch {
+	unsigned int count; /**< Number of downloads */
+	unsigned int connections; /**< Maximum number of transfers at the same time */
+	void (*uri_cb)(Download_Batch *b, unsigned int i, char *uri); /**< Writes the uri of download i, URI_MAX bytes */
+	Eina_Bool (*admit_cb)(Download_Batch *b); /**< Called before a transfer is started, returns EINA_FALSE to wait, NULL to never wait */
+	void (*done_cb)(Download_Batch *b, unsigned int i, CURLcode res, Download *dl); /**< Called for every finished download, takes over dl->data */
+	void (*setup_cb)(Download_Batch *b, unsigned int i, CURL *easy); /**< Sets further options before download i is started, can be NULL */
+	size_t (*write_cb)(Download_Batch *b, unsigned int i, const char *ptr, size_t len); /**< Takes the data of download i as it arrives, returns len to go on, NULL to collect it in dl */
+	Eina_Bool (*skipped_cb)(Download_Batch *b, unsigned int i); /**< Tells if download i was stopped on purpose, after the server answered, can be NULL */
+	void (*progress_cb)(Download_Batch *b, unsigned int i, size_t now, size_t total); /**< Called while download i is running, can be NULL */
+	void *data; /**< Data of the callbacks */
+	void *multi; /**< Multi handle while the batch runs, to wake it up */
+};
+
+/** A pool of worker threads, which steal tasks from each other */
+typedef struct _pool Pool;
+
+/** A task run by a worker thread */
+typedef void (*Pool_Task_Cb)(void *data);
+
+/** Tasks of one call on the shared pool, which are waited for together */
+typedef struct _pool_group {
+	Eina_Lock lock; /**< protects pending */
+	Eina_Condition cond; /**< signalled when pending drops to 0 */
+	unsigned int pending; /**< tasks queued or running */
+} Pool_Group;
+
+/* daemon protocol version, clients and daemon have to agree on it */
+#define DAEMON_PROTO_VERSION 2
+
+/* maximum payload of a daemon message */
+#define DAEMON_FRAME_MAX (256 * 1024 * 1024)
+
+/** Requests of the daemon protocol */
+typedef enum _daemon_op {
+	DAEMON_OP_HELLO, /**< Payload: protocol version (uint32_t) */
+	DAEMON_OP_SERIES_GET, /**< Payload: Daemon_Series_Req, answer: snapshot image */
+	DAEMON_OP_SERIES_POPULATE, /**< Payload: Daemon_Series_Req, answer: snapshot image with Episodes */
+	DAEMON_OP_SERIES_FIND /**< Payload: Daemon_Find_Req, answer: count, then length and snapshot image per Series */
+} Daemon_Op;
+
+/** Status of a daemon answer */
+typedef enum _daemon_status {
+	DAEMON_OK, /**< The answer follows */
+	DAEMON_NOT_FOUND, /**< The data couldn't be fetched */
+	DAEMON_UNSUPPORTED, /**< Another protocol version or language */
+	DAEMON_INVALID /**< Malformed request */
+} Daemon_Status;
+
+/** Header of every daemon message, followed by len bytes of payload */
+typedef struct _daemon_frame {
+	uint32_t len; /**< Length of the payload */
+	uint16_t op; /**< Daemon_Op of the request */
+	uint16_t status; /**< Daemon_Status of an answer */
+} Daemon_Frame;
+
+/** Request for a Series */
+typedef struct _daemon_series_req {
+	char lang[4]; /**< Language code, nul padded */
+	uint32_t id; /**< TVDB ID */
+} Daemon_Series_Req;
+
+/** Request to find Series */
+typedef struct _daemon_find_req {
+	char lang[4]; /**< Language code, nul padded */
+	char name[]; /**< Name to search for, up to the end of the payload */
+} Daemon_Find_Req;
+
+/** A mapped generation of a shared catalogue */
+typedef struct _shared_map Shared_Map;
+
+/** Compressed overviews of a Series */
+typedef struct _etvdb_overviews Overviews;
+
+/** Texts of a Series in another language */
+typedef struct _translation Translation;
+
+/** Library internal data of a Series */
+typedef struct _etvdb_series_priv {
+	Eina_File *file; /**< Snapshot file the Series was loaded from */
+	void *map; /**< Snapshot image the strings point into, a mapping of file if it is set */
+	Episode *episodes; /**< Episodes allocated as one block */
+	unsigned int episodes_count; /**< Number of Episodes in the block */
+	Overviews *overviews; /**< Compressed overviews */
+	Shared_Map *shared; /**< Catalogue generation the strings point into */
+	char *image; /**< Snapshot image received from the daemon, the strings point into it */
+	Eina_List *translations; /**< Translation texts of other languages */
+	int refs; /**< References to a version of a versioned Series */
+	int loads; /**< References handed out by the registry, 0 if the Series isn't registered */
+	Eina_Hash *orders[ETVDB_ORDER_COUNT]; /**< Episodes by their number, per Etvdb_Order */
+	unsigned int skipped; /**< Etvdb_Field mask of the fields, which were left out while parsing */
+	Eina_Bool populated; /**< All Episodes were added, there may be none */
+} Series_Priv;
+
+/** A response retained for lazily decoded fields */
+typedef struct _lazy_buffer Lazy_Buffer;
+
+/** Tags of TVDB documents, the XML tokenizer maps tag names to them once */
+typedef enum _xml_tag {
+	XML_TAG_UNKNOWN, /**< any other tag, also passed with data */
+	XML_TAG_DATA, /**< Data */
+	XML_TAG_ITEMS, /**< Items */
+	XML_TAG_TIME, /**< Time */
+	XML_TAG_LANGUAGES, /**< Languages */
+	XML_TAG_LANGUAGE, /**< Language */
+	XML_TAG_NAME, /**< name */
+	XML_TAG_ABBREVIATION, /**< abbreviation */
+	XML_TAG_EPISODE, /**< Episode */
+	XML_TAG_SERIES, /**< Series */
+	XML_TAG_BANNER, /**< Banner */
+	XML_TAG_ID, /**< id */
+	XML_TAG_EPISODE_NAME, /**< EpisodeName */
+	XML_TAG_SERIES_NAME, /**< SeriesName */
+	XML_TAG_IMDB_ID, /**< IMDB_ID */
+	XML_TAG_OVERVIEW, /**< Overview */
+	XML_TAG_FIRSTAIRED, /**< FirstAired */
+	XML_TAG_EPISODE_NUMBER, /**< EpisodeNumber */
+	XML_TAG_SEASON_NUMBER, /**< SeasonNumber */
+	XML_TAG_DVD_EPISODE_NUMBER, /**< DVD_episodenumber */
+	XML_TAG_DVD_SEASON, /**< DVD_season */
+	XML_TAG_ABSOLUTE_NUMBER, /**< absolute_number */
+	XML_TAG_SERIES_ID, /**< seriesid */
+	XML_TAG_ZAP2IT_ID, /**< zap2it_id */
+	XML_TAG_RUNTIME, /**< Runtime */
+	XML_TAG_BANNER_PATH, /**< BannerPath */
+	XML_TAG_THUMBNAIL_PATH, /**< ThumbnailPath */
+	XML_TAG_BANNER_TYPE, /**< BannerType */
+	XML_TAG_BANNER_TYPE2, /**< BannerType2 */
+	XML_TAG_SEASON, /**< Season */
+	XML_TAG_RATING, /**< Rating */
+	XML_TAG_RATING_COUNT, /**< RatingCount */
+	XML_TAG_COUNT /**< number of tags */
+} Xml_Tag;
+
+/** Parser callback, like Eina_Simple_XML_Cb with the Xml_Tag of opening and closing tags */
+typedef Eina_Bool (*Xml_Cb)(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+
+/** Stores a text field of a record while it is parsed, returns the string to keep in the record.
+ * decode is set for fields with html entities */
+typedef char *(*Field_Text_Cb)(void *data, void *record, Xml_Tag tag,
+		const char *content, unsigned length, Eina_Bool decode);
+
 /** Structure to be passed to the parser */
 typedef struct _pdata {
 	int xml_count; /**< XML element count */
 	int xml_depth; /**< XML nesting depth */
-	int xml_sibling; /**< XML siblings */
+	Xml_Tag xml_sibling; /**< XML_TAG of the current field */
 	void *data; /**< Pointer passed to parser */
 	Series *s; /**< A series structure */
+	char *zap2it_id; /**< zap2it ID of the current series, only for the search index */
+	unsigned int fields; /**< Etvdb_Field mask of the fields to parse */
+	Lazy_Buffer *lazy; /**< Response buffer, if text fields are decoded lazily */
 } Parser_Data;
 
+/** A string blob under construction, every string is stored once */
+typedef struct _string_table {
+	Eina_Binbuf *buf; /**< the strings, offset 0 is an empty string standing for NULL */
+	Eina_Hash *offsets; /**< string -> offset + 1 */
+} String_Table;
+
 size_t _dl_to_mem_cb(char *ptr, size_t size, size_t nmemb, void *userdata);
+uint32_t _etvdb_date_pack(const char *date);
+uint32_t _etvdb_date_today(void);
+Eina_Bool _etvdb_string_table_init(String_Table *t);
+uint32_t  _etvdb_string_table_add(String_Table *t, const char *str);
+void      _etvdb_string_table_free(String_Table *t);
+
+Series_Priv *_etvdb_series_priv_get(Series *s);
+void      _etvdb_series_priv_free(Series *s);
+Episode  *_etvdb_episode_download(Series *s, const char *uri);
+Series   *_etvdb_series_parse(const char *data, size_t len, unsigned int fields);
+Series   *_etvdb_series_all_get(uint32_t id);
+Eina_List *_etvdb_episodes_parse(Series *s, char *data, size_t len, unsigned int fields, Eina_Bool parallel);
+void      _etvdb_series_find_uri_get(const char *name, char *uri);
+Eina_Bool _etvdb_series_episodes_bucket(Series *s, Eina_List *all);
+void      _etvdb_episode_field_set(Episode *e, Xml_Tag tag, const char *content, unsigned length,
+		Field_Text_Cb text_cb, void *data);
+void      _etvdb_series_field_set(Series *s, Xml_Tag tag, const char *content, unsigned length,
+		char **zap2it_id, Field_Text_Cb text_cb, void *data);
+
+Series   *_etvdb_store_series_find(uint32_t id);
+Series   *_etvdb_store_series_imdb_find(const char *imdb_id);
+Eina_Bool _etvdb_store_episodes_find(Series *s, Eina_List **list);
+Episode  *_etvdb_store_episode_find(uint32_t id, uint32_t *series_id);
+Episode  *_etvdb_store_episode_number_find(Series *s, int season, int episode);
+Eina_Bool _etvdb_store_series_add(Series *s);
+Eina_Bool _etvdb_store_episodes_add(Series *s, Eina_List *episodes);
+Eina_Bool _etvdb_store_episode_add(uint32_t series_id, Episode *e);
+Eina_Bool _etvdb_store_init(void);
+void      _etvdb_store_shutdown(void);
+
+Eina_Bool _etvdb_request_init(void);
+void      _etvdb_request_shutdown(void);
+Eina_Bool _etvdb_request_expired(void);
+double    _etvdb_request_remaining(void);
+Etvdb_Cancel *_etvdb_request_cancel_get(void);
+CURLcode  _etvdb_dl_mem(Download *dl, const char *uri);
+CURLcode  _etvdb_dl_stream(Download_Stream *st, const char *uri);
+Eina_Bool _etvdb_dl_batch(Download_Batch *b);
+void      _etvdb_dl_batch_wakeup(Download_Batch *b);
+
+Pool     *_etvdb_pool_new(unsigned int threads);
+Eina_Bool _etvdb_pool_push(Pool *p, Pool_Task_Cb cb, void *data);
+void      _etvdb_pool_free(Pool *p);
+Eina_Bool _etvdb_pool_init(void);
+void      _etvdb_pool_shutdown(void);
+Pool     *_etvdb_pool_shared_get(void);
+void      _etvdb_pool_group_init(Pool_Group *g);
+Eina_Bool _etvdb_pool_group_push(Pool *p, Pool_Group *g, Pool_Task_Cb cb, void *data);
+void      _etvdb_pool_group_wait(Pool *p, Pool_Group *g);
+void      _etvdb_pool_group_free(Pool_Group *g);
+
+Eina_Bool    _etvdb_lazy_init(void);
+void         _etvdb_lazy_shutdown(void);
+Lazy_Buffer *_etvdb_lazy_buffer_new(char *data, size_t len);
+void         _etvdb_lazy_buffer_unref(Lazy_Buffer *buf);
+const char  *_etvdb_lazy_buffer_data_get(const Lazy_Buffer *buf);
+void         _etvdb_lazy_add(Lazy_Buffer *buf, Episode *e, unsigned int field,
+		const char *content, unsigned int length);
+void         _etvdb_lazy_forget(const Episode *e);
+
+Eina_Bool   _etvdb_compress_init(void);
+void        _etvdb_compress_shutdown(void);
+void        _etvdb_overviews_free(Series *s);
+const char *_etvdb_overviews_series_get(const Series *s);
+const char *_etvdb_overviews_episode_get(const Episode *e);
+
+Eina_Bool _etvdb_xml_parse(const char *buf, size_t len, Xml_Cb cb, void *data);
+size_t    _etvdb_xml_decode(char *dst, const char *src);
+
+unsigned int _etvdb_parse_threads_for(size_t len);
+Eina_Bool    _etvdb_parse_parallel(const char *buf, size_t len, const char *tag,
+		Xml_Cb cb, const Parser_Data *tmpl, Eina_List **out);
+
+Eina_Binbuf *_etvdb_snapshot_build(Series *s);
+Series      *_etvdb_snapshot_series_get(const char *map, size_t len);
+void         _etvdb_shared_map_unref(Shared_Map *m);
+
+Eina_Bool   _etvdb_client_init(void);
+void        _etvdb_client_shutdown(void);
+const char *_etvdb_daemon_path_get(char *buf);
+Eina_Bool   _etvdb_daemon_io(int fd, void *buf, size_t len, Eina_Bool out, double until);
+Series     *_etvdb_client_series_get(uint32_t id, Eina_Bool populated);
+Eina_Bool   _etvdb_client_series_populate(Series *s);
+Eina_Bool   _etvdb_client_series_find(const char *name, Eina_List **list);
+
+void _etvdb_translations_free(Series *s);
+
+Eina_Bool _etvdb_registry_init(void);
+void      _etvdb_registry_shutdown(void);
+Series   *_etvdb_registry_series_add(Series *s);
+Eina_Bool _etvdb_registry_series_release(Series *s);
+void      _etvdb_registry_episodes_add(Series *s);
+void      _etvdb_registry_episodes_del(Series *s);
+Eina_Bool _etvdb_registry_series_shared(Series *s);
+void      _etvdb_registry_series_imdb_set(Series *s, char *imdb_id);
+Episode  *_etvdb_registry_episode_find(uint32_t id, Series **s);
+
+void      _etvdb_orders_index(Series *s);
+void      _etvdb_orders_free(Series *s);
+
+Eina_Bool _etvdb_search_init(void);
+void      _etvdb_search_shutdown(void);
+void      _etvdb_search_index_free(void);
+void      _etvdb_search_index_add(Series *s, const char *zap2it_id);
 
 #endif /* __ETVDB_PRIVATE_H__ */
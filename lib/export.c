@@ -0,0 +1,455 @@
+#include "etvdb_private.h"
+#include <errno.h>
+#include <unistd.h>
+
+/* size of the output buffer, it is written when it is full */
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+
+/* source bytes escaped at once, so the worst case always fits into the buffer */
+#define EXPORT_CHUNK 4096
+
+/* longest escape of one byte, \u00XX */
+#define EXPORT_ESCAPE_MAX 6
+
+/* columns of both formats, in this order */
+#define EXPORT_CSV_HEADER "series_id,series_name,series_imdb_id,id,season,number," \
+	"dvd_season,dvd_number,absolute_number,firstaired,imdb_id,name,overview\n"
+
+/* this structure represents an exporter */
+struct _etvdb_export {
+	int fd; /**< file descriptor the records are written to */
+	Etvdb_Export_Format format; /**< output format */
+	char *buf; /**< output buffer */
+	size_t len; /**< used size of buf */
+	unsigned long records; /**< number of records written */
+	Eina_Bool failed; /**< a write failed, nothing is written any more */
+};
+
+/* escapes of JSON strings, 0 for bytes copied as they are, 'u' for \u00XX */
+static const char _json_escape[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	['\\'] = '\\',
+};
+
+static const char _hex[] = "0123456789abcdef";
+
+/* Episode fields, which are missing in the record of a Series without Episodes */
+static const char *_episode_keys[] = { "id", "season", "number", "dvd_season", "dvd_number",
+	"absolute_number", "firstaired", "imdb_id", "name", "overview", NULL };
+
+/* write what comes in front of the value of a field */
+#define FIELD(x, key, first) _field_put(x, key, sizeof(key) - 1, first)
+
+/* internal functions */
+static void _episode_export(Etvdb_Export *x, const Series *s, Episode *e);
+static void _reserve(Etvdb_Export *x, size_t len);
+static void _put(Etvdb_Export *x, const char *str, size_t len);
+static void _uint_put(Etvdb_Export *x, uint32_t n);
+static void _string_put(Etvdb_Export *x, const char *str);
+static void _null_put(Etvdb_Export *x);
+static void _json_put(Etvdb_Export *x, const char *str);
+static void _csv_put(Etvdb_Export *x, const char *str);
+static void _field_put(Etvdb_Export *x, const char *key, size_t key_len, Eina_Bool first);
+
+/**
+ * @brief Export
+ * @defgroup Export
+ *
+ * @{
+ *
+ * These functions write Series and their Episodes to a file
+ * as newline delimited JSON or CSV, e.g. for analytics.
+ *
+ * Every Episode is one record, which carries the ID, name and IMDB ID
+ * of its Series; both formats have the same fields in the same order:
+ * series_id, series_name, series_imdb_id, id, season, number, dvd_season,
+ * dvd_number, absolute_number, firstaired, imdb_id, name and overview.
+ * Missing strings are null in JSON and empty in CSV.
+ * A Series without Episodes is written as one record of its own,
+ * in which all Episode fields are missing.
+ *
+ * Records are escaped in a single pass into a large buffer,
+ * which is written whenever it is full, so exporting allocates nothing
+ * per record. An exporter is used by one thread at a time.
+ */
+
+/**
+ * @brief Create an exporter
+ *
+ * For CSV, the header row is written first.
+ *
+ * @param fd file descriptor to write to, it stays open and belongs to the caller
+ * @param format output format
+ *
+ * @return a new exporter on success, NULL on failure
+ *
+ * @see etvdb_export_free()
+ *
+ * @ingroup Export
+ */
+EAPI Etvdb_Export *etvdb_export_new(int fd, Etvdb_Export_Format format)
+{
+	Etvdb_Export *x;
+
+	if (fd < 0) {
+		ERR("No file to export to.");
+		return NULL;
+	}
+
+	x = calloc(1, sizeof(Etvdb_Export));
+	if (x)
+		x->buf = malloc(EXPORT_BUFFER_SIZE);
+	if (!x || !x->buf) {
+		ERR("Couldn't allocate enough memory.");
+		free(x);
+		return NULL;
+	}
+
+	x->fd = fd;
+	x->format = format;
+
+	if (format == ETVDB_EXPORT_CSV)
+		_put(x, EXPORT_CSV_HEADER, sizeof(EXPORT_CSV_HEADER) - 1);
+
+	return x;
+}
+
+/**
+ * @brief Free an exporter
+ *
+ * The buffered records are written first.
+ *
+ * @param x the exporter
+ *
+ * @return EINA_TRUE if all records were written, EINA_FALSE if a write failed
+ *
+ * @ingroup Export
+ */
+EAPI Eina_Bool etvdb_export_free(Etvdb_Export *x)
+{
+	Eina_Bool ok;
+
+	if (!x)
+		return EINA_FALSE;
+
+	ok = etvdb_export_flush(x);
+	DBG("Exported %lu records.", x->records);
+
+	free(x->buf);
+	free(x);
+
+	return ok;
+}
+
+/**
+ * @brief Write the buffered records
+ *
+ * @param x the exporter
+ *
+ * @return EINA_TRUE if all records were written so far, EINA_FALSE if a write failed
+ *
+ * @ingroup Export
+ */
+EAPI Eina_Bool etvdb_export_flush(Etvdb_Export *x)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (!x->failed && done < x->len) {
+		n = write(x->fd, x->buf + done, x->len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ERR("Couldn't write exported records: %s", strerror(errno));
+			x->failed = EINA_TRUE;
+			break;
+		}
+		done += n;
+	}
+
+	x->len = 0;
+
+	return !x->failed;
+}
+
+/**
+ * @brief Export the Episodes of a Series
+ *
+ * A Series without Episodes is written as a single record
+ * without Episode fields, so it isn't lost.
+ *
+ * @param x the exporter
+ * @param s populated Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if a write failed
+ *
+ * @ingroup Export
+ */
+EAPI Eina_Bool etvdb_export_series(Etvdb_Export *x, const Series *s)
+{
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_export(x, s, e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_export(x, s, e);
+
+	if (!s->seasons && !s->specials)
+		_episode_export(x, s, NULL);
+
+	return !x->failed;
+}
+
+/**
+ * @brief Export the Episodes of a list of Series
+ *
+ * @param x the exporter
+ * @param list list of populated Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if a write failed
+ *
+ * @ingroup Export
+ */
+EAPI Eina_Bool etvdb_export_series_list(Etvdb_Export *x, const Eina_List *list)
+{
+	const Eina_List *l;
+	Series *s;
+
+	EINA_LIST_FOREACH(list, l, s) {
+		if (!etvdb_export_series(x, s))
+			return EINA_FALSE;
+	}
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Export the Series of a bulk download
+ *
+ * This function is an Etvdb_Bulk_Cb, which exports every Series
+ * downloaded by etvdb_series_bulk_get() and frees it.
+ * Pass the exporter as its data. IDs, which couldn't be downloaded,
+ * are left out.
+ *
+ * Example: etvdb_series_bulk_get(ids, count, NULL, etvdb_export_bulk_cb, x);
+ *
+ * @param data the exporter
+ * @param id TVDB ID of the Series
+ * @param s the downloaded Series, or NULL
+ *
+ * @ingroup Export
+ */
+EAPI void etvdb_export_bulk_cb(void *data, uint32_t id UNUSED, Series *s)
+{
+	if (!s)
+		return;
+
+	etvdb_export_series(data, s);
+	etvdb_series_free(s);
+}
+/**
+ * @}
+ */
+
+/* write one Episode record, e is NULL for a Series without Episodes */
+static void _episode_export(Etvdb_Export *x, const Series *s, Episode *e)
+{
+	unsigned int i;
+
+	if (x->failed)
+		return;
+
+	if (x->format == ETVDB_EXPORT_NDJSON)
+		_put(x, "{", 1);
+
+	FIELD(x, "series_id", EINA_TRUE);
+	_uint_put(x, s->id);
+	FIELD(x, "series_name", EINA_FALSE);
+	_string_put(x, s->name);
+	FIELD(x, "series_imdb_id", EINA_FALSE);
+	_string_put(x, s->imdb_id);
+
+	if (!e) {
+		for (i = 0; _episode_keys[i]; i++) {
+			_field_put(x, _episode_keys[i], strlen(_episode_keys[i]), EINA_FALSE);
+			_null_put(x);
+		}
+		goto end;
+	}
+
+	FIELD(x, "id", EINA_FALSE);
+	_uint_put(x, e->id);
+	FIELD(x, "season", EINA_FALSE);
+	_uint_put(x, e->season);
+	FIELD(x, "number", EINA_FALSE);
+	_uint_put(x, e->number);
+	FIELD(x, "dvd_season", EINA_FALSE);
+	_uint_put(x, e->dvd_season);
+	FIELD(x, "dvd_number", EINA_FALSE);
+	_uint_put(x, e->dvd_number);
+	FIELD(x, "absolute_number", EINA_FALSE);
+	_uint_put(x, e->absolute_number);
+	FIELD(x, "firstaired", EINA_FALSE);
+	_string_put(x, e->firstaired);
+	FIELD(x, "imdb_id", EINA_FALSE);
+	_string_put(x, e->imdb_id);
+	FIELD(x, "name", EINA_FALSE);
+	_string_put(x, etvdb_episode_name_get(e));
+	FIELD(x, "overview", EINA_FALSE);
+	_string_put(x, etvdb_episode_overview_get(e));
+
+end:
+	if (x->format == ETVDB_EXPORT_NDJSON)
+		_put(x, "}\n", 2);
+	else
+		_put(x, "\n", 1);
+
+	x->records++;
+}
+
+/* make room for len bytes, len has to be smaller than the buffer */
+static void _reserve(Etvdb_Export *x, size_t len)
+{
+	if (EXPORT_BUFFER_SIZE - x->len < len)
+		etvdb_export_flush(x);
+}
+
+static void _put(Etvdb_Export *x, const char *str, size_t len)
+{
+	_reserve(x, len);
+	memcpy(x->buf + x->len, str, len);
+	x->len += len;
+}
+
+/* write a number without going through printf */
+static void _uint_put(Etvdb_Export *x, uint32_t n)
+{
+	char tmp[10];
+	unsigned int i = sizeof(tmp);
+
+	do {
+		tmp[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	_put(x, tmp + i, sizeof(tmp) - i);
+}
+
+/* write a missing field, null in JSON and empty in CSV */
+static void _null_put(Etvdb_Export *x)
+{
+	if (x->format == ETVDB_EXPORT_NDJSON)
+		_put(x, "null", 4);
+}
+
+static void _string_put(Etvdb_Export *x, const char *str)
+{
+	if (x->format == ETVDB_EXPORT_NDJSON)
+		_json_put(x, str);
+	else
+		_csv_put(x, str);
+}
+
+/* write a JSON string, runs of plain bytes are copied at once */
+static void _json_put(Etvdb_Export *x, const char *str)
+{
+	const unsigned char *p = (const unsigned char *)str, *end, *run;
+	char *out;
+	char esc;
+
+	if (!str) {
+		_put(x, "null", 4);
+		return;
+	}
+
+	_put(x, "\"", 1);
+
+	while (*p) {
+		_reserve(x, EXPORT_CHUNK * EXPORT_ESCAPE_MAX);
+		out = x->buf + x->len;
+
+		for (end = p; *end && end - p < EXPORT_CHUNK; end++);
+
+		while (p < end) {
+			for (run = p; p < end && !_json_escape[*p]; p++);
+			memcpy(out, run, p - run);
+			out += p - run;
+
+			if (p == end)
+				break;
+
+			esc = _json_escape[*p];
+			*out++ = '\\';
+			if (esc == 'u') {
+				memcpy(out, "u00", 3);
+				out[3] = _hex[*p >> 4];
+				out[4] = _hex[*p & 0xf];
+				out += 5;
+			} else
+				*out++ = esc;
+			p++;
+		}
+
+		x->len = out - x->buf;
+	}
+
+	_put(x, "\"", 1);
+}
+
+/* write a CSV field, it is always quoted, so it is never scanned twice */
+static void _csv_put(Etvdb_Export *x, const char *str)
+{
+	const char *p = str, *end, *quote;
+	char *out;
+
+	if (!str)
+		return;
+
+	_put(x, "\"", 1);
+
+	while (*p) {
+		_reserve(x, EXPORT_CHUNK * 2);
+		out = x->buf + x->len;
+
+		for (end = p; *end && end - p < EXPORT_CHUNK; end++);
+
+		while (p < end) {
+			quote = memchr(p, '"', end - p);
+			if (!quote)
+				quote = end;
+
+			memcpy(out, p, quote - p);
+			out += quote - p;
+			p = quote;
+
+			if (p < end) {
+				*out++ = '"';
+				*out++ = '"';
+				p++;
+			}
+		}
+
+		x->len = out - x->buf;
+	}
+
+	_put(x, "\"", 1);
+}
+
+/* write the separator and, for JSON, the key of a field */
+static void _field_put(Etvdb_Export *x, const char *key, size_t key_len, Eina_Bool first)
+{
+	if (!first)
+		_put(x, ",", 1);
+
+	if (x->format == ETVDB_EXPORT_NDJSON) {
+		_put(x, "\"", 1);
+		_put(x, key, key_len);
+		_put(x, "\":", 2);
+	}
+}
@@ -1,10 +1,10 @@
 #include "etvdb_private.h"
 
 /* internal functions */
-static Eina_Bool _parse_time_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length);
-static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length);
+static Eina_Bool _parse_time_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
 static void _hash_free_cb(void *data);
 
 /**
@@ -72,13 +72,15 @@ EAPI Eina_Hash *etvdb_languages_get(const char *lang_file_path)
 		snprintf(uri, URI_MAX, TVDB_API_URI"/%s/languages.xml", etvdb_api_key);
 		CURL_XML_DL_MEM(xml, uri) {
 			ERR("Couldn't get languages from server.");
+			free(xml.data);
+			eina_hash_free(hash);
 			return NULL;
 		}
 	}
 
 	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
 	pdata.data = hash;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_lang_cb, &pdata))
+	if (!_etvdb_xml_parse(xml.data, xml.len, _parse_lang_cb, &pdata))
 		CRIT("Parsing of languages.xml failed. Probably invalid XML file.");
 
 	if (file)
@@ -146,7 +148,7 @@ EAPI time_t etvdb_server_time_get(void)
 	}
 
 	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_time_cb, &pdata)) {
+	if (!_etvdb_xml_parse(xml.data, xml.len, _parse_time_cb, &pdata)) {
 		CRIT("Couldn't parse TVDB timestamp XML.");
 		server_time = 0;
 		goto end;
@@ -165,41 +167,35 @@ end:
  */
 
 /* this callback parses TVDBs languages.xml format and writes the data in a hashtable */
-static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length)
+static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
 {
 	Parser_Data *pdata = data;
 	char buf[length + 1];
 	char itoa[sizeof(pdata->xml_count) + 1];
 	char key[3];
-	enum nname { UNKNOWN, NAME, ABBR };
 
 	switch (type) {
 	case EINA_SIMPLE_XML_OPEN:
 		switch (pdata->xml_depth) {
 		case 0:
-			if (!TAGCMP("Languages", content))
+			if (tag == XML_TAG_LANGUAGES)
 				pdata->xml_depth++;
 			break;
 		case 1:
-			if (!TAGCMP("Language", content)) {
+			if (tag == XML_TAG_LANGUAGE) {
 				pdata->xml_depth++;
 				eina_convert_itoa(pdata->xml_count, itoa);
 				eina_hash_add(pdata->data, itoa, "");
 			}
 			break;
 		case 2:
-			if (!TAGCMP("name", content))
-				pdata->xml_sibling = NAME;
-			else if (!TAGCMP("abbreviation", content))
-				pdata->xml_sibling = ABBR;
-			else
-				pdata->xml_sibling = UNKNOWN;
+			pdata->xml_sibling = tag;
 			break;
 		}
 		break;
 	case EINA_SIMPLE_XML_CLOSE:
-		if (!TAGCMP("Language", content)) {
+		if (tag == XML_TAG_LANGUAGE) {
 			pdata->xml_count++;
 			pdata->xml_depth--;
 		}
@@ -210,7 +206,7 @@ static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const cha
 			MEM2STR(buf, content, length);
 
 			switch (pdata->xml_sibling) {
-			case NAME:
+			case XML_TAG_NAME:
 				DBG("Found Name: %s", buf);
 				MEM2STR(key, (char *)eina_hash_find(pdata->data, itoa), 2);
 
@@ -223,7 +219,7 @@ static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const cha
 					free(eina_hash_modify(pdata->data, key, strdup(buf)));
 				}
 				break;
-			case ABBR:
+			case XML_TAG_ABBREVIATION:
 				DBG("Found Abbreviation: %s", buf);
 
 				/* if the hash is found an contains an empty string, add key as data;
@@ -238,6 +234,8 @@ static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const cha
 				else
 					return EINA_FALSE;
 				break;
+			default:
+				break;
 			}
 		}
 	default:
@@ -247,17 +245,17 @@ static Eina_Bool _parse_lang_cb(void *data, Eina_Simple_XML_Type type, const cha
 }
 
 /* this callback parses and stores TVDBs server time */
-static Eina_Bool _parse_time_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length)
+static Eina_Bool _parse_time_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
 {
 	Parser_Data *pdata = data;
 	char buf[length + 1];
 
 	switch (type) {
 	case EINA_SIMPLE_XML_OPEN:
-		if (pdata->xml_depth == 0 && !TAGCMP("Items", content))
+		if (pdata->xml_depth == 0 && tag == XML_TAG_ITEMS)
 			pdata->xml_depth++;
-		else if (pdata->xml_depth == 1 && !TAGCMP("Time", content))
+		else if (pdata->xml_depth == 1 && tag == XML_TAG_TIME)
 			pdata->xml_depth++;
 		break;
 	case EINA_SIMPLE_XML_DATA:
@@ -0,0 +1,266 @@
+#include "etvdb_private.h"
+
+/* a retained response buffer, shared by the lazy fields pointing into it */
+struct _lazy_buffer {
+	int ref; /**< number of users, the parser and the lazy fields */
+	size_t len; /**< length of data */
+	char *data; /**< the response */
+};
+
+/* the raw text fields of one Episode */
+typedef struct _lazy_text {
+	Lazy_Buffer *buf; /**< buffer the ranges point into */
+	unsigned int name_off; /**< offset of the raw name */
+	unsigned int name_len; /**< length of the raw name */
+	unsigned int overview_off; /**< offset of the raw overview */
+	unsigned int overview_len; /**< length of the raw overview */
+	unsigned int pending; /**< Etvdb_Field mask of the fields, which are not decoded yet */
+} Lazy_Text;
+
+/* internal functions */
+static void _lazy_text_free(void *data);
+static char *_decode(const Lazy_Buffer *buf, unsigned int off, unsigned int len);
+static char *_field_get(Episode *e, unsigned int field);
+
+/* Episode -> Lazy_Text */
+static Eina_Hash *_lazy = NULL;
+static Eina_Lock _lazy_lock;
+
+/**
+ * @brief Lazy Text Fields
+ * @defgroup Lazy
+ *
+ * @{
+ *
+ * When ETVDB_FIELD_LAZY is part of a field mask, the requested name and
+ * overview of Episodes are not decoded while parsing.
+ * Only their position in the response is recorded, and the response is kept.
+ * The text is decoded and cached in the Episode on first access
+ * through etvdb_episode_name_get() or etvdb_episode_overview_get().
+ *
+ * The response is released when all its Episodes are freed,
+ * or all their lazy fields were decoded.
+ * A decoded field is published atomically, so other threads
+ * read it without taking a lock.
+ */
+
+/**
+ * @brief Get the name of an Episode
+ *
+ * This function decodes the name of an Episode, which was parsed lazily.
+ * For other Episodes it returns the name member.
+ *
+ * @param e pointer to Episode structure
+ *
+ * @return the name, which belongs to the Episode, or NULL if there is none
+ *
+ * @ingroup Lazy
+ */
+EAPI const char *etvdb_episode_name_get(Episode *e)
+{
+	const char *str;
+
+	str = __atomic_load_n(&e->name, __ATOMIC_ACQUIRE);
+	if (str)
+		return str;
+
+	return _field_get(e, ETVDB_FIELD_NAME);
+}
+
+/**
+ * @brief Get the overview of an Episode
+ *
+ * This function decodes the overview of an Episode, which was parsed lazily,
+ * or decompresses it, if the overviews of its Series were compressed.
+ * For other Episodes it returns the overview member.
+ *
+ * @param e pointer to Episode structure
+ *
+ * @return the overview, which belongs to the Episode, or NULL if there is none.
+ * A decompressed overview is only valid until the next overview
+ * is read in the same thread.
+ *
+ * @see etvdb_series_overviews_compress()
+ *
+ * @ingroup Lazy
+ */
+EAPI const char *etvdb_episode_overview_get(Episode *e)
+{
+	const char *str;
+
+	str = __atomic_load_n(&e->overview, __ATOMIC_ACQUIRE);
+	if (str)
+		return str;
+
+	str = _etvdb_overviews_episode_get(e);
+	if (str)
+		return str;
+
+	return _field_get(e, ETVDB_FIELD_OVERVIEW);
+}
+/**
+ * @}
+ */
+
+/* set up lazy fields, called by etvdb_init() */
+Eina_Bool _etvdb_lazy_init(void)
+{
+	return eina_lock_new(&_lazy_lock);
+}
+
+/* release all retained responses, called by etvdb_shutdown() */
+void _etvdb_lazy_shutdown(void)
+{
+	if (_lazy)
+		eina_hash_free(_lazy);
+	_lazy = NULL;
+
+	eina_lock_free(&_lazy_lock);
+}
+
+/* retain a response, the buffer takes over data */
+Lazy_Buffer *_etvdb_lazy_buffer_new(char *data, size_t len)
+{
+	Lazy_Buffer *buf;
+
+	buf = malloc(sizeof(Lazy_Buffer));
+	if (!buf) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	buf->ref = 1;
+	buf->len = len;
+	buf->data = data;
+
+	return buf;
+}
+
+/* drop a reference to a response, the last one frees it */
+void _etvdb_lazy_buffer_unref(Lazy_Buffer *buf)
+{
+	if (__atomic_sub_fetch(&buf->ref, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	free(buf->data);
+	free(buf);
+}
+
+/* get the data of a response */
+const char *_etvdb_lazy_buffer_data_get(const Lazy_Buffer *buf)
+{
+	return buf->data;
+}
+
+/* record the raw range of a field, content has to point into buf */
+void _etvdb_lazy_add(Lazy_Buffer *buf, Episode *e, unsigned int field,
+		const char *content, unsigned int length)
+{
+	Lazy_Text *lt;
+
+	eina_lock_take(&_lazy_lock);
+
+	if (!_lazy)
+		_lazy = eina_hash_pointer_new(_lazy_text_free);
+
+	lt = eina_hash_find(_lazy, &e);
+	if (!lt) {
+		lt = calloc(1, sizeof(Lazy_Text));
+		if (!lt) {
+			ERR("Couldn't allocate enough memory.");
+			eina_lock_release(&_lazy_lock);
+			return;
+		}
+		lt->buf = buf;
+		__atomic_add_fetch(&buf->ref, 1, __ATOMIC_ACQ_REL);
+		eina_hash_add(_lazy, &e, lt);
+		__atomic_store_n(&e->lazy, 1, __ATOMIC_RELEASE);
+	}
+
+	if (field == ETVDB_FIELD_NAME) {
+		lt->name_off = content - buf->data;
+		lt->name_len = length;
+	} else {
+		lt->overview_off = content - buf->data;
+		lt->overview_len = length;
+	}
+	lt->pending |= field;
+
+	eina_lock_release(&_lazy_lock);
+}
+
+/* forget the lazy fields of an Episode, which is freed.
+ * only called for Episodes with e->lazy set */
+void _etvdb_lazy_forget(const Episode *e)
+{
+	eina_lock_take(&_lazy_lock);
+	if (_lazy)
+		eina_hash_del_by_key(_lazy, &e);
+	eina_lock_release(&_lazy_lock);
+}
+
+/* decode a field and cache it in the Episode */
+static char *_field_get(Episode *e, unsigned int field)
+{
+	char *str = NULL, *tmp;
+	Lazy_Text *lt;
+
+	eina_lock_take(&_lazy_lock);
+
+	/* another thread might have decoded it while this one waited */
+	str = field == ETVDB_FIELD_NAME ? e->name : e->overview;
+	if (str || !_lazy)
+		goto end;
+
+	lt = eina_hash_find(_lazy, &e);
+	if (!lt || !(lt->pending & field))
+		goto end;
+
+	/* names are interned like the parser does.
+	 * the field is published with a release store, the getters read it without the lock */
+	if (field == ETVDB_FIELD_NAME) {
+		tmp = _decode(lt->buf, lt->name_off, lt->name_len);
+		str = (char *)eina_stringshare_add(tmp);
+		free(tmp);
+		__atomic_store_n(&e->name, str, __ATOMIC_RELEASE);
+	} else {
+		str = _decode(lt->buf, lt->overview_off, lt->overview_len);
+		__atomic_store_n(&e->overview, str, __ATOMIC_RELEASE);
+	}
+
+	lt->pending &= ~field;
+	if (!lt->pending) {
+		eina_hash_del_by_key(_lazy, &e);
+		__atomic_store_n(&e->lazy, 0, __ATOMIC_RELEASE);
+	}
+
+end:
+	eina_lock_release(&_lazy_lock);
+
+	return str;
+}
+
+static char *_decode(const Lazy_Buffer *buf, unsigned int off, unsigned int len)
+{
+	char tmp[len + 1];
+	char *str;
+
+	str = malloc(len + 1);
+	if (!str) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	MEM2STR(tmp, buf->data + off, len);
+	HTML2UTF(str, tmp);
+
+	return str;
+}
+
+static void _lazy_text_free(void *data)
+{
+	Lazy_Text *lt = data;
+
+	_etvdb_lazy_buffer_unref(lt->buf);
+	free(lt);
+}
@@ -0,0 +1,182 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* key of an Episode in the DVD and default index */
+#define ORDER_KEY(season, number) (((uint32_t)(season) << 16) | (uint32_t)(number))
+
+/* internal functions */
+static void _episode_index(Series_Priv *priv, Episode *e);
+static void _key_add(Eina_Hash *index, uint32_t key, Episode *e);
+
+/**
+ * @brief Episode Orderings
+ * @defgroup Orders
+ *
+ * @{
+ *
+ * TVDB numbers Episodes in up to three orderings: the aired order
+ * by season and episode number, the order of the DVD releases
+ * and an absolute order over all seasons, which is common for anime.
+ *
+ * The Episodes of a populated Series are indexed by every ordering,
+ * when they are added to the Series, so looking up an Episode by
+ * any of its numbers doesn't walk the seasons or ask TVDB.
+ */
+
+/**
+ * @brief Get an Episode of a Series by its number in an ordering
+ *
+ * This function looks the Episode up in the indexes of the Series,
+ * it never downloads anything.
+ * If several Episodes have the same number, e.g. the parts of a
+ * split DVD episode numbered 1.1 and 1.2, the first one is returned.
+ *
+ * @param s populated Series
+ * @param order the ordering of season and episode
+ * @param season season number, 0 for specials, ignored for ETVDB_ORDER_ABSOLUTE
+ * @param episode episode number in the season or absolute number
+ *
+ * @return pointer to the Episode, which belongs to the Series
+ * @return NULL if the Series has no such Episode or isn't populated
+ *
+ * @see etvdb_episode_by_order_get()
+ *
+ * @ingroup Orders
+ */
+EAPI Episode *etvdb_episode_from_series_order_get(Series *s, Etvdb_Order order, int season, int episode)
+{
+	uint32_t key;
+
+	if (!s->priv || (unsigned int)order >= ETVDB_ORDER_COUNT || !s->priv->orders[order])
+		return NULL;
+
+	if (episode < 1 || episode > UINT16_MAX)
+		return NULL;
+
+	if (order == ETVDB_ORDER_ABSOLUTE)
+		key = episode;
+	else if (season >= 0 && season <= UINT16_MAX)
+		key = ORDER_KEY(season, episode);
+	else
+		return NULL;
+
+	return eina_hash_find(s->priv->orders[order], &key);
+}
+
+/**
+ * @brief Get episode data for an Episode by its number in an ordering
+ *
+ * This function works like etvdb_episode_by_number_get(),
+ * but in any ordering. The Episode is copied from the Series,
+ * if it is populated, otherwise it is downloaded.
+ *
+ * @param s initialized TVDB Series structure
+ * @param order the ordering of season and episode
+ * @param season season number, ignored for ETVDB_ORDER_ABSOLUTE
+ * @param episode episode number in the season or absolute number
+ *
+ * @return a Episode structure on success, which has to be freed with etvdb_episode_free()
+ * @return NULL on failure.
+ *
+ * @ingroup Orders
+ */
+EAPI Episode *etvdb_episode_by_order_get(Series *s, Etvdb_Order order, int season, int episode)
+{
+	char uri[URI_MAX];
+	Episode *e;
+
+	if (!s->id) {
+		ERR("Passed series data is not valid.");
+		return NULL;
+	}
+
+	e = etvdb_episode_from_series_order_get(s, order, season, episode);
+	if (e)
+		return etvdb_episode_dup(e);
+
+	switch (order) {
+	case ETVDB_ORDER_DEFAULT:
+		return etvdb_episode_by_number_get(s, season, episode);
+	case ETVDB_ORDER_DVD:
+		snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/dvd/%d/%d/%s.xml",
+				etvdb_api_key, s->id, season, episode, etvdb_language);
+		break;
+	case ETVDB_ORDER_ABSOLUTE:
+		snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/absolute/%d/%s.xml",
+				etvdb_api_key, s->id, episode, etvdb_language);
+		break;
+	default:
+		ERR("Unknown Episode ordering %d.", order);
+		return NULL;
+	}
+
+	return _etvdb_episode_download(s, uri);
+}
+/**
+ * @}
+ */
+
+/* index the Episodes of a Series by every ordering, replacing older indexes */
+void _etvdb_orders_index(Series *s)
+{
+	unsigned int i;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+	Series_Priv *priv;
+
+	priv = _etvdb_series_priv_get(s);
+	if (!priv)
+		return;
+
+	_etvdb_orders_free(s);
+
+	for (i = 0; i < ETVDB_ORDER_COUNT; i++) {
+		priv->orders[i] = eina_hash_int32_new(NULL);
+		if (!priv->orders[i]) {
+			ERR("Couldn't index the Episodes of Series %"PRIu32, s->id);
+			_etvdb_orders_free(s);
+			return;
+		}
+	}
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_index(priv, e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_index(priv, e);
+}
+
+/* free the indexes, before the Episodes of a Series are freed */
+void _etvdb_orders_free(Series *s)
+{
+	unsigned int i;
+
+	if (!s->priv)
+		return;
+
+	for (i = 0; i < ETVDB_ORDER_COUNT; i++) {
+		eina_hash_free(s->priv->orders[i]);
+		s->priv->orders[i] = NULL;
+	}
+}
+
+/* add an Episode to the index of every ordering it has a number in */
+static void _episode_index(Series_Priv *priv, Episode *e)
+{
+	_key_add(priv->orders[ETVDB_ORDER_DEFAULT], ORDER_KEY(e->season, e->number), e);
+
+	if (e->dvd_number)
+		_key_add(priv->orders[ETVDB_ORDER_DVD], ORDER_KEY(e->dvd_season, e->dvd_number), e);
+
+	if (e->absolute_number)
+		_key_add(priv->orders[ETVDB_ORDER_ABSOLUTE], e->absolute_number, e);
+}
+
+/* the first Episode keeps a key, the index hash copies it */
+static void _key_add(Eina_Hash *index, uint32_t key, Episode *e)
+{
+	if (!eina_hash_find(index, &key))
+		eina_hash_add(index, &key, e);
+}
@@ -0,0 +1,168 @@
+#include "etvdb_private.h"
+
+/* documents smaller than this per thread are parsed by one thread,
+ * starting threads costs more than it saves */
+#define CHUNK_MIN (128 * 1024)
+
+/* one chunk of a document, parsed by one worker */
+typedef struct _parse_job {
+	const char *buf; /**< start of the chunk */
+	size_t len; /**< length of the chunk */
+	Xml_Cb cb; /**< parser callback */
+	Parser_Data pdata; /**< parser state, pdata.data collects the records */
+	double deadline; /**< deadline of the calling thread */
+	Etvdb_Cancel *cancel; /**< cancellation token of the calling thread */
+	Eina_Bool ok; /**< parsing succeeded */
+} Parse_Job;
+
+/* internal functions */
+static void _job_run(void *data);
+
+static unsigned int _threads = 1;
+
+/**
+ * @brief Parser Settings
+ * @defgroup Parsing
+ *
+ * @{
+ *
+ * Large documents, like all Episodes of a long running Series,
+ * can be parsed by several threads.
+ * The document is split at record boundaries, the chunks are parsed
+ * by the worker threads the library shares between all calls,
+ * and the results are merged in document order.
+ */
+
+/**
+ * @brief Set the number of threads used to parse large documents
+ *
+ * @param threads maximum number of threads, 1 parses in the calling thread only,
+ * 0 uses one thread per CPU
+ *
+ * @ingroup Parsing
+ */
+EAPI void etvdb_parse_threads_set(unsigned int threads)
+{
+	if (!threads)
+		threads = eina_cpu_count();
+
+	__atomic_store_n(&_threads, threads ? threads : 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the number of threads used to parse large documents
+ *
+ * @return maximum number of threads
+ *
+ * @ingroup Parsing
+ */
+EAPI unsigned int etvdb_parse_threads_get(void)
+{
+	return __atomic_load_n(&_threads, __ATOMIC_RELAXED);
+}
+/**
+ * @}
+ */
+
+/* number of threads worth using for a document of len bytes */
+unsigned int _etvdb_parse_threads_for(size_t len)
+{
+	size_t chunks = len / CHUNK_MIN;
+	unsigned int threads = __atomic_load_n(&_threads, __ATOMIC_RELAXED);
+
+	if (chunks < 2)
+		return 1;
+
+	return chunks < threads ? chunks : threads;
+}
+
+/* parse a document on several threads of the shared pool.
+ * the document is split in front of tag, every chunk is parsed with a copy of tmpl,
+ * which continues at nesting depth 1. buf has to be nul-terminated.
+ * the records of all chunks are merged into *out in document order,
+ * also when parsing a chunk failed */
+Eina_Bool _etvdb_parse_parallel(const char *buf, size_t len, const char *tag,
+		Xml_Cb cb, const Parser_Data *tmpl, Eina_List **out)
+{
+	char open[64];
+	unsigned int i, n, threads;
+	const char *start, *end, *split;
+	Eina_Bool ok = EINA_TRUE;
+	Parse_Job *jobs;
+	Pool_Group group;
+	Pool *pool;
+
+	*out = NULL;
+	threads = _etvdb_parse_threads_for(len);
+	snprintf(open, sizeof(open), "<%s>", tag);
+
+	start = strstr(buf, open);
+	if (!start)
+		return EINA_TRUE;
+
+	pool = _etvdb_pool_shared_get();
+	jobs = malloc(threads * sizeof(Parse_Job));
+	if (!pool || !jobs) {
+		ERR("Couldn't allocate enough memory.");
+		free(jobs);
+		return EINA_FALSE;
+	}
+
+	end = buf + len;
+	for (n = 0; n < threads && start < end; n++) {
+		split = (n == threads - 1) ? NULL : strstr(start + (end - start) / (threads - n), open);
+		if (!split)
+			split = end;
+
+		jobs[n].buf = start;
+		jobs[n].len = split - start;
+		jobs[n].cb = cb;
+		jobs[n].pdata = *tmpl;
+		jobs[n].pdata.data = NULL;
+		jobs[n].pdata.xml_count = jobs[n].pdata.xml_sibling = 0;
+		jobs[n].pdata.xml_depth = 1;
+		jobs[n].deadline = etvdb_deadline_get();
+		jobs[n].cancel = _etvdb_request_cancel_get();
+
+		start = split;
+	}
+
+	DBG("Parsing %zu bytes in %u chunks.", len, n);
+
+	/* the first chunk is parsed by the calling thread,
+	 * which runs queued chunks as well while it waits */
+	_etvdb_pool_group_init(&group);
+	for (i = 1; i < n; i++)
+		_etvdb_pool_group_push(pool, &group, _job_run, &jobs[i]);
+
+	_job_run(&jobs[0]);
+
+	_etvdb_pool_group_wait(pool, &group);
+	_etvdb_pool_group_free(&group);
+
+	for (i = 0; i < n; i++) {
+		ok &= jobs[i].ok;
+		*out = eina_list_merge(*out, jobs[i].pdata.data);
+	}
+
+	free(jobs);
+
+	return ok;
+}
+
+/* parse one chunk with the deadline and token of the calling thread.
+ * the thread may be waiting for its own call, which keeps its settings */
+static void _job_run(void *data)
+{
+	Parse_Job *job = data;
+	double deadline = etvdb_deadline_get();
+	Etvdb_Cancel *cancel = _etvdb_request_cancel_get();
+
+	etvdb_deadline_set(job->deadline);
+	etvdb_cancel_set(job->cancel);
+
+	job->ok = _etvdb_xml_parse(job->buf, job->len, job->cb, &job->pdata);
+
+	etvdb_deadline_set(deadline);
+	etvdb_cancel_set(cancel);
+}
@@ -0,0 +1,404 @@
+#include "etvdb_private.h"
+
+/* initial number of tasks a worker queue can hold, it grows when needed */
+#define QUEUE_SIZE_INITIAL 64
+
+/* a queued task */
+typedef struct _pool_task {
+	Pool_Task_Cb cb; /**< function running the task */
+	void *data; /**< data of the task */
+} Pool_Task;
+
+/* a worker thread with its own queue.
+ * the worker takes its newest task, other workers steal the oldest one */
+typedef struct _pool_worker {
+	Pool *pool; /**< pool of the worker */
+	Eina_Lock lock; /**< protects the queue */
+	Pool_Task *tasks; /**< ring buffer of queued tasks */
+	unsigned int head; /**< position of the oldest task */
+	unsigned int count; /**< number of queued tasks */
+	unsigned int size; /**< size of the ring buffer */
+	unsigned int index; /**< index of the worker in the pool */
+	Eina_Thread thread; /**< thread of the worker */
+	Eina_Bool started; /**< the thread was started */
+} Pool_Worker;
+
+struct _pool {
+	Pool_Worker *workers; /**< the workers */
+	unsigned int count; /**< number of workers */
+	unsigned int next; /**< worker which gets the next task pushed from outside */
+	int pending; /**< number of queued tasks in all queues */
+	Eina_Bool quit; /**< workers stop when the queues are empty */
+	Eina_Lock lock; /**< protects next, quit and waiting for tasks */
+	Eina_Condition cond; /**< signalled when a task is queued */
+};
+
+/* a task of a Pool_Group */
+typedef struct _pool_group_task {
+	Pool_Group *group; /**< group of the task */
+	Pool_Task_Cb cb; /**< function running the task */
+	void *data; /**< data of the task */
+} Pool_Group_Task;
+
+/* internal functions */
+static void *_worker_run(void *data, Eina_Thread t UNUSED);
+static void _group_task_run(void *data);
+static Eina_Bool _queue_push(Pool_Worker *w, Pool_Task_Cb cb, void *data);
+static Eina_Bool _queue_pop(Pool_Worker *w, Pool_Task *task);
+static Eina_Bool _queue_steal(Pool_Worker *w, Pool_Task *task);
+static Eina_Bool _task_get(Pool_Worker *w, Pool_Task *task);
+
+/* worker of the current thread, tasks pushed by tasks stay with their worker */
+static __thread Pool_Worker *_self = NULL;
+
+/* the pool shared by all calls, started on first use */
+static Pool *_shared = NULL;
+static Eina_Lock _shared_lock;
+
+/* called by etvdb_init() */
+Eina_Bool _etvdb_pool_init(void)
+{
+	return eina_lock_new(&_shared_lock);
+}
+
+/* stop the shared pool, called by etvdb_shutdown() */
+void _etvdb_pool_shutdown(void)
+{
+	if (_shared)
+		_etvdb_pool_free(_shared);
+	_shared = NULL;
+
+	eina_lock_free(&_shared_lock);
+}
+
+/* get the pool shared by the parsers and bulk downloads, with one worker per CPU.
+ * it is started on first use and runs until etvdb_shutdown() */
+Pool *_etvdb_pool_shared_get(void)
+{
+	Pool *p = __atomic_load_n(&_shared, __ATOMIC_ACQUIRE);
+
+	if (p)
+		return p;
+
+	eina_lock_take(&_shared_lock);
+	if (!_shared)
+		__atomic_store_n(&_shared, _etvdb_pool_new(0), __ATOMIC_RELEASE);
+	p = _shared;
+	eina_lock_release(&_shared_lock);
+
+	return p;
+}
+
+void _etvdb_pool_group_init(Pool_Group *g)
+{
+	eina_lock_new(&g->lock);
+	eina_condition_new(&g->cond, &g->lock);
+	g->pending = 0;
+}
+
+/* queue a task of a group, it runs in the calling thread if it can't be queued */
+Eina_Bool _etvdb_pool_group_push(Pool *p, Pool_Group *g, Pool_Task_Cb cb, void *data)
+{
+	Pool_Group_Task *t;
+
+	t = malloc(sizeof(Pool_Group_Task));
+	if (!t) {
+		ERR("Couldn't allocate enough memory.");
+		cb(data);
+		return EINA_FALSE;
+	}
+
+	t->group = g;
+	t->cb = cb;
+	t->data = data;
+
+	eina_lock_take(&g->lock);
+	g->pending++;
+	eina_lock_release(&g->lock);
+
+	if (!_etvdb_pool_push(p, _group_task_run, t)) {
+		_group_task_run(t);
+		return EINA_FALSE;
+	}
+
+	return EINA_TRUE;
+}
+
+/* wait for the tasks of a group.
+ * the waiting thread runs queued tasks meanwhile, so waiting
+ * from a task of the same pool doesn't take a worker away */
+void _etvdb_pool_group_wait(Pool *p, Pool_Group *g)
+{
+	Pool_Task task;
+	Eina_Bool found;
+	unsigned int i;
+
+	for (;;) {
+		eina_lock_take(&g->lock);
+		if (!g->pending) {
+			eina_lock_release(&g->lock);
+			break;
+		}
+		eina_lock_release(&g->lock);
+
+		if (_self && _self->pool == p)
+			found = _task_get(_self, &task);
+		else
+			for (i = 0, found = EINA_FALSE; i < p->count && !found; i++)
+				found = _queue_steal(&p->workers[i], &task);
+
+		if (found) {
+			__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+			task.cb(task.data);
+			continue;
+		}
+
+		/* the rest of the group is running in other threads */
+		eina_lock_take(&g->lock);
+		while (g->pending)
+			eina_condition_wait(&g->cond);
+		eina_lock_release(&g->lock);
+	}
+}
+
+void _etvdb_pool_group_free(Pool_Group *g)
+{
+	eina_condition_free(&g->cond);
+	eina_lock_free(&g->lock);
+}
+
+/* create a pool of threads workers, 0 uses one per CPU */
+Pool *_etvdb_pool_new(unsigned int threads)
+{
+	unsigned int i;
+	Pool *p;
+
+	if (!threads)
+		threads = eina_cpu_count();
+	if (!threads)
+		threads = 1;
+
+	p = calloc(1, sizeof(Pool));
+	if (!p) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	p->workers = calloc(threads, sizeof(Pool_Worker));
+	if (!p->workers) {
+		ERR("Couldn't allocate enough memory.");
+		free(p);
+		return NULL;
+	}
+
+	p->count = threads;
+	eina_lock_new(&p->lock);
+	eina_condition_new(&p->cond, &p->lock);
+
+	for (i = 0; i < threads; i++) {
+		p->workers[i].pool = p;
+		p->workers[i].index = i;
+		eina_lock_new(&p->workers[i].lock);
+	}
+
+	for (i = 0; i < threads; i++) {
+		p->workers[i].started = eina_thread_create(&p->workers[i].thread,
+				EINA_THREAD_NORMAL, -1, _worker_run, &p->workers[i]);
+		if (!p->workers[i].started)
+			WARN("Couldn't start worker thread %u.", i);
+	}
+
+	DBG("Started a pool of %u workers.", threads);
+
+	return p;
+}
+
+/* queue a task. tasks pushed by a worker go to its own queue,
+ * others are spread over all workers.
+ * tasks for a worker, which couldn't be started, run in the calling thread */
+Eina_Bool _etvdb_pool_push(Pool *p, Pool_Task_Cb cb, void *data)
+{
+	Pool_Worker *w;
+
+	if (_self && _self->pool == p)
+		w = _self;
+	else {
+		eina_lock_take(&p->lock);
+		w = &p->workers[p->next++ % p->count];
+		eina_lock_release(&p->lock);
+	}
+
+	/* nobody would take it from a worker, which couldn't be started */
+	if (!w->started) {
+		cb(data);
+		return EINA_TRUE;
+	}
+
+	/* counted before it can be taken, so pending never drops below the queued tasks */
+	__atomic_add_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+	if (!_queue_push(w, cb, data)) {
+		__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+		return EINA_FALSE;
+	}
+
+	eina_lock_take(&p->lock);
+	eina_condition_signal(&p->cond);
+	eina_lock_release(&p->lock);
+
+	return EINA_TRUE;
+}
+
+/* run all queued tasks, stop the workers and free the pool */
+void _etvdb_pool_free(Pool *p)
+{
+	unsigned int i;
+
+	eina_lock_take(&p->lock);
+	p->quit = EINA_TRUE;
+	eina_condition_broadcast(&p->cond);
+	eina_lock_release(&p->lock);
+
+	for (i = 0; i < p->count; i++)
+		if (p->workers[i].started)
+			eina_thread_join(p->workers[i].thread);
+
+	for (i = 0; i < p->count; i++) {
+		eina_lock_free(&p->workers[i].lock);
+		free(p->workers[i].tasks);
+	}
+
+	eina_condition_free(&p->cond);
+	eina_lock_free(&p->lock);
+	free(p->workers);
+	free(p);
+}
+
+/* run a task of a group and wake up its waiter */
+static void _group_task_run(void *data)
+{
+	Pool_Group_Task *t = data;
+	Pool_Group *g = t->group;
+
+	t->cb(t->data);
+	free(t);
+
+	eina_lock_take(&g->lock);
+	if (!--g->pending)
+		eina_condition_broadcast(&g->cond);
+	eina_lock_release(&g->lock);
+}
+
+static void *_worker_run(void *data, Eina_Thread t UNUSED)
+{
+	Pool_Worker *w = data;
+	Pool *p = w->pool;
+	Pool_Task task;
+
+	_self = w;
+
+	for (;;) {
+		if (_task_get(w, &task)) {
+			__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+			task.cb(task.data);
+			continue;
+		}
+
+		eina_lock_take(&p->lock);
+		while (!__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) && !p->quit)
+			eina_condition_wait(&p->cond);
+
+		if (p->quit && !__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE)) {
+			eina_lock_release(&p->lock);
+			break;
+		}
+		eina_lock_release(&p->lock);
+	}
+
+	_self = NULL;
+
+	return NULL;
+}
+
+/* take the newest own task, or steal the oldest task of another worker */
+static Eina_Bool _task_get(Pool_Worker *w, Pool_Task *task)
+{
+	unsigned int i;
+	Pool *p = w->pool;
+
+	if (_queue_pop(w, task))
+		return EINA_TRUE;
+
+	for (i = 1; i < p->count; i++)
+		if (_queue_steal(&p->workers[(w->index + i) % p->count], task))
+			return EINA_TRUE;
+
+	return EINA_FALSE;
+}
+
+static Eina_Bool _queue_push(Pool_Worker *w, Pool_Task_Cb cb, void *data)
+{
+	unsigned int i, size;
+	Pool_Task *tasks;
+
+	eina_lock_take(&w->lock);
+
+	if (w->count == w->size) {
+		size = w->size ? w->size * 2 : QUEUE_SIZE_INITIAL;
+		tasks = malloc(size * sizeof(Pool_Task));
+		if (!tasks) {
+			ERR("Couldn't allocate enough memory.");
+			eina_lock_release(&w->lock);
+			return EINA_FALSE;
+		}
+
+		/* unwrap the ring buffer */
+		for (i = 0; i < w->count; i++)
+			tasks[i] = w->tasks[(w->head + i) % w->size];
+
+		free(w->tasks);
+		w->tasks = tasks;
+		w->size = size;
+		w->head = 0;
+	}
+
+	w->tasks[(w->head + w->count) % w->size].cb = cb;
+	w->tasks[(w->head + w->count) % w->size].data = data;
+	w->count++;
+
+	eina_lock_release(&w->lock);
+
+	return EINA_TRUE;
+}
+
+/* take the newest task, it is likely still in the cache */
+static Eina_Bool _queue_pop(Pool_Worker *w, Pool_Task *task)
+{
+	Eina_Bool found = EINA_FALSE;
+
+	eina_lock_take(&w->lock);
+	if (w->count) {
+		w->count--;
+		*task = w->tasks[(w->head + w->count) % w->size];
+		found = EINA_TRUE;
+	}
+	eina_lock_release(&w->lock);
+
+	return found;
+}
+
+/* take the oldest task */
+static Eina_Bool _queue_steal(Pool_Worker *w, Pool_Task *task)
+{
+	Eina_Bool found = EINA_FALSE;
+
+	eina_lock_take(&w->lock);
+	if (w->count) {
+		*task = w->tasks[w->head];
+		w->head = (w->head + 1) % w->size;
+		w->count--;
+		found = EINA_TRUE;
+	}
+	eina_lock_release(&w->lock);
+
+	return found;
+}
@@ -0,0 +1,556 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+#include <time.h>
+
+/* requests per second, if no budget is given */
+#define REFRESH_RATE_DEFAULT 1.0
+
+/* requests, which can be spent at once after an idle period */
+#define REFRESH_BURST 4.0
+
+/* default refresh intervals in seconds */
+#define REFRESH_AIRING_DEFAULT (6 * 3600.0)
+#define REFRESH_ENDED_DEFAULT (7 * 86400.0)
+
+/* a Series counts as airing, if an Episode aired in this many days or is upcoming */
+#define REFRESH_AIRING_DAYS 60
+
+/* a tracked Series */
+typedef struct _refresh_entry {
+	uint32_t id; /**< TVDB ID of the Series */
+	Series *s; /**< current version of the Series */
+	uint32_t fingerprint; /**< fingerprint of the current version */
+	double due; /**< time of the next refresh */
+	double interval; /**< current refresh interval, adapted to the changes seen */
+	int heap; /**< index in the heap, -1 if it isn't queued */
+	Eina_Bool busy; /**< the Series is being refreshed */
+	Eina_Bool removed; /**< the Series was removed while it was refreshed */
+} Refresh_Entry;
+
+/* this structure represents a refresh scheduler */
+struct _etvdb_refresh {
+	Eina_Hash *entries; /**< ID -> Refresh_Entry */
+	Refresh_Entry **heap; /**< min-heap of the queued entries by due time */
+	unsigned int count; /**< number of queued entries */
+	unsigned int size; /**< allocated size of the heap */
+	double rate; /**< request budget per second */
+	double tokens; /**< requests, which can be made now */
+	double last; /**< time the tokens were refilled */
+	double airing; /**< base interval of airing Series */
+	double ended; /**< base interval of ended Series */
+	Etvdb_Refresh_Cb cb; /**< callback for refreshed Series */
+	void *data; /**< data of the callback */
+	Eina_Thread thread; /**< the scheduler thread */
+	Eina_Lock lock; /**< protects everything above */
+	Eina_Condition cond; /**< wakes up the scheduler thread */
+	Eina_Bool stop; /**< the scheduler thread has to stop */
+};
+
+/* internal functions */
+static void *_run(void *data, Eina_Thread t UNUSED);
+static double _base_get(const Etvdb_Refresh *r, Series *s);
+static uint32_t _fingerprint(Series *s);
+static uint32_t _hash_add(uint32_t h, const void *data, size_t len);
+static void _schedule(Etvdb_Refresh *r, Refresh_Entry *entry, double due);
+static Eina_Bool _heap_push(Etvdb_Refresh *r, Refresh_Entry *entry);
+static void _heap_remove(Etvdb_Refresh *r, Refresh_Entry *entry);
+static void _heap_up(Etvdb_Refresh *r, unsigned int i);
+static void _heap_down(Etvdb_Refresh *r, unsigned int i);
+static void _heap_swap(Etvdb_Refresh *r, unsigned int i, unsigned int j);
+static Eina_Bool _entry_free_cb(const Eina_Hash *hash, const void *key, void *data, void *fdata);
+
+/**
+ * @brief Background Refresh
+ * @defgroup Refresh
+ *
+ * @{
+ *
+ * A refresh scheduler keeps populated Series fresh in the background.
+ *
+ * Every Series is refreshed after an interval, which depends on it:
+ * Series with recent or upcoming Episodes are refreshed often,
+ * ended Series rarely. The interval adapts to the changes seen,
+ * it is halved when a refresh found changes and doubled when not,
+ * between a quarter and four times the base interval.
+ *
+ * Refreshes are made by a thread of the scheduler, within a budget
+ * of requests per second shared by all Series, so many Series
+ * becoming due at the same time don't cause a burst of requests.
+ * A refreshed Series is a new Series, which is passed to the callback
+ * of the scheduler to be swapped in.
+ */
+
+/**
+ * @brief Create a refresh scheduler
+ *
+ * cb is called from the scheduler thread for every refreshed Series
+ * with the old and the new version. The new version is tracked from
+ * then on, the callback swaps it in and frees the old version
+ * with etvdb_series_free(), once it isn't used anymore.
+ * The scheduler never frees Series.
+ *
+ * @param rate request budget per second, 0 for the default of 1
+ * @param cb callback for refreshed Series
+ * @param data data passed to cb
+ *
+ * @return a new scheduler on success, NULL on failure
+ *
+ * @see etvdb_refresh_free()
+ *
+ * @ingroup Refresh
+ */
+EAPI Etvdb_Refresh *etvdb_refresh_new(double rate, Etvdb_Refresh_Cb cb, const void *data)
+{
+	Etvdb_Refresh *r;
+
+	if (!cb) {
+		ERR("A refresh scheduler needs a callback.");
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(Etvdb_Refresh));
+	if (!r) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	r->rate = rate > 0 ? rate : REFRESH_RATE_DEFAULT;
+	r->tokens = REFRESH_BURST;
+	r->last = etvdb_time_get();
+	r->airing = REFRESH_AIRING_DEFAULT;
+	r->ended = REFRESH_ENDED_DEFAULT;
+	r->cb = cb;
+	r->data = (void *)data;
+
+	r->entries = eina_hash_int32_new(NULL);
+	if (!r->entries) {
+		free(r);
+		return NULL;
+	}
+
+	eina_lock_new(&r->lock);
+	eina_condition_new(&r->cond, &r->lock);
+
+	if (!eina_thread_create(&r->thread, EINA_THREAD_BACKGROUND, -1, _run, r)) {
+		ERR("Couldn't start the refresh thread.");
+		eina_condition_free(&r->cond);
+		eina_lock_free(&r->lock);
+		eina_hash_free(r->entries);
+		free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/**
+ * @brief Free a refresh scheduler
+ *
+ * This function waits for a running refresh. The tracked Series
+ * are not freed.
+ *
+ * @param r the scheduler
+ *
+ * @ingroup Refresh
+ */
+EAPI void etvdb_refresh_free(Etvdb_Refresh *r)
+{
+	if (!r)
+		return;
+
+	eina_lock_take(&r->lock);
+	r->stop = EINA_TRUE;
+	eina_condition_broadcast(&r->cond);
+	eina_lock_release(&r->lock);
+
+	eina_thread_join(r->thread);
+
+	eina_hash_foreach(r->entries, _entry_free_cb, NULL);
+	eina_hash_free(r->entries);
+	free(r->heap);
+	eina_condition_free(&r->cond);
+	eina_lock_free(&r->lock);
+	free(r);
+}
+
+/**
+ * @brief Set the base refresh intervals
+ *
+ * The intervals of tracked Series are adapted, when they are refreshed next.
+ *
+ * @param r the scheduler
+ * @param airing base interval of Series with recent or upcoming Episodes in seconds, 6 hours by default
+ * @param ended base interval of other Series in seconds, 7 days by default
+ *
+ * @ingroup Refresh
+ */
+EAPI void etvdb_refresh_intervals_set(Etvdb_Refresh *r, double airing, double ended)
+{
+	eina_lock_take(&r->lock);
+	if (airing > 0)
+		r->airing = airing;
+	if (ended > 0)
+		r->ended = ended;
+	eina_condition_broadcast(&r->cond);
+	eina_lock_release(&r->lock);
+}
+
+/**
+ * @brief Keep a Series fresh
+ *
+ * The Series is taken as just refreshed, it is refreshed first
+ * after its base interval.
+ *
+ * @param r the scheduler
+ * @param s a populated Series, which has to stay valid until the
+ * callback replaces it or it is removed from the scheduler
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if it couldn't be added or is tracked already
+ *
+ * @ingroup Refresh
+ */
+EAPI Eina_Bool etvdb_refresh_series_add(Etvdb_Refresh *r, Series *s)
+{
+	Refresh_Entry *entry;
+	Eina_Bool ok = EINA_FALSE;
+
+	entry = calloc(1, sizeof(Refresh_Entry));
+	if (!entry) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	entry->id = s->id;
+	entry->s = s;
+	entry->fingerprint = _fingerprint(s);
+	entry->heap = -1;
+
+	eina_lock_take(&r->lock);
+
+	if (eina_hash_find(r->entries, &s->id)) {
+		ERR("Series %"PRIu32" is refreshed already.", s->id);
+		goto end;
+	}
+
+	entry->interval = _base_get(r, s);
+	if (!eina_hash_add(r->entries, &entry->id, entry))
+		goto end;
+
+	_schedule(r, entry, etvdb_time_get() + entry->interval);
+	ok = EINA_TRUE;
+
+end:
+	eina_lock_release(&r->lock);
+	if (!ok)
+		free(entry);
+
+	return ok;
+}
+
+/**
+ * @brief Stop refreshing a Series
+ *
+ * A running refresh of the Series is discarded.
+ *
+ * @param r the scheduler
+ * @param s the Series, or any version of it
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if the Series isn't tracked
+ *
+ * @ingroup Refresh
+ */
+EAPI Eina_Bool etvdb_refresh_series_del(Etvdb_Refresh *r, Series *s)
+{
+	Refresh_Entry *entry;
+
+	eina_lock_take(&r->lock);
+
+	entry = eina_hash_find(r->entries, &s->id);
+	if (!entry) {
+		eina_lock_release(&r->lock);
+		return EINA_FALSE;
+	}
+
+	eina_hash_del_by_key(r->entries, &s->id);
+	if (entry->heap >= 0)
+		_heap_remove(r, entry);
+
+	/* the scheduler thread frees it, when it is done with it */
+	if (entry->busy)
+		entry->removed = EINA_TRUE;
+	else
+		free(entry);
+
+	eina_lock_release(&r->lock);
+
+	return EINA_TRUE;
+}
+/**
+ * @}
+ */
+
+/* the scheduler thread: refresh the most overdue Series, when the budget allows it */
+static void *_run(void *data, Eina_Thread t UNUSED)
+{
+	double now, wait, base;
+	uint32_t fp = 0;
+	Etvdb_Refresh *r = data;
+	Refresh_Entry *entry;
+	Series *old, *fresh;
+
+	eina_lock_take(&r->lock);
+
+	while (!r->stop) {
+		now = etvdb_time_get();
+		r->tokens += (now - r->last) * r->rate;
+		if (r->tokens > REFRESH_BURST)
+			r->tokens = REFRESH_BURST;
+		r->last = now;
+
+		if (!r->count) {
+			eina_condition_wait(&r->cond);
+			continue;
+		}
+
+		entry = r->heap[0];
+		wait = entry->due - now;
+		if (wait <= 0 && r->tokens < 1)
+			wait = (1 - r->tokens) / r->rate;
+		if (wait > 0) {
+			eina_condition_timedwait(&r->cond, wait);
+			continue;
+		}
+
+		r->tokens -= 1;
+		_heap_remove(r, entry);
+		entry->busy = EINA_TRUE;
+		eina_lock_release(&r->lock);
+
+		fresh = _etvdb_series_all_get(entry->id);
+		if (fresh)
+			fp = _fingerprint(fresh);
+
+		eina_lock_take(&r->lock);
+
+		if (entry->removed || r->stop) {
+			if (entry->removed)
+				free(entry);
+			if (fresh)
+				etvdb_series_free(fresh);
+			continue;
+		}
+
+		if (!fresh) {
+			/* try again soon, but not at once */
+			entry->busy = EINA_FALSE;
+			_schedule(r, entry, now + entry->interval / 4);
+			continue;
+		}
+
+		base = _base_get(r, fresh);
+		if (fp != entry->fingerprint)
+			entry->interval /= 2;
+		else
+			entry->interval *= 2;
+		if (entry->interval < base / 4)
+			entry->interval = base / 4;
+		if (entry->interval > base * 4)
+			entry->interval = base * 4;
+
+		old = entry->s;
+		entry->s = fresh;
+		entry->fingerprint = fp;
+
+		DBG("Refreshed Series %"PRIu32", next refresh in %.0f seconds.", entry->id, entry->interval);
+
+		/* the callback may add or remove Series */
+		eina_lock_release(&r->lock);
+		r->cb(r->data, old, fresh);
+		eina_lock_take(&r->lock);
+
+		entry->busy = EINA_FALSE;
+		if (entry->removed)
+			free(entry);
+		else
+			_schedule(r, entry, etvdb_time_get() + entry->interval);
+	}
+
+	eina_lock_release(&r->lock);
+
+	return NULL;
+}
+
+/* get the base interval of a Series: airing, if an Episode aired lately or is upcoming */
+static double _base_get(const Etvdb_Refresh *r, Series *s)
+{
+	struct tm ltime;
+	time_t t;
+	uint32_t since, date;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	t = time(NULL) - REFRESH_AIRING_DAYS * 86400;
+	localtime_r(&t, &ltime);
+	since = DATE_PACK(ltime.tm_year + 1900, ltime.tm_mon + 1, ltime.tm_mday);
+
+	/* the latest Episodes are at the end of the last season */
+	EINA_LIST_REVERSE_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_REVERSE_FOREACH(sl, ll, e) {
+			date = _etvdb_date_pack(e->firstaired);
+			if (date >= since)
+				return r->airing;
+		}
+		break;
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e) {
+		date = _etvdb_date_pack(e->firstaired);
+		if (date >= since)
+			return r->airing;
+	}
+
+	return r->ended;
+}
+
+/* fingerprint the data of a Series, which changes between refreshes */
+static uint32_t _fingerprint(Series *s)
+{
+	uint32_t h = 2166136261u;
+	const char *str;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	str = etvdb_series_overview_get(s);
+	h = _hash_add(h, s->name, s->name ? strlen(s->name) : 0);
+	h = _hash_add(h, str, str ? strlen(str) : 0);
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e) {
+			h = _hash_add(h, &e->id, sizeof(e->id));
+			h = _hash_add(h, e->firstaired, e->firstaired ? strlen(e->firstaired) : 0);
+			str = etvdb_episode_name_get(e);
+			h = _hash_add(h, str, str ? strlen(str) : 0);
+		}
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e) {
+		h = _hash_add(h, &e->id, sizeof(e->id));
+		h = _hash_add(h, e->firstaired, e->firstaired ? strlen(e->firstaired) : 0);
+		str = etvdb_episode_name_get(e);
+		h = _hash_add(h, str, str ? strlen(str) : 0);
+	}
+
+	return h;
+}
+
+/* FNV-1a */
+static uint32_t _hash_add(uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+
+	/* separates the fields */
+	h ^= 0xff;
+	h *= 16777619u;
+
+	return h;
+}
+
+/* queue an entry and wake up the scheduler thread, if it is due first */
+static void _schedule(Etvdb_Refresh *r, Refresh_Entry *entry, double due)
+{
+	entry->due = due;
+	if (!_heap_push(r, entry)) {
+		ERR("Couldn't schedule Series %"PRIu32, entry->id);
+		return;
+	}
+
+	if (r->heap[0] == entry)
+		eina_condition_signal(&r->cond);
+}
+
+static Eina_Bool _heap_push(Etvdb_Refresh *r, Refresh_Entry *entry)
+{
+	unsigned int size;
+	Refresh_Entry **heap;
+
+	if (r->count == r->size) {
+		size = r->size ? r->size * 2 : 16;
+		heap = realloc(r->heap, size * sizeof(Refresh_Entry *));
+		if (!heap)
+			return EINA_FALSE;
+		r->heap = heap;
+		r->size = size;
+	}
+
+	entry->heap = r->count;
+	r->heap[r->count++] = entry;
+	_heap_up(r, entry->heap);
+
+	return EINA_TRUE;
+}
+
+static void _heap_remove(Etvdb_Refresh *r, Refresh_Entry *entry)
+{
+	unsigned int i = entry->heap;
+	Refresh_Entry *moved;
+
+	entry->heap = -1;
+	if (i == --r->count)
+		return;
+
+	/* the last entry takes the place and moves up or down from there */
+	moved = r->heap[r->count];
+	r->heap[i] = moved;
+	moved->heap = i;
+	_heap_up(r, i);
+	_heap_down(r, moved->heap);
+}
+
+static void _heap_up(Etvdb_Refresh *r, unsigned int i)
+{
+	while (i && r->heap[i]->due < r->heap[(i - 1) / 2]->due) {
+		_heap_swap(r, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void _heap_down(Etvdb_Refresh *r, unsigned int i)
+{
+	unsigned int min, c;
+
+	for (;;) {
+		min = i;
+		c = 2 * i + 1;
+		if (c < r->count && r->heap[c]->due < r->heap[min]->due)
+			min = c;
+		if (c + 1 < r->count && r->heap[c + 1]->due < r->heap[min]->due)
+			min = c + 1;
+		if (min == i)
+			break;
+		_heap_swap(r, i, min);
+		i = min;
+	}
+}
+
+static void _heap_swap(Etvdb_Refresh *r, unsigned int i, unsigned int j)
+{
+	Refresh_Entry *tmp = r->heap[i];
+
+	r->heap[i] = r->heap[j];
+	r->heap[j] = tmp;
+	r->heap[i]->heap = i;
+	r->heap[j]->heap = j;
+}
+
+static Eina_Bool _entry_free_cb(const Eina_Hash *hash UNUSED, const void *key UNUSED,
+		void *data, void *fdata UNUSED)
+{
+	free(data);
+
+	return EINA_TRUE;
+}
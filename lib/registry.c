@@ -0,0 +1,379 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* registered objects, all hashes point to objects owned by the registered Series */
+static Eina_Hash *_series = NULL;
+static Eina_Hash *_series_imdb = NULL;
+static Eina_Hash *_episodes = NULL;
+static Eina_Hash *_episodes_imdb = NULL;
+static Eina_Lock _registry_lock;
+static Eina_Bool _enabled = EINA_FALSE;
+
+/* internal functions */
+static void _episodes_del(Series *s);
+static void _episode_add(Episode *e);
+static void _episode_del(Episode *e);
+static Series *_series_ref(Series *s);
+
+/**
+ * @brief Identity Map
+ * @defgroup Registry
+ *
+ * @{
+ *
+ * The registry maps TVDB Series IDs, TVDB Episode IDs and IMDB IDs
+ * to the loaded Series and Episodes, so every Series is loaded once.
+ *
+ * While it is enabled, etvdb_series_by_id_get() returns the Series,
+ * which is loaded already, instead of downloading it again,
+ * and etvdb_series_populate() registers the Episodes of such a Series.
+ * etvdb_episode_by_id_get() returns an Episode of a loaded Series,
+ * which is part of that Series.
+ *
+ * A registered Series is shared: every etvdb_series_by_id_get() takes
+ * a reference, which is given back with etvdb_series_free().
+ * The Series is freed with the last reference.
+ * Registered Episodes belong to their Series, etvdb_episode_free() ignores them.
+ * As other holders may point at its Episodes, a Series, which is
+ * shared and has Episodes already, can't be populated again.
+ */
+
+/**
+ * @brief Enable or disable the registry
+ *
+ * Disabling it stops new registrations and lookups, Series which are
+ * registered already stay shared until they are freed.
+ *
+ * @param enable EINA_TRUE to enable the registry
+ *
+ * @ingroup Registry
+ */
+EAPI void etvdb_registry_set(Eina_Bool enable)
+{
+	eina_lock_take(&_registry_lock);
+	_enabled = enable;
+	eina_lock_release(&_registry_lock);
+}
+
+/**
+ * @brief Get a loaded Series by its TVDB ID
+ *
+ * @param id TVDB Series ID
+ *
+ * @return the Series with a new reference, which has to be given back with etvdb_series_free()
+ * @return NULL if it isn't loaded
+ *
+ * @ingroup Registry
+ */
+EAPI Series *etvdb_registry_series_get(uint32_t id)
+{
+	Series *s;
+
+	eina_lock_take(&_registry_lock);
+	s = _series_ref(_enabled ? eina_hash_find(_series, &id) : NULL);
+	eina_lock_release(&_registry_lock);
+
+	return s;
+}
+
+/**
+ * @brief Get a loaded Series by its IMDB ID
+ *
+ * @param imdb_id IMDB Series ID, e.g. "tt0096697"
+ *
+ * @return the Series with a new reference, which has to be given back with etvdb_series_free()
+ * @return NULL if it isn't loaded
+ *
+ * @ingroup Registry
+ */
+EAPI Series *etvdb_registry_series_by_imdb_get(const char *imdb_id)
+{
+	Series *s;
+
+	if (!imdb_id)
+		return NULL;
+
+	eina_lock_take(&_registry_lock);
+	s = _series_ref(_enabled ? eina_hash_find(_series_imdb, imdb_id) : NULL);
+	eina_lock_release(&_registry_lock);
+
+	return s;
+}
+
+/**
+ * @brief Get a loaded Episode by its TVDB ID
+ *
+ * @param id TVDB Episode ID
+ *
+ * @return the Episode, which is valid as long as its Series
+ * @return NULL if it isn't loaded
+ *
+ * @ingroup Registry
+ */
+EAPI Episode *etvdb_registry_episode_get(uint32_t id)
+{
+	Episode *e;
+
+	eina_lock_take(&_registry_lock);
+	e = _enabled ? eina_hash_find(_episodes, &id) : NULL;
+	eina_lock_release(&_registry_lock);
+
+	return e;
+}
+
+/**
+ * @brief Get a loaded Episode by its IMDB ID
+ *
+ * @param imdb_id IMDB Episode ID
+ *
+ * @return the Episode, which is valid as long as its Series
+ * @return NULL if it isn't loaded
+ *
+ * @ingroup Registry
+ */
+EAPI Episode *etvdb_registry_episode_by_imdb_get(const char *imdb_id)
+{
+	Episode *e;
+
+	if (!imdb_id)
+		return NULL;
+
+	eina_lock_take(&_registry_lock);
+	e = _enabled ? eina_hash_find(_episodes_imdb, imdb_id) : NULL;
+	eina_lock_release(&_registry_lock);
+
+	return e;
+}
+/**
+ * @}
+ */
+
+/* set up the registry, called by etvdb_init() */
+Eina_Bool _etvdb_registry_init(void)
+{
+	if (!eina_lock_new(&_registry_lock))
+		return EINA_FALSE;
+
+	_series = eina_hash_int32_new(NULL);
+	_series_imdb = eina_hash_string_superfast_new(NULL);
+	_episodes = eina_hash_int32_new(NULL);
+	_episodes_imdb = eina_hash_string_superfast_new(NULL);
+
+	if (!_series || !_series_imdb || !_episodes || !_episodes_imdb) {
+		_etvdb_registry_shutdown();
+		return EINA_FALSE;
+	}
+
+	return EINA_TRUE;
+}
+
+/* free the registry, called by etvdb_shutdown(). registered objects are left alone */
+void _etvdb_registry_shutdown(void)
+{
+	eina_hash_free(_series);
+	eina_hash_free(_series_imdb);
+	eina_hash_free(_episodes);
+	eina_hash_free(_episodes_imdb);
+	_series = _series_imdb = _episodes = _episodes_imdb = NULL;
+	_enabled = EINA_FALSE;
+
+	eina_lock_free(&_registry_lock);
+}
+
+/* register a full Series record and return the canonical Series.
+ * if another thread registered the Series meanwhile, s is freed */
+Series *_etvdb_registry_series_add(Series *s)
+{
+	Series *found;
+	Series_Priv *priv;
+
+	eina_lock_take(&_registry_lock);
+
+	if (!_enabled) {
+		eina_lock_release(&_registry_lock);
+		return s;
+	}
+
+	found = _series_ref(eina_hash_find(_series, &s->id));
+	if (found) {
+		eina_lock_release(&_registry_lock);
+		etvdb_series_free(s);
+		return found;
+	}
+
+	priv = _etvdb_series_priv_get(s);
+	if (!priv || !eina_hash_add(_series, &s->id, s)) {
+		eina_lock_release(&_registry_lock);
+		return s;
+	}
+
+	priv->loads = 1;
+	if (s->imdb_id && *s->imdb_id)
+		eina_hash_add(_series_imdb, s->imdb_id, s);
+
+	eina_lock_release(&_registry_lock);
+
+	return s;
+}
+
+/* register the Episodes of a Series, if the Series is registered */
+void _etvdb_registry_episodes_add(Series *s)
+{
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	if (!s->priv || !s->priv->loads)
+		return;
+
+	eina_lock_take(&_registry_lock);
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_add(e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_add(e);
+
+	eina_lock_release(&_registry_lock);
+}
+
+/* unregister the Episodes of a Series, before they are freed */
+void _etvdb_registry_episodes_del(Series *s)
+{
+	if (!s->priv || !s->priv->loads)
+		return;
+
+	eina_lock_take(&_registry_lock);
+	_episodes_del(s);
+	eina_lock_release(&_registry_lock);
+}
+
+/* replace the IMDB ID of a Series, which takes over imdb_id.
+ * a registered Series is keyed by the new ID, so the old one doesn't find it any more */
+void _etvdb_registry_series_imdb_set(Series *s, char *imdb_id)
+{
+	char *old;
+
+	if (!s->priv || !s->priv->loads) {
+		free(s->imdb_id);
+		s->imdb_id = imdb_id;
+		return;
+	}
+
+	eina_lock_take(&_registry_lock);
+
+	old = s->imdb_id;
+	if (old && *old)
+		eina_hash_del(_series_imdb, old, s);
+
+	s->imdb_id = imdb_id;
+	if (imdb_id && *imdb_id)
+		eina_hash_set(_series_imdb, imdb_id, s);
+
+	eina_lock_release(&_registry_lock);
+
+	free(old);
+}
+
+/* give back a reference to a Series.
+ * returns EINA_TRUE if the Series has to be freed now, it is unregistered then */
+Eina_Bool _etvdb_registry_series_release(Series *s)
+{
+	Eina_Bool last;
+
+	if (!s->priv || !s->priv->loads)
+		return EINA_TRUE;
+
+	eina_lock_take(&_registry_lock);
+
+	last = !--s->priv->loads;
+	if (last) {
+		eina_hash_del(_series, &s->id, s);
+		if (s->imdb_id && *s->imdb_id)
+			eina_hash_del(_series_imdb, s->imdb_id, s);
+		_episodes_del(s);
+	}
+
+	eina_lock_release(&_registry_lock);
+
+	return last;
+}
+
+/* check if other holders have a reference to a Series, its Episodes must not be replaced then */
+Eina_Bool _etvdb_registry_series_shared(Series *s)
+{
+	Eina_Bool shared;
+
+	if (!s->priv || !s->priv->loads)
+		return EINA_FALSE;
+
+	eina_lock_take(&_registry_lock);
+	shared = s->priv->loads > 1;
+	eina_lock_release(&_registry_lock);
+
+	return shared;
+}
+
+/* get a registered Episode for etvdb_episode_by_id_get().
+ * if *s isn't set, it gets the Series of the Episode with a new reference */
+Episode *_etvdb_registry_episode_find(uint32_t id, Series **s)
+{
+	Episode *e;
+
+	eina_lock_take(&_registry_lock);
+
+	e = _enabled ? eina_hash_find(_episodes, &id) : NULL;
+	if (e) {
+		if (!*s || !(*s)->id)
+			*s = _series_ref(e->series);
+		else if (*s != e->series)
+			e = NULL;
+	}
+
+	eina_lock_release(&_registry_lock);
+
+	return e;
+}
+
+/* unregister the Episodes of a Series, the lock is held */
+static void _episodes_del(Series *s)
+{
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_del(e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_del(e);
+}
+
+/* register an Episode, the lock is held */
+static void _episode_add(Episode *e)
+{
+	eina_hash_set(_episodes, &e->id, e);
+	if (e->imdb_id && *e->imdb_id)
+		eina_hash_set(_episodes_imdb, e->imdb_id, e);
+	e->owner |= EPISODE_OWNER_REGISTRY;
+}
+
+/* unregister an Episode, the lock is held */
+static void _episode_del(Episode *e)
+{
+	eina_hash_del(_episodes, &e->id, e);
+	if (e->imdb_id && *e->imdb_id)
+		eina_hash_del(_episodes_imdb, e->imdb_id, e);
+	e->owner &= ~EPISODE_OWNER_REGISTRY;
+}
+
+/* take a reference to a registered Series, the lock is held */
+static Series *_series_ref(Series *s)
+{
+	if (s)
+		s->priv->loads++;
+
+	return s;
+}
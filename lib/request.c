@@ -0,0 +1,1175 @@
+#include "etvdb_private.h"
+
+/* timeout used when no deadline was set, this was a fixed value before */
+#define REQUEST_TIMEOUT_DEFAULT 60.0
+
+/* maximum time to block in curl_multi_poll() before checking the deadline again */
+#define REQUEST_POLL_MS 250
+
+/* number of latency samples kept to calculate the hedge delay */
+#define LATENCY_SAMPLES 64
+
+/* minimum number of samples before the percentile is used */
+#define LATENCY_SAMPLES_MIN 8
+
+/* hedge delay used as long as there are not enough samples */
+#define HEDGE_DELAY_INITIAL 1.0
+
+/* this structure represents a cancellation token */
+struct _etvdb_cancel {
+	int triggered; /**< set to 1 when the token was triggered */
+};
+
+/* per thread transfer state, every thread uses its own handles */
+typedef struct _transfer_ctx {
+	CURLM *multi; /**< multi handle, which can be woken up on cancellation */
+	CURL *easy; /**< easy handle, reused to keep connections alive */
+	CURL *hedge; /**< easy handle for hedged requests, created on demand */
+	unsigned int seed; /**< seed for the backoff jitter */
+} Transfer_Ctx;
+
+/* one transfer slot of a download batch */
+typedef struct _batch_slot {
+	Download_Batch *batch; /**< batch the slot belongs to */
+	CURL *easy; /**< easy handle, reused for the following downloads */
+	Download dl; /**< data of the current download */
+	unsigned int index; /**< index of the current download */
+	double start; /**< start time of the current download */
+	Eina_Bool busy; /**< a download is running */
+} Batch_Slot;
+
+/* state of the resilience layer, shared by all threads */
+typedef struct _resilience_state {
+	Eina_Bool enabled; /**< resilience layer is used */
+	Etvdb_Resilience config; /**< current settings */
+	double latency[LATENCY_SAMPLES]; /**< ring buffer of successful request latencies */
+	unsigned int latency_count; /**< number of samples ever added */
+	unsigned int failures; /**< consecutive failed calls */
+	double open_until; /**< circuit breaker is open until this time */
+	Eina_Bool probing; /**< a call is probing a half open breaker */
+} Resilience_State;
+
+/* internal functions */
+static Transfer_Ctx *_transfer_ctx_get(void);
+static void _transfer_ctx_free(void *data);
+static void _transfer_ctx_cleanup(Transfer_Ctx *ctx);
+static CURL *_easy_new(void);
+static void _easy_setup(CURL *easy, const char *uri, curl_write_callback write_cb, void *userdata);
+static CURLcode _easy_result_get(CURL *easy, CURLcode res);
+static CURLcode _dl_attempt(Transfer_Ctx *ctx, Download *dl, const char *uri, double hedge_delay);
+static CURLcode _stream_attempt(Transfer_Ctx *ctx, Download_Stream *st, const char *uri);
+static Eina_Bool _batch_slot_start(Download_Batch *b, Batch_Slot *slot, unsigned int index,
+		const Etvdb_Resilience *r);
+static size_t _dl_stream_cb(char *ptr, size_t size, size_t nmemb, void *userdata);
+static size_t _batch_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata);
+static void _backoff_wait(Transfer_Ctx *ctx, double delay);
+static double _backoff_get(Transfer_Ctx *ctx, const Etvdb_Resilience *r, unsigned int attempt);
+static double _hedge_delay_get(const Etvdb_Resilience *r);
+static void _latency_add(double latency);
+static Eina_Bool _breaker_allow(void);
+static void _breaker_report(const Etvdb_Resilience *r, CURLcode res);
+static int _double_cmp(const void *a, const void *b);
+static int _xferinfo_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+		curl_off_t ultotal, curl_off_t ulnow);
+static int _batch_xferinfo_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+		curl_off_t ultotal, curl_off_t ulnow);
+
+/* deadline and token of the calls in the current thread */
+static __thread double _deadline = 0;
+static __thread Etvdb_Cancel *_cancel = NULL;
+
+/* transfer context of every thread, freed when the thread exits */
+static Eina_TLS _ctx_key;
+
+/* all transfer contexts, so they can be woken up and cleaned up */
+static Eina_List *_ctx_list = NULL;
+/* multi handles of running download batches, so they can be woken up */
+static Eina_List *_batch_list = NULL;
+static Eina_Lock _ctx_lock;
+
+/* resilience layer, disabled by default */
+static Resilience_State _res = {
+	.enabled = EINA_FALSE,
+	.config = {
+		.retries = 2,
+		.backoff_base = 0.1,
+		.backoff_max = 2.0,
+		.hedge_percentile = 95.0,
+		.hedge_delay_min = 0.05,
+		.breaker_threshold = 5,
+		.breaker_cooldown = 30.0,
+	},
+};
+static Eina_Lock _res_lock;
+
+/**
+ * @brief Request Deadlines, Cancellation and Resilience
+ * @defgroup Requests
+ *
+ * @{
+ *
+ * These functions limit how long etvdb calls may take,
+ * and control how failed or slow requests are handled.
+ *
+ * A deadline is an absolute point in time, as returned by etvdb_time_get(),
+ * and covers everything a call does: connecting, transferring and parsing.
+ * A call, which hits its deadline fails the same way as if the data couldn't
+ * be retrieved from the server.
+ *
+ * Deadlines and cancellation tokens are set per thread and apply to
+ * all following etvdb calls of that thread, until they are changed again.
+ * A cancellation token however can be triggered from any thread.
+ *
+ * The optional resilience layer retries failed requests, sends hedged
+ * requests if a server is slow to answer and stops sending requests
+ * for a while, if a server keeps failing.
+ * It is global for all threads and disabled by default.
+ */
+
+/**
+ * @brief Get the current time
+ *
+ * This function returns the time of a monotonic clock,
+ * which is not affected by changes of the system time.
+ * It is meant to be used to calculate deadlines.
+ *
+ * Example: etvdb_deadline_set(etvdb_time_get() + 2.0);
+ *
+ * @return current time in seconds
+ *
+ * @ingroup Requests
+ */
+EAPI double etvdb_time_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/**
+ * @brief Set the deadline for etvdb calls
+ *
+ * This function sets an absolute deadline for all following etvdb calls
+ * in the current thread.
+ * If no deadline is set, every transfer times out after 60 seconds.
+ *
+ * @param deadline absolute time as returned by etvdb_time_get(), or 0 to remove the deadline
+ *
+ * @see etvdb_time_get()
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_deadline_set(double deadline)
+{
+	_deadline = deadline;
+}
+
+/**
+ * @brief Get the deadline for etvdb calls
+ *
+ * @return the deadline of the current thread, or 0 if none is set
+ *
+ * @ingroup Requests
+ */
+EAPI double etvdb_deadline_get(void)
+{
+	return _deadline;
+}
+
+/**
+ * @brief Create a new cancellation token
+ *
+ * A cancellation token aborts all in-flight transfers and parsers
+ * of the calls it is attached to, as soon as it is triggered.
+ * It stays triggered until it is reset.
+ *
+ * @see etvdb_cancel_set()
+ * @see etvdb_cancel_trigger()
+ * @see etvdb_cancel_free()
+ *
+ * @return a new cancellation token on success, NULL on failure
+ *
+ * @ingroup Requests
+ */
+EAPI Etvdb_Cancel *etvdb_cancel_new(void)
+{
+	Etvdb_Cancel *c;
+
+	c = malloc(sizeof(Etvdb_Cancel));
+	if (!c) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	c->triggered = 0;
+
+	return c;
+}
+
+/**
+ * @brief Free a cancellation token
+ *
+ * The token must not be attached to a running call anymore.
+ *
+ * @param c cancellation token
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_cancel_free(Etvdb_Cancel *c)
+{
+	if (_cancel == c)
+		_cancel = NULL;
+
+	free(c);
+}
+
+/**
+ * @brief Attach a cancellation token to etvdb calls
+ *
+ * This function attaches a token to all following etvdb calls
+ * in the current thread.
+ * The same token can be attached in several threads.
+ *
+ * @param c cancellation token, or NULL to detach the current one
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_cancel_set(Etvdb_Cancel *c)
+{
+	_cancel = c;
+}
+
+/**
+ * @brief Trigger a cancellation token
+ *
+ * This function can be called from any thread and aborts
+ * all calls the token is attached to.
+ *
+ * @param c cancellation token
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_cancel_trigger(Etvdb_Cancel *c)
+{
+	Eina_List *l;
+	Transfer_Ctx *ctx;
+	CURLM *multi;
+
+	__atomic_store_n(&c->triggered, 1, __ATOMIC_SEQ_CST);
+
+	/* wake up all waiting transfers, they will check their own token */
+	eina_lock_take(&_ctx_lock);
+	EINA_LIST_FOREACH(_ctx_list, l, ctx)
+		curl_multi_wakeup(ctx->multi);
+	EINA_LIST_FOREACH(_batch_list, l, multi)
+		curl_multi_wakeup(multi);
+	eina_lock_release(&_ctx_lock);
+}
+
+/**
+ * @brief Reset a cancellation token
+ *
+ * After a reset the token can be used for new calls.
+ *
+ * @param c cancellation token
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_cancel_reset(Etvdb_Cancel *c)
+{
+	__atomic_store_n(&c->triggered, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Check if a cancellation token was triggered
+ *
+ * @param c cancellation token
+ *
+ * @return EINA_TRUE if it was triggered, EINA_FALSE otherwise
+ *
+ * @ingroup Requests
+ */
+EAPI Eina_Bool etvdb_cancel_triggered_get(Etvdb_Cancel *c)
+{
+	return __atomic_load_n(&c->triggered, __ATOMIC_SEQ_CST) ? EINA_TRUE : EINA_FALSE;
+}
+
+/**
+ * @brief Enable and configure the resilience layer
+ *
+ * With the resilience layer enabled, all requests (which are idempotent GETs)
+ * are retried with jittered exponential backoff if they fail.
+ * If a request didn't finish after the configured latency percentile
+ * of previous requests, a hedged duplicate is sent, the first response wins
+ * and the other transfer is cancelled.
+ * After a number of consecutive failed calls, a circuit breaker opens
+ * and calls fail immediately until the cooldown has passed.
+ *
+ * Retries and hedged requests always respect the deadline of a call.
+ *
+ * @param r settings to use, or NULL to disable the resilience layer
+ *
+ * @see etvdb_resilience_get()
+ *
+ * @ingroup Requests
+ */
+EAPI void etvdb_resilience_set(const Etvdb_Resilience *r)
+{
+	eina_lock_take(&_res_lock);
+	if (r) {
+		_res.config = *r;
+		_res.enabled = EINA_TRUE;
+	} else
+		_res.enabled = EINA_FALSE;
+
+	_res.failures = 0;
+	_res.open_until = 0;
+	_res.probing = EINA_FALSE;
+	eina_lock_release(&_res_lock);
+}
+
+/**
+ * @brief Get the settings of the resilience layer
+ *
+ * If the resilience layer was never configured, the default settings
+ * are returned, which can be modified and passed to etvdb_resilience_set().
+ *
+ * @param r structure the settings are written to
+ *
+ * @return EINA_TRUE if the resilience layer is enabled, EINA_FALSE otherwise
+ *
+ * @ingroup Requests
+ */
+EAPI Eina_Bool etvdb_resilience_get(Etvdb_Resilience *r)
+{
+	Eina_Bool enabled;
+
+	eina_lock_take(&_res_lock);
+	if (r)
+		*r = _res.config;
+	enabled = _res.enabled;
+	eina_lock_release(&_res_lock);
+
+	return enabled;
+}
+/**
+ * @}
+ */
+
+/* set up the request infrastructure, called by etvdb_init() */
+Eina_Bool _etvdb_request_init(void)
+{
+	return eina_lock_new(&_ctx_lock) && eina_lock_new(&_res_lock)
+		&& eina_tls_cb_new(&_ctx_key, _transfer_ctx_free);
+}
+
+/* clean up all transfer contexts, called by etvdb_shutdown() */
+void _etvdb_request_shutdown(void)
+{
+	Transfer_Ctx *ctx;
+
+	/* threads, which exit later, don't free their context again */
+	eina_tls_free(_ctx_key);
+
+	eina_lock_take(&_ctx_lock);
+	EINA_LIST_FREE(_ctx_list, ctx)
+		_transfer_ctx_cleanup(ctx);
+	eina_lock_release(&_ctx_lock);
+
+	eina_lock_free(&_ctx_lock);
+	eina_lock_free(&_res_lock);
+}
+
+/* check if the current call ran out of time or was cancelled */
+Eina_Bool _etvdb_request_expired(void)
+{
+	if (_cancel && etvdb_cancel_triggered_get(_cancel))
+		return EINA_TRUE;
+
+	if (_deadline > 0 && etvdb_time_get() >= _deadline)
+		return EINA_TRUE;
+
+	return EINA_FALSE;
+}
+
+/* get the cancellation token of the current thread, to pass it on to helper threads */
+Etvdb_Cancel *_etvdb_request_cancel_get(void)
+{
+	return _cancel;
+}
+
+/* remaining time of the current call in seconds */
+double _etvdb_request_remaining(void)
+{
+	if (_deadline > 0)
+		return _deadline - etvdb_time_get();
+
+	return REQUEST_TIMEOUT_DEFAULT;
+}
+
+/* this function downloads a uri to memory, honouring deadline, cancellation
+ * and the resilience layer. dl->data is always allocated and has to be free()d */
+CURLcode _etvdb_dl_mem(Download *dl, const char *uri)
+{
+	unsigned int attempt = 0;
+	double start, delay, hedge_delay = 0;
+	CURLcode res;
+	Eina_Bool resilient;
+	Etvdb_Resilience r;
+	Transfer_Ctx *ctx;
+
+	dl->data = malloc(1);
+	dl->len = 0;
+
+	if (_etvdb_request_expired()) {
+		ERR("Request deadline expired or call was cancelled.");
+		return CURLE_ABORTED_BY_CALLBACK;
+	}
+
+	ctx = _transfer_ctx_get();
+	if (!ctx)
+		return CURLE_FAILED_INIT;
+
+	resilient = etvdb_resilience_get(&r);
+	if (resilient) {
+		if (!_breaker_allow()) {
+			ERR("Circuit breaker is open, not requesting %s", uri);
+			return CURLE_COULDNT_CONNECT;
+		}
+		hedge_delay = _hedge_delay_get(&r);
+	}
+
+	for (;;) {
+		start = etvdb_time_get();
+		res = _dl_attempt(ctx, dl, uri, hedge_delay);
+
+		if (!res && resilient)
+			_latency_add(etvdb_time_get() - start);
+
+		if (!res || !resilient || res == CURLE_ABORTED_BY_CALLBACK || attempt >= r.retries)
+			break;
+
+		delay = _backoff_get(ctx, &r, attempt++);
+		if (delay >= _etvdb_request_remaining())
+			break;
+
+		WARN("Download of %s failed: %s. Retrying in %.2f seconds.",
+				uri, curl_easy_strerror(res), delay);
+		_backoff_wait(ctx, delay);
+
+		dl->len = 0;
+		dl->data[0] = '\0';
+	}
+
+	if (resilient)
+		_breaker_report(&r, res);
+
+	if (res == CURLE_ABORTED_BY_CALLBACK)
+		ERR("Request deadline expired or call was cancelled.");
+	else if (res)
+		ERR("Download of %s failed: %s", uri, curl_easy_strerror(res));
+
+	return res;
+}
+
+/* this function downloads a uri and passes every complete st->tag record to st->record_cb
+ * while the data arrives, so only one partial record is kept in memory.
+ * records can't be taken back, so failed downloads are only retried
+ * as long as no record was passed on, and there are no hedged requests. */
+CURLcode _etvdb_dl_stream(Download_Stream *st, const char *uri)
+{
+	unsigned int attempt = 0;
+	double delay;
+	CURLcode res;
+	Eina_Bool resilient;
+	Etvdb_Resilience r;
+	Transfer_Ctx *ctx;
+
+	st->buf.data = malloc(1);
+	st->buf.data[0] = '\0';
+	st->buf.len = 0;
+	st->records = 0;
+	st->stopped = EINA_FALSE;
+	st->aborted = EINA_FALSE;
+
+	if (_etvdb_request_expired()) {
+		ERR("Request deadline expired or call was cancelled.");
+		return CURLE_ABORTED_BY_CALLBACK;
+	}
+
+	ctx = _transfer_ctx_get();
+	if (!ctx)
+		return CURLE_FAILED_INIT;
+
+	resilient = etvdb_resilience_get(&r);
+	if (resilient && !_breaker_allow()) {
+		ERR("Circuit breaker is open, not requesting %s", uri);
+		return CURLE_COULDNT_CONNECT;
+	}
+
+	for (;;) {
+		res = _stream_attempt(ctx, st, uri);
+
+		/* the records passed on so far are incomplete */
+		if (st->aborted) {
+			res = _etvdb_request_expired() ? CURLE_ABORTED_BY_CALLBACK : CURLE_WRITE_ERROR;
+			break;
+		}
+
+		if (st->stopped) {
+			DBG("Stream of %s stopped after %u records.", uri, st->records);
+			res = CURLE_OK;
+			break;
+		}
+
+		if (!res || !resilient || res == CURLE_ABORTED_BY_CALLBACK
+				|| st->records || attempt >= r.retries)
+			break;
+
+		delay = _backoff_get(ctx, &r, attempt++);
+		if (delay >= _etvdb_request_remaining())
+			break;
+
+		WARN("Download of %s failed: %s. Retrying in %.2f seconds.",
+				uri, curl_easy_strerror(res), delay);
+		_backoff_wait(ctx, delay);
+
+		st->buf.len = 0;
+		st->buf.data[0] = '\0';
+	}
+
+	if (resilient)
+		_breaker_report(&r, res);
+
+	if (res == CURLE_ABORTED_BY_CALLBACK)
+		ERR("Request deadline expired or call was cancelled.");
+	else if (res)
+		ERR("Download of %s failed: %s", uri, curl_easy_strerror(res));
+
+	return res;
+}
+
+/* this function runs the downloads of a batch, at most b->connections at the same time.
+ * a download is only started, when b->admit_cb allows it, so the consumer of
+ * the finished downloads limits how many of them wait in memory.
+ * every download is passed to b->done_cb, failed ones are not retried or hedged.
+ * with b->write_cb set, the data is passed on while it arrives and dl->data is NULL.
+ * returns EINA_FALSE, if the batch was aborted by the deadline or cancellation */
+Eina_Bool _etvdb_dl_batch(Download_Batch *b)
+{
+	unsigned int i, next = 0, done = 0, finished, slots;
+	int running, msgs;
+	CURLcode res;
+	CURLMsg *msg;
+	CURLM *multi;
+	Batch_Slot *slot, *s;
+	Eina_Bool resilient, ok = EINA_TRUE;
+	Etvdb_Resilience r;
+
+	if (!b->count)
+		return EINA_TRUE;
+
+	slots = b->connections ? b->connections : 1;
+	if (slots > b->count)
+		slots = b->count;
+
+	multi = curl_multi_init();
+	slot = calloc(slots, sizeof(Batch_Slot));
+	if (!multi || !slot) {
+		ERR("Couldn't allocate enough memory.");
+		if (multi)
+			curl_multi_cleanup(multi);
+		free(slot);
+		return EINA_FALSE;
+	}
+
+	for (i = 0; i < slots; i++) {
+		slot[i].batch = b;
+		slot[i].easy = _easy_new();
+		if (!slot[i].easy) {
+			CRIT("cURL handles couldn't be initialized.");
+			ok = EINA_FALSE;
+			goto end;
+		}
+	}
+
+	curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)slots);
+
+	eina_lock_take(&_ctx_lock);
+	b->multi = multi;
+	_batch_list = eina_list_append(_batch_list, multi);
+	eina_lock_release(&_ctx_lock);
+
+	resilient = etvdb_resilience_get(&r);
+
+	while (done < b->count) {
+		if (_etvdb_request_expired()) {
+			ERR("Request deadline expired or call was cancelled.");
+			ok = EINA_FALSE;
+			break;
+		}
+
+		for (i = 0; i < slots && next < b->count; i++) {
+			if (slot[i].busy)
+				continue;
+			if (b->admit_cb && !b->admit_cb(b))
+				break;
+
+			if (!_batch_slot_start(b, &slot[i], next++, resilient ? &r : NULL))
+				done++;
+			else
+				curl_multi_add_handle(multi, slot[i].easy);
+		}
+
+		if (curl_multi_perform(multi, &running)) {
+			CRIT("cURL multi handle failed.");
+			ok = EINA_FALSE;
+			break;
+		}
+
+		finished = 0;
+		while ((msg = curl_multi_info_read(multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&s);
+			res = _easy_result_get(msg->easy_handle, msg->data.result);
+			curl_multi_remove_handle(multi, msg->easy_handle);
+
+			/* a download skipped by the consumer was answered by the server,
+			 * every other write error, e.g. a full disk, is a failure */
+			if (resilient) {
+				if (!res)
+					_latency_add(etvdb_time_get() - s->start);
+				if (res == CURLE_WRITE_ERROR && b->skipped_cb && b->skipped_cb(b, s->index))
+					_breaker_report(&r, CURLE_OK);
+				else
+					_breaker_report(&r, res);
+			}
+
+			s->busy = EINA_FALSE;
+			finished++;
+			done++;
+			b->done_cb(b, s->index, res, &s->dl);
+		}
+
+		/* free slots are refilled right away */
+		if (!finished)
+			curl_multi_poll(multi, NULL, 0, REQUEST_POLL_MS, NULL);
+	}
+
+	eina_lock_take(&_ctx_lock);
+	b->multi = NULL;
+	_batch_list = eina_list_remove(_batch_list, multi);
+	eina_lock_release(&_ctx_lock);
+
+end:
+	for (i = 0; i < slots; i++) {
+		if (slot[i].busy) {
+			curl_multi_remove_handle(multi, slot[i].easy);
+			free(slot[i].dl.data);
+		}
+		if (slot[i].easy)
+			curl_easy_cleanup(slot[i].easy);
+	}
+
+	curl_multi_cleanup(multi);
+	free(slot);
+
+	return ok;
+}
+
+/* wake up a batch waiting for b->admit_cb, can be called from any thread */
+void _etvdb_dl_batch_wakeup(Download_Batch *b)
+{
+	eina_lock_take(&_ctx_lock);
+	if (b->multi)
+		curl_multi_wakeup(b->multi);
+	eina_lock_release(&_ctx_lock);
+}
+
+/* start download index of a batch in a slot.
+ * returns EINA_FALSE, if it couldn't be started and was passed to b->done_cb already */
+static Eina_Bool _batch_slot_start(Download_Batch *b, Batch_Slot *slot, unsigned int index,
+		const Etvdb_Resilience *r)
+{
+	char uri[URI_MAX];
+
+	slot->index = index;
+	slot->dl.data = NULL;
+	slot->dl.len = 0;
+
+	/* data passed to b->write_cb is not collected */
+	if (!b->write_cb) {
+		slot->dl.data = malloc(1);
+		if (!slot->dl.data) {
+			ERR("Couldn't allocate enough memory.");
+			b->done_cb(b, index, CURLE_OUT_OF_MEMORY, &slot->dl);
+			return EINA_FALSE;
+		}
+		slot->dl.data[0] = '\0';
+	}
+
+	b->uri_cb(b, index, uri);
+
+	if (r && !_breaker_allow()) {
+		ERR("Circuit breaker is open, not requesting %s", uri);
+		b->done_cb(b, index, CURLE_COULDNT_CONNECT, &slot->dl);
+		return EINA_FALSE;
+	}
+
+	if (b->write_cb)
+		_easy_setup(slot->easy, uri, _batch_write_cb, slot);
+	else
+		_easy_setup(slot->easy, uri, _dl_to_mem_cb, &slot->dl);
+
+	if (b->progress_cb) {
+		curl_easy_setopt(slot->easy, CURLOPT_XFERINFOFUNCTION, _batch_xferinfo_cb);
+		curl_easy_setopt(slot->easy, CURLOPT_XFERINFODATA, slot);
+	}
+
+	curl_easy_setopt(slot->easy, CURLOPT_PRIVATE, slot);
+
+	if (b->setup_cb)
+		b->setup_cb(b, index, slot->easy);
+
+	slot->start = etvdb_time_get();
+	slot->busy = EINA_TRUE;
+
+	return EINA_TRUE;
+}
+
+/* one attempt of a streamed download */
+static CURLcode _stream_attempt(Transfer_Ctx *ctx, Download_Stream *st, const char *uri)
+{
+	int running, msgs;
+	CURLcode res = CURLE_OK;
+	CURLMsg *msg;
+	Eina_Bool active = EINA_TRUE;
+
+	_easy_setup(ctx->easy, uri, _dl_stream_cb, st);
+	curl_multi_add_handle(ctx->multi, ctx->easy);
+
+	while (active) {
+		if (curl_multi_perform(ctx->multi, &running)) {
+			res = CURLE_FAILED_INIT;
+			break;
+		}
+
+		while ((msg = curl_multi_info_read(ctx->multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			res = _easy_result_get(msg->easy_handle, msg->data.result);
+			active = EINA_FALSE;
+		}
+
+		if (!active)
+			break;
+
+		if (_etvdb_request_expired()) {
+			res = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+
+		curl_multi_poll(ctx->multi, NULL, 0, REQUEST_POLL_MS, NULL);
+	}
+
+	curl_multi_remove_handle(ctx->multi, ctx->easy);
+
+	return res;
+}
+
+/* one attempt of a download, sends a hedged request after hedge_delay if it is > 0.
+ * the first successful transfer wins, the other one is cancelled. */
+static CURLcode _dl_attempt(Transfer_Ctx *ctx, Download *dl, const char *uri, double hedge_delay)
+{
+	int running, msgs, wait_ms;
+	double start, now;
+	CURL *winner = NULL;
+	CURLcode res = CURLE_OK;
+	CURLMsg *msg;
+	Download hdl;
+	Eina_Bool easy_active, hedge_active = EINA_FALSE, hedged = EINA_FALSE;
+
+	hdl.data = NULL;
+	hdl.len = 0;
+
+	_easy_setup(ctx->easy, uri, _dl_to_mem_cb, dl);
+	curl_multi_add_handle(ctx->multi, ctx->easy);
+	easy_active = EINA_TRUE;
+
+	start = etvdb_time_get();
+
+	while (easy_active || hedge_active) {
+		if (curl_multi_perform(ctx->multi, &running)) {
+			res = CURLE_FAILED_INIT;
+			break;
+		}
+
+		while ((msg = curl_multi_info_read(ctx->multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			res = _easy_result_get(msg->easy_handle, msg->data.result);
+			curl_multi_remove_handle(ctx->multi, msg->easy_handle);
+
+			if (msg->easy_handle == ctx->easy)
+				easy_active = EINA_FALSE;
+			else
+				hedge_active = EINA_FALSE;
+
+			if (!res && !winner)
+				winner = msg->easy_handle;
+		}
+
+		if (winner)
+			break;
+
+		if (_etvdb_request_expired()) {
+			res = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+
+		now = etvdb_time_get();
+		if (!hedged && easy_active && hedge_delay > 0 && now - start >= hedge_delay) {
+			if (!ctx->hedge)
+				ctx->hedge = _easy_new();
+
+			if (ctx->hedge) {
+				DBG("No response after %.3f seconds, sending hedged request.", now - start);
+				hdl.data = malloc(1);
+				hdl.len = 0;
+				_easy_setup(ctx->hedge, uri, _dl_to_mem_cb, &hdl);
+				curl_multi_add_handle(ctx->multi, ctx->hedge);
+				hedge_active = EINA_TRUE;
+			}
+			hedged = EINA_TRUE;
+		}
+
+		if (easy_active || hedge_active) {
+			wait_ms = REQUEST_POLL_MS;
+			if (!hedged && hedge_delay > 0 && (hedge_delay - (now - start)) * 1000 < wait_ms)
+				wait_ms = (int)((hedge_delay - (now - start)) * 1000) + 1;
+
+			curl_multi_poll(ctx->multi, NULL, 0, wait_ms, NULL);
+		}
+	}
+
+	/* cancel the transfers, which lost or were aborted */
+	if (easy_active)
+		curl_multi_remove_handle(ctx->multi, ctx->easy);
+	if (hedge_active)
+		curl_multi_remove_handle(ctx->multi, ctx->hedge);
+
+	if (winner && winner == ctx->hedge) {
+		DBG("Hedged request won.");
+		free(dl->data);
+		*dl = hdl;
+	} else
+		free(hdl.data);
+
+	return winner ? CURLE_OK : res;
+}
+/* get the transfer context of the current thread, create it if necessary */
+static Transfer_Ctx *_transfer_ctx_get(void)
+{
+	Transfer_Ctx *ctx;
+
+	ctx = eina_tls_get(_ctx_key);
+	if (ctx)
+		return ctx;
+
+	ctx = malloc(sizeof(Transfer_Ctx));
+	if (!ctx) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	ctx->multi = curl_multi_init();
+	ctx->easy = _easy_new();
+	ctx->hedge = NULL;
+	ctx->seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)ctx;
+	if (!ctx->multi || !ctx->easy) {
+		CRIT("cURL handles couldn't be initialized.");
+		if (ctx->multi)
+			curl_multi_cleanup(ctx->multi);
+		if (ctx->easy)
+			curl_easy_cleanup(ctx->easy);
+		free(ctx);
+		return NULL;
+	}
+
+	if (!eina_tls_set(_ctx_key, ctx)) {
+		ERR("Couldn't keep the transfer context of the thread.");
+		_transfer_ctx_cleanup(ctx);
+		return NULL;
+	}
+
+	eina_lock_take(&_ctx_lock);
+	_ctx_list = eina_list_append(_ctx_list, ctx);
+	eina_lock_release(&_ctx_lock);
+
+	return ctx;
+}
+
+/* free the transfer context of a thread, when the thread exits */
+static void _transfer_ctx_free(void *data)
+{
+	Transfer_Ctx *ctx = data;
+
+	eina_lock_take(&_ctx_lock);
+	_ctx_list = eina_list_remove(_ctx_list, ctx);
+	eina_lock_release(&_ctx_lock);
+
+	_transfer_ctx_cleanup(ctx);
+}
+
+/* close the connections of a transfer context and free it */
+static void _transfer_ctx_cleanup(Transfer_Ctx *ctx)
+{
+	curl_easy_cleanup(ctx->easy);
+	if (ctx->hedge)
+		curl_easy_cleanup(ctx->hedge);
+	curl_multi_cleanup(ctx->multi);
+	free(ctx);
+}
+
+/* abort transfers from inside cURL, this catches the deadline during long reads */
+static int _xferinfo_cb(void *clientp UNUSED, curl_off_t dltotal UNUSED, curl_off_t dlnow UNUSED,
+		curl_off_t ultotal UNUSED, curl_off_t ulnow UNUSED)
+{
+	return _etvdb_request_expired();
+}
+
+/* abort batch transfers like _xferinfo_cb, and report their progress */
+static int _batch_xferinfo_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+		curl_off_t ultotal UNUSED, curl_off_t ulnow UNUSED)
+{
+	Batch_Slot *slot = clientp;
+
+	if (_etvdb_request_expired())
+		return 1;
+
+	slot->batch->progress_cb(slot->batch, slot->index, (size_t)dlnow, (size_t)dltotal);
+
+	return 0;
+}
+
+/* create an easy handle with the options all transfers share */
+static CURL *_easy_new(void)
+{
+	CURL *easy;
+
+	easy = curl_easy_init();
+	if (!easy)
+		return NULL;
+
+#ifdef DEBUG
+	curl_easy_setopt(easy, CURLOPT_VERBOSE, 1);
+#endif
+	curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(easy, CURLOPT_XFERINFOFUNCTION, _xferinfo_cb);
+
+	return easy;
+}
+
+/* point an easy handle to a uri and a write callback */
+static void _easy_setup(CURL *easy, const char *uri, curl_write_callback write_cb, void *userdata)
+{
+	long timeout_ms;
+
+	timeout_ms = (long)(_etvdb_request_remaining() * 1000);
+	if (timeout_ms < 1)
+		timeout_ms = 1;
+
+	curl_easy_setopt(easy, CURLOPT_URL, uri);
+	curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeout_ms);
+	curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, timeout_ms);
+	curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_cb);
+	curl_easy_setopt(easy, CURLOPT_WRITEDATA, userdata);
+}
+
+/* this cURL write callback collects data and cuts it into records */
+static size_t _dl_stream_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	char open[64], close[64];
+	size_t size_total = size * nmemb, consumed, open_len, close_len;
+	char *p, *rec, *end;
+	Download_Stream *st = userdata;
+
+	if (_dl_to_mem_cb(ptr, size, nmemb, &st->buf) != size_total)
+		return 0;
+
+	open_len = snprintf(open, sizeof(open), "<%s>", st->tag);
+	close_len = snprintf(close, sizeof(close), "</%s>", st->tag);
+
+	p = st->buf.data;
+	while ((end = strstr(p, close))) {
+		end += close_len;
+
+		/* everything in front of the record is skipped */
+		rec = strstr(p, open);
+		if (!rec || rec > end)
+			rec = p;
+
+		if (!st->record_cb(st, rec, end - rec)) {
+			st->stopped = !st->aborted;
+			return 0;
+		}
+
+		st->records++;
+		p = end;
+	}
+
+	/* keep the started record, or the length of an opening tag, which might be incomplete */
+	rec = strstr(p, open);
+	if (rec)
+		p = rec;
+	else if ((size_t)(st->buf.data + st->buf.len - p) > open_len)
+		p = st->buf.data + st->buf.len - open_len;
+
+	consumed = p - st->buf.data;
+	if (consumed) {
+		st->buf.len -= consumed;
+		memmove(st->buf.data, p, st->buf.len + 1);
+	}
+
+	return size_total;
+}
+
+/* this cURL write callback passes the data of a batch download on */
+static size_t _batch_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	Batch_Slot *slot = userdata;
+	size_t written;
+
+	written = slot->batch->write_cb(slot->batch, slot->index, ptr, size * nmemb);
+	slot->dl.len += written;
+
+	return written;
+}
+
+/* server errors are treated like failed transfers, so they can be retried */
+static CURLcode _easy_result_get(CURL *easy, CURLcode res)
+{
+	long code = 0;
+
+	if (res)
+		return res;
+
+	curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+	if (code >= 500) {
+		DBG("Server responded with HTTP %ld.", code);
+		return CURLE_HTTP_RETURNED_ERROR;
+	}
+
+	return CURLE_OK;
+}
+
+/* wait between retries, a cancellation wakes up the multi handle */
+static void _backoff_wait(Transfer_Ctx *ctx, double delay)
+{
+	double left, until;
+
+	until = etvdb_time_get() + delay;
+	while (!_etvdb_request_expired() && (left = until - etvdb_time_get()) > 0)
+		curl_multi_poll(ctx->multi, NULL, 0, (int)(left * 1000) + 1, NULL);
+}
+
+/* exponential backoff with equal jitter: half fixed, half random */
+static double _backoff_get(Transfer_Ctx *ctx, const Etvdb_Resilience *r, unsigned int attempt)
+{
+	double delay;
+
+	delay = r->backoff_base * (double)(1u << (attempt < 16 ? attempt : 16));
+	if (delay > r->backoff_max)
+		delay = r->backoff_max;
+
+	return delay / 2 + (delay / 2) * ((double)rand_r(&ctx->seed) / RAND_MAX);
+}
+
+/* calculate the hedge delay from the latency percentile, 0 disables hedging */
+static double _hedge_delay_get(const Etvdb_Resilience *r)
+{
+	unsigned int n, idx;
+	double delay, samples[LATENCY_SAMPLES];
+
+	if (r->hedge_percentile <= 0)
+		return 0;
+
+	eina_lock_take(&_res_lock);
+	n = _res.latency_count < LATENCY_SAMPLES ? _res.latency_count : LATENCY_SAMPLES;
+	memcpy(samples, _res.latency, n * sizeof(double));
+	eina_lock_release(&_res_lock);
+
+	if (n < LATENCY_SAMPLES_MIN)
+		return HEDGE_DELAY_INITIAL > r->hedge_delay_min ? HEDGE_DELAY_INITIAL : r->hedge_delay_min;
+
+	qsort(samples, n, sizeof(double), _double_cmp);
+
+	idx = (unsigned int)(r->hedge_percentile / 100.0 * (n - 1));
+	if (idx >= n)
+		idx = n - 1;
+
+	delay = samples[idx];
+
+	return delay > r->hedge_delay_min ? delay : r->hedge_delay_min;
+}
+
+/* remember the latency of a successful request */
+static void _latency_add(double latency)
+{
+	eina_lock_take(&_res_lock);
+	_res.latency[_res.latency_count % LATENCY_SAMPLES] = latency;
+	_res.latency_count++;
+	eina_lock_release(&_res_lock);
+}
+
+/* check if the circuit breaker lets a call through.
+ * after the cooldown, a single call probes if the server is back. */
+static Eina_Bool _breaker_allow(void)
+{
+	Eina_Bool allow = EINA_TRUE;
+
+	eina_lock_take(&_res_lock);
+	if (_res.open_until > 0) {
+		if (etvdb_time_get() < _res.open_until || _res.probing)
+			allow = EINA_FALSE;
+		else
+			_res.probing = EINA_TRUE;
+	}
+	eina_lock_release(&_res_lock);
+
+	return allow;
+}
+
+/* update the circuit breaker with the result of a call */
+static void _breaker_report(const Etvdb_Resilience *r, CURLcode res)
+{
+	eina_lock_take(&_res_lock);
+	_res.probing = EINA_FALSE;
+
+	if (!res) {
+		_res.failures = 0;
+		_res.open_until = 0;
+	} else if (res != CURLE_ABORTED_BY_CALLBACK) {
+		_res.failures++;
+		if (r->breaker_threshold && _res.failures >= r->breaker_threshold) {
+			_res.open_until = etvdb_time_get() + r->breaker_cooldown;
+			WARN("%u requests failed in a row, circuit breaker is open for %.1f seconds.",
+					_res.failures, r->breaker_cooldown);
+		}
+	}
+	eina_lock_release(&_res_lock);
+}
+
+static int _double_cmp(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
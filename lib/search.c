@@ -0,0 +1,649 @@
+#include "etvdb_private.h"
+
+/* maximum length of a folded name, longer names are cut */
+#define FOLD_MAX 256
+
+/* minimum trigram similarity of a typo tolerant match */
+#define SIMILARITY_MIN 0.3
+
+/* ranking bonus of exact, prefix and word prefix matches */
+#define BONUS_EXACT 3.0
+#define BONUS_PREFIX 2.0
+#define BONUS_WORD 1.0
+
+/* dead entries are dropped once they are this share of all entries */
+#define DEAD_RATIO 4
+#define DEAD_MIN 64
+
+/* one indexed Series */
+typedef struct _search_entry {
+	uint32_t id; /**< TVDB ID */
+	char *name; /**< Series name */
+	char *folded; /**< normalized name */
+	char *imdb_id; /**< IMDB ID */
+	char *zap2it_id; /**< zap2it ID */
+	unsigned int trigrams; /**< number of distinct trigrams of the folded name */
+	Eina_Bool dead; /**< replaced by a newer entry */
+} Search_Entry;
+
+/* a scored search result */
+typedef struct _search_hit {
+	unsigned int idx; /**< entry index */
+	double score; /**< ranking score */
+} Search_Hit;
+
+/* the search index */
+typedef struct _search_index {
+	Search_Entry *entries; /**< all entries */
+	unsigned int count; /**< number of entries */
+	unsigned int size; /**< allocated entries */
+	unsigned int dead; /**< number of dead entries */
+	Eina_Hash *ids; /**< TVDB ID -> entry index + 1 */
+	Eina_Hash *remote; /**< IMDB or zap2it ID -> entry index + 1 */
+	Eina_Hash *trigrams; /**< trigram -> Eina_Inarray of entry indexes */
+	unsigned int *sorted; /**< entry indexes sorted by folded name */
+	unsigned int sorted_count; /**< number of sorted entries */
+	uint16_t *hits; /**< per entry trigram hits of the current query */
+	unsigned char *picked; /**< per entry flag, set if it is a result of the current query */
+	unsigned int hits_size; /**< allocated hit counters and flags */
+} Search_Index;
+
+/* internal functions */
+static void _entry_add(Series *s, const char *zap2it_id);
+static void _entry_index(unsigned int idx);
+static void _compact(void);
+static unsigned int _fold(const char *src, char *dst, unsigned int max);
+static unsigned int _trigrams_get(const char *folded, uint32_t **out);
+static void _sorted_update(void);
+static unsigned int _prefix_lower(const char *q);
+static Series *_series_from_entry(const Search_Entry *en);
+static int _uint32_cmp(const void *a, const void *b);
+static int _sorted_cmp(const void *a, const void *b);
+static int _hit_cmp(const void *a, const void *b);
+
+static Search_Index _idx;
+static Eina_Lock _idx_lock;
+
+/* base letters of U+00C0 - U+017F, used to fold accented latin letters */
+static const char _latin_fold[] =
+	"aaaaaaaceeeeiiiidnooooo ouuuuyts"
+	"aaaaaaaceeeeiiiidnooooo ouuuuyty"
+	"aaaaaaccccccccddddeeeeeeeeeegggg"
+	"gggghhhhiiiiiiiiiiiijjkkklllllll"
+	"lllnnnnnnnnnoooooooorrrrrrssssss"
+	"ssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
+/**
+ * @brief Local Series Search
+ * @defgroup Search
+ *
+ * @{
+ *
+ * etvdb keeps a local search index over the names, IMDB and zap2it IDs
+ * of every Series it has parsed or loaded, and of every Series it was fed
+ * with etvdb_search_index_add().
+ *
+ * Names are normalized (case and accents are folded, punctuation is ignored)
+ * and indexed by trigrams, so the index answers prefix queries and
+ * queries with typos, ranked by similarity, without network access.
+ */
+
+/**
+ * @brief Add a Series to the search index
+ *
+ * Series are added automatically when they are parsed,
+ * this function adds Series from other sources.
+ * Adding a Series again updates its entry.
+ *
+ * @param s Series, which needs at least an ID and a name
+ *
+ * @ingroup Search
+ */
+EAPI void etvdb_search_index_add(Series *s)
+{
+	_etvdb_search_index_add(s, NULL);
+}
+
+/**
+ * @brief Remove all Series from the search index
+ *
+ * @ingroup Search
+ */
+EAPI void etvdb_search_index_clear(void)
+{
+	eina_lock_take(&_idx_lock);
+	_etvdb_search_index_free();
+	eina_lock_release(&_idx_lock);
+}
+
+/**
+ * @brief Search Series in the local index
+ *
+ * This function searches the local index only, it never accesses the network.
+ * Like etvdb_series_find(), it also searches by IMDB ID (query starting with "tt"),
+ * or by zap2it ID (starting with "SH").
+ *
+ * The results are ranked: exact matches first, then prefix matches,
+ * then matches of a word in the name, then similar names.
+ *
+ * @param query name, start of a name or ID
+ * @param max maximum number of results, 0 for no limit
+ *
+ * @return a list of partial Series records like etvdb_series_find() returns,
+ * which have to be freed with etvdb_series_free()
+ *
+ * @ingroup Search
+ */
+EAPI Eina_List *etvdb_search_local(const char *query, unsigned int max)
+{
+	char q[FOLD_MAX], word[FOLD_MAX + 1];
+	unsigned int i, j, qlen, qtri, n = 0, nhits = 0;
+	uintptr_t found;
+	double sim;
+	uint32_t *tri = NULL, *p;
+	Eina_Inarray *postings;
+	Eina_List *list = NULL;
+	Search_Entry *en;
+	Search_Hit *hits = NULL;
+	unsigned int *touched = NULL;
+
+	if (!query)
+		return NULL;
+
+	eina_lock_take(&_idx_lock);
+
+	if (!_idx.count)
+		goto end;
+
+	/* remote IDs are matched exactly */
+	if (!strncmp(query, "tt", 2) || !strncmp(query, "SH", 2)) {
+		found = (uintptr_t)eina_hash_find(_idx.remote, query);
+		if (found)
+			list = eina_list_append(list, _series_from_entry(&_idx.entries[found - 1]));
+		goto end;
+	}
+
+	qlen = _fold(query, q, FOLD_MAX);
+	if (!qlen)
+		goto end;
+
+	_sorted_update();
+	if (_idx.hits_size < _idx.count) {
+		free(_idx.hits);
+		free(_idx.picked);
+		_idx.hits = calloc(_idx.size, sizeof(uint16_t));
+		_idx.picked = calloc(_idx.size, 1);
+		_idx.hits_size = _idx.hits && _idx.picked ? _idx.size : 0;
+		if (!_idx.hits_size)
+			goto end;
+	}
+
+	hits = malloc(_idx.count * sizeof(Search_Hit));
+	touched = malloc(_idx.count * sizeof(unsigned int));
+	if (!hits || !touched)
+		goto end;
+
+	/* count trigram hits per entry */
+	qtri = _trigrams_get(q, &tri);
+	for (i = 0; i < qtri; i++) {
+		postings = eina_hash_find(_idx.trigrams, &tri[i]);
+		if (!postings)
+			continue;
+
+		EINA_INARRAY_FOREACH(postings, p) {
+			if (!_idx.hits[*p]++)
+				touched[n++] = *p;
+		}
+	}
+
+	snprintf(word, sizeof(word), " %s", q);
+
+	for (i = 0; i < n; i++) {
+		j = touched[i];
+		en = &_idx.entries[j];
+		sim = 2.0 * _idx.hits[j] / (qtri + en->trigrams);
+		_idx.hits[j] = 0;
+
+		if (en->dead)
+			continue;
+
+		if (!strcmp(en->folded, q))
+			sim += BONUS_EXACT;
+		else if (!strncmp(en->folded, q, qlen))
+			sim += BONUS_PREFIX;
+		else if (strstr(en->folded, word))
+			sim += BONUS_WORD;
+		else if (sim < SIMILARITY_MIN)
+			continue;
+
+		_idx.picked[j] = 1;
+		hits[nhits].idx = j;
+		hits[nhits++].score = sim;
+	}
+
+	/* short queries have no full trigram, but can still be prefixes */
+	for (i = _prefix_lower(q); i < _idx.sorted_count && nhits < _idx.count; i++) {
+		en = &_idx.entries[_idx.sorted[i]];
+		if (strncmp(en->folded, q, qlen))
+			break;
+
+		j = _idx.sorted[i];
+		if (!_idx.picked[j] && !en->dead) {
+			_idx.picked[j] = 1;
+			hits[nhits].idx = j;
+			hits[nhits++].score = BONUS_PREFIX + (double)qlen / strlen(en->folded);
+		}
+
+		if (max && nhits >= max * 4)
+			break;
+	}
+
+	for (i = 0; i < nhits; i++)
+		_idx.picked[hits[i].idx] = 0;
+
+	qsort(hits, nhits, sizeof(Search_Hit), _hit_cmp);
+
+	for (i = 0; i < nhits && (!max || i < max); i++)
+		list = eina_list_append(list, _series_from_entry(&_idx.entries[hits[i].idx]));
+
+	DBG("Local search for %s: %u candidates, %u results.", query, nhits, eina_list_count(list));
+
+end:
+	eina_lock_release(&_idx_lock);
+	free(tri);
+	free(hits);
+	free(touched);
+
+	return list;
+}
+
+/**
+ * @brief Search Series locally, falling back to TVDB
+ *
+ * This function answers from the local index, and only if it has
+ * no results, it searches TVDB with etvdb_series_find().
+ * The Series found online are added to the index.
+ *
+ * @param query name, start of a name or ID
+ * @param max maximum number of local results, 0 for no limit
+ *
+ * @return a list of partial Series records, which have to be freed with etvdb_series_free()
+ *
+ * @see etvdb_search_local()
+ * @see etvdb_series_find()
+ *
+ * @ingroup Search
+ */
+EAPI Eina_List *etvdb_series_search(const char *query, unsigned int max)
+{
+	Eina_List *list;
+
+	list = etvdb_search_local(query, max);
+	if (list)
+		return list;
+
+	DBG("No local results for %s, searching online.", query);
+
+	return etvdb_series_find(query);
+}
+/**
+ * @}
+ */
+
+/* set up the search index, called by etvdb_init() */
+Eina_Bool _etvdb_search_init(void)
+{
+	memset(&_idx, 0, sizeof(Search_Index));
+
+	return eina_lock_new(&_idx_lock);
+}
+
+/* free the search index, called by etvdb_shutdown() */
+void _etvdb_search_shutdown(void)
+{
+	_etvdb_search_index_free();
+	eina_lock_free(&_idx_lock);
+}
+
+/* free all entries, the caller has to hold the lock if necessary */
+void _etvdb_search_index_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < _idx.count; i++) {
+		free(_idx.entries[i].name);
+		free(_idx.entries[i].folded);
+		free(_idx.entries[i].imdb_id);
+		free(_idx.entries[i].zap2it_id);
+	}
+
+	if (_idx.ids)
+		eina_hash_free(_idx.ids);
+	if (_idx.remote)
+		eina_hash_free(_idx.remote);
+	if (_idx.trigrams)
+		eina_hash_free(_idx.trigrams);
+
+	free(_idx.entries);
+	free(_idx.sorted);
+	free(_idx.hits);
+	free(_idx.picked);
+	memset(&_idx, 0, sizeof(Search_Index));
+}
+
+/* add a Series to the index, this is called by the parser for every Series */
+void _etvdb_search_index_add(Series *s, const char *zap2it_id)
+{
+	if (!s || !s->id || !s->name)
+		return;
+
+	eina_lock_take(&_idx_lock);
+	_entry_add(s, zap2it_id);
+	eina_lock_release(&_idx_lock);
+}
+
+static void _entry_add(Series *s, const char *zap2it_id)
+{
+	char folded[FOLD_MAX];
+	unsigned int n, idx;
+	uintptr_t old;
+	Search_Entry *en, *entries;
+
+	if (!_idx.ids) {
+		_idx.ids = eina_hash_int32_new(NULL);
+		_idx.remote = eina_hash_string_superfast_new(NULL);
+		_idx.trigrams = eina_hash_int32_new((Eina_Free_Cb)eina_inarray_free);
+	}
+
+	if (!_fold(s->name, folded, FOLD_MAX))
+		return;
+
+	old = (uintptr_t)eina_hash_find(_idx.ids, &s->id);
+	if (old) {
+		en = &_idx.entries[old - 1];
+
+		/* same name, only update the remote IDs */
+		if (!strcmp(en->folded, folded)) {
+			if (s->imdb_id && !en->imdb_id) {
+				en->imdb_id = strdup(s->imdb_id);
+				eina_hash_set(_idx.remote, en->imdb_id, (void *)old);
+			}
+			if (zap2it_id && !en->zap2it_id) {
+				en->zap2it_id = strdup(zap2it_id);
+				eina_hash_set(_idx.remote, en->zap2it_id, (void *)old);
+			}
+			return;
+		}
+
+		/* renamed, its postings are stale now */
+		en->dead = EINA_TRUE;
+		_idx.dead++;
+	}
+
+	if (_idx.count == _idx.size) {
+		n = _idx.size ? _idx.size * 2 : 64;
+		entries = realloc(_idx.entries, n * sizeof(Search_Entry));
+		if (!entries) {
+			ERR("Couldn't allocate enough memory.");
+			return;
+		}
+		_idx.entries = entries;
+		_idx.size = n;
+	}
+
+	idx = _idx.count++;
+	en = &_idx.entries[idx];
+	en->id = s->id;
+	en->name = strdup(s->name);
+	en->folded = strdup(folded);
+	en->imdb_id = s->imdb_id ? strdup(s->imdb_id) : NULL;
+	en->zap2it_id = zap2it_id ? strdup(zap2it_id) : NULL;
+	en->dead = EINA_FALSE;
+
+	_entry_index(idx);
+
+	if (_idx.dead >= DEAD_MIN && _idx.dead * DEAD_RATIO > _idx.count)
+		_compact();
+}
+
+/* add an entry to the ID and trigram hashes */
+static void _entry_index(unsigned int idx)
+{
+	unsigned int i, n;
+	uint32_t *tri = NULL;
+	Eina_Inarray *postings;
+	Search_Entry *en = &_idx.entries[idx];
+
+	eina_hash_set(_idx.ids, &en->id, (void *)(uintptr_t)(idx + 1));
+	if (en->imdb_id)
+		eina_hash_set(_idx.remote, en->imdb_id, (void *)(uintptr_t)(idx + 1));
+	if (en->zap2it_id)
+		eina_hash_set(_idx.remote, en->zap2it_id, (void *)(uintptr_t)(idx + 1));
+
+	en->trigrams = n = _trigrams_get(en->folded, &tri);
+	for (i = 0; i < n; i++) {
+		postings = eina_hash_find(_idx.trigrams, &tri[i]);
+		if (!postings) {
+			postings = eina_inarray_new(sizeof(unsigned int), 4);
+			eina_hash_add(_idx.trigrams, &tri[i], postings);
+		}
+		eina_inarray_push(postings, &idx);
+	}
+
+	free(tri);
+}
+
+/* drop the dead entries of renamed Series and index the others again */
+static void _compact(void)
+{
+	unsigned int i, j;
+	Search_Entry *en;
+
+	DBG("Dropping %u dead entries of %u from the search index.", _idx.dead, _idx.count);
+
+	for (i = j = 0; i < _idx.count; i++) {
+		en = &_idx.entries[i];
+		if (en->dead) {
+			free(en->name);
+			free(en->folded);
+			free(en->imdb_id);
+			free(en->zap2it_id);
+			continue;
+		}
+		_idx.entries[j++] = *en;
+	}
+
+	_idx.count = j;
+	_idx.dead = 0;
+
+	eina_hash_free_buckets(_idx.ids);
+	eina_hash_free_buckets(_idx.remote);
+	eina_hash_free_buckets(_idx.trigrams);
+
+	for (i = 0; i < _idx.count; i++)
+		_entry_index(i);
+
+	/* the prefix array is sorted again by the next query */
+	_idx.sorted_count = 0;
+}
+
+/* normalize a UTF-8 string: lower case, accents and punctuation folded,
+ * white space collapsed. returns the length of the result */
+static unsigned int _fold(const char *src, char *dst, unsigned int max)
+{
+	const unsigned char *p = (const unsigned char *)src, *start;
+	unsigned int len = 0, cp, n;
+	char c;
+
+	while (*p && len < max - 4) {
+		if (*p < 0x80) {
+			cp = *p++;
+			if (cp >= 'A' && cp <= 'Z')
+				c = cp - 'A' + 'a';
+			else if ((cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9'))
+				c = cp;
+			else
+				c = ' ';
+		} else {
+			/* decode a multibyte sequence */
+			if ((*p & 0xE0) == 0xC0) {
+				cp = *p & 0x1F;
+				n = 1;
+			} else if ((*p & 0xF0) == 0xE0) {
+				cp = *p & 0x0F;
+				n = 2;
+			} else if ((*p & 0xF8) == 0xF0) {
+				cp = *p & 0x07;
+				n = 3;
+			} else {
+				p++;
+				continue;
+			}
+
+			start = p++;
+			while (n-- && (*p & 0xC0) == 0x80)
+				cp = (cp << 6) | (*p++ & 0x3F);
+
+			if (cp >= 0xC0 && cp < 0x180)
+				c = _latin_fold[cp - 0xC0];
+			else {
+				/* keep other characters as they are */
+				while (start < p)
+					dst[len++] = *start++;
+				continue;
+			}
+		}
+
+		if (c == ' ' && (len == 0 || dst[len - 1] == ' '))
+			continue;
+
+		dst[len++] = c;
+	}
+
+	if (len && dst[len - 1] == ' ')
+		len--;
+
+	dst[len] = '\0';
+
+	return len;
+}
+
+/* get the sorted, distinct trigrams of a folded string */
+static unsigned int _trigrams_get(const char *folded, uint32_t **out)
+{
+	char buf[FOLD_MAX + 3];
+	unsigned int i, n = 0, len;
+	uint32_t *tri;
+
+	len = snprintf(buf, sizeof(buf), " %s ", folded);
+	if (len < 3) {
+		*out = NULL;
+		return 0;
+	}
+
+	tri = malloc((len - 2) * sizeof(uint32_t));
+	if (!tri) {
+		*out = NULL;
+		return 0;
+	}
+
+	for (i = 0; i + 2 < len; i++)
+		tri[i] = ((uint32_t)(unsigned char)buf[i] << 16)
+			| ((uint32_t)(unsigned char)buf[i + 1] << 8)
+			| (unsigned char)buf[i + 2];
+
+	qsort(tri, len - 2, sizeof(uint32_t), _uint32_cmp);
+
+	for (i = 0; i < len - 2; i++)
+		if (!n || tri[n - 1] != tri[i])
+			tri[n++] = tri[i];
+
+	*out = tri;
+
+	return n;
+}
+
+/* keep the prefix array sorted, only done after entries were added.
+ * entries are appended, so the new ones are the last indexes.
+ * a few are inserted at their place, many are sorted with the others */
+static void _sorted_update(void)
+{
+	unsigned int i, pos, *sorted;
+
+	if (_idx.sorted_count == _idx.count)
+		return;
+
+	sorted = realloc(_idx.sorted, _idx.size * sizeof(unsigned int));
+	if (!sorted)
+		return;
+	_idx.sorted = sorted;
+
+	if (_idx.count - _idx.sorted_count > _idx.sorted_count) {
+		for (i = 0; i < _idx.count; i++)
+			sorted[i] = i;
+
+		_idx.sorted_count = _idx.count;
+		qsort(_idx.sorted, _idx.sorted_count, sizeof(unsigned int), _sorted_cmp);
+		return;
+	}
+
+	for (i = _idx.sorted_count; i < _idx.count; i++) {
+		pos = _prefix_lower(_idx.entries[i].folded);
+		memmove(sorted + pos + 1, sorted + pos, (_idx.sorted_count - pos) * sizeof(unsigned int));
+		sorted[pos] = i;
+		_idx.sorted_count++;
+	}
+}
+
+/* first position in the prefix array, which is not smaller than q */
+static unsigned int _prefix_lower(const char *q)
+{
+	unsigned int lo = 0, hi = _idx.sorted_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(_idx.entries[_idx.sorted[mid]].folded, q) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* create a partial Series record from an entry */
+static Series *_series_from_entry(const Search_Entry *en)
+{
+	Series *s;
+
+	s = etvdb_series_new();
+	s->id = en->id;
+	s->name = strdup(en->name);
+	s->imdb_id = en->imdb_id ? strdup(en->imdb_id) : NULL;
+
+	return s;
+}
+
+static int _uint32_cmp(const void *a, const void *b)
+{
+	uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+
+	return (ua > ub) - (ua < ub);
+}
+
+static int _sorted_cmp(const void *a, const void *b)
+{
+	return strcmp(_idx.entries[*(const unsigned int *)a].folded,
+			_idx.entries[*(const unsigned int *)b].folded);
+}
+
+/* higher scores first, shorter names first on equal scores */
+static int _hit_cmp(const void *a, const void *b)
+{
+	const Search_Hit *ha = a, *hb = b;
+
+	if (ha->score != hb->score)
+		return ha->score < hb->score ? 1 : -1;
+
+	return (int)strlen(_idx.entries[ha->idx].folded) - (int)strlen(_idx.entries[hb->idx].folded);
+}
@@ -1,9 +1,25 @@
 #include "etvdb_private.h"
 #include <inttypes.h>
 
+/* downloads at the same time of etvdb_series_list_upgrade() */
+#define UPGRADE_CONNECTIONS 8
+
+/* state of etvdb_series_list_upgrade() */
+typedef struct _list_upgrade {
+	Series **series; /**< Series to upgrade */
+	Eina_Bool ok; /**< all Series were upgraded */
+} List_Upgrade;
+
 /* internal functions */
-static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length);
+static void _upgrade_uri_cb(Download_Batch *batch, unsigned int i, char *uri);
+static void _upgrade_done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl);
+static void _record_take(Series *s, Series *full);
+static unsigned int _episodes_missing_get(Eina_List *episodes, unsigned int fields);
+static void _episodes_fill(Eina_List *episodes, Eina_Hash *fetched, unsigned int need);
+static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static char *_series_text_cb(void *data, void *record, Xml_Tag tag,
+		const char *content, unsigned length, Eina_Bool decode);
 
 /**
  * @brief Overall Series Functions
@@ -32,31 +48,59 @@ static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const c
  * @ingroup Series
  */
 EAPI Series *etvdb_series_by_id_get(uint32_t id)
+{
+	return etvdb_series_by_id_fields_get(id, ETVDB_FIELD_ALL);
+}
+
+/**
+ * @brief Get Series data with selected fields by TVDB Series ID
+ *
+ * This function works like etvdb_series_by_id_get(), but only parses
+ * the fields in the mask, the others are left NULL.
+ *
+ * @param id TVDB ID of a series
+ * @param fields mask of Etvdb_Field values
+ *
+ * @return a Series structure on success,
+ * @return NULL on failure.
+ *
+ * @see etvdb_series_fields_fill()
+ *
+ * @ingroup Series
+ */
+EAPI Series *etvdb_series_by_id_fields_get(uint32_t id, unsigned int fields)
 {
 	char uri[URI_MAX];
 	Download xml;
 	Series *s = NULL;
-	Parser_Data pdata;
 
-	pdata.s = NULL;
-	pdata.data = NULL;
+	/* only full records are shared */
+	if (fields == ETVDB_FIELD_ALL && (s = etvdb_registry_series_get(id)))
+		return s;
 
-	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/%s.xml",
-			etvdb_api_key, id, etvdb_language);
+	s = _etvdb_store_series_find(id);
+	if (!s && fields == ETVDB_FIELD_ALL)
+		s = _etvdb_client_series_get(id, EINA_FALSE);
 
-	CURL_XML_DL_MEM(xml, uri)
-		ERR("Couldn't get series data from server.");
+	if (!s) {
+		snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/%s.xml",
+				etvdb_api_key, id, etvdb_language);
 
-	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_series_cb, &pdata))
-		CRIT("Parsing series data failed. If it happens again, please report a bug.");
+		CURL_XML_DL_MEM(xml, uri) {
+			ERR("Couldn't get series data from server.");
+			free(xml.data);
+			return NULL;
+		}
 
-	free(xml.data);
+		s = _etvdb_series_parse(xml.data, xml.len, fields);
+		free(xml.data);
 
-	/* we assume that only a single episode is in the list
-	 * should it be more (which would be a TVDB bug), its a memleak */
-	s = eina_list_data_get(pdata.data);
-	pdata.data = eina_list_remove_list(pdata.data, pdata.data);
+		if (s && fields == ETVDB_FIELD_ALL)
+			_etvdb_store_series_add(s);
+	}
+
+	if (s && fields == ETVDB_FIELD_ALL)
+		s = _etvdb_registry_series_add(s);
 
 	return s;
 }
@@ -76,6 +120,8 @@ EAPI Series *etvdb_series_by_id_get(uint32_t id)
  * @return a fully initialized Series on success.
  * @return NULL on failure.
  *
+ * @see etvdb_series_list_upgrade()
+ *
  * @ingroup Series
  */
 EAPI Series *etvdb_series_from_list_get(Eina_List *list, int number)
@@ -100,6 +146,80 @@ EAPI Series *etvdb_series_from_list_get(Eina_List *list, int number)
 	return s;
 }
 
+/**
+ * @brief Upgrade the Series of a list to full records
+ *
+ * This function retrieves the full Base Series Record of the first
+ * count Series of a list, usually one generated with etvdb_series_find(),
+ * like etvdb_series_from_list_get() does for one of them.
+ * The records are downloaded at the same time, and the Series
+ * in the list are updated in place, so no new Series are allocated.
+ *
+ * Series loaded from a snapshot or a catalogue are full records
+ * already and left as they are.
+ *
+ * @param list a list containing etvdb Series structures
+ * @param count number of Series to upgrade from the start of the list, 0 for all
+ *
+ * @return EINA_TRUE if all Series were upgraded
+ * @return EINA_FALSE if any Series failed, the others are upgraded nonetheless
+ *
+ * @ingroup Series
+ */
+EAPI Eina_Bool etvdb_series_list_upgrade(Eina_List *list, unsigned int count)
+{
+	unsigned int n = 0;
+	Download_Batch batch;
+	Eina_List *l;
+	List_Upgrade up;
+	Series *s, *full;
+
+	if (!count || count > eina_list_count(list))
+		count = eina_list_count(list);
+
+	up.ok = EINA_TRUE;
+	up.series = malloc((count + 1) * sizeof(Series *));
+	if (!up.series) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	/* Series in the store don't need to be downloaded */
+	EINA_LIST_FOREACH(list, l, s) {
+		if (!count--)
+			break;
+		if (s->priv && s->priv->map)
+			continue;
+
+		full = _etvdb_store_series_find(s->id);
+		if (full)
+			_record_take(s, full);
+		else
+			up.series[n++] = s;
+	}
+
+	if (!n)
+		goto end;
+
+	memset(&batch, 0, sizeof(Download_Batch));
+	batch.count = n;
+	batch.connections = UPGRADE_CONNECTIONS;
+	batch.uri_cb = _upgrade_uri_cb;
+	batch.done_cb = _upgrade_done_cb;
+	batch.data = &up;
+
+	DBG("Upgrading %u Series to full records.", n);
+
+	/* the batch is only aborted by the deadline or cancellation */
+	if (!_etvdb_dl_batch(&batch))
+		up.ok = EINA_FALSE;
+
+end:
+	free(up.series);
+
+	return up.ok;
+}
+
 /**
  * @brief Find Series by Name
  *
@@ -122,45 +242,87 @@ EAPI Series *etvdb_series_from_list_get(Eina_List *list, int number)
  */
 EAPI Eina_List *etvdb_series_find(const char *name)
 {
-	char *buf;
 	char uri[URI_MAX];
 	Download xml;
+	Eina_List *list;
 	Parser_Data pdata;
+	Series *s;
 
 	pdata.s = NULL;
 	pdata.data = NULL;
+	pdata.zap2it_id = NULL;
+	pdata.fields = ETVDB_FIELD_ALL;
 
 	if (!name)
 		return NULL;
 
 	if (!memcmp(name, "tt", 2)) {
-		DBG("Searching by IMDB ID: %s", name);
-		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeriesByRemoteID.php?imdbid=%s&language=%s",
-				name, etvdb_language);
-	} else if (!memcmp(name, "SH", 2)) {
-		DBG("Searching by zap2it ID: %s", name);
-		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeriesByRemoteID.php?zap2it=%s&language=%s",
-				name, etvdb_language);
-	} else {
-		buf = curl_easy_escape(curl_handle, name, strlen(name));
-		DBG("Searching by Name: %s", name);
-		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeries.php?seriesname=%s&language=%s",
-				buf, etvdb_language);
-		free(buf);
+		s = etvdb_registry_series_by_imdb_get(name);
+		if (!s)
+			s = _etvdb_store_series_imdb_find(name);
+		if (s)
+			return eina_list_append(NULL, s);
 	}
 
-	CURL_XML_DL_MEM(xml, uri)
+	if (_etvdb_client_series_find(name, &list))
+		return list;
+
+	_etvdb_series_find_uri_get(name, uri);
+
+	CURL_XML_DL_MEM(xml, uri) {
 		ERR("Couldn't get series data from server.");
+		free(xml.data);
+		return NULL;
+	}
 
 	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
-	if (!eina_simple_xml_parse(xml.data, xml.len, EINA_TRUE, _parse_series_cb, &pdata))
+	if (!_etvdb_xml_parse(xml.data, xml.len, _parse_series_cb, &pdata)) {
+		if (_etvdb_request_expired()) {
+			ERR("Parsing Series data aborted, the deadline expired or the call was cancelled.");
+			free(xml.data);
+			free(pdata.zap2it_id);
+			EINA_LIST_FREE(pdata.data, s)
+				etvdb_series_free(s);
+			return NULL;
+		}
 		CRIT("Parsing Series data failed. If it happens again, please report a bug.");
+	}
 
 	free(xml.data);
+	free(pdata.zap2it_id);
 
 	return pdata.data;
 }
 
+/**
+ * @brief Copy a Series structure
+ *
+ * This function copies the Base Series Record of a Series,
+ * Episodes are not copied.
+ * It is useful to keep a Series passed to a callback by etvdb_series_find_foreach().
+ *
+ * @param s pointer to Series structure
+ *
+ * @return a new Series structure, which has to be freed with etvdb_series_free()
+ *
+ * @ingroup Series
+ */
+EAPI Series *etvdb_series_dup(const Series *s)
+{
+	Series *dup;
+
+	dup = etvdb_series_new();
+	dup->id = s->id;
+	dup->imdb_id = s->imdb_id ? strdup(s->imdb_id) : NULL;
+	dup->name = s->name ? strdup(s->name) : NULL;
+	dup->overview = s->overview ? strdup(s->overview) : NULL;
+	dup->runtime = s->runtime;
+	if (s->priv && s->priv->skipped)
+		_etvdb_series_priv_get(dup)->skipped = s->priv->skipped;
+
+	return dup;
+}
+
 /**
  * @brief Initialize new Series structure
  *
@@ -184,6 +346,7 @@ EAPI Series *etvdb_series_new()
 	s->seasons = NULL;
 	s->specials = NULL;
 	s->runtime = 0;
+	s->priv = NULL;
 
 	return s;
 }
@@ -205,6 +368,10 @@ EAPI Series *etvdb_series_new()
  * for example after using etvdb_episode_by_id_get(), this function will dump
  * and free all existing associated episodes.
  * Be aware of any pointers left to existing episodes before using it!
+ * Series read by other threads are refreshed with etvdb_versioned_refresh() instead.
+ * A Series shared by the @ref Registry, which has Episodes already,
+ * can't be populated again, because other holders may point at them.
+ * Use etvdb_versioned_refresh() to refresh shared data.
  *
  * @param s pointer to Series structure.
  *
@@ -215,61 +382,296 @@ EAPI Series *etvdb_series_new()
  *
  * @see etvdb_series_find()
  * @see etvdb_series_free()
+ * @see etvdb_series_populate_fields()
  */
 EAPI Eina_Bool etvdb_series_populate(Series *s)
+{
+	return etvdb_series_populate_fields(s, ETVDB_FIELD_ALL);
+}
+
+/**
+ * @brief Populate a Series structure with selected Episode data
+ *
+ * This function works like etvdb_series_populate(), but the Episodes only
+ * contain the fields in the mask, the others are left NULL.
+ * For example ETVDB_FIELD_FIRSTAIRED is enough for a schedule,
+ * and is much faster to parse than all fields.
+ *
+ * @param s pointer to Series structure.
+ * @param fields mask of Etvdb_Field values
+ *
+ * @return EINA_TRUE on success
+ * @return EINA_FALSE on failure.
+ *
+ * @see etvdb_series_fields_fill()
+ *
+ * @ingroup Series
+ */
+EAPI Eina_Bool etvdb_series_populate_fields(Series *s, unsigned int fields)
 {
 	Eina_List *all, *l, *lnex, *sl;
 	Episode *e;
 
+	if ((s->seasons || s->specials) && _etvdb_registry_series_shared(s)) {
+		ERR("Series %"PRIu32" is shared by the registry, its Episodes can't be replaced.", s->id);
+		return EINA_FALSE;
+	}
+
 	/* remove all existing list nodes to avoid corrupt data */
+	_etvdb_registry_episodes_del(s);
 	EINA_LIST_FREE(s->specials, e)
 		etvdb_episode_free(e);
 
 	EINA_LIST_FOREACH_SAFE(s->seasons, l, lnex, sl) {
-		EINA_LIST_FREE(sl, e);
+		EINA_LIST_FREE(sl, e)
+			etvdb_episode_free(e);
 		s->seasons = eina_list_remove_list(s->seasons, l);
 	}
 
+	/* compressed overviews and the indexes belong to the old Episodes */
+	_etvdb_overviews_free(s);
+	_etvdb_orders_free(s);
+	if (s->priv)
+		s->priv->populated = EINA_FALSE;
+
 	if (!s->id) {
 		ERR("No ID for the selected Series found.");
 		return EINA_FALSE;
 	}
 
-	all = etvdb_episodes_get(s);
+	if (fields == ETVDB_FIELD_ALL && _etvdb_client_series_populate(s)) {
+		_etvdb_registry_episodes_add(s);
+		return EINA_TRUE;
+	}
+
+	all = etvdb_episodes_fields_get(s, fields);
 	if (!all) {
 		ERR("Couldn't get Episodes for Series %"PRIu32, s->id);
 		return EINA_FALSE;
 	}
 
-	EINA_LIST_FOREACH_SAFE(all, l, lnex, e) {
-		/* specials are season 0 */
-		if (e->season == 0)
-			eina_list_move(&s->specials, &all, e);
-		else if (eina_list_count(s->seasons) < e->season) {
-			sl = NULL;
-			eina_list_move(&sl, &all, e);
-			s->seasons =  eina_list_append(s->seasons, sl);
-		} else {
-			sl = (Eina_List *)eina_list_nth(s->seasons, e->season - 1);
-			eina_list_move(&sl, &all, e);
-		}
+	if (!_etvdb_series_episodes_bucket(s, all))
+		return EINA_FALSE;
+
+	_etvdb_registry_episodes_add(s);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Fill in fields, which were left out before
+ *
+ * This function fetches the fields in the mask, which were left out
+ * of a Series or its Episodes, e.g. by etvdb_series_populate_fields().
+ * Existing fields are kept, only the left out ones are downloaded.
+ * Fields, which TVDB doesn't have, are not asked for again.
+ *
+ * Series loaded with etvdb_series_load() can't be filled in.
+ *
+ * @param s pointer to Series structure.
+ * @param fields mask of Etvdb_Field values
+ *
+ * @return EINA_TRUE on success
+ * @return EINA_FALSE on failure.
+ *
+ * @ingroup Series
+ */
+EAPI Eina_Bool etvdb_series_fields_fill(Series *s, unsigned int fields)
+{
+	unsigned int need = 0;
+	Eina_Hash *hash;
+	Eina_List *all, *l, *sl;
+	Episode *e;
+	Series *tmp;
+
+	if (!s->id) {
+		ERR("No ID for the selected Series found.");
+		return EINA_FALSE;
 	}
 
-	if (eina_list_count(all) != 0) {
-		ERR("Not all episodes could be added to the Season structure.");
+	if (s->priv && s->priv->map) {
+		ERR("Series %"PRIu32" was loaded from a snapshot and can't be changed.", s->id);
 		return EINA_FALSE;
 	}
 
+	/* the Series record has no air date */
+	if (s->priv)
+		need = s->priv->skipped & fields & ~ETVDB_FIELD_FIRSTAIRED;
+
+	if (need) {
+		tmp = etvdb_series_by_id_fields_get(s->id, need);
+		if (!tmp)
+			return EINA_FALSE;
+
+		if (need & ETVDB_FIELD_NAME) {
+			free(s->name);
+			s->name = tmp->name;
+			tmp->name = NULL;
+		}
+		if (need & ETVDB_FIELD_OVERVIEW) {
+			free(s->overview);
+			s->overview = tmp->overview;
+			tmp->overview = NULL;
+		}
+		if (need & ETVDB_FIELD_IMDB_ID) {
+			free(s->imdb_id);
+			s->imdb_id = tmp->imdb_id;
+			tmp->imdb_id = NULL;
+		}
+		etvdb_series_free(tmp);
+
+		s->priv->skipped &= ~need;
+	}
+
+	need = _episodes_missing_get(s->specials, fields);
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		need |= _episodes_missing_get(sl, fields);
+
+	if (!need)
+		return EINA_TRUE;
+
+	DBG("Filling in fields 0x%x of the Episodes of Series %"PRIu32, need, s->id);
+
+	all = etvdb_episodes_fields_get(s, need);
+	if (!all)
+		return EINA_FALSE;
+
+	hash = eina_hash_int32_new(NULL);
+	EINA_LIST_FOREACH(all, l, e)
+		eina_hash_add(hash, &e->id, e);
+
+	_episodes_fill(s->specials, hash, need);
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		_episodes_fill(sl, hash, need);
+
+	eina_hash_free(hash);
 	EINA_LIST_FREE(all, e)
 		etvdb_episode_free(e);
 
+	_etvdb_orders_index(s);
+
 	return EINA_TRUE;
 }
 
+/* this parses the Series record of a downloaded document */
+Series *_etvdb_series_parse(const char *data, size_t len, unsigned int fields)
+{
+	Parser_Data pdata;
+	Series *s;
+
+	pdata.s = NULL;
+	pdata.data = NULL;
+	pdata.zap2it_id = NULL;
+	pdata.fields = fields;
+
+	pdata.xml_count = pdata.xml_depth = pdata.xml_sibling = 0;
+	if (!_etvdb_xml_parse(data, len, _parse_series_cb, &pdata)) {
+		if (_etvdb_request_expired()) {
+			ERR("Parsing series data aborted, the deadline expired or the call was cancelled.");
+			free(pdata.zap2it_id);
+			EINA_LIST_FREE(pdata.data, s)
+				etvdb_series_free(s);
+			return NULL;
+		}
+		CRIT("Parsing series data failed. If it happens again, please report a bug.");
+	}
+
+	free(pdata.zap2it_id);
+
+	/* only a single series is expected, should there be more
+	 * (which would be a TVDB bug), they are dropped */
+	s = eina_list_data_get(pdata.data);
+	pdata.data = eina_list_remove_list(pdata.data, pdata.data);
+	EINA_LIST_FREE(pdata.data, pdata.s)
+		etvdb_series_free(pdata.s);
+
+	return s;
+}
+
+/* download a Series with all Episodes in one request, bypassing the store */
+Series *_etvdb_series_all_get(uint32_t id)
+{
+	char uri[URI_MAX];
+	Download xml;
+	Eina_List *all;
+	Series *s;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/all/%s.xml",
+			etvdb_api_key, id, etvdb_language);
+
+	CURL_XML_DL_MEM(xml, uri) {
+		ERR("Couldn't get Series %"PRIu32" from server.", id);
+		free(xml.data);
+		return NULL;
+	}
+
+	s = _etvdb_series_parse(xml.data, xml.len, ETVDB_FIELD_ALL);
+	if (!s) {
+		free(xml.data);
+		return NULL;
+	}
+
+	all = _etvdb_episodes_parse(s, xml.data, xml.len, ETVDB_FIELD_ALL, EINA_FALSE);
+	if (!all || !_etvdb_series_episodes_bucket(s, all)) {
+		etvdb_series_free(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+/* this builds the search uri for etvdb_series_find(), uri has to be URI_MAX long */
+void _etvdb_series_find_uri_get(const char *name, char *uri)
+{
+	char *buf;
+
+	if (!memcmp(name, "tt", 2)) {
+		DBG("Searching by IMDB ID: %s", name);
+		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeriesByRemoteID.php?imdbid=%s&language=%s",
+				name, etvdb_language);
+	} else if (!memcmp(name, "SH", 2)) {
+		DBG("Searching by zap2it ID: %s", name);
+		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeriesByRemoteID.php?zap2it=%s&language=%s",
+				name, etvdb_language);
+	} else {
+		buf = curl_easy_escape(curl_handle, name, strlen(name));
+		DBG("Searching by Name: %s", name);
+		snprintf(uri, URI_MAX, TVDB_API_URI"/GetSeries.php?seriesname=%s&language=%s",
+				buf, etvdb_language);
+		free(buf);
+	}
+}
+
+/**
+ * @brief Get the overview of a Series
+ *
+ * This function returns the overview member, or decompresses
+ * the overview, if the overviews of the Series were compressed.
+ *
+ * @param s pointer to Series structure
+ *
+ * @return the overview, which belongs to the Series, or NULL if there is none.
+ * A decompressed overview is only valid until the next overview
+ * is read in the same thread.
+ *
+ * @see etvdb_series_overviews_compress()
+ *
+ * @ingroup Series
+ */
+EAPI const char *etvdb_series_overview_get(const Series *s)
+{
+	if (s->overview)
+		return s->overview;
+
+	return _etvdb_overviews_series_get(s);
+}
+
 /**
  * @brief Free a Series structure
  *
  * This function frees a Series structure and its data.
+ * A Series shared by the registry only gives back a reference,
+ * it is freed with the last one, see @ref Registry.
  *
  * @param s pointer to Series structure
  *
@@ -280,6 +682,9 @@ EAPI void etvdb_series_free(Series *s)
 	Eina_List *sl;
 	Episode *e;
 
+	if (!_etvdb_registry_series_release(s))
+		return;
+
 	EINA_LIST_FREE(s->seasons, sl) {
 		EINA_LIST_FREE(sl, e)
 			etvdb_episode_free(e);
@@ -288,9 +693,14 @@ EAPI void etvdb_series_free(Series *s)
 	EINA_LIST_FREE(s->specials, e)
 		etvdb_episode_free(e);
 
-	free(s->imdb_id);
-	free(s->name);
-	free(s->overview);
+	/* strings of a loaded snapshot point into its mapping */
+	if (!s->priv || !s->priv->map) {
+		free(s->imdb_id);
+		free(s->name);
+		free(s->overview);
+	}
+
+	_etvdb_series_priv_free(s);
 	free(s);
 }
 
@@ -317,12 +727,174 @@ EAPI int etvdb_series_episodes_count(Series *s, int season)
  * @}
  */
 
-/* this callback parses found series and puts them in a list */
-static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const char *content,
-		unsigned offset UNUSED, unsigned length)
+/* this sorts a list of Episodes into the seasons and specials of a Series.
+ * the list is consumed, Episodes which can't be sorted are freed. */
+Eina_Bool _etvdb_series_episodes_bucket(Series *s, Eina_List *all)
+{
+	Eina_List *l, *lnex, *sl;
+	Episode *e;
+
+	EINA_LIST_FOREACH_SAFE(all, l, lnex, e) {
+		/* specials are season 0 */
+		if (e->season == 0)
+			eina_list_move(&s->specials, &all, e);
+		else if (eina_list_count(s->seasons) < e->season) {
+			sl = NULL;
+			eina_list_move(&sl, &all, e);
+			s->seasons =  eina_list_append(s->seasons, sl);
+		} else {
+			sl = (Eina_List *)eina_list_nth(s->seasons, e->season - 1);
+			eina_list_move(&sl, &all, e);
+		}
+	}
+
+	if (eina_list_count(all) != 0) {
+		ERR("Not all episodes could be added to the Season structure.");
+		return EINA_FALSE;
+	}
+
+	EINA_LIST_FREE(all, e)
+		etvdb_episode_free(e);
+
+	_etvdb_orders_index(s);
+	if (_etvdb_series_priv_get(s))
+		s->priv->populated = EINA_TRUE;
+
+	return EINA_TRUE;
+}
+
+static void _upgrade_uri_cb(Download_Batch *batch, unsigned int i, char *uri)
+{
+	List_Upgrade *up = batch->data;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/%s.xml",
+			etvdb_api_key, up->series[i]->id, etvdb_language);
+}
+
+/* move a downloaded record into the Series of the list */
+static void _upgrade_done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl)
+{
+	List_Upgrade *up = batch->data;
+	Series *full = NULL;
+
+	if (!res)
+		full = _etvdb_series_parse(dl->data, dl->len, ETVDB_FIELD_ALL);
+	free(dl->data);
+
+	if (!full) {
+		ERR("Couldn't get Series %"PRIu32" from server.", up->series[i]->id);
+		up->ok = EINA_FALSE;
+		return;
+	}
+
+	_etvdb_store_series_add(full);
+	_record_take(up->series[i], full);
+}
+
+/* replace the record of a Series with a full one, full is consumed */
+static void _record_take(Series *s, Series *full)
+{
+	free(s->name);
+	free(s->overview);
+
+	/* a registered Series is found by its IMDB ID, it is keyed again */
+	_etvdb_registry_series_imdb_set(s, full->imdb_id);
+	s->name = full->name;
+	s->overview = full->overview;
+	s->runtime = full->runtime;
+	full->imdb_id = full->name = full->overview = NULL;
+
+	if (s->priv)
+		s->priv->skipped = 0;
+
+	etvdb_series_free(full);
+}
+
+/* get the mask of the requested fields, which were left out of a list of Episodes */
+static unsigned int _episodes_missing_get(Eina_List *episodes, unsigned int fields)
+{
+	unsigned int need = 0;
+	Eina_List *l;
+	Episode *e;
+
+	EINA_LIST_FOREACH(episodes, l, e)
+		need |= e->skipped;
+
+	return need & fields;
+}
+
+/* move the fetched fields (Episodes hashed by ID) into the Episodes, which left them out */
+static void _episodes_fill(Eina_List *episodes, Eina_Hash *fetched, unsigned int need)
+{
+	unsigned int fill;
+	Eina_List *l;
+	Episode *e, *f;
+
+	EINA_LIST_FOREACH(episodes, l, e) {
+		fill = e->skipped & need;
+		if (!fill || !(f = eina_hash_find(fetched, &e->id)))
+			continue;
+
+		if (fill & ETVDB_FIELD_NAME) {
+			e->name = f->name;
+			f->name = NULL;
+		}
+		if (fill & ETVDB_FIELD_OVERVIEW) {
+			e->overview = f->overview;
+			f->overview = NULL;
+		}
+		if (fill & ETVDB_FIELD_IMDB_ID) {
+			e->imdb_id = f->imdb_id;
+			f->imdb_id = NULL;
+		}
+		if (fill & ETVDB_FIELD_FIRSTAIRED) {
+			e->firstaired = f->firstaired;
+			f->firstaired = NULL;
+		}
+
+		e->skipped &= ~fill;
+	}
+}
+
+/* set the field of a Series, which tag stands for, from its content.
+ * the strings are stored by text_cb, this is shared by all Series parsers */
+void _etvdb_series_field_set(Series *s, Xml_Tag tag, const char *content, unsigned length,
+		char **zap2it_id, Field_Text_Cb text_cb, void *data)
 {
 	char buf[length + 1];
-	enum nname { UNKNOWN, ID, NAME, IMDB, OVERVIEW, RUNTIME };
+
+	switch (tag) {
+	case XML_TAG_ID:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu32, &s->id);
+		DBG("Found ID: %"PRIu32, s->id);
+		break;
+	case XML_TAG_SERIES_NAME:
+		s->name = text_cb(data, s, tag, content, length, EINA_TRUE);
+		break;
+	case XML_TAG_IMDB_ID:
+		s->imdb_id = text_cb(data, s, tag, content, length, EINA_FALSE);
+		break;
+	case XML_TAG_ZAP2IT_ID:
+		*zap2it_id = text_cb(data, s, tag, content, length, EINA_FALSE);
+		break;
+	case XML_TAG_OVERVIEW:
+		s->overview = text_cb(data, s, tag, content, length, EINA_TRUE);
+		break;
+	case XML_TAG_RUNTIME:
+		MEM2STR(buf, content, length);
+		sscanf(buf, "%"SCNu16, &s->runtime);
+		DBG("Found Runtime: %"PRIu16, s->runtime);
+		break;
+	default:
+		break;
+	}
+}
+
+/* this callback parses found series and puts them in a list */
+static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
+{
 	Parser_Data *pdata = data;
 	Series *series = pdata->s;
 
@@ -330,34 +902,37 @@ static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const c
 	case EINA_SIMPLE_XML_OPEN:
 		switch (pdata->xml_depth) {
 		case 0:
-			if (!TAGCMP("Data", content))
+			if (tag == XML_TAG_DATA)
 				pdata->xml_depth++;
 			break;
 		case 1:
-			if (!TAGCMP("Series", content)) {
+			if (tag == XML_TAG_SERIES) {
+				if (_etvdb_request_expired())
+					return EINA_FALSE;
+
 				pdata->xml_depth++;
 				series = etvdb_series_new();
+				if (pdata->fields != ETVDB_FIELD_ALL)
+					_etvdb_series_priv_get(series)->skipped = ~pdata->fields & ETVDB_FIELD_ALL;
 				pdata->data= eina_list_append(pdata->data, series);
 			}
 			break;
 		case 2:
-			if (!TAGCMP("id", content))
-				pdata->xml_sibling = ID;
-			else if (!TAGCMP("SeriesName", content))
-				pdata->xml_sibling = NAME;
-			else if (!TAGCMP("IMDB_ID", content))
-				pdata->xml_sibling = IMDB;
-			else if (!TAGCMP("Overview", content))
-				pdata->xml_sibling = OVERVIEW;
-			else if (!TAGCMP("Runtime", content))
-				pdata->xml_sibling = RUNTIME;
-			else
-				pdata->xml_sibling = UNKNOWN;
+			pdata->xml_sibling = tag;
+			if ((tag == XML_TAG_SERIES_NAME && !(pdata->fields & ETVDB_FIELD_NAME))
+					|| (tag == XML_TAG_IMDB_ID && !(pdata->fields & ETVDB_FIELD_IMDB_ID))
+					|| (tag == XML_TAG_OVERVIEW && !(pdata->fields & ETVDB_FIELD_OVERVIEW)))
+				pdata->xml_sibling = XML_TAG_UNKNOWN;
 			break;
 		}
 		break;
 	case EINA_SIMPLE_XML_CLOSE:
-		if(!TAGCMP("Series", content)) {
+		if (tag == XML_TAG_SERIES) {
+			series = eina_list_nth(pdata->data, pdata->xml_count);
+			_etvdb_search_index_add(series, pdata->zap2it_id);
+			free(pdata->zap2it_id);
+			pdata->zap2it_id = NULL;
+
 			pdata->xml_count++;
 			pdata->xml_depth--;
 		}
@@ -366,35 +941,8 @@ static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const c
 		if (pdata->xml_depth == 2) {
 			series = eina_list_nth(pdata->data, pdata->xml_count);
 
-			switch (pdata->xml_sibling) {
-			case ID:
-				MEM2STR(buf, content, length);
-				sscanf(buf, "%"SCNu32, &series->id);
-				DBG("Found ID: %"PRIu32, series->id);
-				break;
-			case NAME:
-				series->name = malloc(length + 1);
-				MEM2STR(buf, content, length);
-				HTML2UTF(series->name, buf);
-				DBG("Found Name: %s", series->name);
-				break;
-			case IMDB:
-				series->imdb_id = malloc(length + 1);
-				MEM2STR(series->imdb_id, content, length);
-				DBG("Found IMDB_ID: %s", series->imdb_id);
-				break;
-			case OVERVIEW:
-				series->overview = malloc(length + 1);
-				MEM2STR(buf, content, length);
-				HTML2UTF(series->overview, buf);
-				DBG("Found Overview: %zu chars", strlen(series->overview));
-				break;
-			case RUNTIME:
-				MEM2STR(buf, content, length);
-				sscanf(buf, "%"SCNu16, &series->runtime);
-				DBG("Found Runtime: %"PRIu16, series->runtime);
-				break;
-			}
+			_etvdb_series_field_set(series, pdata->xml_sibling, content, length,
+					&pdata->zap2it_id, _series_text_cb, pdata);
 		}
 		break;
 	default:
@@ -403,3 +951,45 @@ static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, const c
 
 	return EINA_TRUE;
 }
+
+/* stores the strings of a parsed Series */
+static char *_series_text_cb(void *data, void *record UNUSED, Xml_Tag tag,
+		const char *content, unsigned length, Eina_Bool decode)
+{
+	char buf[length + 1];
+	char *str;
+	Parser_Data *pdata = data;
+
+	str = malloc(length + 1);
+	if (!str) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	if (decode) {
+		MEM2STR(buf, content, length);
+		HTML2UTF(str, buf);
+	} else {
+		MEM2STR(str, content, length);
+	}
+
+	switch (tag) {
+	case XML_TAG_SERIES_NAME:
+		DBG("Found Name: %s", str);
+		break;
+	case XML_TAG_IMDB_ID:
+		DBG("Found IMDB_ID: %s", str);
+		break;
+	case XML_TAG_ZAP2IT_ID:
+		free(pdata->zap2it_id);
+		DBG("Found zap2it_id: %s", str);
+		break;
+	case XML_TAG_OVERVIEW:
+		DBG("Found Overview: %zu chars", strlen(str));
+		break;
+	default:
+		break;
+	}
+
+	return str;
+}
@@ -0,0 +1,661 @@
+#include "etvdb_private.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* catalogue format identification */
+#define CATALOGUE_MAGIC "ETVDBCAT"
+#define CATALOGUE_VERSION 2
+#define CATALOGUE_ENDIAN 0x01020304
+
+/* attempts to map the published generation, while a writer keeps publishing */
+#define CATALOGUE_RETRIES 8
+
+/* snapshot images are 8 byte aligned in a generation */
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+/* control segment, it only holds the published generation */
+typedef struct _catalogue_control {
+	char magic[8]; /**< CATALOGUE_MAGIC */
+	uint32_t version; /**< CATALOGUE_VERSION */
+	uint32_t endian; /**< CATALOGUE_ENDIAN in host byte order */
+	uint64_t generation; /**< published generation, 0 if there is none, updated atomically */
+} Catalogue_Control;
+
+/* header at the start of a generation segment
+ *
+ * the segment layout is:
+ * header | index entries sorted by ID | snapshot images
+ * offsets are relative to the start of the segment. */
+typedef struct _catalogue_header {
+	char magic[8]; /**< CATALOGUE_MAGIC */
+	uint32_t version; /**< CATALOGUE_VERSION */
+	uint32_t endian; /**< CATALOGUE_ENDIAN in host byte order */
+	uint64_t generation; /**< generation of the segment */
+	uint64_t size; /**< total size of the segment */
+	uint32_t count; /**< number of Series */
+	uint32_t reserved; /**< padding, always 0 */
+} Catalogue_Header;
+
+/* index entry of a Series */
+typedef struct _catalogue_entry {
+	uint32_t id; /**< TVDB ID */
+	uint32_t reserved; /**< padding, always 0 */
+	uint64_t offset; /**< offset of the snapshot image */
+	uint64_t len; /**< length of the snapshot image */
+} Catalogue_Entry;
+
+/* a mapped generation, shared by the Series built from it */
+struct _shared_map {
+	int ref; /**< the catalogue and every Series built from it */
+	void *map; /**< the mapping */
+	size_t len; /**< length of the mapping */
+};
+
+/* a Series image while a generation is written */
+typedef struct _catalogue_source {
+	uint32_t id; /**< TVDB ID */
+	const void *data; /**< snapshot image */
+	size_t len; /**< length of the snapshot image */
+} Catalogue_Source;
+
+struct _etvdb_catalogue {
+	char *name; /**< name of the catalogue */
+	Eina_Bool writer; /**< the catalogue was created, not opened */
+	Catalogue_Control *control; /**< mapped control segment */
+	Shared_Map *current; /**< mapped current generation, or NULL */
+	Eina_Hash *pending; /**< ID -> Eina_Binbuf, Series added since the last publish */
+	Eina_Lock lock; /**< protects current and pending, the catalogue can be used by many threads */
+};
+
+/* internal functions */
+static Eina_Bool _name_valid(const char *name);
+static Shared_Map *_map_open(const char *name, uint64_t generation);
+static void _refresh(Etvdb_Catalogue *c);
+static const Catalogue_Entry *_entry_find(const Shared_Map *m, uint32_t id);
+static Eina_Bool _pending_collect(const Eina_Hash *hash, const void *key, void *data, void *fdata);
+static void _binbuf_free(void *data);
+static int _source_cmp(const void *a, const void *b);
+static Etvdb_Catalogue *_catalogue_new(const char *name, int flags, int prot);
+
+/**
+ * @brief Shared Catalogues
+ * @defgroup Shared
+ *
+ * @{
+ *
+ * A catalogue holds Series in shared memory, so many processes on a host
+ * share one copy of them instead of fetching and parsing their own.
+ *
+ * One process creates the catalogue, adds Series and publishes them.
+ * Every publish writes a new generation of the catalogue,
+ * made of an index and snapshot images of the Series, see @ref Snapshots.
+ * The generation is made visible with a single atomic store,
+ * so other processes always see complete generations.
+ *
+ * Other processes open the catalogue read-only and get Series from it.
+ * Their strings point into the shared memory, only the Series and Episode
+ * structures are allocated per process.
+ * A Series keeps its generation mapped until it is freed,
+ * also if newer generations are published in the meantime.
+ *
+ * Catalogues use the host byte order and are meant for one host only.
+ * There must only be one writer per catalogue.
+ */
+
+/**
+ * @brief Create a catalogue to publish Series
+ *
+ * If the catalogue exists already, its current generation is kept
+ * and new Series are added to it.
+ *
+ * @param name name of the catalogue, without any '/'
+ *
+ * @return the catalogue, which has to be closed with etvdb_catalogue_close()
+ * @return NULL on failure
+ *
+ * @see etvdb_catalogue_open()
+ *
+ * @ingroup Shared
+ */
+EAPI Etvdb_Catalogue *etvdb_catalogue_create(const char *name)
+{
+	Etvdb_Catalogue *c;
+
+	c = _catalogue_new(name, O_RDWR | O_CREAT, PROT_READ | PROT_WRITE);
+	if (!c)
+		return NULL;
+
+	c->writer = EINA_TRUE;
+	c->pending = eina_hash_int32_new(_binbuf_free);
+
+	/* a new control segment is all zeroes */
+	if (!c->control->version) {
+		memcpy(c->control->magic, CATALOGUE_MAGIC, sizeof(c->control->magic));
+		c->control->version = CATALOGUE_VERSION;
+		c->control->endian = CATALOGUE_ENDIAN;
+	}
+
+	_refresh(c);
+
+	return c;
+}
+
+/**
+ * @brief Open a catalogue to read Series from it
+ *
+ * @param name name of the catalogue, as passed to etvdb_catalogue_create()
+ *
+ * @return the catalogue, which has to be closed with etvdb_catalogue_close()
+ * @return NULL on failure, e.g. if it wasn't created yet
+ *
+ * @ingroup Shared
+ */
+EAPI Etvdb_Catalogue *etvdb_catalogue_open(const char *name)
+{
+	Etvdb_Catalogue *c;
+
+	c = _catalogue_new(name, O_RDONLY, PROT_READ);
+	if (!c)
+		return NULL;
+
+	_refresh(c);
+
+	return c;
+}
+
+/**
+ * @brief Close a catalogue
+ *
+ * The shared memory stays, so other processes can still use it,
+ * and Series got from the catalogue stay valid.
+ * Series added since the last publish are dropped.
+ *
+ * @param c the catalogue
+ *
+ * @see etvdb_catalogue_unlink()
+ *
+ * @ingroup Shared
+ */
+EAPI void etvdb_catalogue_close(Etvdb_Catalogue *c)
+{
+	if (c->current)
+		_etvdb_shared_map_unref(c->current);
+	if (c->pending)
+		eina_hash_free(c->pending);
+
+	munmap(c->control, sizeof(Catalogue_Control));
+	eina_lock_free(&c->lock);
+	free(c->name);
+	free(c);
+}
+
+/**
+ * @brief Remove a catalogue from the system
+ *
+ * Processes, which have it mapped, can keep using it.
+ *
+ * @param name name of the catalogue
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if it couldn't be removed
+ *
+ * @ingroup Shared
+ */
+EAPI Eina_Bool etvdb_catalogue_unlink(const char *name)
+{
+	char path[URI_MAX];
+	uint64_t generation;
+	Etvdb_Catalogue *c;
+
+	c = etvdb_catalogue_open(name);
+	if (!c)
+		return EINA_FALSE;
+
+	generation = __atomic_load_n(&c->control->generation, __ATOMIC_ACQUIRE);
+	etvdb_catalogue_close(c);
+
+	if (generation) {
+		snprintf(path, URI_MAX, "/%s.%"PRIu64, name, generation);
+		shm_unlink(path);
+	}
+
+	snprintf(path, URI_MAX, "/%s", name);
+
+	return !shm_unlink(path);
+}
+
+/**
+ * @brief Add a Series to a catalogue
+ *
+ * The Series is copied, it becomes visible to other processes with
+ * the next etvdb_catalogue_publish(). A Series with the same ID is replaced.
+ *
+ * @param c a catalogue created by this process
+ * @param s a populated Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Shared
+ */
+EAPI Eina_Bool etvdb_catalogue_series_add(Etvdb_Catalogue *c, Series *s)
+{
+	Eina_Binbuf *buf;
+
+	if (!c->writer) {
+		ERR("Catalogue %s was opened read-only.", c->name);
+		return EINA_FALSE;
+	}
+
+	buf = _etvdb_snapshot_build(s);
+	if (!buf)
+		return EINA_FALSE;
+
+	eina_lock_take(&c->lock);
+	eina_hash_del_by_key(c->pending, &s->id);
+	eina_hash_add(c->pending, &s->id, buf);
+	eina_lock_release(&c->lock);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Publish the Series added to a catalogue
+ *
+ * This function writes a new generation with the Series of the current
+ * generation and the added ones, and makes it visible to other processes.
+ *
+ * @param c a catalogue created by this process
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Shared
+ */
+EAPI Eina_Bool etvdb_catalogue_publish(Etvdb_Catalogue *c)
+{
+	char path[URI_MAX];
+	int fd;
+	unsigned int i, n = 0, count;
+	uint64_t generation, size, offset;
+	char *map;
+	Catalogue_Entry *entries;
+	Catalogue_Header *h;
+	Catalogue_Source *sources, *next;
+	const Catalogue_Entry *old;
+	const Catalogue_Header *oh = NULL;
+	Eina_Bool ret = EINA_FALSE;
+
+	if (!c->writer) {
+		ERR("Catalogue %s was opened read-only.", c->name);
+		return EINA_FALSE;
+	}
+
+	/* the current generation is read while the new one is written */
+	eina_lock_take(&c->lock);
+
+	if (c->current)
+		oh = c->current->map;
+
+	count = (oh ? oh->count : 0) + eina_hash_population(c->pending);
+	sources = calloc(count + 1, sizeof(Catalogue_Source));
+	if (!sources) {
+		ERR("Couldn't allocate enough memory.");
+		goto end;
+	}
+
+	/* Series of the current generation, which weren't replaced */
+	if (oh) {
+		old = (const Catalogue_Entry *)(oh + 1);
+		for (i = 0; i < oh->count; i++) {
+			if (eina_hash_find(c->pending, &old[i].id))
+				continue;
+			sources[n].id = old[i].id;
+			sources[n].data = (const char *)oh + old[i].offset;
+			sources[n].len = old[i].len;
+			n++;
+		}
+	}
+
+	next = sources + n;
+	eina_hash_foreach(c->pending, _pending_collect, &next);
+	n = next - sources;
+	qsort(sources, n, sizeof(Catalogue_Source), _source_cmp);
+
+	size = offset = ALIGN8(sizeof(Catalogue_Header) + n * sizeof(Catalogue_Entry));
+	for (i = 0; i < n; i++)
+		size += ALIGN8(sources[i].len);
+
+	generation = __atomic_load_n(&c->control->generation, __ATOMIC_ACQUIRE) + 1;
+	snprintf(path, URI_MAX, "/%s.%"PRIu64, c->name, generation);
+
+	/* a stale segment of a crashed writer is replaced */
+	shm_unlink(path);
+	fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 || ftruncate(fd, size)) {
+		ERR("Couldn't create shared memory %s: %s", path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(path);
+		}
+		goto end;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		ERR("Couldn't map shared memory %s: %s", path, strerror(errno));
+		shm_unlink(path);
+		goto end;
+	}
+
+	h = (Catalogue_Header *)map;
+	memcpy(h->magic, CATALOGUE_MAGIC, sizeof(h->magic));
+	h->version = CATALOGUE_VERSION;
+	h->endian = CATALOGUE_ENDIAN;
+	h->generation = generation;
+	h->size = size;
+	h->count = n;
+
+	entries = (Catalogue_Entry *)(h + 1);
+	for (i = 0; i < n; i++) {
+		entries[i].id = sources[i].id;
+		entries[i].offset = offset;
+		entries[i].len = sources[i].len;
+		memcpy(map + offset, sources[i].data, sources[i].len);
+		offset += ALIGN8(sources[i].len);
+	}
+
+	munmap(map, size);
+
+	/* readers load the generation with acquire semantics */
+	__atomic_store_n(&c->control->generation, generation, __ATOMIC_RELEASE);
+	eina_hash_free_buckets(c->pending);
+	_refresh(c);
+
+	/* processes, which mapped the old generation, keep it */
+	if (generation > 1) {
+		snprintf(path, URI_MAX, "/%s.%"PRIu64, c->name, generation - 1);
+		shm_unlink(path);
+	}
+
+	DBG("Published generation %"PRIu64" of %s with %u Series in %"PRIu64" bytes.",
+			generation, c->name, n, size);
+	ret = EINA_TRUE;
+
+end:
+	free(sources);
+	eina_lock_release(&c->lock);
+
+	return ret;
+}
+
+/**
+ * @brief Get a Series from a catalogue
+ *
+ * This function looks up a Series in the latest published generation.
+ * All strings of the Series and its Episodes point into shared memory,
+ * they must not be freed or modified.
+ *
+ * @param c the catalogue
+ * @param id TVDB ID of the Series
+ *
+ * @return a populated Series, which has to be freed with etvdb_series_free()
+ * @return NULL if the catalogue holds no such Series
+ *
+ * @ingroup Shared
+ */
+EAPI Series *etvdb_catalogue_series_get(Etvdb_Catalogue *c, uint32_t id)
+{
+	Series *s = NULL;
+	Shared_Map *m;
+	const Catalogue_Entry *entry;
+
+	eina_lock_take(&c->lock);
+	_refresh(c);
+
+	m = c->current;
+	if (!m)
+		goto end;
+
+	entry = _entry_find(m, id);
+	if (!entry)
+		goto end;
+
+	s = _etvdb_snapshot_series_get((const char *)m->map + entry->offset, entry->len);
+	if (!s) {
+		ERR("Series %"PRIu32" in catalogue %s is damaged.", id, c->name);
+		goto end;
+	}
+
+	__atomic_add_fetch(&m->ref, 1, __ATOMIC_ACQ_REL);
+	_etvdb_series_priv_get(s)->shared = m;
+
+end:
+	eina_lock_release(&c->lock);
+
+	return s;
+}
+
+/**
+ * @brief Get the generation of a catalogue
+ *
+ * @param c the catalogue
+ *
+ * @return the latest published generation, 0 if nothing was published yet
+ *
+ * @ingroup Shared
+ */
+EAPI uint64_t etvdb_catalogue_generation_get(const Etvdb_Catalogue *c)
+{
+	return __atomic_load_n(&c->control->generation, __ATOMIC_ACQUIRE);
+}
+/**
+ * @}
+ */
+
+/* drop a reference to a mapped generation, the last one unmaps it */
+void _etvdb_shared_map_unref(Shared_Map *m)
+{
+	if (__atomic_sub_fetch(&m->ref, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	munmap(m->map, m->len);
+	free(m);
+}
+
+/* open and map the control segment of a catalogue */
+static Etvdb_Catalogue *_catalogue_new(const char *name, int flags, int prot)
+{
+	char path[URI_MAX];
+	int fd;
+	struct stat st;
+	Etvdb_Catalogue *c;
+
+	if (!_name_valid(name)) {
+		ERR("Invalid catalogue name.");
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(Etvdb_Catalogue));
+	if (!c) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	snprintf(path, URI_MAX, "/%s", name);
+	fd = shm_open(path, flags, 0644);
+	if (fd < 0) {
+		ERR("Couldn't open shared memory %s: %s", path, strerror(errno));
+		free(c);
+		return NULL;
+	}
+
+	if ((flags & O_CREAT) && ftruncate(fd, sizeof(Catalogue_Control)))
+		ERR("Couldn't resize shared memory %s: %s", path, strerror(errno));
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(Catalogue_Control)) {
+		ERR("Shared memory %s is not a catalogue.", path);
+		close(fd);
+		free(c);
+		return NULL;
+	}
+
+	c->control = mmap(NULL, sizeof(Catalogue_Control), prot, MAP_SHARED, fd, 0);
+	close(fd);
+	if (c->control == MAP_FAILED) {
+		ERR("Couldn't map shared memory %s: %s", path, strerror(errno));
+		free(c);
+		return NULL;
+	}
+
+	/* a created control segment is initialized by the caller */
+	if (c->control->version && (memcmp(c->control->magic, CATALOGUE_MAGIC, sizeof(c->control->magic))
+			|| c->control->version != CATALOGUE_VERSION || c->control->endian != CATALOGUE_ENDIAN)) {
+		ERR("Shared memory %s is not a supported catalogue.", path);
+		munmap(c->control, sizeof(Catalogue_Control));
+		free(c);
+		return NULL;
+	}
+
+	c->name = strdup(name);
+	eina_lock_new(&c->lock);
+
+	return c;
+}
+
+/* map the published generation, if it changed. c->lock has to be held,
+ * unless the catalogue isn't shared yet */
+static void _refresh(Etvdb_Catalogue *c)
+{
+	unsigned int i;
+	uint64_t generation;
+	Shared_Map *m;
+
+	for (i = 0; i < CATALOGUE_RETRIES; i++) {
+		generation = __atomic_load_n(&c->control->generation, __ATOMIC_ACQUIRE);
+		if (!generation)
+			return;
+
+		if (c->current && ((const Catalogue_Header *)c->current->map)->generation == generation)
+			return;
+
+		/* the generation can be replaced and removed before it is opened */
+		m = _map_open(c->name, generation);
+		if (!m)
+			continue;
+
+		if (c->current)
+			_etvdb_shared_map_unref(c->current);
+		c->current = m;
+
+		return;
+	}
+
+	WARN("Couldn't map the current generation of catalogue %s.", c->name);
+}
+
+/* map a generation read-only and check it */
+static Shared_Map *_map_open(const char *name, uint64_t generation)
+{
+	char path[URI_MAX];
+	int fd;
+	struct stat st;
+	void *map;
+	Shared_Map *m;
+	const Catalogue_Header *h;
+
+	snprintf(path, URI_MAX, "/%s.%"PRIu64, name, generation);
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(Catalogue_Header)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	h = map;
+	if (memcmp(h->magic, CATALOGUE_MAGIC, sizeof(h->magic)) || h->version != CATALOGUE_VERSION
+			|| h->endian != CATALOGUE_ENDIAN || h->generation != generation
+			|| h->size > (uint64_t)st.st_size
+			|| sizeof(Catalogue_Header) + (uint64_t)h->count * sizeof(Catalogue_Entry) > h->size) {
+		ERR("Shared memory %s is not a valid catalogue generation.", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	m = malloc(sizeof(Shared_Map));
+	if (!m) {
+		ERR("Couldn't allocate enough memory.");
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	m->ref = 1;
+	m->map = map;
+	m->len = st.st_size;
+
+	return m;
+}
+
+/* binary search the index of a generation */
+static const Catalogue_Entry *_entry_find(const Shared_Map *m, uint32_t id)
+{
+	unsigned int lo = 0, hi, mid;
+	const Catalogue_Header *h = m->map;
+	const Catalogue_Entry *entries = (const Catalogue_Entry *)(h + 1);
+
+	hi = h->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (entries[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == h->count || entries[lo].id != id)
+		return NULL;
+
+	if (entries[lo].offset > h->size || entries[lo].len > h->size - entries[lo].offset)
+		return NULL;
+
+	return &entries[lo];
+}
+
+static Eina_Bool _pending_collect(const Eina_Hash *hash UNUSED, const void *key, void *data, void *fdata)
+{
+	Catalogue_Source **next = fdata;
+
+	(*next)->id = *(const uint32_t *)key;
+	(*next)->data = eina_binbuf_string_get(data);
+	(*next)->len = eina_binbuf_length_get(data);
+	(*next)++;
+
+	return EINA_TRUE;
+}
+
+static void _binbuf_free(void *data)
+{
+	eina_binbuf_free(data);
+}
+
+static int _source_cmp(const void *a, const void *b)
+{
+	const Catalogue_Source *sa = a, *sb = b;
+
+	return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+/* catalogue names become shared memory names, so they can't contain a '/' */
+static Eina_Bool _name_valid(const char *name)
+{
+	return name && *name && !strchr(name, '/') && strlen(name) < 200;
+}
@@ -0,0 +1,430 @@
+#include "etvdb_private.h"
+#include <stdio.h>
+
+/* snapshot format identification */
+#define SNAPSHOT_MAGIC "ETVDBSNP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ENDIAN 0x01020304
+
+/* header at the start of a snapshot file
+ *
+ * the file layout is:
+ * header | season sizes (uint32_t) | episode records | string table
+ * all offsets are relative to the start of the file, string offsets are
+ * relative to the string table; string offset 0 means NULL. */
+typedef struct _snapshot_header {
+	char magic[8]; /**< SNAPSHOT_MAGIC */
+	uint32_t version; /**< SNAPSHOT_VERSION */
+	uint32_t endian; /**< SNAPSHOT_ENDIAN in host byte order */
+	uint32_t size; /**< total size of the snapshot */
+	uint32_t id; /**< TVDB ID */
+	uint32_t imdb_id; /**< string offset of the IMDB ID */
+	uint32_t name; /**< string offset of the name */
+	uint32_t overview; /**< string offset of the overview */
+	uint16_t runtime; /**< typical episode runtime */
+	uint16_t reserved; /**< padding, always 0 */
+	uint32_t season_count; /**< number of seasons */
+	uint32_t specials_count; /**< number of special episodes */
+	uint32_t episodes_count; /**< number of episode records, specials last */
+	uint32_t seasons; /**< offset of the season sizes */
+	uint32_t episodes; /**< offset of the episode records */
+	uint32_t strings; /**< offset of the string table */
+	uint32_t strings_len; /**< size of the string table */
+} Snapshot_Header;
+
+/* fixed size episode record */
+typedef struct _snapshot_episode {
+	uint32_t id; /**< TVDB ID */
+	uint32_t imdb_id; /**< string offset of the IMDB ID */
+	uint32_t name; /**< string offset of the name */
+	uint32_t overview; /**< string offset of the overview */
+	uint32_t firstaired; /**< string offset of the first aired date */
+	uint16_t number; /**< episode number in season */
+	uint16_t season; /**< season number */
+	uint16_t dvd_number; /**< episode number in DVD season */
+	uint16_t dvd_season; /**< DVD season number */
+	uint16_t absolute_number; /**< episode number over all seasons */
+	uint16_t reserved; /**< padding, always 0 */
+} Snapshot_Episode;
+
+/* internal functions */
+static void _episode_record_set(String_Table *st, Snapshot_Episode *rec, Episode *e);
+static Eina_Bool _header_check(const Snapshot_Header *h, size_t len);
+static const char *_string_get(const Snapshot_Header *h, const char *map, uint32_t offset);
+
+/**
+ * @brief Series Snapshots
+ * @defgroup Snapshots
+ *
+ * @{
+ *
+ * These functions store populated Series in a compact binary file
+ * and load them again, without any network access or XML parsing.
+ *
+ * The file is versioned and made of fixed size episode records
+ * and a deduplicated string table. Loading maps the file into memory,
+ * the strings of the loaded Series and Episodes point into the mapping,
+ * so a load is mostly page faults instead of copies.
+ *
+ * Snapshots are meant as a local cache, they use the host byte order
+ * and can't be exchanged between machines of different architectures.
+ */
+
+/**
+ * @brief Save a Series to a snapshot file
+ *
+ * This function writes a Series, including all of its Episodes, to a file.
+ * An existing file is replaced atomically.
+ *
+ * @param s Series to save, usually populated
+ * @param path path of the snapshot file
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @see etvdb_series_load()
+ *
+ * @ingroup Snapshots
+ */
+EAPI Eina_Bool etvdb_series_save(Series *s, const char *path)
+{
+	char tmp[URI_MAX];
+	size_t size;
+	Eina_Binbuf *out;
+	FILE *file;
+
+	out = _etvdb_snapshot_build(s);
+	if (!out)
+		return EINA_FALSE;
+
+	size = eina_binbuf_length_get(out);
+
+	/* write to a temporary file and rename it, so readers never see partial data */
+	snprintf(tmp, URI_MAX, "%s.tmp", path);
+	file = fopen(tmp, "wb");
+	if (!file) {
+		ERR("Couldn't open %s for writing.", tmp);
+		eina_binbuf_free(out);
+		return EINA_FALSE;
+	}
+
+	if (fwrite(eina_binbuf_string_get(out), 1, size, file) != size) {
+		ERR("Couldn't write snapshot %s.", tmp);
+		fclose(file);
+		remove(tmp);
+		eina_binbuf_free(out);
+		return EINA_FALSE;
+	}
+
+	eina_binbuf_free(out);
+
+	if (fclose(file) || rename(tmp, path)) {
+		ERR("Couldn't write snapshot %s.", path);
+		remove(tmp);
+		return EINA_FALSE;
+	}
+
+	DBG("Saved Series %"PRIu32" in %zu bytes.", s->id, size);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Load a Series from a snapshot file
+ *
+ * This function maps a snapshot file and builds a populated Series from it.
+ * All strings of the Series and its Episodes point into the mapping,
+ * they must not be freed or modified.
+ * The mapping is released by etvdb_series_free().
+ *
+ * @param path path of the snapshot file
+ *
+ * @return a populated Series on success, NULL on failure
+ *
+ * @see etvdb_series_save()
+ *
+ * @ingroup Snapshots
+ */
+EAPI Series *etvdb_series_load(const char *path)
+{
+	size_t len;
+	const char *map;
+	Eina_File *file;
+	Series *s;
+	Series_Priv *priv;
+
+	file = eina_file_open(path, EINA_FALSE);
+	if (!file) {
+		ERR("Couldn't open snapshot %s.", path);
+		return NULL;
+	}
+
+	len = eina_file_size_get(file);
+	map = eina_file_map_all(file, EINA_FILE_WILLNEED);
+	if (!map) {
+		ERR("Couldn't map snapshot %s.", path);
+		eina_file_close(file);
+		return NULL;
+	}
+
+	s = _etvdb_snapshot_series_get(map, len);
+	if (!s) {
+		ERR("%s is not a valid snapshot.", path);
+		eina_file_map_free(file, (void *)map);
+		eina_file_close(file);
+		return NULL;
+	}
+
+	priv = _etvdb_series_priv_get(s);
+	priv->file = file;
+
+	_etvdb_search_index_add(s, NULL);
+
+	DBG("Loaded Series %"PRIu32" from %s.", s->id, path);
+
+	return s;
+}
+/**
+ * @}
+ */
+
+/* build the snapshot image of a Series */
+Eina_Binbuf *_etvdb_snapshot_build(Series *s)
+{
+	unsigned int i = 0, count = 0;
+	Eina_Binbuf *out;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+	Snapshot_Episode *recs;
+	Snapshot_Header h;
+	String_Table st;
+	uint32_t *sizes;
+
+	memset(&h, 0, sizeof(Snapshot_Header));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.endian = SNAPSHOT_ENDIAN;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		count += eina_list_count(sl);
+	h.season_count = eina_list_count(s->seasons);
+	h.specials_count = eina_list_count(s->specials);
+	h.episodes_count = count + h.specials_count;
+
+	sizes = calloc(h.season_count + 1, sizeof(uint32_t));
+	recs = calloc(h.episodes_count + 1, sizeof(Snapshot_Episode));
+	out = eina_binbuf_new();
+	if (!_etvdb_string_table_init(&st) || !sizes || !recs || !out) {
+		ERR("Couldn't allocate enough memory.");
+		if (out)
+			eina_binbuf_free(out);
+		out = NULL;
+		goto end;
+	}
+
+	h.id = s->id;
+	h.runtime = s->runtime;
+	h.imdb_id = _etvdb_string_table_add(&st, s->imdb_id);
+	h.name = _etvdb_string_table_add(&st, s->name);
+	h.overview = _etvdb_string_table_add(&st, etvdb_series_overview_get(s));
+
+	count = 0;
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		sizes[i++] = eina_list_count(sl);
+		EINA_LIST_FOREACH(sl, ll, e)
+			_episode_record_set(&st, &recs[count++], e);
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e)
+		_episode_record_set(&st, &recs[count++], e);
+
+	/* pad the string table, so the total size stays aligned */
+	while (eina_binbuf_length_get(st.buf) % sizeof(uint32_t))
+		eina_binbuf_append_length(st.buf, (const unsigned char *)"", 1);
+
+	h.seasons = sizeof(Snapshot_Header);
+	h.episodes = h.seasons + h.season_count * sizeof(uint32_t);
+	h.strings = h.episodes + h.episodes_count * sizeof(Snapshot_Episode);
+	h.strings_len = eina_binbuf_length_get(st.buf);
+	h.size = h.strings + h.strings_len;
+
+	eina_binbuf_append_length(out, (const unsigned char *)&h, sizeof(Snapshot_Header));
+	eina_binbuf_append_length(out, (const unsigned char *)sizes, h.season_count * sizeof(uint32_t));
+	eina_binbuf_append_length(out, (const unsigned char *)recs, h.episodes_count * sizeof(Snapshot_Episode));
+	eina_binbuf_append_length(out, eina_binbuf_string_get(st.buf), h.strings_len);
+
+end:
+	free(sizes);
+	free(recs);
+	_etvdb_string_table_free(&st);
+
+	return out;
+}
+
+/* build a Series from a snapshot image. the strings point into map,
+ * which has to stay valid until the Series is freed */
+Series *_etvdb_snapshot_series_get(const char *map, size_t len)
+{
+	unsigned int i, j, n = 0;
+	Eina_List *sl;
+	Episode *e;
+	Series *s;
+	Series_Priv *priv;
+	const Snapshot_Episode *recs;
+	const Snapshot_Header *h;
+	const uint32_t *sizes;
+
+	h = (const Snapshot_Header *)map;
+	if (!_header_check(h, len))
+		return NULL;
+
+	sizes = (const uint32_t *)(map + h->seasons);
+	recs = (const Snapshot_Episode *)(map + h->episodes);
+
+	s = etvdb_series_new();
+	priv = _etvdb_series_priv_get(s);
+	/* calloc() clears the fields, which aren't stored, e.g. the mask of left out fields */
+	priv->episodes = calloc(h->episodes_count + 1, sizeof(Episode));
+	if (!priv->episodes) {
+		ERR("Couldn't allocate enough memory.");
+		etvdb_series_free(s);
+		return NULL;
+	}
+	priv->episodes_count = h->episodes_count;
+	priv->map = (void *)map;
+
+	s->id = h->id;
+	s->runtime = h->runtime;
+	s->imdb_id = (char *)_string_get(h, map, h->imdb_id);
+	s->name = (char *)_string_get(h, map, h->name);
+	s->overview = (char *)_string_get(h, map, h->overview);
+
+	for (i = 0; i < h->episodes_count; i++) {
+		e = &priv->episodes[i];
+		e->id = recs[i].id;
+		e->imdb_id = (char *)_string_get(h, map, recs[i].imdb_id);
+		e->name = (char *)_string_get(h, map, recs[i].name);
+		e->overview = (char *)_string_get(h, map, recs[i].overview);
+		e->firstaired = (char *)_string_get(h, map, recs[i].firstaired);
+		e->number = recs[i].number;
+		e->season = recs[i].season;
+		e->dvd_number = recs[i].dvd_number;
+		e->dvd_season = recs[i].dvd_season;
+		e->absolute_number = recs[i].absolute_number;
+		e->series = s;
+		e->owner = EPISODE_OWNER_SNAPSHOT;
+	}
+
+	for (i = 0; i < h->season_count; i++) {
+		sl = NULL;
+		for (j = 0; j < sizes[i]; j++)
+			sl = eina_list_append(sl, &priv->episodes[n++]);
+		s->seasons = eina_list_append(s->seasons, sl);
+	}
+
+	for (; n < h->episodes_count; n++)
+		s->specials = eina_list_append(s->specials, &priv->episodes[n]);
+
+	_etvdb_orders_index(s);
+	priv->populated = EINA_TRUE;
+
+	return s;
+}
+
+/* get the private data of a Series, create it if necessary */
+Series_Priv *_etvdb_series_priv_get(Series *s)
+{
+	if (s->priv)
+		return s->priv;
+
+	s->priv = calloc(1, sizeof(Series_Priv));
+	if (!s->priv)
+		ERR("Couldn't allocate enough memory.");
+
+	return s->priv;
+}
+
+/* free the private data of a Series, including the snapshot data its strings point into */
+void _etvdb_series_priv_free(Series *s)
+{
+	Series_Priv *priv = s->priv;
+
+	if (!priv)
+		return;
+
+	_etvdb_overviews_free(s);
+	_etvdb_translations_free(s);
+	_etvdb_orders_free(s);
+	free(priv->episodes);
+	if (priv->file) {
+		eina_file_map_free(priv->file, priv->map);
+		eina_file_close(priv->file);
+	}
+	if (priv->shared)
+		_etvdb_shared_map_unref(priv->shared);
+	free(priv->image);
+
+	free(priv);
+	s->priv = NULL;
+}
+
+/* fill an episode record */
+static void _episode_record_set(String_Table *st, Snapshot_Episode *rec, Episode *e)
+{
+	rec->id = e->id;
+	rec->imdb_id = _etvdb_string_table_add(st, e->imdb_id);
+	rec->name = _etvdb_string_table_add(st, etvdb_episode_name_get(e));
+	rec->overview = _etvdb_string_table_add(st, etvdb_episode_overview_get(e));
+	rec->firstaired = _etvdb_string_table_add(st, e->firstaired);
+	rec->number = e->number;
+	rec->season = e->season;
+	rec->dvd_number = e->dvd_number;
+	rec->dvd_season = e->dvd_season;
+	rec->absolute_number = e->absolute_number;
+	rec->reserved = 0;
+}
+
+/* validate a snapshot header against the mapped size */
+static Eina_Bool _header_check(const Snapshot_Header *h, size_t len)
+{
+	uint64_t count = 0;
+	unsigned int i;
+	const uint32_t *sizes;
+
+	if (len < sizeof(Snapshot_Header) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)))
+		return EINA_FALSE;
+
+	if (h->version != SNAPSHOT_VERSION) {
+		ERR("Unsupported snapshot version %"PRIu32".", h->version);
+		return EINA_FALSE;
+	}
+
+	if (h->endian != SNAPSHOT_ENDIAN) {
+		ERR("Snapshot was written on a machine with a different byte order.");
+		return EINA_FALSE;
+	}
+
+	if (h->size > len || h->seasons != sizeof(Snapshot_Header)
+			|| h->episodes != h->seasons + (uint64_t)h->season_count * sizeof(uint32_t)
+			|| h->strings != h->episodes + (uint64_t)h->episodes_count * sizeof(Snapshot_Episode)
+			|| (uint64_t)h->strings + h->strings_len != h->size || h->strings_len == 0)
+		return EINA_FALSE;
+
+	/* every string has to be terminated inside the table */
+	if (((const char *)h)[h->strings + h->strings_len - 1] != '\0')
+		return EINA_FALSE;
+
+	sizes = (const uint32_t *)((const char *)h + h->seasons);
+	for (i = 0; i < h->season_count; i++)
+		count += sizes[i];
+
+	return count + h->specials_count == h->episodes_count;
+}
+
+/* get a string from the string table */
+static const char *_string_get(const Snapshot_Header *h, const char *map, uint32_t offset)
+{
+	if (!offset || offset >= h->strings_len)
+		return NULL;
+
+	return map + h->strings + offset;
+}
@@ -0,0 +1,821 @@
+#include "etvdb_private.h"
+
+/**
+ * @brief Local Catalogue Store
+ * @defgroup Store
+ *
+ * @{
+ *
+ * The store is an optional embedded database (SQLite), which persists
+ * Series and Episodes fetched through etvdb.
+ *
+ * While a store is open, all fetched data is written to it,
+ * and the lookup functions answer from it first:
+ * etvdb_series_by_id_get(), etvdb_episodes_get() (and so etvdb_series_populate()),
+ * etvdb_episode_by_id_get(), etvdb_episode_by_number_get()
+ * and etvdb_series_find() searching by IMDB ID.
+ * Only when the store doesn't know the data, TVDB is asked.
+ *
+ * The store keeps indexes on TVDB IDs, IMDB IDs, season and episode numbers
+ * and air dates. Data is stored per language.
+ *
+ * The store can be used by many threads, they take turns.
+ * It is only available if etvdb was built with SQLite support.
+ */
+
+#ifdef HAVE_SQLITE
+#include <sqlite3.h>
+
+/* prepared statements of the store */
+enum stmt {
+	SERIES_GET,
+	SERIES_IMDB,
+	SERIES_PUT,
+	SERIES_POPULATED,
+	SERIES_IS_POPULATED,
+	EPISODES_DEL,
+	EPISODES_GET,
+	EPISODES_AIRED,
+	EPISODE_GET,
+	EPISODE_NUMBER,
+	EPISODE_PUT,
+	STMT_LAST
+};
+
+static const char *_schema =
+	"PRAGMA journal_mode = WAL;"
+	"CREATE TABLE IF NOT EXISTS series ("
+	" id INTEGER NOT NULL, language TEXT NOT NULL, imdb_id TEXT, name TEXT,"
+	" overview TEXT, runtime INTEGER, populated INTEGER NOT NULL DEFAULT 0,"
+	" updated INTEGER NOT NULL, PRIMARY KEY (id, language));"
+	"CREATE INDEX IF NOT EXISTS series_imdb ON series (imdb_id, language);"
+	"CREATE TABLE IF NOT EXISTS episodes ("
+	" id INTEGER NOT NULL, language TEXT NOT NULL, series_id INTEGER NOT NULL,"
+	" season INTEGER, number INTEGER, imdb_id TEXT, name TEXT, overview TEXT,"
+	" firstaired TEXT, aired INTEGER, updated INTEGER NOT NULL,"
+	" PRIMARY KEY (id, language));"
+	"CREATE INDEX IF NOT EXISTS episodes_number ON episodes (series_id, language, season, number);"
+	"CREATE INDEX IF NOT EXISTS episodes_imdb ON episodes (imdb_id, language);"
+	"CREATE INDEX IF NOT EXISTS episodes_aired ON episodes (language, aired);";
+
+/* changes of the schema, the user_version of a store is the number applied */
+static const char *_migrations[] = {
+	/* DVD and absolute order of Episodes */
+	"ALTER TABLE episodes ADD COLUMN dvd_season INTEGER;"
+	"ALTER TABLE episodes ADD COLUMN dvd_number INTEGER;"
+	"ALTER TABLE episodes ADD COLUMN absolute_number INTEGER;",
+};
+
+#define MIGRATIONS_COUNT (sizeof(_migrations) / sizeof(_migrations[0]))
+
+#define EPISODE_COLUMNS "id, season, number, imdb_id, name, overview, firstaired, series_id," \
+	" dvd_season, dvd_number, absolute_number"
+
+static const char *_sql[STMT_LAST] = {
+	[SERIES_GET] = "SELECT imdb_id, name, overview, runtime FROM series"
+		" WHERE id = ?1 AND language = ?2 AND updated >= ?3 AND name IS NOT NULL",
+	[SERIES_IMDB] = "SELECT id FROM series"
+		" WHERE imdb_id = ?1 AND language = ?2 AND updated >= ?3 AND name IS NOT NULL",
+	[SERIES_PUT] = "INSERT INTO series (id, language, imdb_id, name, overview, runtime, populated, updated)"
+		" VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8) ON CONFLICT (id, language) DO UPDATE SET"
+		" imdb_id = excluded.imdb_id, name = excluded.name, overview = excluded.overview,"
+		" runtime = excluded.runtime, updated = excluded.updated,"
+		" populated = max(populated, excluded.populated)",
+	[SERIES_POPULATED] = "INSERT INTO series (id, language, populated, updated) VALUES (?1, ?2, 1, ?3)"
+		" ON CONFLICT (id, language) DO UPDATE SET populated = 1",
+	[SERIES_IS_POPULATED] = "SELECT 1 FROM series"
+		" WHERE id = ?1 AND language = ?2 AND populated = 1 AND updated >= ?3",
+	[EPISODES_DEL] = "DELETE FROM episodes WHERE series_id = ?1 AND language = ?2",
+	[EPISODES_GET] = "SELECT "EPISODE_COLUMNS" FROM episodes WHERE series_id = ?1 AND language = ?2"
+		" ORDER BY season, number",
+	[EPISODES_AIRED] = "SELECT "EPISODE_COLUMNS" FROM episodes WHERE language = ?1"
+		" AND aired BETWEEN ?2 AND ?3 AND (?4 = 0 OR series_id = ?4) AND updated >= ?5"
+		" ORDER BY aired, series_id, season, number",
+	[EPISODE_GET] = "SELECT "EPISODE_COLUMNS" FROM episodes"
+		" WHERE id = ?1 AND language = ?2 AND updated >= ?3",
+	[EPISODE_NUMBER] = "SELECT "EPISODE_COLUMNS" FROM episodes WHERE series_id = ?1 AND language = ?2"
+		" AND season = ?3 AND number = ?4 AND updated >= ?5",
+	[EPISODE_PUT] = "INSERT OR REPLACE INTO episodes (id, language, series_id, season, number,"
+		" imdb_id, name, overview, firstaired, aired, updated, dvd_season, dvd_number, absolute_number)"
+		" VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14)",
+};
+
+static sqlite3 *_db = NULL;
+static sqlite3_stmt *_stmt[STMT_LAST];
+static time_t _max_age = 0;
+
+/* protects _db, the statements and transactions, which are shared by all threads */
+static Eina_Lock _store_lock;
+
+/* internal functions */
+static Eina_Bool _schema_migrate(void);
+static sqlite3_stmt *_stmt_get(enum stmt id);
+static sqlite3_int64 _oldest_get(void);
+static Eina_Bool _populated_get(uint32_t id);
+static char *_column_strdup(sqlite3_stmt *st, int col);
+static Episode *_episode_from_row(sqlite3_stmt *st);
+static Eina_Bool _episode_put(uint32_t series_id, Episode *e, time_t now);
+
+/**
+ * @brief Open the local store
+ *
+ * This function opens (and if necessary creates) a store.
+ * Only one store can be open at a time.
+ *
+ * @param path path to the database file
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Store
+ */
+EAPI Eina_Bool etvdb_store_open(const char *path)
+{
+	char *err = NULL;
+	Eina_Bool ret = EINA_FALSE;
+
+	eina_lock_take(&_store_lock);
+
+	if (_db) {
+		ERR("A store is already open.");
+		goto end;
+	}
+
+	if (sqlite3_open_v2(path, &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE
+				| SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK) {
+		ERR("Couldn't open store %s: %s", path, sqlite3_errmsg(_db));
+		goto fail;
+	}
+
+	if (sqlite3_exec(_db, _schema, NULL, NULL, &err) != SQLITE_OK) {
+		ERR("Couldn't create store schema: %s", err);
+		sqlite3_free(err);
+		goto fail;
+	}
+
+	if (!_schema_migrate())
+		goto fail;
+
+	memset(_stmt, 0, sizeof(_stmt));
+	INFO("Opened store %s.", path);
+	ret = EINA_TRUE;
+	goto end;
+
+fail:
+	sqlite3_close(_db);
+	_db = NULL;
+end:
+	eina_lock_release(&_store_lock);
+
+	return ret;
+}
+
+/**
+ * @brief Close the local store
+ *
+ * @ingroup Store
+ */
+EAPI void etvdb_store_close(void)
+{
+	int i;
+
+	eina_lock_take(&_store_lock);
+
+	if (_db) {
+		for (i = 0; i < STMT_LAST; i++)
+			sqlite3_finalize(_stmt[i]);
+
+		sqlite3_close(_db);
+		_db = NULL;
+	}
+
+	eina_lock_release(&_store_lock);
+}
+
+/**
+ * @brief Set the maximum age of stored data
+ *
+ * Data older than this isn't used to answer lookups,
+ * so it will be fetched from TVDB again.
+ *
+ * @param seconds maximum age, or 0 to use stored data forever (the default)
+ *
+ * @ingroup Store
+ */
+EAPI void etvdb_store_max_age_set(time_t seconds)
+{
+	_max_age = seconds;
+}
+
+/**
+ * @brief Put a Series into the store
+ *
+ * This function stores a Series and all of its Episodes.
+ * If the Series is populated, all Episodes it had before are replaced,
+ * also if it has none, so it is found populated later.
+ * Data fetched while the store is open is stored automatically.
+ *
+ * @param s Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Store
+ */
+EAPI Eina_Bool etvdb_store_series_put(Series *s)
+{
+	Eina_Bool ret = EINA_TRUE;
+	Eina_List *all = NULL, *l, *sl;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		all = eina_list_merge(all, eina_list_clone(sl));
+	all = eina_list_merge(all, eina_list_clone(s->specials));
+
+	if (!_etvdb_store_series_add(s))
+		ret = EINA_FALSE;
+	else if ((all || (s->priv && s->priv->populated)) && !_etvdb_store_episodes_add(s, all))
+		ret = EINA_FALSE;
+
+	eina_list_free(all);
+
+	return ret;
+}
+
+/**
+ * @brief Get a Series from the store
+ *
+ * This function never accesses the network.
+ * If the store holds all Episodes of the Series, it is returned populated.
+ *
+ * @param id TVDB ID of the Series
+ *
+ * @return a Series on success, NULL if it is not in the store
+ *
+ * @ingroup Store
+ */
+EAPI Series *etvdb_store_series_get(uint32_t id)
+{
+	Eina_List *all = NULL;
+	Series *s;
+
+	s = _etvdb_store_series_find(id);
+	if (!s)
+		return NULL;
+
+	if (_etvdb_store_episodes_find(s, &all))
+		_etvdb_series_episodes_bucket(s, all);
+
+	return s;
+}
+
+/**
+ * @brief Get a Series from the store by its IMDB ID
+ *
+ * @param imdb_id IMDB ID, e.g. "tt0903747"
+ *
+ * @return a Series on success, NULL if it is not in the store
+ *
+ * @ingroup Store
+ */
+EAPI Series *etvdb_store_series_by_imdb_get(const char *imdb_id)
+{
+	Eina_List *all = NULL;
+	Series *s;
+
+	s = _etvdb_store_series_imdb_find(imdb_id);
+	if (!s)
+		return NULL;
+
+	if (_etvdb_store_episodes_find(s, &all))
+		_etvdb_series_episodes_bucket(s, all);
+
+	return s;
+}
+
+/**
+ * @brief Get all stored Episodes, which aired in a period of time
+ *
+ * Both dates are inclusive ISO 8601 date strings.
+ *
+ * @param s only search Episodes of this Series, or NULL for all Series
+ * @param from first day of the period
+ * @param to last day of the period
+ *
+ * @return a list of Episodes ordered by air date, which have to be freed.
+ * If s is NULL, the Episodes are not associated with a Series.
+ *
+ * @ingroup Store
+ */
+EAPI Eina_List *etvdb_store_episodes_aired_get(Series *s, const char *from, const char *to)
+{
+	Eina_List *list = NULL;
+	Episode *e;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(EPISODES_AIRED)))
+		goto end;
+
+	sqlite3_bind_text(st, 1, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 2, _etvdb_date_pack(from));
+	sqlite3_bind_int64(st, 3, _etvdb_date_pack(to));
+	sqlite3_bind_int64(st, 4, s ? s->id : 0);
+	sqlite3_bind_int64(st, 5, _oldest_get());
+
+	while (sqlite3_step(st) == SQLITE_ROW) {
+		e = _episode_from_row(st);
+		e->series = s;
+		list = eina_list_append(list, e);
+	}
+
+	sqlite3_reset(st);
+end:
+	eina_lock_release(&_store_lock);
+
+	return list;
+}
+/**
+ * @}
+ */
+
+/* find the base record of a Series */
+Series *_etvdb_store_series_find(uint32_t id)
+{
+	Series *s = NULL;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(SERIES_GET)))
+		goto end;
+
+	sqlite3_bind_int64(st, 1, id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 3, _oldest_get());
+
+	if (sqlite3_step(st) == SQLITE_ROW) {
+		s = etvdb_series_new();
+		s->id = id;
+		s->imdb_id = _column_strdup(st, 0);
+		s->name = _column_strdup(st, 1);
+		s->overview = _column_strdup(st, 2);
+		s->runtime = sqlite3_column_int(st, 3);
+		DBG("Found Series %"PRIu32" in the store.", id);
+	}
+
+	sqlite3_reset(st);
+end:
+	eina_lock_release(&_store_lock);
+
+	return s;
+}
+
+/* find the base record of a Series by its IMDB ID */
+Series *_etvdb_store_series_imdb_find(const char *imdb_id)
+{
+	uint32_t id = 0;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(SERIES_IMDB)))
+		goto end;
+
+	sqlite3_bind_text(st, 1, imdb_id, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 3, _oldest_get());
+
+	if (sqlite3_step(st) == SQLITE_ROW)
+		id = sqlite3_column_int64(st, 0);
+
+	sqlite3_reset(st);
+end:
+	eina_lock_release(&_store_lock);
+
+	return id ? _etvdb_store_series_find(id) : NULL;
+}
+
+/* find all Episodes of a Series, only succeeds if the Series was stored populated.
+ * a Series without Episodes is found with an empty list */
+Eina_Bool _etvdb_store_episodes_find(Series *s, Eina_List **list)
+{
+	Eina_Bool found = EINA_FALSE;
+	Episode *e;
+	sqlite3_stmt *st;
+
+	*list = NULL;
+
+	eina_lock_take(&_store_lock);
+
+	if (!_populated_get(s->id) || !(st = _stmt_get(EPISODES_GET)))
+		goto end;
+
+	sqlite3_bind_int64(st, 1, s->id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+
+	while (sqlite3_step(st) == SQLITE_ROW) {
+		e = _episode_from_row(st);
+		e->series = s;
+		*list = eina_list_append(*list, e);
+	}
+
+	sqlite3_reset(st);
+	found = EINA_TRUE;
+end:
+	eina_lock_release(&_store_lock);
+
+	if (found)
+		DBG("Found %u Episodes of Series %"PRIu32" in the store.", eina_list_count(*list), s->id);
+
+	return found;
+}
+
+/* find an Episode by its ID, the Series ID is written to series_id */
+Episode *_etvdb_store_episode_find(uint32_t id, uint32_t *series_id)
+{
+	Episode *e = NULL;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(EPISODE_GET)))
+		goto end;
+
+	sqlite3_bind_int64(st, 1, id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 3, _oldest_get());
+
+	if (sqlite3_step(st) == SQLITE_ROW) {
+		e = _episode_from_row(st);
+		*series_id = sqlite3_column_int64(st, 7);
+	}
+
+	sqlite3_reset(st);
+end:
+	eina_lock_release(&_store_lock);
+
+	return e;
+}
+
+/* find an Episode by season and episode number */
+Episode *_etvdb_store_episode_number_find(Series *s, int season, int episode)
+{
+	Episode *e = NULL;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(EPISODE_NUMBER)))
+		goto end;
+
+	sqlite3_bind_int64(st, 1, s->id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(st, 3, season);
+	sqlite3_bind_int(st, 4, episode);
+	sqlite3_bind_int64(st, 5, _oldest_get());
+
+	if (sqlite3_step(st) == SQLITE_ROW) {
+		e = _episode_from_row(st);
+		e->series = s;
+	}
+
+	sqlite3_reset(st);
+end:
+	eina_lock_release(&_store_lock);
+
+	return e;
+}
+
+/* store the base record of a Series */
+Eina_Bool _etvdb_store_series_add(Series *s)
+{
+	int rc;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(SERIES_PUT))) {
+		eina_lock_release(&_store_lock);
+		return EINA_FALSE;
+	}
+
+	sqlite3_bind_int64(st, 1, s->id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(st, 3, s->imdb_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 4, s->name, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 5, etvdb_series_overview_get(s), -1, SQLITE_STATIC);
+	sqlite3_bind_int(st, 6, s->runtime);
+	sqlite3_bind_int(st, 7, 0);
+	sqlite3_bind_int64(st, 8, time(NULL));
+
+	rc = sqlite3_step(st);
+	sqlite3_reset(st);
+	sqlite3_clear_bindings(st);
+
+	if (rc != SQLITE_DONE)
+		ERR("Couldn't store Series %"PRIu32": %s", s->id, sqlite3_errmsg(_db));
+
+	eina_lock_release(&_store_lock);
+
+	return rc == SQLITE_DONE;
+}
+
+/* store all Episodes of a Series, replacing the stored ones, and mark it as populated.
+ * the marker is stored even without Episodes, so such a Series is found, too */
+Eina_Bool _etvdb_store_episodes_add(Series *s, Eina_List *episodes)
+{
+	time_t now;
+	Eina_Bool ret = EINA_TRUE;
+	Eina_List *l;
+	Episode *e;
+	sqlite3_stmt *st;
+
+	eina_lock_take(&_store_lock);
+
+	if (!(st = _stmt_get(EPISODES_DEL))) {
+		eina_lock_release(&_store_lock);
+		return EINA_FALSE;
+	}
+
+	now = time(NULL);
+	sqlite3_exec(_db, "BEGIN", NULL, NULL, NULL);
+
+	sqlite3_bind_int64(st, 1, s->id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_step(st);
+	sqlite3_reset(st);
+
+	EINA_LIST_FOREACH(episodes, l, e)
+		if (!(ret = _episode_put(s->id, e, now)))
+			break;
+
+	if (ret && (st = _stmt_get(SERIES_POPULATED))) {
+		sqlite3_bind_int64(st, 1, s->id);
+		sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(st, 3, now);
+		sqlite3_step(st);
+		sqlite3_reset(st);
+	}
+
+	sqlite3_exec(_db, ret ? "COMMIT" : "ROLLBACK", NULL, NULL, NULL);
+
+	eina_lock_release(&_store_lock);
+
+	return ret;
+}
+
+/* store a single Episode */
+Eina_Bool _etvdb_store_episode_add(uint32_t series_id, Episode *e)
+{
+	Eina_Bool ret;
+
+	eina_lock_take(&_store_lock);
+	ret = _episode_put(series_id, e, time(NULL));
+	eina_lock_release(&_store_lock);
+
+	return ret;
+}
+
+/* set up the store lock, called by etvdb_init() */
+Eina_Bool _etvdb_store_init(void)
+{
+	return eina_lock_new(&_store_lock);
+}
+
+/* close the store, called by etvdb_shutdown() */
+void _etvdb_store_shutdown(void)
+{
+	etvdb_store_close();
+	eina_lock_free(&_store_lock);
+}
+
+/* get a prepared statement, NULL if no store is open. _store_lock has to be held */
+static sqlite3_stmt *_stmt_get(enum stmt id)
+{
+	if (!_db)
+		return NULL;
+
+	if (!_stmt[id] && sqlite3_prepare_v2(_db, _sql[id], -1, &_stmt[id], NULL) != SQLITE_OK) {
+		ERR("Couldn't prepare store statement: %s", sqlite3_errmsg(_db));
+		return NULL;
+	}
+
+	return _stmt[id];
+}
+
+/* bring the schema of an older store up to date */
+static Eina_Bool _schema_migrate(void)
+{
+	char sql[64], *err = NULL;
+	unsigned int version = 0;
+	sqlite3_stmt *st;
+
+	if (sqlite3_prepare_v2(_db, "PRAGMA user_version", -1, &st, NULL) != SQLITE_OK) {
+		ERR("Couldn't read store schema version: %s", sqlite3_errmsg(_db));
+		return EINA_FALSE;
+	}
+	if (sqlite3_step(st) == SQLITE_ROW)
+		version = sqlite3_column_int(st, 0);
+	sqlite3_finalize(st);
+
+	if (version > MIGRATIONS_COUNT) {
+		ERR("Store schema version %u is newer than this etvdb.", version);
+		return EINA_FALSE;
+	}
+
+	for (; version < MIGRATIONS_COUNT; version++) {
+		snprintf(sql, sizeof(sql), "PRAGMA user_version = %u;", version + 1);
+
+		if (sqlite3_exec(_db, "BEGIN;", NULL, NULL, &err) != SQLITE_OK
+				|| sqlite3_exec(_db, _migrations[version], NULL, NULL, &err) != SQLITE_OK
+				|| sqlite3_exec(_db, sql, NULL, NULL, &err) != SQLITE_OK
+				|| sqlite3_exec(_db, "COMMIT;", NULL, NULL, &err) != SQLITE_OK) {
+			ERR("Couldn't update store schema to version %u: %s", version + 1, err);
+			sqlite3_free(err);
+			sqlite3_exec(_db, "ROLLBACK;", NULL, NULL, NULL);
+			return EINA_FALSE;
+		}
+
+		DBG("Updated store schema to version %u.", version + 1);
+	}
+
+	return EINA_TRUE;
+}
+
+/* check if a Series was stored populated, _store_lock has to be held */
+static Eina_Bool _populated_get(uint32_t id)
+{
+	Eina_Bool populated;
+	sqlite3_stmt *st;
+
+	if (!(st = _stmt_get(SERIES_IS_POPULATED)))
+		return EINA_FALSE;
+
+	sqlite3_bind_int64(st, 1, id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 3, _oldest_get());
+
+	populated = sqlite3_step(st) == SQLITE_ROW;
+	sqlite3_reset(st);
+
+	return populated;
+}
+
+/* oldest update time, which is still used */
+static sqlite3_int64 _oldest_get(void)
+{
+	return _max_age ? time(NULL) - _max_age : 0;
+}
+
+static char *_column_strdup(sqlite3_stmt *st, int col)
+{
+	const unsigned char *text;
+
+	text = sqlite3_column_text(st, col);
+
+	return text ? strdup((const char *)text) : NULL;
+}
+
+/* create an Episode from a row selected with EPISODE_COLUMNS */
+static Episode *_episode_from_row(sqlite3_stmt *st)
+{
+	Episode *e;
+
+	e = etvdb_episode_new();
+	e->id = sqlite3_column_int64(st, 0);
+	e->season = sqlite3_column_int(st, 1);
+	e->number = sqlite3_column_int(st, 2);
+	e->imdb_id = _column_strdup(st, 3);
+	e->name = (char *)eina_stringshare_add((const char *)sqlite3_column_text(st, 4));
+	e->overview = _column_strdup(st, 5);
+	e->firstaired = (char *)eina_stringshare_add((const char *)sqlite3_column_text(st, 6));
+	e->dvd_season = sqlite3_column_int(st, 8);
+	e->dvd_number = sqlite3_column_int(st, 9);
+	e->absolute_number = sqlite3_column_int(st, 10);
+
+	return e;
+}
+
+/* store an Episode, _store_lock has to be held */
+static Eina_Bool _episode_put(uint32_t series_id, Episode *e, time_t now)
+{
+	int rc;
+	sqlite3_stmt *st;
+
+	if (!(st = _stmt_get(EPISODE_PUT)))
+		return EINA_FALSE;
+
+	sqlite3_bind_int64(st, 1, e->id);
+	sqlite3_bind_text(st, 2, etvdb_language, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(st, 3, series_id);
+	sqlite3_bind_int(st, 4, e->season);
+	sqlite3_bind_int(st, 5, e->number);
+	sqlite3_bind_text(st, 6, e->imdb_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 7, etvdb_episode_name_get(e), -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 8, etvdb_episode_overview_get(e), -1, SQLITE_STATIC);
+	sqlite3_bind_text(st, 9, e->firstaired, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(st, 10, _etvdb_date_pack(e->firstaired));
+	sqlite3_bind_int64(st, 11, now);
+	sqlite3_bind_int(st, 12, e->dvd_season);
+	sqlite3_bind_int(st, 13, e->dvd_number);
+	sqlite3_bind_int(st, 14, e->absolute_number);
+
+	rc = sqlite3_step(st);
+	sqlite3_reset(st);
+	sqlite3_clear_bindings(st);
+
+	if (rc != SQLITE_DONE) {
+		ERR("Couldn't store Episode %"PRIu32": %s", e->id, sqlite3_errmsg(_db));
+		return EINA_FALSE;
+	}
+
+	return EINA_TRUE;
+}
+
+#else /* HAVE_SQLITE */
+
+EAPI Eina_Bool etvdb_store_open(const char *path UNUSED)
+{
+	ERR("etvdb was built without store support.");
+	return EINA_FALSE;
+}
+
+EAPI void etvdb_store_close(void)
+{
+}
+
+EAPI void etvdb_store_max_age_set(time_t seconds UNUSED)
+{
+}
+
+EAPI Eina_Bool etvdb_store_series_put(Series *s UNUSED)
+{
+	return EINA_FALSE;
+}
+
+EAPI Series *etvdb_store_series_get(uint32_t id UNUSED)
+{
+	return NULL;
+}
+
+EAPI Series *etvdb_store_series_by_imdb_get(const char *imdb_id UNUSED)
+{
+	return NULL;
+}
+
+EAPI Eina_List *etvdb_store_episodes_aired_get(Series *s UNUSED, const char *from UNUSED,
+		const char *to UNUSED)
+{
+	return NULL;
+}
+
+Series *_etvdb_store_series_find(uint32_t id UNUSED)
+{
+	return NULL;
+}
+
+Series *_etvdb_store_series_imdb_find(const char *imdb_id UNUSED)
+{
+	return NULL;
+}
+
+Eina_Bool _etvdb_store_episodes_find(Series *s UNUSED, Eina_List **list)
+{
+	*list = NULL;
+	return EINA_FALSE;
+}
+
+Episode *_etvdb_store_episode_find(uint32_t id UNUSED, uint32_t *series_id UNUSED)
+{
+	return NULL;
+}
+
+Episode *_etvdb_store_episode_number_find(Series *s UNUSED, int season UNUSED, int episode UNUSED)
+{
+	return NULL;
+}
+
+Eina_Bool _etvdb_store_series_add(Series *s UNUSED)
+{
+	return EINA_FALSE;
+}
+
+Eina_Bool _etvdb_store_episodes_add(Series *s UNUSED, Eina_List *episodes UNUSED)
+{
+	return EINA_FALSE;
+}
+
+Eina_Bool _etvdb_store_episode_add(uint32_t series_id UNUSED, Episode *e UNUSED)
+{
+	return EINA_FALSE;
+}
+
+Eina_Bool _etvdb_store_init(void)
+{
+	return EINA_TRUE;
+}
+
+void _etvdb_store_shutdown(void)
+{
+}
+
+#endif /* HAVE_SQLITE */
@@ -0,0 +1,305 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* state of a stream, holds the scratch records passed to the callbacks */
+typedef struct _stream_data {
+	Etvdb_Episode_Cb episode_cb; /**< user callback for Episodes */
+	Etvdb_Series_Cb series_cb; /**< user callback for Series */
+	void *data; /**< user data */
+	Episode e; /**< scratch Episode */
+	Series s; /**< scratch Series */
+	char *zap2it_id; /**< zap2it ID of the scratch Series */
+	char *text; /**< strings of the scratch record */
+	size_t text_size; /**< allocated size of text */
+	size_t text_used; /**< used size of text */
+	int depth; /**< XML nesting depth */
+	Xml_Tag sibling; /**< XML_TAG of the current field */
+	Eina_Bool go_on; /**< the user callback wants more records */
+} Stream_Data;
+
+/* internal functions */
+static Eina_Bool _stream_run(Stream_Data *sd, const char *uri, const char *tag,
+		Eina_Bool (*record_cb)(Download_Stream *st, const char *rec, size_t len));
+static Eina_Bool _episode_record_cb(Download_Stream *st, const char *rec, size_t len);
+static Eina_Bool _series_record_cb(Download_Stream *st, const char *rec, size_t len);
+static Eina_Bool _parse_episode_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length);
+static Eina_Bool _text_reserve(Stream_Data *sd, size_t len);
+static char *_text_cb(void *data, void *record UNUSED, Xml_Tag tag UNUSED,
+		const char *content, unsigned length, Eina_Bool decode);
+
+/**
+ * @brief Streaming Functions
+ * @defgroup Streaming
+ *
+ * @{
+ *
+ * These functions pass records to a callback while the data is downloaded,
+ * instead of building a list of all of them.
+ *
+ * The record passed to the callback is reused for the next record,
+ * it and its strings are only valid during the callback.
+ * Nothing is allocated per record, to keep one use etvdb_episode_dup()
+ * or etvdb_series_dup().
+ * The memory used does not grow with the size of the result.
+ */
+
+/**
+ * @brief Stream all Episodes of a Series
+ *
+ * This function calls cb for every Episode of a Series, while
+ * it is downloaded. The Episodes are not stored.
+ * Their series member is NULL, since no Series structure exists.
+ *
+ * @param series_id TVDB ID of a Series
+ * @param cb function called for every Episode, returning EINA_FALSE stops the stream
+ * @param data data passed to cb
+ *
+ * @return EINA_TRUE if all Episodes were passed to cb, or cb stopped the stream
+ * @return EINA_FALSE on failure
+ *
+ * @see etvdb_episodes_get()
+ *
+ * @ingroup Streaming
+ */
+EAPI Eina_Bool etvdb_episodes_foreach(uint32_t series_id, Etvdb_Episode_Cb cb, const void *data)
+{
+	char uri[URI_MAX];
+	Stream_Data sd;
+
+	if (!series_id || !cb) {
+		ERR("Passed series data is not valid.");
+		return EINA_FALSE;
+	}
+
+	memset(&sd, 0, sizeof(Stream_Data));
+	sd.episode_cb = cb;
+	sd.data = (void *)data;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/all/%s.xml",
+			etvdb_api_key, series_id, etvdb_language);
+
+	return _stream_run(&sd, uri, "Episode", _episode_record_cb);
+}
+
+/**
+ * @brief Stream the results of a Series search
+ *
+ * This function searches like etvdb_series_find(), but calls cb for every
+ * partial Series record found, instead of returning a list.
+ *
+ * @param name string to search for (name or id of the series).
+ * @param cb function called for every Series, returning EINA_FALSE stops the stream
+ * @param data data passed to cb
+ *
+ * @return EINA_TRUE if all Series were passed to cb, or cb stopped the stream
+ * @return EINA_FALSE on failure
+ *
+ * @see etvdb_series_find()
+ *
+ * @ingroup Streaming
+ */
+EAPI Eina_Bool etvdb_series_find_foreach(const char *name, Etvdb_Series_Cb cb, const void *data)
+{
+	char uri[URI_MAX];
+	Stream_Data sd;
+
+	if (!name || !cb)
+		return EINA_FALSE;
+
+	memset(&sd, 0, sizeof(Stream_Data));
+	sd.series_cb = cb;
+	sd.data = (void *)data;
+
+	_etvdb_series_find_uri_get(name, uri);
+
+	return _stream_run(&sd, uri, "Series", _series_record_cb);
+}
+/**
+ * @}
+ */
+
+/* download and parse a stream, then free the scratch data */
+static Eina_Bool _stream_run(Stream_Data *sd, const char *uri, const char *tag,
+		Eina_Bool (*record_cb)(Download_Stream *st, const char *rec, size_t len))
+{
+	CURLcode res;
+	Download_Stream st;
+
+	sd->go_on = EINA_TRUE;
+
+	st.tag = tag;
+	st.record_cb = record_cb;
+	st.data = sd;
+
+	res = _etvdb_dl_stream(&st, uri);
+
+	free(st.buf.data);
+	free(sd->text);
+
+	if (res) {
+		ERR("Couldn't stream %s records from server.", tag);
+		return EINA_FALSE;
+	}
+
+	DBG("Streamed %u %s records.", st.records, tag);
+
+	return EINA_TRUE;
+}
+
+/* parse one complete Episode record and pass it on */
+static Eina_Bool _episode_record_cb(Download_Stream *st, const char *rec, size_t len)
+{
+	Stream_Data *sd = st->data;
+
+	if (_etvdb_request_expired() || !_text_reserve(sd, len)) {
+		st->aborted = EINA_TRUE;
+		return EINA_FALSE;
+	}
+
+	memset(&sd->e, 0, sizeof(Episode));
+	sd->depth = 0;
+
+	if (!_etvdb_xml_parse(rec, len, _parse_episode_cb, sd) && sd->go_on)
+		WARN("Parsing a streamed Episode failed, skipping it.");
+
+	return sd->go_on;
+}
+
+/* parse one complete Series record and pass it on */
+static Eina_Bool _series_record_cb(Download_Stream *st, const char *rec, size_t len)
+{
+	Stream_Data *sd = st->data;
+
+	if (_etvdb_request_expired() || !_text_reserve(sd, len)) {
+		st->aborted = EINA_TRUE;
+		return EINA_FALSE;
+	}
+
+	memset(&sd->s, 0, sizeof(Series));
+	sd->zap2it_id = NULL;
+	sd->depth = 0;
+
+	if (!_etvdb_xml_parse(rec, len, _parse_series_cb, sd) && sd->go_on)
+		WARN("Parsing a streamed Series failed, skipping it.");
+
+	return sd->go_on;
+}
+
+/* parses a single Episode record into the scratch Episode */
+static Eina_Bool _parse_episode_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
+{
+	Stream_Data *sd = data;
+	Episode *e = &sd->e;
+
+	switch (type) {
+	case EINA_SIMPLE_XML_OPEN:
+		if (sd->depth == 0 && tag == XML_TAG_EPISODE)
+			sd->depth++;
+		else if (sd->depth == 1)
+			sd->sibling = tag;
+		break;
+	case EINA_SIMPLE_XML_CLOSE:
+		if (tag == XML_TAG_EPISODE) {
+			sd->depth--;
+			sd->go_on = sd->episode_cb(sd->data, e);
+			return sd->go_on;
+		}
+		break;
+	case EINA_SIMPLE_XML_DATA:
+		if (sd->depth != 1)
+			break;
+
+		_etvdb_episode_field_set(e, sd->sibling, content, length, _text_cb, sd);
+		break;
+	default:
+		break;
+	}
+
+	return EINA_TRUE;
+}
+
+/* parses a single Series record into the scratch Series */
+static Eina_Bool _parse_series_cb(void *data, Eina_Simple_XML_Type type, Xml_Tag tag,
+		const char *content, unsigned length)
+{
+	Stream_Data *sd = data;
+	Series *s = &sd->s;
+
+	switch (type) {
+	case EINA_SIMPLE_XML_OPEN:
+		if (sd->depth == 0 && tag == XML_TAG_SERIES)
+			sd->depth++;
+		else if (sd->depth == 1)
+			sd->sibling = tag;
+		break;
+	case EINA_SIMPLE_XML_CLOSE:
+		if (tag == XML_TAG_SERIES) {
+			sd->depth--;
+			_etvdb_search_index_add(s, sd->zap2it_id);
+			sd->go_on = sd->series_cb(sd->data, s);
+			return sd->go_on;
+		}
+		break;
+	case EINA_SIMPLE_XML_DATA:
+		if (sd->depth != 1)
+			break;
+
+		_etvdb_series_field_set(s, sd->sibling, content, length, &sd->zap2it_id, _text_cb, sd);
+		break;
+	default:
+		break;
+	}
+
+	return EINA_TRUE;
+}
+
+/* make room for the strings of a record of len bytes.
+ * the strings of a record are never longer than the record itself,
+ * so the buffer only grows for the largest record. */
+static Eina_Bool _text_reserve(Stream_Data *sd, size_t len)
+{
+	char *text;
+
+	sd->text_used = 0;
+
+	if (len < sd->text_size)
+		return EINA_TRUE;
+
+	text = realloc(sd->text, len + 1);
+	if (!text) {
+		ERR("Couldn't allocate enough memory.");
+		return EINA_FALSE;
+	}
+
+	sd->text = text;
+	sd->text_size = len + 1;
+
+	return EINA_TRUE;
+}
+
+/* copy a string of the current record into the scratch text */
+static char *_text_cb(void *data, void *record UNUSED, Xml_Tag tag UNUSED,
+		const char *content, unsigned length, Eina_Bool decode)
+{
+	char buf[length + 1];
+	Stream_Data *sd = data;
+	char *str = sd->text + sd->text_used;
+
+	if (sd->text_used + length + 1 > sd->text_size)
+		return NULL;
+
+	if (decode) {
+		MEM2STR(buf, content, length);
+		HTML2UTF(str, buf);
+	} else {
+		MEM2STR(str, content, length);
+	}
+
+	sd->text_used += strlen(str) + 1;
+
+	return str;
+}
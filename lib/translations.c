@@ -0,0 +1,409 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+
+/* fields parsed from the documents of the other languages */
+#define TRANSLATION_FIELDS (ETVDB_FIELD_NAME | ETVDB_FIELD_OVERVIEW)
+
+/* texts of an Episode in another language */
+typedef struct _translation_text {
+	uint32_t id; /**< TVDB ID of the Episode */
+	const char *name; /**< Episode Name, an eina_stringshare */
+	char *overview; /**< Episode Description */
+} Translation_Text;
+
+/* texts of a Series and its Episodes in another language */
+struct _translation {
+	char lang[3]; /**< language code */
+	char *name; /**< Series Name */
+	char *overview; /**< Series Description */
+	Translation_Text *texts; /**< texts of the Episodes, sorted by ID */
+	unsigned int count; /**< number of Episode texts */
+	Eina_Bool primary; /**< the texts are the members of the Series and Episodes */
+};
+
+/* state of a multi-language load */
+typedef struct _translations_load {
+	uint32_t id; /**< TVDB ID of the Series */
+	const char **langs; /**< languages, the first one is the primary language */
+	Series *s; /**< the Series in the primary language */
+	Translation **tr; /**< texts of the languages, by index of langs */
+	Eina_Bool ok; /**< all languages were loaded */
+} Translations_Load;
+
+/* internal functions */
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri);
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl);
+static Translation *_translation_parse(const char *lang, char *data, size_t len);
+static const Translation *_translation_find(const Series *s, const char *lang);
+static const Translation_Text *_text_find(const Translation *tr, const Episode *e);
+static int _text_cmp(const void *a, const void *b);
+static void _translation_free(Translation *tr);
+
+/**
+ * @brief Translations
+ * @defgroup Translations
+ *
+ * @{
+ *
+ * These functions load a Series in several languages at once.
+ *
+ * IDs, numbers and dates are the same in every language, so the Series
+ * and its Episodes exist only once, in the primary language.
+ * The names and overviews of the other languages are kept in a text table
+ * per language, which is looked up with the functions below.
+ */
+
+/**
+ * @brief Get a Series in several languages
+ *
+ * This function downloads the Series record and all Episodes
+ * in every language at the same time, and returns one populated Series.
+ * Its members are in the first language, the texts of the
+ * other languages are available through the functions of this group.
+ *
+ * The translations are freed with the Series, they are not copied by
+ * etvdb_series_dup() and not saved by etvdb_series_save().
+ *
+ * @param id TVDB Series ID
+ * @param langs array of 2 character language codes, the first one is the primary language
+ * @param count number of languages
+ *
+ * @return a populated Series on success, NULL if any language couldn't be loaded
+ *
+ * @ingroup Translations
+ */
+EAPI Series *etvdb_series_translations_get(uint32_t id, const char **langs, unsigned int count)
+{
+	unsigned int i;
+	Download_Batch batch;
+	Series_Priv *priv;
+	Translations_Load load;
+
+	if (!id || !langs || !count) {
+		ERR("No Series or languages to load.");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!langs[i] || strlen(langs[i]) != 2) {
+			ERR("Invalid language code.");
+			return NULL;
+		}
+	}
+
+	memset(&load, 0, sizeof(Translations_Load));
+	load.id = id;
+	load.langs = langs;
+	load.ok = EINA_TRUE;
+	load.tr = calloc(count, sizeof(Translation *));
+	if (!load.tr) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	memset(&batch, 0, sizeof(Download_Batch));
+	batch.count = count;
+	batch.connections = count;
+	batch.uri_cb = _uri_cb;
+	batch.done_cb = _done_cb;
+	batch.data = &load;
+
+	DBG("Loading Series %"PRIu32" in %u languages.", id, count);
+
+	if (!_etvdb_dl_batch(&batch))
+		load.ok = EINA_FALSE;
+
+	/* downloads, which weren't started because the call was aborted */
+	for (i = 1; i < count; i++) {
+		if (!load.tr[i])
+			load.ok = EINA_FALSE;
+	}
+
+	priv = load.ok && load.s ? _etvdb_series_priv_get(load.s) : NULL;
+	if (priv)
+		load.tr[0] = calloc(1, sizeof(Translation));
+	if (!load.tr[0]) {
+		for (i = 1; i < count; i++)
+			_translation_free(load.tr[i]);
+		if (load.s)
+			etvdb_series_free(load.s);
+		free(load.tr);
+		return NULL;
+	}
+
+	/* the primary language only marks the members */
+	strcpy(load.tr[0]->lang, langs[0]);
+	load.tr[0]->primary = EINA_TRUE;
+
+	for (i = 0; i < count; i++)
+		priv->translations = eina_list_append(priv->translations, load.tr[i]);
+	free(load.tr);
+
+	return load.s;
+}
+
+/**
+ * @brief Get the name of a Series in one of its languages
+ *
+ * @param s Series returned by etvdb_series_translations_get()
+ * @param lang 2 character language code
+ *
+ * @return the name, which belongs to the Series, or NULL if the language wasn't loaded
+ *
+ * @ingroup Translations
+ */
+EAPI const char *etvdb_series_name_translation_get(const Series *s, const char *lang)
+{
+	const Translation *tr;
+
+	tr = _translation_find(s, lang);
+	if (!tr)
+		return NULL;
+
+	return tr->primary ? s->name : tr->name;
+}
+
+/**
+ * @brief Get the overview of a Series in one of its languages
+ *
+ * @param s Series returned by etvdb_series_translations_get()
+ * @param lang 2 character language code
+ *
+ * @return the overview, which belongs to the Series, or NULL if the language wasn't loaded
+ *
+ * @see etvdb_series_overview_get()
+ *
+ * @ingroup Translations
+ */
+EAPI const char *etvdb_series_overview_translation_get(const Series *s, const char *lang)
+{
+	const Translation *tr;
+
+	tr = _translation_find(s, lang);
+	if (!tr)
+		return NULL;
+
+	return tr->primary ? etvdb_series_overview_get(s) : tr->overview;
+}
+
+/**
+ * @brief Get the name of an Episode in one of its languages
+ *
+ * @param e Episode of a Series returned by etvdb_series_translations_get()
+ * @param lang 2 character language code
+ *
+ * @return the name, which belongs to the Series, or NULL if there is none in the language
+ *
+ * @ingroup Translations
+ */
+EAPI const char *etvdb_episode_name_translation_get(const Episode *e, const char *lang)
+{
+	const Translation *tr;
+	const Translation_Text *t;
+
+	if (!e->series || !(tr = _translation_find(e->series, lang)))
+		return NULL;
+
+	if (tr->primary)
+		return etvdb_episode_name_get((Episode *)e);
+
+	t = _text_find(tr, e);
+
+	return t ? t->name : NULL;
+}
+
+/**
+ * @brief Get the overview of an Episode in one of its languages
+ *
+ * @param e Episode of a Series returned by etvdb_series_translations_get()
+ * @param lang 2 character language code
+ *
+ * @return the overview, which belongs to the Series, or NULL if there is none in the language
+ *
+ * @see etvdb_episode_overview_get()
+ *
+ * @ingroup Translations
+ */
+EAPI const char *etvdb_episode_overview_translation_get(const Episode *e, const char *lang)
+{
+	const Translation *tr;
+	const Translation_Text *t;
+
+	if (!e->series || !(tr = _translation_find(e->series, lang)))
+		return NULL;
+
+	if (tr->primary)
+		return etvdb_episode_overview_get((Episode *)e);
+
+	t = _text_find(tr, e);
+
+	return t ? t->overview : NULL;
+}
+/**
+ * @}
+ */
+
+/* free the translations of a Series */
+void _etvdb_translations_free(Series *s)
+{
+	Translation *tr;
+
+	if (!s->priv)
+		return;
+
+	EINA_LIST_FREE(s->priv->translations, tr)
+		_translation_free(tr);
+}
+
+static void _uri_cb(Download_Batch *batch, unsigned int i, char *uri)
+{
+	Translations_Load *load = batch->data;
+
+	snprintf(uri, URI_MAX, TVDB_API_URI"/%s/series/%"PRIu32"/all/%s.xml",
+			etvdb_api_key, load->id, load->langs[i]);
+}
+
+/* parse a downloaded language, while the others are still downloading */
+static void _done_cb(Download_Batch *batch, unsigned int i, CURLcode res, Download *dl)
+{
+	Translations_Load *load = batch->data;
+	Eina_List *all;
+	Series *s;
+
+	if (res) {
+		ERR("Couldn't get Series %"PRIu32" in %s from server.", load->id, load->langs[i]);
+		free(dl->data);
+		load->ok = EINA_FALSE;
+		return;
+	}
+
+	if (i) {
+		load->tr[i] = _translation_parse(load->langs[i], dl->data, dl->len);
+		if (!load->tr[i])
+			load->ok = EINA_FALSE;
+		return;
+	}
+
+	/* the primary language is a complete Series */
+	s = _etvdb_series_parse(dl->data, dl->len, ETVDB_FIELD_ALL);
+	if (!s) {
+		ERR("Couldn't parse Series %"PRIu32, load->id);
+		free(dl->data);
+		load->ok = EINA_FALSE;
+		return;
+	}
+
+	all = _etvdb_episodes_parse(s, dl->data, dl->len, ETVDB_FIELD_ALL, EINA_TRUE);
+	if (!all || !_etvdb_series_episodes_bucket(s, all)) {
+		ERR("Couldn't get Episodes for Series %"PRIu32, load->id);
+		etvdb_series_free(s);
+		load->ok = EINA_FALSE;
+		return;
+	}
+
+	load->s = s;
+}
+
+/* parse the texts of a language, data is consumed.
+ * the texts are taken over from a temporary Series */
+static Translation *_translation_parse(const char *lang, char *data, size_t len)
+{
+	unsigned int n = 0;
+	Eina_List *all;
+	Episode *e;
+	Series *s;
+	Translation *tr;
+
+	s = _etvdb_series_parse(data, len, TRANSLATION_FIELDS);
+	if (!s) {
+		ERR("Couldn't parse Series in %s.", lang);
+		free(data);
+		return NULL;
+	}
+
+	all = _etvdb_episodes_parse(s, data, len, TRANSLATION_FIELDS, EINA_TRUE);
+
+	tr = calloc(1, sizeof(Translation));
+	if (tr)
+		tr->texts = calloc(eina_list_count(all) + 1, sizeof(Translation_Text));
+	if (!tr || !tr->texts) {
+		ERR("Couldn't allocate enough memory.");
+		free(tr);
+		EINA_LIST_FREE(all, e)
+			etvdb_episode_free(e);
+		etvdb_series_free(s);
+		return NULL;
+	}
+
+	strcpy(tr->lang, lang);
+	tr->name = s->name;
+	tr->overview = s->overview;
+	s->name = s->overview = NULL;
+
+	EINA_LIST_FREE(all, e) {
+		tr->texts[n].id = e->id;
+		tr->texts[n].name = e->name;
+		tr->texts[n].overview = e->overview;
+		e->name = e->overview = NULL;
+		etvdb_episode_free(e);
+		n++;
+	}
+
+	tr->count = n;
+	qsort(tr->texts, n, sizeof(Translation_Text), _text_cmp);
+	etvdb_series_free(s);
+
+	return tr;
+}
+
+/* find the texts of a language, NULL if it wasn't loaded */
+static const Translation *_translation_find(const Series *s, const char *lang)
+{
+	Eina_List *l;
+	Translation *tr;
+
+	if (!lang || !s->priv)
+		return NULL;
+
+	EINA_LIST_FOREACH(s->priv->translations, l, tr) {
+		if (!strcmp(tr->lang, lang))
+			return tr;
+	}
+
+	return NULL;
+}
+
+/* find the texts of an Episode in a language */
+static const Translation_Text *_text_find(const Translation *tr, const Episode *e)
+{
+	Translation_Text key;
+
+	key.id = e->id;
+
+	return bsearch(&key, tr->texts, tr->count, sizeof(Translation_Text), _text_cmp);
+}
+
+static int _text_cmp(const void *a, const void *b)
+{
+	const Translation_Text *ta = a, *tb = b;
+
+	return (ta->id > tb->id) - (ta->id < tb->id);
+}
+
+static void _translation_free(Translation *tr)
+{
+	unsigned int i;
+
+	if (!tr)
+		return;
+
+	for (i = 0; i < tr->count; i++) {
+		eina_stringshare_del(tr->texts[i].name);
+		free(tr->texts[i].overview);
+	}
+
+	free(tr->texts);
+	free(tr->name);
+	free(tr->overview);
+	free(tr);
+}
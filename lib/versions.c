@@ -0,0 +1,252 @@
+#include "etvdb_private.h"
+#include <inttypes.h>
+#include <sched.h>
+
+/* this structure represents a Series, which is replaced by new versions */
+struct _etvdb_versioned {
+	Series *current; /**< published version, read atomically */
+	uint64_t version; /**< number of the published version */
+	int readers[2]; /**< readers between loading current and taking a reference, per side */
+	unsigned int side; /**< side new readers register on */
+	Eina_Lock lock; /**< serializes publishers */
+};
+
+/* internal functions */
+static void _readers_wait(Etvdb_Versioned *v);
+
+/**
+ * @brief Versioned Series
+ * @defgroup Versions
+ *
+ * @{
+ *
+ * A versioned Series is read by many threads while it is refreshed.
+ *
+ * Readers take a reference to the current version with
+ * etvdb_versioned_acquire(), which never blocks or waits,
+ * and release it when they are done.
+ * A refresh builds a new version off to the side and publishes it
+ * atomically, readers get the new version from then on.
+ * An old version is freed, once its last reader released it.
+ *
+ * Published versions must not be changed, e.g. by etvdb_series_populate().
+ * A refresh scheduler can publish its refreshed Series with
+ * etvdb_versioned_publish() from its callback, see etvdb_refresh_new().
+ */
+
+/**
+ * @brief Create a versioned Series
+ *
+ * @param s the first version, which belongs to the versioned Series from now on
+ *
+ * @return a new versioned Series on success, NULL on failure
+ *
+ * @see etvdb_versioned_free()
+ *
+ * @ingroup Versions
+ */
+EAPI Etvdb_Versioned *etvdb_versioned_new(Series *s)
+{
+	Etvdb_Versioned *v;
+	Series_Priv *priv;
+
+	priv = _etvdb_series_priv_get(s);
+	if (!priv)
+		return NULL;
+
+	v = calloc(1, sizeof(Etvdb_Versioned));
+	if (!v) {
+		ERR("Couldn't allocate enough memory.");
+		return NULL;
+	}
+
+	if (!eina_lock_new(&v->lock)) {
+		free(v);
+		return NULL;
+	}
+
+	/* the published version holds one reference */
+	priv->refs = 1;
+	v->current = s;
+	v->version = 1;
+
+	return v;
+}
+
+/**
+ * @brief Free a versioned Series
+ *
+ * The current version is freed, once its last reader released it.
+ * No thread may acquire versions any more.
+ *
+ * @param v the versioned Series
+ *
+ * @ingroup Versions
+ */
+EAPI void etvdb_versioned_free(Etvdb_Versioned *v)
+{
+	if (!v)
+		return;
+
+	etvdb_versioned_release(v->current);
+	eina_lock_free(&v->lock);
+	free(v);
+}
+
+/**
+ * @brief Get the current version of a Series
+ *
+ * This function is wait-free and can be called from any thread.
+ * The Series stays valid until it is released,
+ * even if a new version is published meanwhile.
+ *
+ * @param v the versioned Series
+ *
+ * @return the current version, which has to be released with etvdb_versioned_release()
+ *
+ * @ingroup Versions
+ */
+EAPI Series *etvdb_versioned_acquire(Etvdb_Versioned *v)
+{
+	unsigned int side;
+	Series *s;
+
+	/* the publisher waits for readers of its side, before the old version may go */
+	side = __atomic_load_n(&v->side, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&v->readers[side], 1, __ATOMIC_SEQ_CST);
+
+	s = __atomic_load_n(&v->current, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&s->priv->refs, 1, __ATOMIC_SEQ_CST);
+
+	__atomic_sub_fetch(&v->readers[side], 1, __ATOMIC_SEQ_CST);
+
+	return s;
+}
+
+/**
+ * @brief Release a version of a Series
+ *
+ * The version is freed, if it isn't published any more
+ * and this was its last reader.
+ *
+ * @param s a Series returned by etvdb_versioned_acquire()
+ *
+ * @ingroup Versions
+ */
+EAPI void etvdb_versioned_release(Series *s)
+{
+	if (__atomic_sub_fetch(&s->priv->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		etvdb_series_free(s);
+}
+
+/**
+ * @brief Publish a new version of a Series
+ *
+ * Readers get the new version from now on,
+ * the old one is freed after its last reader released it.
+ *
+ * @param v the versioned Series
+ * @param s the new version, which belongs to the versioned Series from now on
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Versions
+ */
+EAPI Eina_Bool etvdb_versioned_publish(Etvdb_Versioned *v, Series *s)
+{
+	uint64_t version;
+	Series *old;
+	Series_Priv *priv;
+
+	priv = _etvdb_series_priv_get(s);
+	if (!priv)
+		return EINA_FALSE;
+
+	priv->refs = 1;
+
+	eina_lock_take(&v->lock);
+
+	old = v->current;
+	__atomic_store_n(&v->current, s, __ATOMIC_SEQ_CST);
+	version = __atomic_add_fetch(&v->version, 1, __ATOMIC_SEQ_CST);
+
+	/* readers, which loaded the old version, hold their reference now */
+	_readers_wait(v);
+
+	eina_lock_release(&v->lock);
+
+	DBG("Published version %"PRIu64" of Series %"PRIu32, version, s->id);
+
+	etvdb_versioned_release(old);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Refresh a versioned Series
+ *
+ * This function downloads the Series with all Episodes
+ * and publishes it as a new version.
+ * Readers keep using the current version meanwhile.
+ *
+ * @param v the versioned Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if the Series couldn't be downloaded
+ *
+ * @ingroup Versions
+ */
+EAPI Eina_Bool etvdb_versioned_refresh(Etvdb_Versioned *v)
+{
+	uint32_t id;
+	Series *s;
+
+	s = etvdb_versioned_acquire(v);
+	id = s->id;
+	etvdb_versioned_release(s);
+
+	s = _etvdb_series_all_get(id);
+	if (!s)
+		return EINA_FALSE;
+
+	if (!etvdb_versioned_publish(v, s)) {
+		etvdb_series_free(s);
+		return EINA_FALSE;
+	}
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Get the number of the current version
+ *
+ * The first version is 1, every published version counts up.
+ *
+ * @param v the versioned Series
+ *
+ * @return the number of the current version
+ *
+ * @ingroup Versions
+ */
+EAPI uint64_t etvdb_versioned_version_get(const Etvdb_Versioned *v)
+{
+	return __atomic_load_n(&v->version, __ATOMIC_SEQ_CST);
+}
+/**
+ * @}
+ */
+
+/* wait until no reader can take a reference to the old version any more.
+ * the readers of the other side are drained, new readers are moved there,
+ * then the readers of the previous side are drained. */
+static void _readers_wait(Etvdb_Versioned *v)
+{
+	unsigned int side = v->side;
+
+	while (__atomic_load_n(&v->readers[(side + 1) & 1], __ATOMIC_SEQ_CST))
+		sched_yield();
+
+	__atomic_store_n(&v->side, side + 1, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&v->readers[side & 1], __ATOMIC_SEQ_CST))
+		sched_yield();
+}
@@ -0,0 +1,499 @@
+#include "etvdb_private.h"
+
+/* one entry of a timeline */
+typedef struct _airing {
+	uint32_t date; /**< packed air date */
+	Series *s; /**< Series the Episode belongs to */
+	Episode *e; /**< the Episode */
+} Airing;
+
+/* a time ordered array of airings */
+typedef struct _timeline {
+	Airing *items; /**< airings, ordered by date */
+	unsigned int count; /**< number of airings */
+} Timeline;
+
+/* data passed when collecting the next Episode of every Series */
+typedef struct _next_data {
+	uint32_t date; /**< packed date to search after */
+	Eina_List *list; /**< collected Episodes */
+} Next_Data;
+
+/* this structure represents a watchlist */
+struct _etvdb_watchlist {
+	Timeline all; /**< timeline of all Series, the first merged airings are ordered */
+	unsigned int merged; /**< number of ordered airings, the ones after them were added since */
+	unsigned int size; /**< allocated number of airings in all */
+	Eina_Hash *series; /**< Series -> Timeline of that Series */
+};
+
+/* internal functions */
+static Eina_Bool _timeline_build(Timeline *t, Series *s);
+static Eina_Bool _all_append(Etvdb_Watchlist *w, const Timeline *t);
+static void _all_merge(Etvdb_Watchlist *w);
+static unsigned int _timeline_upper(const Timeline *t, uint32_t date);
+static uint32_t _date_get(const char *date);
+static int _airing_cmp(const void *a, const void *b);
+static void _timeline_free_cb(void *data);
+static Eina_Bool _series_next_cb(const Eina_Hash *hash, const void *key, void *data, void *fdata);
+
+/**
+ * @brief Watchlist Functions
+ * @defgroup Watchlist
+ *
+ * @{
+ *
+ * A watchlist holds many populated Series and keeps a merged,
+ * time ordered timeline of all their air dates.
+ * It answers schedule queries for the whole set without scanning
+ * every Series: lookups are binary searches on the timeline,
+ * so a query costs O(log n + k) for k results.
+ * Added Series are merged into the timeline by the next query,
+ * so adding many Series at once doesn't rebuild it every time.
+ *
+ * A watchlist doesn't own the Series, they have to stay valid
+ * as long as they are part of it.
+ * If a Series is populated again, it has to be updated with
+ * etvdb_watchlist_series_update().
+ */
+
+/**
+ * @brief Create a new watchlist
+ *
+ * @see etvdb_watchlist_free()
+ *
+ * @return a new, empty watchlist on success, NULL on failure
+ *
+ * @ingroup Watchlist
+ */
+EAPI Etvdb_Watchlist *etvdb_watchlist_new(void)
+{
+	Etvdb_Watchlist *w;
+
+	w = calloc(1, sizeof(Etvdb_Watchlist));
+	if (w)
+		w->series = eina_hash_pointer_new(_timeline_free_cb);
+	if (!w || !w->series) {
+		ERR("Couldn't allocate enough memory.");
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+/**
+ * @brief Free a watchlist
+ *
+ * The Series in the watchlist are not freed.
+ *
+ * @param w watchlist
+ *
+ * @ingroup Watchlist
+ */
+EAPI void etvdb_watchlist_free(Etvdb_Watchlist *w)
+{
+	if (!w)
+		return;
+
+	eina_hash_free(w->series);
+	free(w->all.items);
+	free(w);
+}
+
+/**
+ * @brief Add a Series to a watchlist
+ *
+ * The Series should be populated, only Episodes with an air date
+ * are added to the timeline, including specials.
+ *
+ * @param w watchlist
+ * @param s populated Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure or if the Series already is on the watchlist
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_Bool etvdb_watchlist_series_add(Etvdb_Watchlist *w, Series *s)
+{
+	Timeline *t;
+
+	if (eina_hash_find(w->series, &s)) {
+		WARN("Series %"PRIu32" is already on the watchlist.", s->id);
+		return EINA_FALSE;
+	}
+
+	t = malloc(sizeof(Timeline));
+	if (!t || !_timeline_build(t, s)) {
+		ERR("Couldn't allocate enough memory.");
+		free(t);
+		return EINA_FALSE;
+	}
+
+	if (!_all_append(w, t)) {
+		ERR("Couldn't allocate enough memory.");
+		_timeline_free_cb(t);
+		return EINA_FALSE;
+	}
+
+	eina_hash_add(w->series, &s, t);
+	DBG("Added %u airings of Series %"PRIu32" to the watchlist.", t->count, s->id);
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Remove a Series from a watchlist
+ *
+ * @param w watchlist
+ * @param s Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE if the Series is not on the watchlist
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_Bool etvdb_watchlist_series_del(Etvdb_Watchlist *w, Series *s)
+{
+	unsigned int i, j, merged = 0;
+
+	if (!eina_hash_del_by_key(w->series, &s))
+		return EINA_FALSE;
+
+	for (i = j = 0; i < w->all.count; i++) {
+		if (i == w->merged)
+			merged = j;
+		if (w->all.items[i].s != s)
+			w->all.items[j++] = w->all.items[i];
+	}
+	w->merged = w->merged < w->all.count ? merged : j;
+	w->all.count = j;
+
+	return EINA_TRUE;
+}
+
+/**
+ * @brief Update a Series on a watchlist
+ *
+ * This has to be called after a Series on the watchlist was populated again,
+ * since etvdb_series_populate() replaces all its Episodes.
+ *
+ * @param w watchlist
+ * @param s Series
+ *
+ * @return EINA_TRUE on success, EINA_FALSE on failure
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_Bool etvdb_watchlist_series_update(Etvdb_Watchlist *w, Series *s)
+{
+	etvdb_watchlist_series_del(w, s);
+
+	return etvdb_watchlist_series_add(w, s);
+}
+
+/**
+ * @brief Get the next airings of all Series on a watchlist
+ *
+ * This function returns up to n Episodes, which air after today or a given date,
+ * ordered by their air date.
+ *
+ * The date string has to be in an ISO 8601 format and contain only the date.
+ * Example: 2013-03-28
+ *
+ * @param w watchlist
+ * @param date a string containing an ISO 8601 date or NULL for today
+ * @param n maximum number of Episodes
+ *
+ * @return a list of Episodes, which has to be freed with eina_list_free(), but not its data
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_List *etvdb_watchlist_airs_next_get(Etvdb_Watchlist *w, const char *date, unsigned int n)
+{
+	unsigned int i;
+	Eina_List *list = NULL;
+
+	_all_merge(w);
+
+	for (i = _timeline_upper(&w->all, _date_get(date)); i < w->all.count && n > 0; i++, n--)
+		list = eina_list_append(list, w->all.items[i].e);
+
+	return list;
+}
+
+/**
+ * @brief Get all Episodes of a watchlist, which aired in a period of time
+ *
+ * Both dates are inclusive and have to be ISO 8601 date strings.
+ *
+ * @param w watchlist
+ * @param from first day of the period
+ * @param to last day of the period, or NULL for today
+ *
+ * @return a list of Episodes ordered by air date, which has to be freed
+ * with eina_list_free(), but not its data
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_List *etvdb_watchlist_aired_between_get(Etvdb_Watchlist *w, const char *from, const char *to)
+{
+	unsigned int i = 0;
+	uint32_t dfrom, dto;
+	Eina_List *list = NULL;
+
+	dfrom = _etvdb_date_pack(from);
+	dto = _date_get(to);
+
+	_all_merge(w);
+
+	/* first airing on or after from is the first one after the day before */
+	if (dfrom)
+		i = _timeline_upper(&w->all, dfrom - 1);
+
+	for (; i < w->all.count && w->all.items[i].date <= dto; i++)
+		list = eina_list_append(list, w->all.items[i].e);
+
+	return list;
+}
+
+/**
+ * @brief Get the next Episode of one Series on a watchlist
+ *
+ * @param w watchlist
+ * @param s Series on the watchlist
+ * @param date a string containing an ISO 8601 date or NULL for today
+ *
+ * @return the Episode that airs next after the date, NULL if there is none
+ *
+ * @ingroup Watchlist
+ */
+EAPI Episode *etvdb_watchlist_series_next_get(Etvdb_Watchlist *w, Series *s, const char *date)
+{
+	unsigned int i;
+	Timeline *t;
+
+	t = eina_hash_find(w->series, &s);
+	if (!t)
+		return NULL;
+
+	i = _timeline_upper(t, _date_get(date));
+
+	return i < t->count ? t->items[i].e : NULL;
+}
+
+/**
+ * @brief Get the latest aired Episode of one Series on a watchlist
+ *
+ * @param w watchlist
+ * @param s Series on the watchlist
+ * @param date a string containing an ISO 8601 date or NULL for today
+ *
+ * @return the Episode that aired last on or before the date, NULL if there is none
+ *
+ * @ingroup Watchlist
+ */
+EAPI Episode *etvdb_watchlist_series_latest_get(Etvdb_Watchlist *w, Series *s, const char *date)
+{
+	unsigned int i;
+	Timeline *t;
+
+	t = eina_hash_find(w->series, &s);
+	if (!t)
+		return NULL;
+
+	i = _timeline_upper(t, _date_get(date));
+
+	return i > 0 ? t->items[i - 1].e : NULL;
+}
+
+/**
+ * @brief Get the next Episode of every Series on a watchlist
+ *
+ * @param w watchlist
+ * @param date a string containing an ISO 8601 date or NULL for today
+ *
+ * @return a list with the next Episode of every Series which has one, which has
+ * to be freed with eina_list_free(), but not its data
+ *
+ * @ingroup Watchlist
+ */
+EAPI Eina_List *etvdb_watchlist_next_per_series_get(Etvdb_Watchlist *w, const char *date)
+{
+	Next_Data fdata;
+
+	fdata.date = _date_get(date);
+	fdata.list = NULL;
+
+	eina_hash_foreach(w->series, _series_next_cb, &fdata);
+
+	return fdata.list;
+}
+/**
+ * @}
+ */
+
+/* build the sorted timeline of a single Series */
+static Eina_Bool _timeline_build(Timeline *t, Series *s)
+{
+	unsigned int max = 0;
+	uint32_t date;
+	Eina_List *l, *ll, *sl;
+	Episode *e;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl)
+		max += eina_list_count(sl);
+	max += eina_list_count(s->specials);
+
+	t->count = 0;
+	t->items = malloc((max ? max : 1) * sizeof(Airing));
+	if (!t->items)
+		return EINA_FALSE;
+
+	EINA_LIST_FOREACH(s->seasons, l, sl) {
+		EINA_LIST_FOREACH(sl, ll, e) {
+			if ((date = _etvdb_date_pack(e->firstaired))) {
+				t->items[t->count].date = date;
+				t->items[t->count].s = s;
+				t->items[t->count++].e = e;
+			}
+		}
+	}
+
+	EINA_LIST_FOREACH(s->specials, l, e) {
+		if ((date = _etvdb_date_pack(e->firstaired))) {
+			t->items[t->count].date = date;
+			t->items[t->count].s = s;
+			t->items[t->count++].e = e;
+		}
+	}
+
+	qsort(t->items, t->count, sizeof(Airing), _airing_cmp);
+
+	return EINA_TRUE;
+}
+
+/* add the airings of a Series to the timeline of all Series, it is merged later */
+static Eina_Bool _all_append(Etvdb_Watchlist *w, const Timeline *t)
+{
+	unsigned int size;
+	Airing *items;
+
+	if (w->all.count + t->count > w->size) {
+		size = w->size ? w->size : 64;
+		while (size < w->all.count + t->count)
+			size *= 2;
+
+		items = realloc(w->all.items, size * sizeof(Airing));
+		if (!items)
+			return EINA_FALSE;
+
+		w->all.items = items;
+		w->size = size;
+	}
+
+	memcpy(w->all.items + w->all.count, t->items, t->count * sizeof(Airing));
+	w->all.count += t->count;
+
+	return EINA_TRUE;
+}
+
+/* merge the airings added since the last query into the ordered ones */
+static void _all_merge(Etvdb_Watchlist *w)
+{
+	unsigned int i, j, k, n;
+	Airing *added;
+
+	n = w->all.count - w->merged;
+	if (!n)
+		return;
+
+	qsort(w->all.items + w->merged, n, sizeof(Airing), _airing_cmp);
+
+	added = malloc(n * sizeof(Airing));
+	if (!added) {
+		ERR("Couldn't allocate enough memory, sorting the whole timeline.");
+		qsort(w->all.items, w->all.count, sizeof(Airing), _airing_cmp);
+		w->merged = w->all.count;
+		return;
+	}
+
+	/* merge from the back, so only the added airings have to be copied */
+	memcpy(added, w->all.items + w->merged, n * sizeof(Airing));
+	i = w->merged;
+	j = n;
+	k = w->all.count;
+
+	while (j > 0) {
+		if (i > 0 && w->all.items[i - 1].date > added[j - 1].date)
+			w->all.items[--k] = w->all.items[--i];
+		else
+			w->all.items[--k] = added[--j];
+	}
+
+	free(added);
+	w->merged = w->all.count;
+}
+
+/* index of the first airing after a date */
+static unsigned int _timeline_upper(const Timeline *t, uint32_t date)
+{
+	unsigned int lo = 0, hi = t->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->items[mid].date <= date)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* packed date of a date string or today */
+static uint32_t _date_get(const char *date)
+{
+	if (date) {
+		DBG("Requested Date: %s", date);
+		return _etvdb_date_pack(date);
+	}
+
+	return _etvdb_date_today();
+}
+
+/* sort airings by date, then by season and number */
+static int _airing_cmp(const void *a, const void *b)
+{
+	const Airing *aa = a, *ab = b;
+
+	if (aa->date != ab->date)
+		return aa->date < ab->date ? -1 : 1;
+
+	if (aa->e->season != ab->e->season)
+		return aa->e->season - ab->e->season;
+
+	return aa->e->number - ab->e->number;
+}
+
+static void _timeline_free_cb(void *data)
+{
+	Timeline *t = data;
+
+	free(t->items);
+	free(t);
+}
+
+/* collect the next Episode of a Series timeline */
+static Eina_Bool _series_next_cb(const Eina_Hash *hash UNUSED, const void *key UNUSED,
+		void *data, void *fdata)
+{
+	unsigned int i;
+	Timeline *t = data;
+	Next_Data *next = fdata;
+
+	i = _timeline_upper(t, next->date);
+	if (i < t->count)
+		next->list = eina_list_append(next->list, t->items[i].e);
+
+	return EINA_TRUE;
+}
@@ -0,0 +1,247 @@
+#include "etvdb_private.h"
+#include <ctype.h>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+/* result of a tokenizer pass */
+typedef enum _xml_result {
+	XML_OK, /**< the whole document was tokenized */
+	XML_UNSUPPORTED, /**< the document contains something TVDB doesn't send */
+	XML_ABORTED /**< the callback stopped parsing */
+} Xml_Result;
+
+/* a tag name and its length */
+typedef struct _xml_name {
+	const char *name; /**< tag name */
+	unsigned int len; /**< length of name */
+} Xml_Name;
+
+/* a tag from the fallback parser, passed on with its Xml_Tag */
+typedef struct _xml_fallback {
+	Xml_Cb cb; /**< parser callback */
+	void *data; /**< data passed to cb */
+} Xml_Fallback;
+
+#define XML_NAME(x) { x, sizeof(x) - 1 }
+
+/* names of the tags, by Xml_Tag */
+static const Xml_Name _names[XML_TAG_COUNT] = {
+	[XML_TAG_UNKNOWN] = { NULL, 0 },
+	[XML_TAG_DATA] = XML_NAME("Data"),
+	[XML_TAG_ITEMS] = XML_NAME("Items"),
+	[XML_TAG_TIME] = XML_NAME("Time"),
+	[XML_TAG_LANGUAGES] = XML_NAME("Languages"),
+	[XML_TAG_LANGUAGE] = XML_NAME("Language"),
+	[XML_TAG_NAME] = XML_NAME("name"),
+	[XML_TAG_ABBREVIATION] = XML_NAME("abbreviation"),
+	[XML_TAG_EPISODE] = XML_NAME("Episode"),
+	[XML_TAG_SERIES] = XML_NAME("Series"),
+	[XML_TAG_BANNER] = XML_NAME("Banner"),
+	[XML_TAG_ID] = XML_NAME("id"),
+	[XML_TAG_EPISODE_NAME] = XML_NAME("EpisodeName"),
+	[XML_TAG_SERIES_NAME] = XML_NAME("SeriesName"),
+	[XML_TAG_IMDB_ID] = XML_NAME("IMDB_ID"),
+	[XML_TAG_OVERVIEW] = XML_NAME("Overview"),
+	[XML_TAG_FIRSTAIRED] = XML_NAME("FirstAired"),
+	[XML_TAG_EPISODE_NUMBER] = XML_NAME("EpisodeNumber"),
+	[XML_TAG_SEASON_NUMBER] = XML_NAME("SeasonNumber"),
+	[XML_TAG_DVD_EPISODE_NUMBER] = XML_NAME("DVD_episodenumber"),
+	[XML_TAG_DVD_SEASON] = XML_NAME("DVD_season"),
+	[XML_TAG_ABSOLUTE_NUMBER] = XML_NAME("absolute_number"),
+	[XML_TAG_SERIES_ID] = XML_NAME("seriesid"),
+	[XML_TAG_ZAP2IT_ID] = XML_NAME("zap2it_id"),
+	[XML_TAG_RUNTIME] = XML_NAME("Runtime"),
+	[XML_TAG_BANNER_PATH] = XML_NAME("BannerPath"),
+	[XML_TAG_THUMBNAIL_PATH] = XML_NAME("ThumbnailPath"),
+	[XML_TAG_BANNER_TYPE] = XML_NAME("BannerType"),
+	[XML_TAG_BANNER_TYPE2] = XML_NAME("BannerType2"),
+	[XML_TAG_SEASON] = XML_NAME("Season"),
+	[XML_TAG_RATING] = XML_NAME("Rating"),
+	[XML_TAG_RATING_COUNT] = XML_NAME("RatingCount")
+};
+
+/* internal functions */
+static const char *_find(const char *p, const char *end, char c);
+static Eina_Bool _name_valid(const char *s, const char *e);
+static Xml_Tag _tag_get(const char *s, const char *e);
+static Xml_Result _tokenize(const char *buf, const char *end, Xml_Cb cb, void *data);
+static Eina_Bool _fallback_cb(void *data, Eina_Simple_XML_Type type, const char *content,
+		unsigned offset UNUSED, unsigned length);
+
+/* this parses a TVDB document and calls cb like eina_simple_xml_parse() does with strip set,
+ * with the Xml_Tag of every opening and closing tag.
+ * TVDB documents are flat records of tags without attributes, comments or CDATA,
+ * which are tokenized by scanning for the next '<' and '>' only.
+ * the head of the document, up to the first closing tag, is checked before cb is called
+ * for the first time, anything else there is passed to the generic Eina parser.
+ * the rest is checked while cb is called, unexpected XML there fails the parse. */
+Eina_Bool _etvdb_xml_parse(const char *buf, size_t len, Xml_Cb cb, void *data)
+{
+	Xml_Fallback f = { cb, data };
+	Xml_Result res;
+
+	if (_tokenize(buf, buf + len, NULL, NULL) != XML_OK) {
+		DBG("Unexpected XML, falling back to the generic parser.");
+		return eina_simple_xml_parse(buf, len, EINA_TRUE, _fallback_cb, &f);
+	}
+
+	res = _tokenize(buf, buf + len, cb, data);
+	if (res == XML_UNSUPPORTED)
+		WARN("Unexpected XML after the first record, parsing stopped.");
+
+	return res == XML_OK;
+}
+
+/* decode the html entities of src into dst, like decode_html_entities_utf8() does.
+ * most fields contain no entities, those are only copied */
+size_t _etvdb_xml_decode(char *dst, const char *src)
+{
+	size_t len;
+
+	if (!src)
+		src = dst;
+
+	len = strlen(src);
+	if (_find(src, src + len, '&') != src + len)
+		return decode_html_entities_utf8(dst, src);
+
+	memmove(dst, src, len + 1);
+
+	return len;
+}
+
+/* tokenize a document.
+ * if cb is NULL, only its head up to the first closing tag is checked */
+static Xml_Result _tokenize(const char *buf, const char *end, Xml_Cb cb, void *data)
+{
+	const char *p = buf, *lt, *gt, *s, *e;
+	Eina_Simple_XML_Type type;
+	Xml_Tag tag;
+
+	while (p < end) {
+		lt = _find(p, end, '<');
+
+		/* the text in front of the tag, without surrounding whitespace */
+		for (s = p; s < lt && isspace((unsigned char)*s); s++);
+		for (e = lt; e > s && isspace((unsigned char)e[-1]); e--);
+		if (s < e && cb && !cb(data, EINA_SIMPLE_XML_DATA, XML_TAG_UNKNOWN, s, e - s))
+			return XML_ABORTED;
+
+		if (lt == end)
+			break;
+
+		gt = _find(lt + 1, end, '>');
+		if (gt == end)
+			return XML_UNSUPPORTED;
+
+		s = lt + 1;
+		e = gt;
+		switch (*s) {
+		case '/':
+			type = EINA_SIMPLE_XML_CLOSE;
+			s++;
+			break;
+		case '?':
+			/* the xml declaration */
+			if (e - s < 2 || e[-1] != '?')
+				return XML_UNSUPPORTED;
+			type = EINA_SIMPLE_XML_PROCESSING;
+			s++;
+			e--;
+			break;
+		case '!':
+			/* comments, CDATA and doctypes */
+			return XML_UNSUPPORTED;
+		default:
+			if (e[-1] == '/') {
+				type = EINA_SIMPLE_XML_OPEN_EMPTY;
+				e--;
+			} else
+				type = EINA_SIMPLE_XML_OPEN;
+			break;
+		}
+
+		if (type == EINA_SIMPLE_XML_PROCESSING)
+			tag = XML_TAG_UNKNOWN;
+		else if (_name_valid(s, e))
+			tag = _tag_get(s, e);
+		else
+			return XML_UNSUPPORTED;
+
+		if (!cb) {
+			if (type == EINA_SIMPLE_XML_CLOSE)
+				return XML_OK;
+		} else if (!cb(data, type, tag, s, e - s))
+			return XML_ABORTED;
+
+		p = gt + 1;
+	}
+
+	return XML_OK;
+}
+
+/* TVDB tags are plain names without attributes */
+static Eina_Bool _name_valid(const char *s, const char *e)
+{
+	if (s >= e)
+		return EINA_FALSE;
+
+	for (; s < e; s++)
+		if (!isalnum((unsigned char)*s) && *s != '_' && *s != '-' && *s != '.' && *s != ':')
+			return EINA_FALSE;
+
+	return EINA_TRUE;
+}
+
+/* map a tag name to its Xml_Tag, tags the parsers don't look at are XML_TAG_UNKNOWN */
+static Xml_Tag _tag_get(const char *s, const char *e)
+{
+	unsigned int i, len = e - s;
+
+	for (i = XML_TAG_UNKNOWN + 1; i < XML_TAG_COUNT; i++)
+		if (_names[i].len == len && !memcmp(_names[i].name, s, len))
+			return i;
+
+	return XML_TAG_UNKNOWN;
+}
+
+/* the generic parser passes tags with their attributes, only the name is mapped */
+static Eina_Bool _fallback_cb(void *data, Eina_Simple_XML_Type type, const char *content,
+		unsigned offset UNUSED, unsigned length)
+{
+	Xml_Fallback *f = data;
+	Xml_Tag tag = XML_TAG_UNKNOWN;
+	const char *e = content, *end = content + length;
+
+	if (type == EINA_SIMPLE_XML_OPEN || type == EINA_SIMPLE_XML_OPEN_EMPTY
+			|| type == EINA_SIMPLE_XML_CLOSE) {
+		while (e < end && !isspace((unsigned char)*e) && *e != '/' && *e != '>')
+			e++;
+		tag = _tag_get(content, e);
+	}
+
+	return f->cb(f->data, type, tag, content, length);
+}
+
+/* find the first c in [p, end), 16 bytes at a time where SSE2 is available */
+static const char *_find(const char *p, const char *end, char c)
+{
+#ifdef __SSE2__
+	__m128i needle = _mm_set1_epi8(c);
+	int mask;
+
+	for (; end - p >= 16; p += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), needle));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; p < end; p++)
+		if (*p == c)
+			return p;
+
+	return end;
+}